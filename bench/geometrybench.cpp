@@ -0,0 +1,116 @@
+/*
+ * Times the job system Geometry normal and bounds passes against cyTriMesh on a generated grid mesh.
+ * Usage: GeometryBench [millions of triangles] [iterations]
+ */
+
+#include "geometry.h"
+#include "jobsystem.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Rippled height field, so normals vary and every interior vertex has six neighbours
+static void BuildGrid(cyTriMesh &mesh, int size)
+{
+    mesh.SetNumVertex((unsigned int)(size * size));
+    mesh.SetNumFaces((unsigned int)((size - 1) * (size - 1) * 2));
+
+    for (int y = 0; y < size; y++)
+    {
+        for (int x = 0; x < size; x++)
+        {
+            float u = (float)x / size, v = (float)y / size;
+            mesh.V(y * size + x).Set(u * 100, sinf(u * 40) * cosf(v * 30) * 2, v * 100);
+        }
+    }
+
+    int face = 0;
+    for (int y = 0; y + 1 < size; y++)
+    {
+        for (int x = 0; x + 1 < size; x++)
+        {
+            unsigned int a = (unsigned int)(y * size + x), b = a + 1, c = a + (unsigned int)size, d = c + 1;
+            mesh.F(face).v[0] = a; mesh.F(face).v[1] = c; mesh.F(face).v[2] = b; face++;
+            mesh.F(face).v[0] = b; mesh.F(face).v[1] = c; mesh.F(face).v[2] = d; face++;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    double millions = argc > 1 ? atof(argv[1]) : 4.0;
+    int iterations = argc > 2 ? atoi(argv[2]) : 5;
+    int size = (int)sqrt(millions * 1e6 / 2) + 1;
+
+    cyTriMesh mesh;
+    BuildGrid(mesh, size);
+    int numVertices = (int)mesh.NV(), numFaces = (int)mesh.NF();
+    printf("%d vertices, %d triangles, %d iterations\n\n", numVertices, numFaces, iterations);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int n = 0; n < iterations; n++)
+        mesh.ComputeNormals();
+    double referenceNormals = Seconds(start) * 1000 / iterations;
+    std::vector<cyVec3f> reference(&mesh.VN(0), &mesh.VN(0) + numVertices);
+
+    start = std::chrono::steady_clock::now();
+    for (int n = 0; n < iterations; n++)
+        mesh.ComputeBoundingBox();
+    double referenceBounds = Seconds(start) * 1000 / iterations;
+
+    printf("%-24s %12s %12s %12s\n", "method", "normals ms", "bounds ms", "max error");
+    printf("%-24s %12.2f %12.2f %12s\n", "cyTriMesh", referenceNormals, referenceBounds, "-");
+
+    Vec3Buffer positions;
+    positions.Assign(&mesh.V(0).x, numVertices, 3);
+    std::vector<cyVec3f> normals((size_t)numVertices);
+
+    JobSystem::Initialize();
+    int hardwareThreads = JobSystem::GetThreadCount();
+
+    for (int weighting = Geometry::Area; weighting < Geometry::Count; weighting++)
+    {
+        for (int threads = 1; threads <= hardwareThreads; threads *= 2)
+        {
+            JobSystem::Initialize(threads);
+
+            start = std::chrono::steady_clock::now();
+            for (int n = 0; n < iterations; n++)
+            {
+                Geometry::ComputeNormals(&mesh.V(0), numVertices, &mesh.F(0), numFaces, (Geometry::Weighting)weighting,
+                                         threads, normals.data());
+            }
+            double normalTime = Seconds(start) * 1000 / iterations;
+
+            Bounds bounds;
+            start = std::chrono::steady_clock::now();
+            for (int n = 0; n < iterations; n++)
+                bounds = Geometry::ComputeBounds(positions, threads);
+            double boundsTime = Seconds(start) * 1000 / iterations;
+
+            // Angle weighting is a different normal by design, only the bounds have to match there
+            float error = (bounds.min - mesh.GetBoundMin()).Length() + (bounds.max - mesh.GetBoundMax()).Length();
+            if (weighting == Geometry::Area)
+            {
+                for (int i = 0; i < numVertices; i++)
+                    error = fmaxf(error, (normals[i] - reference[i]).Length());
+            }
+
+            char name[64];
+            snprintf(name, sizeof(name), "%s, %d thread%s", Geometry::WeightingNames[weighting], threads,
+                     threads > 1 ? "s" : "");
+            printf("%-24s %12.2f %12.2f %12.2e\n", name, normalTime, boundsTime, error);
+        }
+    }
+
+    JobSystem::Shutdown();
+    return 0;
+}
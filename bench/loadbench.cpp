@@ -0,0 +1,334 @@
+/*
+ * Times model startup from an OBJ against the same asset as binary glTF and as the compressed geometry cache, up to
+ * the point where the vertex and index data is ready for glBufferData. The GLB and cache are written next to the OBJ
+ * first, the GLB welded and indexed per material and without textures, so every path is timed on geometry alone.
+ * Each path reads every byte it would upload, which is where the mapped GLB pages in. Cold runs drop the file from
+ * the page cache before every iteration, which is only supported on Linux.
+ * Usage: LoadBench <obj> [iterations]
+ */
+
+#include "gltf.h"
+#include "meshcodec.h"
+#include "geometry.h"
+#include "jobsystem.h"
+#include "simplify.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <functional>
+#include <sys/stat.h>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static long long FileSize(const char *fileName)
+{
+    struct stat info = {};
+    return stat(fileName, &info) == 0 ? (long long)info.st_size : 0;
+}
+
+// Stands in for the driver reading the upload source
+static unsigned int Checksum(const void *data, long long size)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    unsigned int sum = 0;
+    for (long long i = 0; i < size; i += 4)
+        sum += bytes[i];
+    return sum;
+}
+
+// Writes back and drops the file's pages, so the next read comes from the disk
+static bool Evict(const char *fileName)
+{
+#ifdef __linux__
+    int file = open(fileName, O_RDONLY);
+    if (file < 0)
+        return false;
+
+    fdatasync(file);
+    bool evicted = posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(file);
+    return evicted;
+#else
+    return false;
+#endif
+}
+
+// Model's vertex expansion, one vertex per face corner for every sub-mesh
+static unsigned int Expand(const cyTriMesh &mesh, std::vector<std::vector<Mesh::Vertex>> &meshes, long long &uploadBytes)
+{
+    int numMeshes = mesh.NM() ? (int)mesh.NM() : 1;
+    meshes.assign((size_t)numMeshes, std::vector<Mesh::Vertex>());
+
+    unsigned int sum = 0;
+    uploadBytes = 0;
+
+    for (int m = 0; m < numMeshes; m++)
+    {
+        int firstFace = mesh.NM() ? mesh.GetMaterialFirstFace(m) : 0;
+        int numFaces = mesh.NM() ? mesh.GetMaterialFaceCount(m) : (int)mesh.NF();
+        std::vector<Mesh::Vertex> &vertices = meshes[m];
+        vertices.resize((size_t)numFaces * 3);
+
+        for (int f = 0; f < numFaces; f++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                Mesh::Vertex &vertex = vertices[f * 3 + k];
+                vertex.position = mesh.V((int)mesh.F(firstFace + f).v[k]);
+                vertex.normal = mesh.VN((int)mesh.FN(firstFace + f).v[k]);
+                vertex.texture = mesh.HasTextureVertices() ? mesh.VT((int)mesh.FT(firstFace + f).v[k]).XY() : cyVec2f(0, 0);
+            }
+        }
+
+        sum += Checksum(vertices.data(), (long long)(vertices.size() * sizeof(Mesh::Vertex)));
+        uploadBytes += (long long)(vertices.size() * sizeof(Mesh::Vertex));
+    }
+
+    return sum;
+}
+
+// The CPU side of Model's OBJ path: parse, normals, then expansion
+static unsigned int LoadObj(const char *fileName, cyTriMesh &mesh, std::vector<std::vector<Mesh::Vertex>> &meshes,
+                            long long &uploadBytes)
+{
+    if (!mesh.LoadFromFileObj(fileName, true))
+        return 0;
+
+    if (!mesh.HasNormals())
+        Geometry::ComputeNormals(mesh, Geometry::Area, Geometry::DefaultThreads());
+
+    for (int i = 0; i < (int)mesh.NVN(); i++)
+        mesh.VN(i).Normalize();
+
+    return Expand(mesh, meshes, uploadBytes);
+}
+
+// The same with the compressed copy in place of the text parse and normal pass
+static unsigned int LoadCompressed(const char *fileName, const char *objFileName,
+                                   std::vector<std::vector<Mesh::Vertex>> &meshes, long long &uploadBytes)
+{
+    MeshCodec::TriMesh mesh;
+    if (!MeshCodec::Load(fileName, mesh, objFileName))
+        return 0;
+
+    return Expand(mesh, meshes, uploadBytes);
+}
+
+// The CPU side of Model's GLB path: map, read the JSON, and hand the accessors over as they are
+static unsigned int LoadGlb(const char *fileName, GlbFile &file, long long &uploadBytes)
+{
+    if (!file.Open(fileName))
+        return 0;
+
+    unsigned int sum = 0;
+    uploadBytes = 0;
+
+    for (int i = 0; i < file.GetNumPrimitives(); i++)
+    {
+        const GlbFile::Primitive &primitive = file.GetPrimitive(i);
+        const GlbFile::Accessor &position = primitive.position;
+        const GlbFile::Accessor &indices = primitive.indices;
+
+        long long vertexBytes = (long long)position.count * (position.stride ? position.stride : 12);
+        long long indexBytes = (long long)indices.count * GlbFile::ComponentSize(indices.componentType);
+
+        sum += Checksum(position.view + position.offset, vertexBytes);
+        sum += Checksum(indices.view + indices.offset, indexBytes);
+        uploadBytes += vertexBytes + indexBytes;
+    }
+
+    return sum;
+}
+
+static void Append(std::string &json, const char *format, ...)
+{
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    json += buffer;
+}
+
+// One interleaved view and one index view per material, 16 bit indices wherever they fit, like common exporters
+static bool WriteGlb(const char *fileName, const cyTriMesh &mesh, const std::vector<std::vector<Mesh::Vertex>> &meshes)
+{
+    std::vector<unsigned char> binary;
+    std::string views, accessors, materials, primitives;
+    int written = 0;
+
+    for (size_t m = 0; m < meshes.size(); m++)
+    {
+        std::vector<Mesh::Vertex> unique;
+        std::vector<unsigned int> indices;
+        Simplify::Weld(meshes[m].data(), (int)meshes[m].size(), unique, indices);
+        if (unique.empty())
+            continue;
+
+        cyVec3f min = unique[0].position, max = unique[0].position;
+        for (const Mesh::Vertex &vertex : unique)
+        {
+            min.x = fminf(min.x, vertex.position.x); max.x = fmaxf(max.x, vertex.position.x);
+            min.y = fminf(min.y, vertex.position.y); max.y = fmaxf(max.y, vertex.position.y);
+            min.z = fminf(min.z, vertex.position.z); max.z = fmaxf(max.z, vertex.position.z);
+        }
+
+        size_t vertexOffset = binary.size();
+        size_t vertexBytes = unique.size() * sizeof(Mesh::Vertex);
+        binary.resize(vertexOffset + vertexBytes);
+        memcpy(&binary[vertexOffset], unique.data(), vertexBytes);
+
+        bool shortIndices = unique.size() <= 65536;
+        size_t indexOffset = binary.size();
+        size_t indexBytes = indices.size() * (shortIndices ? 2 : 4);
+        binary.resize((indexOffset + indexBytes + 3) & ~(size_t)3);
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            if (shortIndices)
+            {
+                unsigned short index = (unsigned short)indices[i];
+                memcpy(&binary[indexOffset + i * 2], &index, 2);
+            }
+            else
+                memcpy(&binary[indexOffset + i * 4], &indices[i], 4);
+        }
+
+        const char *separator = written ? "," : "";
+        int view = written * 2, accessor = written * 4;
+        Append(views, "%s{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%zu,\"byteStride\":%d},"
+                      "{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%zu}",
+               separator, vertexOffset, vertexBytes, (int)sizeof(Mesh::Vertex), indexOffset, indexBytes);
+        Append(accessors, "%s{\"bufferView\":%d,\"componentType\":5126,\"count\":%zu,\"type\":\"VEC3\","
+                          "\"min\":[%.9g,%.9g,%.9g],\"max\":[%.9g,%.9g,%.9g]},",
+               separator, view, unique.size(), min.x, min.y, min.z, max.x, max.y, max.z);
+        Append(accessors, "{\"bufferView\":%d,\"byteOffset\":12,\"componentType\":5126,\"count\":%zu,\"type\":\"VEC3\"},"
+                          "{\"bufferView\":%d,\"byteOffset\":24,\"componentType\":5126,\"count\":%zu,\"type\":\"VEC2\"},"
+                          "{\"bufferView\":%d,\"componentType\":%d,\"count\":%zu,\"type\":\"SCALAR\"}",
+               view, unique.size(), view, unique.size(), view + 1, shortIndices ? 5123 : 5125, indices.size());
+
+        cyVec3f color(1, 1, 1);
+        if (mesh.NM())
+            color.Set(mesh.M((int)m).Kd[0], mesh.M((int)m).Kd[1], mesh.M((int)m).Kd[2]);
+        Append(materials, "%s{\"pbrMetallicRoughness\":{\"baseColorFactor\":[%g,%g,%g,1],\"metallicFactor\":0}}",
+               separator, color.x, color.y, color.z);
+        Append(primitives, "%s{\"attributes\":{\"POSITION\":%d,\"NORMAL\":%d,\"TEXCOORD_0\":%d},\"indices\":%d,"
+                           "\"material\":%d}",
+               separator, accessor, accessor + 1, accessor + 2, accessor + 3, written);
+        written++;
+    }
+
+    std::string json = "{\"asset\":{\"version\":\"2.0\"},\"buffers\":[{\"byteLength\":" +
+                       std::to_string(binary.size()) + "}],\"bufferViews\":[" + views + "],\"accessors\":[" +
+                       accessors + "],\"materials\":[" + materials + "],\"meshes\":[{\"primitives\":[" + primitives +
+                       "]}],\"nodes\":[{\"mesh\":0}],\"scenes\":[{\"nodes\":[0]}],\"scene\":0}";
+    json.resize((json.size() + 3) & ~(size_t)3, ' ');
+
+    FILE *out = fopen(fileName, "wb");
+    if (!out)
+        return false;
+
+    unsigned int header[3] = {0x46546c67, 2, (unsigned int)(12 + 8 + json.size() + 8 + binary.size())};
+    unsigned int jsonChunk[2] = {(unsigned int)json.size(), 0x4e4f534a};
+    unsigned int binaryChunk[2] = {(unsigned int)binary.size(), 0x004e4942};
+
+    bool saved = fwrite(header, sizeof(header), 1, out) == 1 && fwrite(jsonChunk, sizeof(jsonChunk), 1, out) == 1 &&
+                   fwrite(json.data(), 1, json.size(), out) == json.size() &&
+                   fwrite(binaryChunk, sizeof(binaryChunk), 1, out) == 1 &&
+                   fwrite(binary.data(), 1, binary.size(), out) == binary.size();
+    fclose(out);
+    return saved;
+}
+
+// Milliseconds per iteration, optionally with the file dropped from the page cache before each one
+static double Time(int iterations, const char *evict, const std::function<unsigned int()> &load, unsigned int &sum)
+{
+    double total = 0;
+    for (int n = 0; n < iterations; n++)
+    {
+        if (evict)
+            Evict(evict);
+
+        auto start = std::chrono::steady_clock::now();
+        sum += load();
+        total += Seconds(start);
+    }
+
+    return total * 1000 / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: LoadBench <obj> [iterations]\n");
+        return 1;
+    }
+
+    const char *objFile = argv[1];
+    int iterations = argc > 2 ? atoi(argv[2]) : 5;
+    std::string glbFile = std::string(objFile) + ".glb";
+    std::string geomFile = std::string(objFile) + ".geom";
+
+    JobSystem::Initialize();
+
+    cyTriMesh mesh;
+    std::vector<std::vector<Mesh::Vertex>> meshes;
+    MeshCodec::Stats stats = {};
+    long long objUpload = 0, glbUpload = 0, geomUpload = 0;
+    if (!LoadObj(objFile, mesh, meshes, objUpload) || !WriteGlb(glbFile.c_str(), mesh, meshes) ||
+        !MeshCodec::Save(geomFile.c_str(), mesh, objFile, &stats))
+    {
+        printf("Unable to convert %s\n", objFile);
+        return 1;
+    }
+
+    bool cold = Evict(objFile);
+    printf("%s, %d sub-meshes, %d triangles, %d iterations, %d threads\n", objFile, (int)meshes.size(), (int)mesh.NF(),
+           iterations, JobSystem::GetThreadCount());
+    if (!cold)
+        printf("Dropping files from the page cache is not supported here, cold runs are warm\n");
+    printf("\n");
+
+    unsigned int sum = 0;
+    auto obj = [&]() { cyTriMesh objMesh; return LoadObj(objFile, objMesh, meshes, objUpload); };
+    auto glb = [&]() { GlbFile file; return LoadGlb(glbFile.c_str(), file, glbUpload); };
+    auto geom = [&]() { return LoadCompressed(geomFile.c_str(), objFile, meshes, geomUpload); };
+
+    double objWarm = Time(iterations, nullptr, obj, sum), objCold = Time(iterations, objFile, obj, sum);
+    double glbWarm = Time(iterations, nullptr, glb, sum), glbCold = Time(iterations, glbFile.c_str(), glb, sum);
+    double geomWarm = Time(iterations, nullptr, geom, sum), geomCold = Time(iterations, geomFile.c_str(), geom, sum);
+
+    // Decode alone, without the expansion that follows it on the Model path
+    MeshCodec::TriMesh decoded;
+    double decodeTime = Time(iterations, nullptr, [&]() { return (unsigned int)MeshCodec::Load(geomFile.c_str(), decoded,
+                                                                                               objFile); }, sum);
+
+    printf("%-8s %12s %12s %12s %12s\n", "format", "file MB", "upload MB", "warm ms", "cold ms");
+    printf("%-8s %12.2f %12.2f %12.2f %12.2f\n", "OBJ", FileSize(objFile) / 1048576.0, objUpload / 1048576.0, objWarm,
+           objCold);
+    printf("%-8s %12.2f %12.2f %12.2f %12.2f\n", "GLB", FileSize(glbFile.c_str()) / 1048576.0, glbUpload / 1048576.0,
+           glbWarm, glbCold);
+    printf("%-8s %12.2f %12.2f %12.2f %12.2f\n", "GEOM", FileSize(geomFile.c_str()) / 1048576.0,
+           geomUpload / 1048576.0, geomWarm, geomCold);
+
+    printf("\nGEOM byte planes %.2f MB, %.2f ms to decode, %.2f GB/s\n", stats.rawBytes / 1048576.0, decodeTime,
+           stats.rawBytes / (decodeTime / 1000) / 1e9);
+    printf("checksum %u\n", sum);
+
+    JobSystem::Shutdown();
+    return 0;
+}
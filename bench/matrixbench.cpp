@@ -0,0 +1,120 @@
+/*
+ * Compares every supported MatrixMath kernel level against the scalar cyCode path.
+ * Usage: MatrixBench [iterations]
+ */
+
+#include "matrixmath.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static const int NumMatrices = 4096;
+static const int NumPoints = 65536;
+
+static double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static float MaxError(const float *a, const float *b, int count)
+{
+    float error = 0;
+    for (int i = 0; i < count; i++)
+    {
+        float scale = fabsf(b[i]) > 1 ? fabsf(b[i]) : 1;
+        error = fmaxf(error, fabsf(a[i] - b[i]) / scale);
+    }
+    return error;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+
+    // Random well conditioned transforms, so inverses are meaningful
+    std::vector<cyMatrix4f> matrices(NumMatrices);
+    std::vector<cyVec3f> points(NumPoints);
+    unsigned int seed = 1;
+    auto random = [&seed]()
+    {
+        seed = seed * 1664525u + 1013904223u;
+        return (float)(seed >> 8) / (float)(1 << 24) * 2.0f - 1.0f;
+    };
+
+    for (cyMatrix4f &m : matrices)
+    {
+        m = cyMatrix4f::Translation(cyVec3f(random(), random(), random()) * 10.0f) *
+            cyMatrix4f::RotationXYZ(random() * 3, random() * 3, random() * 3) * cyMatrix4f::Scale(1.5f + random());
+        m.cell[3] = random() * 0.1f;
+    }
+    for (cyVec3f &p : points)
+        p.Set(random(), random(), random());
+
+    std::vector<cyMatrix4f> products(NumMatrices), reference(NumMatrices);
+    std::vector<cyMatrix4f> inverses(NumMatrices), referenceInverses(NumMatrices);
+    std::vector<cyVec3f> transformed(NumPoints), referencePoints(NumPoints);
+
+    printf("%-8s %14s %14s %14s %12s\n", "isa", "multiply ns", "inverse ns", "point ns", "max error");
+
+    double baseline[3] = {};
+    for (int isa = MatrixMath::Scalar; isa < MatrixMath::Count; isa++)
+    {
+        if (!MatrixMath::IsSupported((MatrixMath::Isa)isa))
+        {
+            printf("%-8s unsupported\n", MatrixMath::IsaNames[isa]);
+            continue;
+        }
+
+        MatrixMath::SetIsa((MatrixMath::Isa)isa);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int n = 0; n < iterations; n++)
+            MatrixMath::Multiply(&matrices[n % NumMatrices], 0, matrices.data(), 1, products.data(), NumMatrices);
+        double multiply = Seconds(start) * 1e9 / ((double)iterations * NumMatrices);
+
+        start = std::chrono::steady_clock::now();
+        for (int n = 0; n < iterations; n++)
+        {
+            for (int i = 0; i < NumMatrices; i++)
+                inverses[i] = MatrixMath::Inverse(matrices[i]);
+        }
+        double inverse = Seconds(start) * 1e9 / ((double)iterations * NumMatrices);
+
+        start = std::chrono::steady_clock::now();
+        for (int n = 0; n < iterations / 4 + 1; n++)
+            MatrixMath::TransformPoints(matrices[n % NumMatrices], points.data(), transformed.data(), NumPoints);
+        double transform = Seconds(start) * 1e9 / ((double)(iterations / 4 + 1) * NumPoints);
+
+        // The last pass of each loop used the same inputs on every level, so outputs compare directly
+        float error = 0;
+        if (isa == MatrixMath::Scalar)
+        {
+            reference = products;
+            referenceInverses = inverses;
+            referencePoints = transformed;
+            baseline[0] = multiply;
+            baseline[1] = inverse;
+            baseline[2] = transform;
+        }
+        else
+        {
+            error = fmaxf(error, MaxError(products[0].cell, reference[0].cell, NumMatrices * 16));
+            error = fmaxf(error, MaxError(inverses[0].cell, referenceInverses[0].cell, NumMatrices * 16));
+            error = fmaxf(error, MaxError(&transformed[0].x, &referencePoints[0].x, NumPoints * 3));
+        }
+
+        printf("%-8s %8.2f x%4.1f %8.2f x%4.1f %8.2f x%4.1f %12.2e\n", MatrixMath::IsaNames[isa], multiply,
+               baseline[0] / multiply, inverse, baseline[1] / inverse, transform, baseline[2] / transform, error);
+
+        if (error > 1e-3f)
+        {
+            printf("%s disagrees with scalar\n", MatrixMath::IsaNames[isa]);
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -3,7 +3,30 @@
 
 #include <GLFW/glfw3.h>
 #include "model.h"
+#include "pagedmodel.h"
 #include "framebuffer.h"
+#include "gputimer.h"
+#include "shadowatlas.h"
+#include "shadowfilter.h"
+#include "overlay.h"
+#include "triplebuffer.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct FrameTimings
+{
+    enum Pass
+    {
+        Shadow, Lit, Overlay, Total, NumPasses
+    };
+
+    double gpuMs[NumPasses];
+    double cpuFrameMs, cpuUpdateMs, cpuDrawMs;
+};
 
 class Application
 {
@@ -12,35 +35,158 @@ private:
     Model mModel;
     Mesh mPlaneMesh;
     Mesh::Material mPlaneMaterial, mDepthViewMaterial;
-    Shader mModelShader, mDepthShader;
+    Shader mModelShaders[ShadowModes::Count][ShadowFilters::Count], mDepthShader, mDepthCubeShader;
+    Shader mInstancedShaders[ShadowModes::Count][ShadowFilters::Count], mDepthInstancedShader, mDepthCubeInstancedShader;
+    GpuTimer mFilterTimers[ShadowModes::Count][ShadowFilters::Count];
+    int mShadowMode, mShadowFilter;
     Texture mEnvironmentMap;
-    Framebuffer mDepthbuffer;
+    Framebuffer mDepthbuffer, mDepthCube;
 
     cyMatrix4f mPlaneWorld, mDepthViewWorld;
     cyMatrix4f mModelProjection, mModelView, mModelWorld;
     cyMatrix4f mLightProjection, mLightView, mLightTransform;
+    cyMatrix4f mCubeProjection, mCubeMatrices[6];
+    Frustum mCubeFrusta[6];
+    const float mCubeFar = 10.0f;
+
+    static const int NumAtlasLights = 6;
+    ShadowAtlas mShadowAtlas;
+    ShadowScheduler mShadowScheduler;
+    ShadowLight mAtlasLights[NumAtlasLights];
+    int mScheduledLights[NumAtlasLights];
+    int mNumScheduledLights = 0;
+    cyMatrix4f mAtlasProjection;
+
+    /*
+     * One simulated frame: the queued draws plus every value their passes read on the GL thread.
+     * The simulation thread fills the back slot, after publishing only the GL thread touches it.
+     */
+    struct FramePacket
+    {
+        RenderQueue queue;
+        std::vector<cyMatrix4f> instances;
+
+        cyMatrix4f projection, view, lightView;
+        cyMatrix4f cubeMatrices[6];
+        cyVec3f camera, light;
+        int shadowMode = 0, shadowFilter = 0;
+        bool crowdMode = false;
+        ShadowLight atlasLights[NumAtlasLights];
+
+        CullStats shadowStats = {}, cameraStats = {};
+        double updateMs = 0;
+    };
+
+    TripleBuffer<FramePacket> mFrames;
+
+    /* The simulation runs at most one frame ahead, the counters tell each side when the other is done */
+    std::thread mSimulation;
+    std::mutex mFrameMutex;
+    std::condition_variable mFrameSignal;
+    long mPublished = 0, mConsumed = 0;
+    bool mStopping = false;
+
+    /* Written by the GLFW callbacks on the GL thread, read by the simulation thread at the start of every frame */
+    struct Input
+    {
+        cyVec2d mouse, prevMouse;
+        bool leftDown, rightDown;
+        cyMatrix4f projection;
+        int height;
+        int shadowMode, shadowFilter;
+        bool crowdMode, useLods, coneCulling;
+    };
+
+    std::mutex mInputMutex;
+    Input mInput;
+    int mViewHeight = 0;
+
+    /* Pass timers use timestamps so they can overlap the per-filter elapsed timers */
+    GpuTimer mPassTimers[FrameTimings::NumPasses];
+    Overlay mOverlay;
+    bool mShowOverlay = true;
+    double mCpuFrameMs = 0, mCpuUpdateMs = 0, mCpuDrawMs = 0;
+    double mLastFrameTime = 0;
+    long mFrameCount = 0;
+
+    /* Screen space error allowed before switching to a coarser LOD */
+    const float CameraLodPixels = 1.0f;
+    const float ShadowLodTexels = 2.0f;
+    bool mUseLods = true;
+
+    /* Crowd mode draws a grid of model copies with a single instanced draw per sub-mesh and LOD */
+    static const int CrowdSide = 100;
+    InstanceBuffer mCrowd;
+    bool mCrowdMode = false;
+    float mLodErrors[Model::MaxLods];
+    int mNumLodErrors = 1;
+    int mLodErrorMeshes = 0;
     cyVec3f mCamera, mCameraTarget, mLight;
-    cyVec2d mMouse = {0, 0}, mPrevMouse = {0, 0};
+
+    /* Extra models loaded on the upload contexts, each joins the scene on a ring around the main one once it is ready */
+    static const int MaxStreamedModels = 8;
+    Model *mStreamed[MaxStreamedModels];
+    cyMatrix4f mStreamedWorld[MaxStreamedModels];
+    bool mStreamedPlaced[MaxStreamedModels];
+    std::atomic<int> mNumStreamed;
+
+    /* Out of core models, added before the simulation starts and placed between the streamed ones */
+    static const int MaxPagedModels = 4;
+    PagedModel *mPaged[MaxPagedModels];
+    cyMatrix4f mPagedWorld[MaxPagedModels];
+    int mNumPaged = 0;
 
     float mModelYaw = 0, mModelPitch = 0, mModelRadius = 1;
     const float mMouseSensitivity = 0.1f;
     const float mZoomSensitivity = 0.01f;
     float mLightRotation = 0;
 
-    bool mMouseLeftDown = false, mMouseRightDown = false;
+    cyVec3f ToModelSpace(const cyVec3f &position) const;
+    float ShadowLodScale(const cyMatrix4f &projection, int resolution) const;
+    void UploadLitUniforms(Shader &shader, const FramePacket &frame);
+    void DrawOverlay(const FramePacket &frame);
+    void EnqueueCrowd(FramePacket &frame, Shader &shader, bool useMaterials, const Frustum *frusta, int numFrusta,
+                      const cyVec3f &viewPosition, float lodScale, CullStats &stats);
+    void EnqueueStreamed(FramePacket &frame, Shader &shader, bool useMaterials, const cyMatrix4f *viewProjection,
+                         const Frustum *layers, int numLayers, const cyVec3f &viewPosition, float lodScale,
+                         CullStats &stats);
+    void UpdateAtlasLights();
+    void EnqueueAtlasShadows(FramePacket &frame);
+
+    /* Simulation thread */
+    void SimulationLoop();
+    void Update();
+    void BuildFrame(FramePacket &frame);
 
 public:
-    Application(int width, int height, const char* modelFile);
-    ~Application() = default;
+    /* A progressive load only parses the model here, its sub-meshes and textures show up over the first frames */
+    Application(int width, int height, const char* modelFile, const char* shadowFilter = nullptr,
+                bool progressive = false);
+    ~Application();
 
     Application(const Application&) = delete;
     Application(Application&&) = delete;
     Application& operator=(const Application&) = delete;
     Application& operator=(Application&&) = delete;
 
-    void Update();
+    /* Update, culling and queue building run on their own thread, Draw submits their packets on the GL thread */
+    void StartSimulation();
+    void StopSimulation();
     void Draw();
 
+    /* GL thread, the model keeps loading in the background and shows up once its upload has finished */
+    bool StreamModel(const char *modelFile);
+
+    /* GL thread, before StartSimulation. Pages of the model are read in as the view needs them, within the budget */
+    bool AddPagedModel(const char *modelFile, long long budgetBytes);
+
+    void PrintFilterTable() const;
+    void PrintCullStats() const;
+    void PrintStateStats() const;
+
+    FrameTimings GetFrameTimings() const;
+    bool WriteTimingsJson(const char *fileName) const;
+
     static void KeyCallback(GLFWwindow *handle, int key, int scancode, int action, int mods);
     static void ResizeCallback(GLFWwindow *handle, int width, int height);
     static void CursorPosCallback(GLFWwindow *handle, double x, double y);
@@ -0,0 +1,76 @@
+#ifndef COMMANDBUFFER_H
+#define COMMANDBUFFER_H
+
+#include <vector>
+#include <cyVector.h>
+#include <cyMatrix.h>
+
+class Shader;
+class Texture;
+class Mesh;
+
+/*
+ * Flat list of GL work that can be recorded on any thread and replayed on the GL thread.
+ * Recording only copies values and resolves cached uniform locations, so separate buffers for parts of a frame
+ * can be filled in parallel and replayed back to back. Program, texture and vertex array binds go through GLState
+ * on replay, so binds repeated across buffer boundaries are still filtered.
+ */
+class CommandBuffer
+{
+private:
+    enum Op
+    {
+        ProgramBind, TextureBind, Int, Float, Vec3, Matrix, InstanceBind, Arrays, Ranges, Elements
+    };
+
+    struct Command
+    {
+        Op op;
+        int location;       // uniform location or texture unit
+        int first, count;   // vertices, indices, offset into the value or range arrays
+        int instances;      // 0 for plain draws, first instance for BindInstances
+        unsigned int buffer;
+
+        Shader *shader;
+        const Mesh *mesh;
+        const Texture *texture;
+    };
+
+    std::vector<Command> mCommands;
+    std::vector<float> mValues;
+    std::vector<int> mRangeFirsts, mRangeCounts;
+
+    Command &Append(Op op);
+
+public:
+    CommandBuffer() = default;
+    ~CommandBuffer() = default;
+
+    CommandBuffer(const CommandBuffer&) = delete;
+    CommandBuffer(CommandBuffer&&) = delete;
+    CommandBuffer& operator=(const CommandBuffer&) = delete;
+    CommandBuffer& operator=(CommandBuffer&&) = delete;
+
+    void Clear();
+
+    void Use(Shader &shader);
+    void Bind(unsigned int unit, const Texture &texture);
+
+    // Locations come from Shader::GetUniformLocation, inactive uniforms (-1) are not recorded
+    void Uniform(int location, int value);
+    void Uniform(int location, float value);
+    void Uniform(int location, const cyVec3f &value);
+    void Uniform(int location, const cyMatrix4f &value);
+
+    void Instances(const Mesh &mesh, unsigned int buffer, int firstInstance);
+    void Draw(const Mesh &mesh, Shader &shader, int numInstances = 0);
+    void DrawRanges(const Mesh &mesh, Shader &shader, const int *firsts, const int *counts, int numRanges);
+    void DrawElements(const Mesh &mesh, Shader &shader, int firstIndex, int numIndices, int numInstances = 0);
+
+    // GL thread only
+    void Replay() const;
+
+    int GetCount() const;
+};
+
+#endif //COMMANDBUFFER_H
@@ -24,6 +24,7 @@ public:
 
     bool Create(int width, int height, bool depth);
     bool CreateDepthOnly(int width, int height);
+    bool CreateDepthCube(int size);
     void Begin() const;
     void End(int width, int height);
 
@@ -0,0 +1,49 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <cyVector.h>
+#include <cyMatrix.h>
+
+struct Bounds
+{
+    cyVec3f min;
+    cyVec3f max;
+
+    Bounds Transform(const cyMatrix4f &matrix) const;
+};
+
+struct CullStats
+{
+    int tested;
+    int visible;
+    int skipped;
+
+    int meshletsTested;
+    int meshletsVisible;
+    int trianglesTotal;
+    int triangles;
+    int lodDraws;
+};
+
+class Frustum
+{
+private:
+    cyVec4f mPlanes[6];
+
+public:
+    Frustum() = default;
+    explicit Frustum(const cyMatrix4f &viewProjection);
+
+    void Extract(const cyMatrix4f &viewProjection);
+
+    bool TestBox(const Bounds &bounds) const;
+    bool TestSphere(const cyVec3f &center, float radius) const;
+    int TestBoxes(const float *minX, const float *minY, const float *minZ,
+                  const float *maxX, const float *maxY, const float *maxZ, int count, unsigned char *visible) const;
+
+    const cyVec4f &GetPlane(int i) const;
+
+    static unsigned int FaceMask(const Frustum *frusta, int count, const Bounds &bounds);
+};
+
+#endif //FRUSTUM_H
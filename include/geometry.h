@@ -0,0 +1,35 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include "frustum.h"
+#include "vec3buffer.h"
+
+#include <cyTriMesh.h>
+
+/*
+ * Load time vertex normal and bounding box passes that split the work across the job system.
+ * Area weighting gives the same normals as cyTriMesh::ComputeNormals.
+ */
+namespace Geometry
+{
+    enum Weighting
+    {
+        Area, Angle, Count
+    };
+
+    extern const char *WeightingNames[Count];
+
+    // Passes given one thread run serially, more lets them split into job system batches
+    int DefaultThreads();
+
+    // Normals are gathered per vertex through a vertex to corner table, so threads never write the same normal
+    void ComputeNormals(const cyVec3f *positions, int numVertices, const cyTriMesh::TriFace *faces, int numFaces,
+                        Weighting weighting, int numThreads, cyVec3f *normals);
+
+    // Replaces the mesh normals the way cyTriMesh::ComputeNormals does, one normal per vertex
+    void ComputeNormals(cyTriMesh &mesh, Weighting weighting, int numThreads);
+
+    Bounds ComputeBounds(const Vec3Buffer &positions, int numThreads);
+}
+
+#endif //GEOMETRY_H
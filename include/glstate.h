@@ -0,0 +1,47 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+/*
+ * Shadow copy of the GL binding state, calls that would not change anything never reach the driver.
+ * The copy is per thread, so upload threads with their own shared context never disturb the main one's.
+ */
+namespace GLState
+{
+    enum Category
+    {
+        Programs, VertexArrays, ActiveTextures, Textures, Samplers, Framebuffers, Viewports, Scissors, Capabilities, Count
+    };
+
+    struct Stats
+    {
+        int issued[Count];
+        int filtered[Count];
+    };
+
+    static const int MaxTextureUnits = 16;
+    extern const char *CategoryNames[Count];
+
+    void UseProgram(unsigned int program);
+    void BindVertexArray(unsigned int vertexArray);
+    void BindTexture(unsigned int unit, unsigned int target, unsigned int texture);
+    void BindSampler(unsigned int unit, unsigned int sampler);
+    void BindFramebuffer(unsigned int framebuffer);
+    void Viewport(int x, int y, int width, int height);
+    void Scissor(int x, int y, int width, int height);
+    void Enable(unsigned int capability);
+    void Disable(unsigned int capability);
+
+    /* Deleted names can be handed out again, so the cache must not keep them as bound */
+    void ForgetProgram(unsigned int program);
+    void ForgetVertexArray(unsigned int vertexArray);
+    void ForgetTexture(unsigned int texture);
+    void ForgetFramebuffer(unsigned int framebuffer);
+
+    /* For code that talks to GL directly, everything is reissued on next use */
+    void Invalidate();
+
+    void BeginFrame();
+    const Stats &GetLastFrameStats();
+}
+
+#endif //GLSTATE_H
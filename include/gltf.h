@@ -0,0 +1,102 @@
+#ifndef GLTF_H
+#define GLTF_H
+
+#include <cyVector.h>
+#include <string>
+#include <vector>
+
+/*
+ * Binary glTF 2.0 (GLB) reader. The file is memory mapped and every accessor resolves to a pointer into the mapping,
+ * so vertex and index data can go to glBufferData as they are, without a parse or a copy on the CPU.
+ * Only what Model draws is read: triangle primitives with POSITION, NORMAL, TEXCOORD_0 and indices, and the base
+ * color of metallic roughness materials. Node transforms are not applied, every mesh is drawn in its own space.
+ */
+class GlbFile
+{
+public:
+    // Same values as the matching GL enums
+    enum ComponentType
+    {
+        Byte = 5120, UnsignedByte = 5121, Short = 5122, UnsignedShort = 5123, UnsignedInt = 5125, Float = 5126
+    };
+
+    struct Accessor
+    {
+        const unsigned char *view;  // start of the buffer view in the mapping, nullptr when the accessor is missing
+        long long offset;           // of the first element within the view
+        int stride;                 // bytes between elements, 0 when tightly packed
+        int count;
+        int components;
+        unsigned int componentType;
+        bool normalized;
+    };
+
+    struct Primitive
+    {
+        Accessor position, normal, texture;
+        Accessor indices;           // missing for non-indexed primitives
+        int material;               // -1 for the default material
+        cyVec3f min, max;           // from the POSITION accessor, which the format requires to carry them
+    };
+
+    struct Material
+    {
+        cyVec3f baseColor;
+        float metallic, roughness;
+        int baseColorImage;         // -1 when untextured
+    };
+
+    // Either embedded in the binary chunk or a file next to the GLB
+    struct Image
+    {
+        const unsigned char *data;
+        long long size;
+        std::string path;
+    };
+
+private:
+    unsigned char *mData;
+    long long mSize;
+    const unsigned char *mBinary;
+    long long mBinarySize;
+
+#ifdef _WIN32
+    void *mFile, *mMapping;
+#endif
+
+    std::vector<Primitive> mPrimitives;
+    std::vector<Material> mMaterials;
+    std::vector<Image> mImages;
+
+    bool Map(const char *fileName);
+    bool Parse(const char *json, long long length, const std::string &directory);
+
+public:
+    GlbFile();
+    ~GlbFile();
+
+    GlbFile(const GlbFile&) = delete;
+    GlbFile(GlbFile&&) = delete;
+    GlbFile& operator=(const GlbFile&) = delete;
+    GlbFile& operator=(GlbFile&&) = delete;
+
+    static bool IsGlb(const char *fileName);
+
+    // Maps and parses the file, accessors stay valid until Close
+    bool Open(const char *fileName);
+    void Close();
+
+    int GetNumPrimitives() const;
+    const Primitive &GetPrimitive(int i) const;
+    int GetNumMaterials() const;
+    const Material &GetMaterial(int i) const;
+    int GetNumImages() const;
+    const Image &GetImage(int i) const;
+
+    static int ComponentSize(unsigned int componentType);
+
+    // Element i of an index accessor, index data has no alignment guarantee within the binary chunk
+    static unsigned int GetIndex(const Accessor &indices, int i);
+};
+
+#endif //GLTF_H
@@ -0,0 +1,40 @@
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+class GpuTimer
+{
+private:
+    static const int QueryCount = 3;
+
+    unsigned int mQueries[QueryCount];
+    unsigned int mEndQueries[QueryCount];
+    bool mTimestamps;
+    // Issued queries form a ring starting at the oldest one still waiting on the GPU
+    int mHead, mNumPending;
+    int mCurrent;
+
+    double mLastMs, mAverageMs;
+    long mSamples;
+
+public:
+    GpuTimer();
+    ~GpuTimer();
+
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer(GpuTimer&&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+    GpuTimer& operator=(GpuTimer&&) = delete;
+
+    /* Timestamp timers record two counters instead of an elapsed query, so they may overlap other timers */
+    void Create(bool timestamps = false);
+    void Begin();
+    void End();
+    void Poll();
+    void Reset();
+
+    double GetLastMs() const;
+    double GetAverageMs() const;
+    long GetSamples() const;
+};
+
+#endif //GPUTIMER_H
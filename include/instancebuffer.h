@@ -0,0 +1,72 @@
+#ifndef INSTANCEBUFFER_H
+#define INSTANCEBUFFER_H
+
+#include <cyMatrix.h>
+#include <vector>
+#include "frustum.h"
+#include "vec3buffer.h"
+
+class InstanceBuffer
+{
+public:
+    static const int MaxBuckets = 8;
+
+private:
+    // Culling runs as one job per batch of instances, each keeping its own LOD bucket totals
+    static const int CullBatchSize = 1024;
+
+    struct BatchStats
+    {
+        int count[MaxBuckets];
+        float distance[MaxBuckets];
+    };
+
+    unsigned int mVBO;
+    int mCount, mStride;
+
+    // Most instances a frame can append over all of its culls
+    int mCapacity;
+
+    cyMatrix4f *mTransforms;
+
+    // World bounds split into min and max corners for batch culling
+    Vec3Buffer mMin, mMax;
+    float *mScales;
+    unsigned char *mVisible, *mCombined;
+    unsigned char *mLods;
+    BatchStats *mBatches;
+    int mNumBatches;
+
+    int mNumBuckets;
+    int mBucketFirst[MaxBuckets];
+    int mBucketCount[MaxBuckets];
+    float mBucketDistance[MaxBuckets];
+
+public:
+    InstanceBuffer();
+    ~InstanceBuffer();
+
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    InstanceBuffer(InstanceBuffer&&) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+    InstanceBuffer& operator=(InstanceBuffer&&) = delete;
+
+    static const int MaxCullsPerFrame = 16;
+
+    bool Create(const cyMatrix4f *transforms, int count, const Bounds &bounds);
+
+    // Appends the visible transforms grouped by LOD, so draws queued by earlier culls keep their instances.
+    // Only touches CPU data, the frame's transforms reach the GPU through Upload on the GL thread
+    int Cull(const Frustum *frusta, int numFrusta, const cyVec3f &viewPosition, float lodScale, const float *lodErrors,
+             int numLods, std::vector<cyMatrix4f> &instances);
+    void Upload(const std::vector<cyMatrix4f> &instances);
+
+    unsigned int GetID() const;
+    int GetCount() const;
+    int GetNumBuckets() const;
+    int GetBucketFirst(int bucket) const;
+    int GetBucketCount(int bucket) const;
+    float GetBucketDistance(int bucket) const;
+};
+
+#endif //INSTANCEBUFFER_H
@@ -0,0 +1,57 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <functional>
+
+/*
+ * Fixed pool of worker threads, each owning a Chase-Lev deque that idle workers steal from.
+ * With one thread there are no workers and every job runs on the submitting thread in submission order,
+ * which keeps results and traces repeatable while debugging. Before Initialize it behaves the same way.
+ */
+namespace JobSystem
+{
+    struct Job;
+
+    struct Hooks
+    {
+        // Called on the thread running the job, around its function
+        void (*begin)(const char *name, int worker);
+        void (*end)(const char *name, int worker);
+    };
+
+    struct Stats
+    {
+        long long executed;
+        long long stolen;
+    };
+
+    // Thread count includes the calling thread, 0 uses every hardware thread
+    void Initialize(int numThreads = 0);
+    void Shutdown();
+
+    int GetThreadCount();
+    bool IsSingleThreaded();
+
+    // 0 is the thread that called Initialize, workers follow, -1 for threads outside the pool
+    int GetWorkerIndex();
+
+    void SetHooks(const Hooks &hooks);
+    Stats GetStats(int worker);
+
+    // A job starts once it is submitted and all of its dependencies have finished.
+    // Names must outlive the job, string literals are the intended use
+    Job *Create(const char *name, std::function<void()> function);
+    void AddDependency(Job *job, Job *dependency);
+    void Submit(Job *job);
+
+    // Runs other jobs while waiting and releases the handle, so every created job is waited on exactly once
+    void Wait(Job *job);
+
+    // Fire and forget, there is no handle to wait on
+    void Run(const char *name, std::function<void()> function);
+
+    // Splits [0, count) into batches of at least minBatch items and returns once every batch ran
+    void ParallelFor(const char *name, int count, int minBatch, const std::function<void(int first, int last)> &function);
+}
+
+#endif //JOBSYSTEM_H
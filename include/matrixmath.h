@@ -0,0 +1,48 @@
+#ifndef MATRIXMATH_H
+#define MATRIXMATH_H
+
+#include <cyMatrix.h>
+#include <cyVector.h>
+
+/*
+ * Hot cyMatrix4f operations with SSE4.1 and AVX2 kernels, picked at runtime from the CPU features.
+ * The scalar kernels are cyCode itself, so every path must agree with it.
+ */
+namespace MatrixMath
+{
+    enum Isa
+    {
+        Scalar, SSE41, AVX2, Count
+    };
+
+    extern const char *IsaNames[Count];
+
+    // Each table is built in its own translation unit with matching compiler flags, null when not compiled in
+    struct Kernels
+    {
+        // A step of 0 reuses the first matrix of that side for every product
+        void (*multiply)(const float *left, int leftStep, const float *right, int rightStep, float *result, int count);
+        void (*inverse)(const float *matrix, float *result);
+        void (*transformPoints)(const float *matrix, const float *points, float *result, int count);
+    };
+
+    const Kernels *ScalarKernels();
+    const Kernels *Sse41Kernels();
+    const Kernels *Avx2Kernels();
+
+    bool IsSupported(Isa isa);
+    Isa GetIsa();
+
+    // Falls back to the best supported level below the requested one
+    void SetIsa(Isa isa);
+
+    cyMatrix4f Multiply(const cyMatrix4f &left, const cyMatrix4f &right);
+    void Multiply(const cyMatrix4f *left, int leftStep, const cyMatrix4f *right, int rightStep, cyMatrix4f *result,
+                  int count);
+    cyMatrix4f Inverse(const cyMatrix4f &matrix);
+
+    // Points are treated as w = 1 and the w of the result is dropped, points and result may be the same array
+    void TransformPoints(const cyMatrix4f &matrix, const cyVec3f *points, cyVec3f *result, int count);
+}
+
+#endif //MATRIXMATH_H
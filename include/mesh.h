@@ -6,6 +6,8 @@
 #include "texture.h"
 #include "shader.h"
 
+class CommandBuffer;
+
 class Mesh
 {
 public:
@@ -31,20 +33,76 @@ public:
 
         bool    bSpecular;
         Texture *tSpecular;
+
+        bool    bCastShadows;
+    };
+
+    // An attribute in memory that is uploaded as it is, such as a glTF accessor in a mapped file
+    struct Attribute
+    {
+        const void *view;       // nullptr leaves the attribute disabled, so the shader reads zero
+        long long offset;       // of the first element within the view
+        int stride;             // 0 when tightly packed
+        int components;
+        unsigned int type;
+        bool normalized;
     };
 
 private:
+    // Where an attribute sits in the vertex buffer, the interleaved Vertex unless the buffers came from views
+    struct AttributeFormat
+    {
+        long long offset;
+        int stride, components;
+        unsigned int type;
+        bool normalized, enabled;
+    };
+
     unsigned int mVAO;
     unsigned int mVBO;
+    unsigned int mIBO;
     int mNumVertices;
+    int mNumIndices;
+    AttributeFormat mFormats[3];
+    unsigned int mIndexType;
+    int mIndexSize;
 
 public:
     Mesh();
     ~Mesh();
 
+    // The shader has to be in use already, binding it is left to the caller so it happens once per batch
+    static void UploadMaterial(Shader &shader, Material &material);
+
+    // Same uniforms and binds as UploadMaterial, recorded for replay on the GL thread
+    static void RecordMaterial(CommandBuffer &commands, const Shader &shader, const Material &material);
+
     void Create(const Vertex *vertices, int numVertices);
+    void CreateIndexed(const Vertex *vertices, int numVertices, const unsigned int *indices, int numIndices);
+
+    // Buffers only, safe on an upload context. Vertex arrays are not shared between contexts,
+    // so CreateVertexArray has to follow on the GL thread before the mesh is drawn
+    void CreateBuffers(const Vertex *vertices, int numVertices);
+    void CreateIndexedBuffers(const Vertex *vertices, int numVertices, const unsigned int *indices, int numIndices);
+
+    // Same as CreateIndexedBuffers for position, normal and texture attributes that stay in their own layout and types.
+    // Only the bytes the attributes reach are uploaded, once per view, so interleaved views stay interleaved
+    void CreateViewBuffers(const Attribute attributes[3], int numVertices, const void *indices, int numIndices,
+                           unsigned int indexType);
+    void CreateVertexArray();
+    // Indexed meshes draw every index
     void Draw(Shader &shader, Material &material) const;
     void Draw(Shader &shader) const;
+    void DrawRanges(Shader &shader, Material &material, const int *firsts, const int *counts, int numRanges) const;
+    void DrawRanges(Shader &shader, const int *firsts, const int *counts, int numRanges) const;
+    void DrawElements(Shader &shader, Material &material, int firstIndex, int numIndices) const;
+    void DrawElements(Shader &shader, int firstIndex, int numIndices) const;
+
+    void BindInstances(unsigned int buffer, int firstInstance) const;
+    void DrawInstanced(Shader &shader, Material &material, int numInstances) const;
+    void DrawInstanced(Shader &shader, int numInstances) const;
+    void DrawElementsInstanced(Shader &shader, Material &material, int firstIndex, int numIndices, int numInstances) const;
+    void DrawElementsInstanced(Shader &shader, int firstIndex, int numIndices, int numInstances) const;
 };
 
 namespace Meshes
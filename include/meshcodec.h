@@ -0,0 +1,49 @@
+#ifndef MESHCODEC_H
+#define MESHCODEC_H
+
+#include <cyTriMesh.h>
+
+/*
+ * Compressed binary copy of a parsed OBJ, so later runs skip the text parse and read a fraction of the bytes.
+ * Positions and texture coordinates are quantized to 16 bits over their range and normals to 16 bit octahedral
+ * pairs. Every stream is delta and zigzag coded, split into byte planes so the mostly zero high bytes sit together,
+ * and the planes go through an order-0 rANS coder in fixed size chunks that decode in parallel on the job system.
+ * Each chunk interleaves 32 rANS states so the AVX2 kernel decodes a round of 32 symbols with four gathers, at about
+ * 1.2 GB/s per core against 0.25 GB/s for the scalar loop on the machines measured so far. Multiple GB/s only come
+ * from decoding chunks on several cores: a single core is held back by the dependent table gathers, and the planes
+ * it writes are first touches that page fault at around 2 GB/s.
+ */
+namespace MeshCodec
+{
+    // cyTriMesh only fills its material face ranges from OBJ files, this lets a decoded file restore them
+    class TriMesh : public cyTriMesh
+    {
+    public:
+        void SetMaterialFaceEnd(int material, int end) { mcfc[material] = end; }
+    };
+
+    struct Stats
+    {
+        long long rawBytes;         // byte planes before the entropy stage
+        long long compressedBytes;  // whole file
+    };
+
+    // The copy is keyed on the size and time of the OBJ and of every material library it names,
+    // Load fails when any of them changed so the caller re-parses. Normals are expected to be unit length already
+    bool Save(const char *fileName, const cyTriMesh &mesh, const char *objFileName, Stats *stats = nullptr);
+    bool Load(const char *fileName, TriMesh &mesh, const char *objFileName, Stats *stats = nullptr);
+
+    // Entropy stage parameters, shared with the decode kernels
+    static const int RansLanes = 32;
+    static const int RansProbabilityBits = 12;
+    static const unsigned int RansLow = 1u << 16;
+
+    // Decodes whole rounds of RansLanes symbols while the input holds enough for a round of loads, and returns how
+    // many symbols it wrote. Slots are the packed lookup table, states and cursor are updated so the
+    // scalar decoder can finish the rest. Built in its own translation unit with AVX2 flags, null when not compiled in
+    typedef int (*RansDecoder)(const unsigned int *slots, unsigned int *states, const unsigned char *&cursor,
+                               const unsigned char *end, unsigned char *out, int count);
+    RansDecoder Avx2RansDecoder();
+}
+
+#endif //MESHCODEC_H
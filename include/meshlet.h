@@ -0,0 +1,34 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include "mesh.h"
+#include "frustum.h"
+
+class MeshletList
+{
+private:
+    int mCount, mStride;
+
+    // Padded arrays: center x/y/z, radius, cone axis x/y/z, cone cutoff
+    float *mData;
+    int *mFirstVertex;
+    int *mNumVertices;
+    unsigned char *mVisible;
+
+public:
+    MeshletList();
+    ~MeshletList();
+
+    MeshletList(const MeshletList&) = delete;
+    MeshletList(MeshletList&&) = delete;
+    MeshletList& operator=(const MeshletList&) = delete;
+    MeshletList& operator=(MeshletList&&) = delete;
+
+    void Build(Mesh::Vertex *vertices, int numVertices, int trianglesPerMeshlet);
+    int Cull(const Frustum &frustum, const cyVec3f &viewPosition, bool coneCulling);
+    int Emit(int *firsts, int *counts, int &numVertices) const;
+
+    int GetCount() const;
+};
+
+#endif //MESHLET_H
@@ -2,17 +2,113 @@
 #define MODEL_H
 
 #include "mesh.h"
+#include "frustum.h"
+#include "meshlet.h"
+#include "vec3buffer.h"
+#include "geometry.h"
+#include "instancebuffer.h"
+#include "renderqueue.h"
 #include <cyTriMesh.h>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+
+class GlbFile;
 
 class Model
 {
+public:
+    static const int MaxLods = 5;
+
+    struct LoadProgress
+    {
+        int meshes, numMeshes;
+        int textures, numTextures;
+    };
+
 private:
+    // LOD 0 is the full mesh drawn through its meshlets, the rest index into the sub-mesh's LOD buffer
+    struct LodChain
+    {
+        int numLods;
+        int firstIndex[MaxLods];
+        int numIndices[MaxLods];
+        float error[MaxLods];
+    };
+
+    // Per sub-mesh load state, set on the GL thread once the matching upload has finished
+    enum MeshState
+    {
+        Geometry = 1, Textured = 2
+    };
+
+    // Parsed file shared by the stages of a load, freed once the last of them is done with it
+    struct LoadState;
+
     Mesh *mMeshes;
     Mesh::Material *mMaterials;
+    Bounds *mBounds;
     int mNumMeshes;
 
+    // Untextured copies of the materials, drawn until a sub-mesh's textures are in
+    Mesh::Material *mBaseMaterials;
+    std::atomic<int> *mMeshStates;
+
+    // Sub-meshes become drawable in file order, so readers only need the length of the loaded prefix
+    std::atomic<int> mNumLoaded;
+    std::atomic<int> mNumTexturesLoaded;
+    int mNumTextures;
+    Bounds mModelBounds;
+
+    // Sub-mesh bounds split into min and max corners for batch culling, plus scratch for their world space boxes
+    Vec3Buffer mCullMin, mCullMax;
+    Vec3Buffer mWorldMin, mWorldMax;
+    unsigned char *mVisible;
+    int mNumCulled;
+
+    MeshletList *mMeshlets;
+    int *mRangeFirsts, *mRangeCounts;
+    int *mNumVertices;
+    bool mConeCulling;
+
+    Mesh *mLodMeshes;
+    LodChain *mLods;
+
+    // GLB sub-meshes keep the file's own index buffers, so full detail is one indexed draw of mMeshes instead of
+    // meshlet ranges, and their materials share the image textures below rather than owning one each
+    bool mIndexed;
+    Texture **mImageTextures;
+    int mNumImages;
+
+    void BuildCullData();
+    void SyncCullData();
+    void BuildLods(int mesh, const Mesh::Vertex *vertices, int numVertices, FILE *&cacheIn, FILE *cacheOut);
+    int SelectLod(int mesh, const cyVec3f &viewPosition, float lodScale) const;
+
     cyVec3f mScale;
 
+    int mLoadThreads;
+    Geometry::Weighting mNormalWeighting;
+
+    // Set on the GL thread once the vertex arrays exist, read by whichever thread queues draws
+    std::atomic<bool> mReady;
+
+    // Everything but the vertex arrays, so it can run on an upload context
+    bool LoadData(LoadState &state, const char *fileName);
+    bool Parse(LoadState &state, const char *fileName);
+    void BuildMesh(LoadState &state, int mesh);
+    void LoadTextures(LoadState &state, int first, int last);
+    void SubmitMesh(std::shared_ptr<LoadState> state, int mesh);
+    void Allocate(int numMeshes);
+
+    // Uploads straight from the mapped file, there is no parsed mesh to stage or expand
+    bool LoadGlb(const char *fileName);
+    void LoadGlbTextures(const GlbFile &file);
+
+    // GL thread, makes the vertex arrays of a finished sub-mesh and hands it to the readers
+    void Publish(int mesh, int state);
+    Mesh::Material *GetDrawMaterial(int mesh);
+
 public:
     Model();
     ~Model();
@@ -22,10 +118,39 @@ public:
     Model& operator=(const Model&) = delete;
     Model& operator=(Model&&) = delete;
 
+    // Threads used by the load time normal and bounds passes, 0 uses the whole job system and 1 runs them serially
+    void SetLoadThreads(int threads);
+    void SetNormalWeighting(Geometry::Weighting weighting);
+
+    // OBJ, or binary glTF when the name ends in .glb
     bool LoadFromFile(const char* modelDirectory);
-    void Draw(Shader &shader, bool useMaterials);
+
+    // Parses and uploads on an upload context while the GL thread keeps drawing, IsReady turns true once it can be drawn
+    void LoadAsync(const char *fileName);
+
+    // Parses here, then builds and uploads one sub-mesh at a time on the upload contexts. Each one draws as soon as
+    // its upload finishes, with flat material colors until its textures follow
+    bool LoadProgressive(const char *fileName);
+
+    bool IsReady() const;
+    LoadProgress GetLoadProgress() const;
+
+    // Each call catches the cull data up with newly loaded sub-meshes, so every Enqueue belongs to one thread
+    void Enqueue(RenderQueue &queue, Shader &shader, bool useMaterials, const cyMatrix4f &world, const Frustum &frustum,
+                 const cyVec3f &viewPosition, float lodScale, CullStats &stats);
+    void EnqueueLayered(RenderQueue &queue, Shader &shader, const cyMatrix4f &world, const Frustum *layers, int numLayers,
+                        const cyVec3f &viewPosition, float lodScale, CullStats &stats);
+    void EnqueueInstanced(RenderQueue &queue, Shader &shader, bool useMaterials, const InstanceBuffer &instances,
+                          CullStats &stats);
+
+    void SetConeCulling(bool enabled);
+    bool GetConeCulling() const;
 
     cyVec3f GetSize();
+    Bounds GetBounds() const;
+
+    // Covers the sub-meshes loaded so far, a progressive load can add levels later
+    int GetLodErrors(float *errors) const;
 };
 
 #endif //MODEL_H
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include "shader.h"
+#include "texture.h"
+
+struct nk_context;
+struct nk_font_atlas;
+struct nk_buffer;
+struct nk_draw_null_texture;
+
+/* Read-only stats panel drawn with nuklear through a small GL 3.3 backend */
+class Overlay
+{
+private:
+    nk_context *mContext;
+    nk_font_atlas *mAtlas;
+    nk_buffer *mCommands;
+    nk_draw_null_texture *mNullTexture;
+
+    Shader mShader;
+    Texture mFont;
+    unsigned int mVAO, mVBO, mEBO;
+
+    char *mVertices, *mElements;
+    int mWidth, mHeight;
+    bool mOpen;
+
+    void Render();
+
+public:
+    Overlay();
+    ~Overlay();
+
+    Overlay(const Overlay&) = delete;
+    Overlay(Overlay&&) = delete;
+    Overlay& operator=(const Overlay&) = delete;
+    Overlay& operator=(Overlay&&) = delete;
+
+    bool Create();
+
+    void Begin(const char *title, int width, int height);
+    void Text(const char *label, const char *value);
+    void Bar(const char *label, double value, double max);
+    void End();
+};
+
+#endif //OVERLAY_H
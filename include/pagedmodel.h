@@ -0,0 +1,119 @@
+#ifndef PAGEDMODEL_H
+#define PAGEDMODEL_H
+
+#include "mesh.h"
+#include "frustum.h"
+#include "renderqueue.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/*
+ * Out of core rendering for meshes bigger than GPU memory. The mesh is split into an octree on disk where every node
+ * owns one page of vertices: leaves hold the full detail triangles, inner nodes a simplified copy of their subtree.
+ * Only the pages the camera needs are read in, against a memory budget, and least recently used pages make room.
+ * Wherever a finer page is not resident yet its parent draws instead, the root page is always resident.
+ */
+class PagedModel
+{
+public:
+    struct Residency
+    {
+        int residentPages, numPages;
+        long long residentBytes, budgetBytes;
+    };
+
+private:
+    // Stored as is in the page file, children of a node are contiguous
+    struct Node
+    {
+        Bounds bounds;
+        float error;
+        int firstChild, numChildren;
+        int numVertices;
+        long long offset;
+    };
+
+    enum PageState
+    {
+        NonResident, Loading, Resident, Retired, Failed
+    };
+
+    struct CullSetup
+    {
+        const Frustum *frusta;
+        int numFrusta;
+        const cyMatrix4f *world;   // nullptr when the single frustum is already in model space
+    };
+
+    Node *mNodes;
+    int mNumNodes;
+    int mNumTriangles;
+    int mFile;
+    Mesh::Material mMaterial;
+
+    // Shared between the simulation thread, which draws and evicts, and the GL thread, which loads and frees
+    std::atomic<int> *mStates;
+    Mesh **mMeshes;
+
+    // Simulation thread
+    long *mLastUsed, *mRequestFrame;
+    long mFrame;
+    long long mBudget;
+    std::vector<std::pair<float, int>> mRequests;
+
+    // Handed from the simulation thread to the GL thread once per frame
+    std::mutex mMutex;
+    std::vector<int> mWanted, mEvicted;
+
+    // GL thread
+    std::vector<std::pair<int, long>> mRetiring;
+    long mServiceCount;
+    int mInFlight;
+    int mResidentPages;
+    long long mResidentBytes;
+
+    long long PageBytes(int node) const;
+    unsigned int TestNode(int node, const CullSetup &cull) const;
+    void Select(RenderQueue &queue, Shader &shader, Mesh::Material *material, const cyMatrix4f &world, int node,
+                unsigned int mask, const CullSetup &cull, const cyVec3f &viewPosition, float lodScale, CullStats &stats);
+    bool ReadPage(int node, Mesh::Vertex *vertices) const;
+    void LoadPage(int node);
+    bool Open(const char *pageFile);
+    void Close();
+
+public:
+    PagedModel();
+    ~PagedModel();
+
+    PagedModel(const PagedModel&) = delete;
+    PagedModel(PagedModel&&) = delete;
+    PagedModel& operator=(const PagedModel&) = delete;
+    PagedModel& operator=(PagedModel&&) = delete;
+
+    // Converts an OBJ into a page file. Only drawing is out of core, the conversion holds the whole mesh in memory
+    static bool Build(const char *objFile, const char *pageFile);
+
+    // GL thread. An OBJ goes through a page file next to it, rebuilt whenever the source changes
+    bool LoadFromFile(const char *fileName, long long budgetBytes);
+
+    // Simulation thread, same spaces as Model: the single frustum in model space, layers in world space
+    void Enqueue(RenderQueue &queue, Shader &shader, bool useMaterials, const cyMatrix4f &world, const Frustum &frustum,
+                 const cyVec3f &viewPosition, float lodScale, CullStats &stats);
+    void EnqueueLayered(RenderQueue &queue, Shader &shader, const cyMatrix4f &world, const Frustum *layers, int numLayers,
+                        const cyVec3f &viewPosition, float lodScale, CullStats &stats);
+
+    // Simulation thread, once per frame after the last Enqueue. Picks the pages to read and evicts to fit the budget
+    void UpdateResidency();
+
+    // GL thread, once per frame. Starts reads and frees evicted pages once no queued frame can still draw them
+    void Service();
+
+    Bounds GetBounds() const;
+
+    // GL thread
+    Residency GetResidency() const;
+};
+
+#endif //PAGEDMODEL_H
@@ -0,0 +1,42 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+/*
+ * Scoped CPU zones written to per-thread ring buffers and exported as Chrome trace events.
+ * Zone names must outlive the export, string literals are the intended use.
+ */
+namespace Profiler
+{
+    unsigned long long Now();
+    void Record(const char *name, unsigned long long start, unsigned long long end);
+    void SetThreadName(const char *name);
+    bool WriteChromeTrace(const char *fileName);
+
+    class Scope
+    {
+    private:
+        const char *mName;
+        unsigned long long mStart;
+
+    public:
+        explicit Scope(const char *name) : mName(name), mStart(Now()) {}
+        ~Scope() { Record(mName, mStart, Now()); }
+
+        Scope(const Scope&) = delete;
+        Scope(Scope&&) = delete;
+        Scope& operator=(const Scope&) = delete;
+        Scope& operator=(Scope&&) = delete;
+    };
+}
+
+#ifdef ENABLE_PROFILER
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) Profiler::Scope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_THREAD(name) Profiler::SetThreadName(name)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_THREAD(name) ((void)0)
+#endif
+
+#endif //PROFILER_H
@@ -0,0 +1,102 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "mesh.h"
+#include "commandbuffer.h"
+
+struct DrawPacket
+{
+    enum Type
+    {
+        Arrays, Ranges, Elements
+    };
+
+    Shader *shader;
+    const Mesh *mesh;
+    Mesh::Material *material;   // nullptr in depth passes
+    const cyMatrix4f *model;    // uploaded as uModel when it changes
+    int layerMask;              // uploaded as uLayerMask when not negative
+
+    Type type;
+    int first, count;           // vertices, indices, or ranges pushed to the queue
+
+    unsigned int instanceBuffer;
+    int firstInstance, numInstances;
+};
+
+struct QueueStats
+{
+    int packets;
+    int passes;
+    int programChanges;
+    int materialChanges;
+    int modelChanges;
+};
+
+class RenderQueue
+{
+private:
+    struct Pass
+    {
+        std::function<void()> begin;
+        std::function<void()> end;
+    };
+
+    std::vector<Pass> mPasses;
+    std::vector<DrawPacket> mPackets;
+    std::vector<unsigned long long> mKeys, mSortedKeys;
+    std::vector<unsigned int> mOrder, mSortedOrder;
+    std::vector<int> mRangeFirsts, mRangeCounts;
+
+    // Sorted packets split into runs that never cross a pass, each recorded into its own buffer
+    struct Chunk
+    {
+        int pass;
+        int first, last;
+        QueueStats stats;
+        CommandBuffer *commands;
+    };
+
+    std::vector<Chunk> mChunks;
+    std::vector<CommandBuffer *> mBuffers;
+    bool mRecorded;
+
+    std::unordered_map<const void *, unsigned int> mIds[3];
+    int mDropped;
+    QueueStats mStats;
+
+    unsigned int Intern(int table, const void *pointer, unsigned int bits);
+    void Sort();
+    void RecordChunk(Chunk &chunk);
+
+public:
+    static const int MaxPasses = 16;
+    static const int PacketsPerChunk = 256;
+
+    RenderQueue();
+    ~RenderQueue();
+
+    RenderQueue(const RenderQueue&) = delete;
+    RenderQueue(RenderQueue&&) = delete;
+    RenderQueue& operator=(const RenderQueue&) = delete;
+    RenderQueue& operator=(RenderQueue&&) = delete;
+
+    void Clear();
+    void BeginPass(std::function<void()> begin, std::function<void()> end);
+    int PushRanges(const int *firsts, const int *counts, int numRanges);
+    void Push(const DrawPacket &packet, float depth, bool translucent = false);
+
+    // Sorts and records every packet into command buffers in parallel on the job system, safe off the GL thread
+    void Record();
+
+    // GL thread only, runs the passes and replays their buffers, recording first if Record was not called
+    void Submit();
+
+    const QueueStats &GetStats() const;
+};
+
+#endif //RENDERQUEUE_H
@@ -0,0 +1,35 @@
+#ifndef RENDERSTATS_H
+#define RENDERSTATS_H
+
+/* Per-frame counters for the GL work issued by Shader, Mesh, Texture and Framebuffer, kept over a sliding window */
+namespace RenderStats
+{
+    enum Counter
+    {
+        DrawCalls, Triangles, Vertices, UniformUploads, TextureBinds, ProgramSwitches, BufferBytes, FramebufferSwitches,
+        Count
+    };
+
+    struct Frame
+    {
+        long long values[Count];
+    };
+
+    static const int WindowFrames = 120;
+    extern const char *CounterNames[Count];
+
+    void Add(Counter counter, long long amount = 1);
+
+    /* Vertices are what the draw fetches, so indexed draws count their indices and instanced draws every instance */
+    void AddDraw(long long vertices, long long instances = 1);
+
+    void BeginFrame();
+    const Frame &GetLastFrame();
+    Frame GetWindowAverage();
+    Frame GetWindowMax();
+    int GetWindowSize();
+
+    bool WriteJson(const char *fileName);
+}
+
+#endif //RENDERSTATS_H
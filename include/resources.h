@@ -0,0 +1,38 @@
+#ifndef RESOURCES_H
+#define RESOURCES_H
+
+#include <string>
+
+/* Estimated memory held by every live GPU object and CPU staging copy, keyed by the object that owns it */
+namespace Resources
+{
+    enum Type
+    {
+        Textures, Buffers, Renderbuffers, Staging, Count
+    };
+
+    struct Totals
+    {
+        long long current[Count];
+        long long peak[Count];
+        int objects[Count];
+    };
+
+    extern const char *TypeNames[Count];
+
+    /* Drivers pad RGB8 and DEPTH24 to four bytes, so callers pass the padded texel size */
+    long long TextureBytes(int width, int height, int bytesPerTexel, int layers = 1, bool mips = false);
+
+    /* Tracking an owner again replaces its size, an empty label keeps the previous one */
+    void Track(Type type, const void *owner, long long bytes, const std::string &label = std::string());
+    void SetLabel(Type type, const void *owner, const std::string &label);
+    void Release(Type type, const void *owner);
+
+    Totals GetTotals();
+    void PrintTopConsumers(int count);
+
+    /* Anything still tracked once every owner should be gone is reported and counted */
+    int ReportLeaks();
+}
+
+#endif //RESOURCES_H
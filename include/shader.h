@@ -3,12 +3,20 @@
 
 #include <cyVector.h>
 #include <cyMatrix.h>
+#include <string>
+#include <utility>
+#include <vector>
 
 class Shader
 {
 private:
     unsigned int mProgramID;
 
+    // Active uniforms sorted by name, filled once after linking
+    std::vector<std::pair<std::string, int>> mUniforms;
+
+    void CacheUniforms();
+
 public:
     Shader();
     ~Shader();
@@ -19,8 +27,12 @@ public:
     Shader& operator=(Shader&&) = delete;
 
     void Use() const;
-    bool LoadFromSource(const char *vertSrc, const char *fragSrc);
-    bool LoadFromFile(const char *vertFileName, const char *fragFileName);
+    bool LoadFromSource(const char *vertSrc, const char *fragSrc, const char *defines = nullptr);
+    bool LoadFromSource(const char *vertSrc, const char *geomSrc, const char *fragSrc, const char *defines);
+    bool LoadFromFile(const char *vertFileName, const char *fragFileName, const char *defines = nullptr);
+
+    // Reads the table built at link time and never calls GL, so command recording can use it on any thread
+    int GetUniformLocation(const char *name) const;
 
     bool UploadUniform(const char *name, bool value) const;
     bool UploadUniform(const char *name, int value) const;
@@ -29,8 +41,11 @@ public:
     bool UploadUniform(const char *name, float *values, int count) const;
     bool UploadUniform(const char *name, cyVec2f value) const;
     bool UploadUniform(const char *name, cyVec3f value) const;
+    bool UploadUniform(const char *name, const cyVec3f *values, int count) const;
     bool UploadUniform(const char *name, cyVec4f value) const;
+    bool UploadUniform(const char *name, const cyVec4f *values, int count) const;
     bool UploadUniform(const char *name, cyMatrix4f value) const;
+    bool UploadUniform(const char *name, const cyMatrix4f *values, int count) const;
 };
 
 namespace Shaders
@@ -41,6 +56,9 @@ namespace Shaders
 layout (location = 0) in vec3 aPosition;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+#ifdef INSTANCED
+layout (location = 3) in mat4 aInstanceModel;
+#endif
 
 uniform mat4 uModel;
 uniform mat4 uProjection;
@@ -56,11 +74,17 @@ out vec2 fTexCoords;
 
 void main()
 {
-    fPosition = (uModel * vec4(aPosition, 1)).xyz;
-    fLightViewPosition = uLightTransform * (uLightProjection * uLightView * uModel) * vec4(aPosition, 1);
-    fNormal = mat3(transpose(inverse(uModel))) * aNormal;
+#ifdef INSTANCED
+    mat4 model = aInstanceModel;
+#else
+    mat4 model = uModel;
+#endif
+
+    fPosition = (model * vec4(aPosition, 1)).xyz;
+    fLightViewPosition = uLightTransform * (uLightProjection * uLightView * model) * vec4(aPosition, 1);
+    fNormal = mat3(transpose(inverse(model))) * aNormal;
     fTexCoords = aTexCoords;
-    gl_Position = uProjection * uView * uModel * vec4(aPosition, 1);
+    gl_Position = uProjection * uView * model * vec4(aPosition, 1);
 }
 )";
 
@@ -91,11 +115,146 @@ uniform vec3 uViewPos;
 uniform sampler2DShadow uShadowMap;
 uniform Material uMaterial;
 
+uniform float uFilterRadius;
+#ifdef SHADOW_CUBE
+uniform samplerCubeShadow uShadowCube;
+uniform float uCubeFar;
+#endif
+#ifdef SHADOW_ATLAS
+uniform int uLightCount;
+uniform vec3 uLightPositions[MAX_LIGHTS];
+uniform vec3 uLightColors[MAX_LIGHTS];
+uniform mat4 uLightMatrices[MAX_LIGHTS];
+uniform vec4 uLightTiles[MAX_LIGHTS];
+#endif
+#ifdef SHADOW_PCSS
+uniform sampler2D uShadowDepth;
+uniform float uLightSize;
+uniform float uLightNear;
+uniform float uLightFar;
+#endif
+
 in vec3 fPosition;
 in vec4 fLightViewPosition;
 in vec3 fNormal;
 in vec2 fTexCoords;
 
+#ifdef SHADOW_TAPS
+const vec2 PoissonDisk[32] = vec2[](
+    vec2(-0.975402, -0.071138), vec2(-0.920347, -0.411420), vec2(-0.883908,  0.217872), vec2(-0.884518,  0.568041),
+    vec2(-0.811945,  0.904297), vec2(-0.792474, -0.779962), vec2(-0.614411,  0.554592), vec2(-0.616809, -0.204364),
+    vec2(-0.590176, -0.970593), vec2(-0.558812,  0.113216), vec2(-0.443337, -0.373216), vec2(-0.406214,  0.889106),
+    vec2(-0.346768, -0.632470), vec2(-0.320187,  0.347012), vec2(-0.197552, -0.962498), vec2(-0.137006,  0.046637),
+    vec2(-0.098624,  0.640024), vec2( 0.046616, -0.417498), vec2( 0.101645,  0.997113), vec2( 0.150291, -0.811474),
+    vec2( 0.224707,  0.366880), vec2( 0.301425, -0.091432), vec2( 0.395342,  0.661530), vec2( 0.461810, -0.408836),
+    vec2( 0.506082,  0.106431), vec2( 0.573613, -0.918416), vec2( 0.672521,  0.394516), vec2( 0.712483, -0.303124),
+    vec2( 0.798913,  0.768216), vec2( 0.842367, -0.646829), vec2( 0.958733,  0.110286), vec2( 0.971142, -0.355211)
+);
+
+// Taking every n-th point keeps small kernels spread over the whole disk
+const int PoissonStride = 32 / SHADOW_TAPS;
+
+float linearDepth(float depth)
+{
+#ifdef SHADOW_PCSS
+    float z = depth * 2.0 - 1.0;
+    return (2.0 * uLightNear * uLightFar) / (uLightFar + uLightNear - z * (uLightFar - uLightNear));
+#else
+    return depth;
+#endif
+}
+
+mat2 kernelRotation()
+{
+    float angle = 6.2831853 * fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+    float s = sin(angle);
+    float c = cos(angle);
+    return mat2(c, s, -s, c);
+}
+#endif
+
+float shadow(vec4 lightViewPosition, vec4 tile)
+{
+    vec3 coords = lightViewPosition.xyz / lightViewPosition.w;
+
+#ifdef SHADOW_ATLAS
+    // Outside this light's tile means outside its frustum
+    if (lightViewPosition.w <= 0.0 || any(lessThan(coords.xy, tile.xy)) || any(greaterThan(coords.xy, tile.zw)))
+        return 1.0;
+#endif
+
+#ifdef SHADOW_TAPS
+    vec2 texel = 1.0 / vec2(textureSize(uShadowMap, 0));
+    mat2 rotation = kernelRotation();
+    vec2 radius = texel * uFilterRadius;
+
+#ifdef SHADOW_PCSS
+    float receiver = linearDepth(coords.z);
+    float tileScale = tile.z - tile.x;
+    vec2 searchRadius = vec2(tileScale * uLightSize * (receiver - uLightNear) / receiver);
+
+    float blockerSum = 0.0;
+    int blockers = 0;
+    for (int i = 0; i < SHADOW_BLOCKER_TAPS; i++)
+    {
+        vec2 offset = rotation * PoissonDisk[i * (32 / SHADOW_BLOCKER_TAPS)] * searchRadius;
+        float depth = texture(uShadowDepth, clamp(coords.xy + offset, tile.xy, tile.zw)).r;
+        if (depth < coords.z)
+        {
+            blockerSum += linearDepth(depth);
+            blockers++;
+        }
+    }
+
+    // Nothing in the search region occludes us, or everything does
+    if (blockers == 0)
+        return 1.0;
+    if (blockers == SHADOW_BLOCKER_TAPS)
+        return 0.0;
+
+    float blocker = blockerSum / float(blockers);
+    float penumbra = (receiver - blocker) / blocker;
+    radius = max(radius, vec2(tileScale * penumbra * uLightSize * uLightNear / receiver));
+#endif
+
+    float sum = 0.0;
+    for (int i = 0; i < SHADOW_TAPS; i++)
+    {
+        vec2 offset = rotation * PoissonDisk[i * PoissonStride] * radius;
+        sum += texture(uShadowMap, vec3(clamp(coords.xy + offset, tile.xy, tile.zw), coords.z));
+    }
+    return sum / float(SHADOW_TAPS);
+#else
+    return texture(uShadowMap, coords);
+#endif
+}
+
+#ifdef SHADOW_CUBE
+float shadowCube(vec3 position)
+{
+    vec3 toFragment = position - uLightPos;
+    float depth = length(toFragment) / uCubeFar - 0.005;
+
+#ifdef SHADOW_TAPS
+    vec3 axis = normalize(toFragment);
+    vec3 tangent = normalize(cross(axis, abs(axis.y) < 0.99 ? vec3(0, 1, 0) : vec3(1, 0, 0)));
+    vec3 bitangent = cross(axis, tangent);
+    mat2 rotation = kernelRotation();
+    float radius = 2.0 * uFilterRadius / float(textureSize(uShadowCube, 0).x);
+
+    float sum = 0.0;
+    for (int i = 0; i < SHADOW_TAPS; i++)
+    {
+        vec2 offset = rotation * PoissonDisk[i * PoissonStride] * radius;
+        sum += texture(uShadowCube, vec4(axis + tangent * offset.x + bitangent * offset.y, depth));
+    }
+    return sum / float(SHADOW_TAPS);
+#else
+    return texture(uShadowCube, vec4(toFragment, depth));
+#endif
+}
+#endif
+
 float diffuse(vec3 lightDir, vec3 normal)
 {
     return max(dot(lightDir, normal), 0.0);
@@ -111,31 +270,52 @@ void main()
 {
     vec3 position = fPosition.xyz;
     vec3 normal = normalize(fNormal);
-    vec3 lightDir = normalize(uLightPos - fPosition);
     vec3 viewDir = normalize(uViewPos - fPosition);
 
-    vec4 lightDiffuse = vec4(vec3(diffuse(lightDir, normal)), 1);
-    vec4 lightAmbience = vec4(0, 0, 0, 1);
-    vec4 lightSpecular = vec4(vec3(specular(lightDir, viewDir, position, normal)), 1);
+    vec4 materialDiffuse = vec4(uMaterial.kDiffuse, 1);
+    vec4 materialAmbience = vec4(uMaterial.kAmbience, 1);
+    vec4 materialSpecular = vec4(uMaterial.kSpecular, 1);
 
     if (uMaterial.bDiffuse)
-        lightDiffuse *= texture(uMaterial.mTextureDiffuse, fTexCoords);
-    else
-        lightDiffuse *= vec4(uMaterial.kDiffuse, 1);
+        materialDiffuse = texture(uMaterial.mTextureDiffuse, fTexCoords);
 
     if (uMaterial.bAmbience)
-        lightAmbience *= texture(uMaterial.mTextureAmbience, fTexCoords);
-    else
-        lightAmbience *= vec4(uMaterial.kAmbience, 1);
+        materialAmbience = texture(uMaterial.mTextureAmbience, fTexCoords);
 
     if (uMaterial.bSpecular)
-        lightSpecular *= texture(uMaterial.mTextureSpecular, fTexCoords);
-    else
-        lightSpecular *= vec4(uMaterial.kSpecular, 1);
+        materialSpecular = texture(uMaterial.mTextureSpecular, fTexCoords);
+
+    vec4 lightAmbience = vec4(0, 0, 0, 1) * materialAmbience;
+
+#ifdef SHADOW_ATLAS
+    oColor = lightAmbience;
+
+    for (int i = 0; i < uLightCount; i++)
+    {
+        vec3 lightDir = normalize(uLightPositions[i] - fPosition);
+        vec3 lit = diffuse(lightDir, normal) * materialDiffuse.rgb +
+                   specular(lightDir, viewDir, position, normal) * materialSpecular.rgb;
+
+        float visibility = 1.0;
+        if (uLightTiles[i].z >= 0.0)
+            visibility = shadow(uLightMatrices[i] * vec4(fPosition, 1), uLightTiles[i]);
+
+        oColor.rgb += lit * uLightColors[i] * visibility;
+    }
+#else
+    vec3 lightDir = normalize(uLightPos - fPosition);
+
+    vec4 lightDiffuse = vec4(vec3(diffuse(lightDir, normal)), 1) * materialDiffuse;
+    vec4 lightSpecular = vec4(vec3(specular(lightDir, viewDir, position, normal)), 1) * materialSpecular;
 
     oColor = (lightAmbience + lightDiffuse + lightSpecular);
 
-    oColor *= textureProj(uShadowMap, fLightViewPosition);
+#ifdef SHADOW_CUBE
+    oColor *= shadowCube(fPosition);
+#else
+    oColor *= shadow(fLightViewPosition, vec4(0, 0, 1, 1));
+#endif
+#endif
 }
 )";
 
@@ -143,6 +323,9 @@ void main()
 #version 330 core
 
 layout (location = 0) in vec3 aPosition;
+#ifdef INSTANCED
+layout (location = 3) in mat4 aInstanceModel;
+#endif
 
 uniform mat4 uModel;
 uniform mat4 uView;
@@ -150,7 +333,11 @@ uniform mat4 uProjection;
 
 void main()
 {
+#ifdef INSTANCED
+    gl_Position = uProjection * uView * aInstanceModel * vec4(aPosition, 1);
+#else
     gl_Position = uProjection * uView * uModel * vec4(aPosition, 1);
+#endif
 }
 )";
 
@@ -164,6 +351,87 @@ void main()
 )";
 
 
+    static const char *DepthCubeVS = R"(
+#version 330 core
+
+layout (location = 0) in vec3 aPosition;
+#ifdef INSTANCED
+layout (location = 3) in mat4 aInstanceModel;
+#endif
+
+uniform mat4 uModel;
+
+void main()
+{
+#ifdef INSTANCED
+    gl_Position = aInstanceModel * vec4(aPosition, 1);
+#else
+    gl_Position = uModel * vec4(aPosition, 1);
+#endif
+}
+)";
+
+    static const char *DepthCubeGS = R"(
+#version 330 core
+
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 18) out;
+
+uniform mat4 uLayerMatrices[6];
+uniform int uLayerMask;
+
+out vec3 gPosition;
+
+void main()
+{
+    for (int layer = 0; layer < 6; layer++)
+    {
+        if ((uLayerMask & (1 << layer)) == 0)
+            continue;
+
+        vec4 clip[3];
+        for (int i = 0; i < 3; i++)
+            clip[i] = uLayerMatrices[layer] * gl_in[i].gl_Position;
+
+        // Skip faces where the whole triangle is outside one clip plane
+        bvec3 outside = bvec3(false);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (clip[0][axis] < -clip[0].w && clip[1][axis] < -clip[1].w && clip[2][axis] < -clip[2].w)
+                outside[axis] = true;
+            if (clip[0][axis] > clip[0].w && clip[1][axis] > clip[1].w && clip[2][axis] > clip[2].w)
+                outside[axis] = true;
+        }
+        if (any(outside))
+            continue;
+
+        for (int i = 0; i < 3; i++)
+        {
+            gl_Layer = layer;
+            gPosition = gl_in[i].gl_Position.xyz;
+            gl_Position = clip[i];
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+}
+)";
+
+    static const char *DepthCubeFS = R"(
+#version 330 core
+
+uniform vec3 uLightPos;
+uniform float uCubeFar;
+
+in vec3 gPosition;
+
+void main()
+{
+    gl_FragDepth = length(gPosition - uLightPos) / uCubeFar;
+}
+)";
+
+
     static const char *BlinnVS = R"(
 #version 330 core
 
@@ -257,6 +525,42 @@ void main()
 
     oColor = lightAmbience + lightDiffuse + lightSpecular;
 }
+)";
+
+    static const char *OverlayVS = R"(
+#version 330 core
+
+layout (location = 0) in vec2 aPosition;
+layout (location = 1) in vec2 aTexCoords;
+layout (location = 2) in vec4 aColor;
+
+uniform mat4 uProjection;
+
+out vec2 fTexCoords;
+out vec4 fColor;
+
+void main()
+{
+    fTexCoords = aTexCoords;
+    fColor = aColor;
+    gl_Position = uProjection * vec4(aPosition, 0, 1);
+}
+)";
+
+    static const char *OverlayFS = R"(
+#version 330 core
+
+uniform sampler2D uTexture;
+
+in vec2 fTexCoords;
+in vec4 fColor;
+
+out vec4 oColor;
+
+void main()
+{
+    oColor = fColor * texture(uTexture, fTexCoords);
+}
 )";
 }
 
@@ -0,0 +1,90 @@
+#ifndef SHADOWATLAS_H
+#define SHADOWATLAS_H
+
+#include <vector>
+#include <cyVector.h>
+#include <cyMatrix.h>
+
+#include "framebuffer.h"
+
+class ShadowAtlas
+{
+public:
+    struct Tile
+    {
+        int x, y;
+        int size;
+    };
+
+private:
+    Framebuffer mFramebuffer;
+    int mSize, mMinTileSize, mNumLevels;
+
+    // Buddy allocator, one free list per power-of-two tile size (level 0 is the whole atlas)
+    std::vector<Tile> *mFreeLists;
+
+    int GetLevel(int tileSize) const;
+
+public:
+    ShadowAtlas();
+    ~ShadowAtlas();
+
+    ShadowAtlas(const ShadowAtlas&) = delete;
+    ShadowAtlas(ShadowAtlas&&) = delete;
+    ShadowAtlas& operator=(const ShadowAtlas&) = delete;
+    ShadowAtlas& operator=(ShadowAtlas&&) = delete;
+
+    bool Create(int size, int minTileSize);
+    bool Allocate(int tileSize, Tile &tile);
+    void Free(const Tile &tile);
+
+    void Begin() const;
+    void BeginTile(const Tile &tile) const;
+    void End(int width, int height);
+
+    cyMatrix4f GetTileTransform(const Tile &tile, float bias) const;
+    cyVec4f GetTileRect(const Tile &tile) const;
+
+    int GetSize() const;
+    int GetMinTileSize() const;
+    Texture &GetTexture();
+};
+
+struct ShadowLight
+{
+    cyVec3f position;
+    cyVec3f color;
+    float radius;
+
+    cyMatrix4f view, projection;
+
+    ShadowAtlas::Tile tile;
+    bool hasTile;
+    bool valid;
+
+    // What the tile currently holds, lookups have to use it until the scheduler refreshes the tile
+    cyVec3f renderedPosition;
+    cyMatrix4f renderedViewProjection;
+    int lastUpdate;
+    float coverage;
+    float priority;
+};
+
+class ShadowScheduler
+{
+private:
+    int mBudget;
+    int mFrame;
+    float mMotionWeight;
+
+public:
+    ShadowScheduler();
+
+    void SetBudget(int viewsPerFrame);
+    int GetBudget() const;
+
+    int Schedule(ShadowLight *lights, int numLights, int *scheduled);
+    void MarkUpdated(ShadowLight &light) const;
+};
+
+#endif //SHADOWATLAS_H
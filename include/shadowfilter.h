@@ -0,0 +1,75 @@
+#ifndef SHADOWFILTER_H
+#define SHADOWFILTER_H
+
+#include <cstring>
+
+namespace ShadowModes
+{
+    enum Type
+    {
+        Spot = 0,
+        Point,
+        Atlas,
+        Count
+    };
+
+    struct Info
+    {
+        const char *name;
+        const char *defines;
+    };
+
+    const Info Modes[Count] =
+            {
+                    {"spot", ""},
+                    {"point", "#define SHADOW_CUBE\n"},
+                    {"atlas", "#define SHADOW_ATLAS\n#define MAX_LIGHTS 8\n"}
+            };
+}
+
+namespace ShadowFilters
+{
+    enum Type
+    {
+        Hardware = 0,
+        PCF4,
+        PCF8,
+        PCF16,
+        PCF32,
+        PCSS16,
+        PCSS32,
+        Count
+    };
+
+    struct Info
+    {
+        const char *name;
+        const char *defines;
+        int taps;
+        int blockerTaps;
+    };
+
+    const Info Filters[Count] =
+            {
+                    {"hardware", "", 1, 0},
+                    {"pcf4", "#define SHADOW_TAPS 4\n", 4, 0},
+                    {"pcf8", "#define SHADOW_TAPS 8\n", 8, 0},
+                    {"pcf16", "#define SHADOW_TAPS 16\n", 16, 0},
+                    {"pcf32", "#define SHADOW_TAPS 32\n", 32, 0},
+                    {"pcss16", "#define SHADOW_TAPS 16\n#define SHADOW_PCSS\n#define SHADOW_BLOCKER_TAPS 8\n", 16, 8},
+                    {"pcss32", "#define SHADOW_TAPS 32\n#define SHADOW_PCSS\n#define SHADOW_BLOCKER_TAPS 16\n", 32, 16}
+            };
+
+    inline int Find(const char *name)
+    {
+        for (int i = 0; i < Count; i++)
+        {
+            if (strcmp(Filters[i].name, name) == 0)
+                return i;
+        }
+
+        return -1;
+    }
+}
+
+#endif //SHADOWFILTER_H
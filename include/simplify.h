@@ -0,0 +1,16 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <vector>
+#include "mesh.h"
+
+namespace Simplify
+{
+    void Weld(const Mesh::Vertex *vertices, int numVertices, std::vector<Mesh::Vertex> &unique,
+              std::vector<unsigned int> &indices);
+
+    float Collapse(const std::vector<Mesh::Vertex> &vertices, const std::vector<unsigned int> &indices,
+                   int targetTriangles, std::vector<unsigned int> &result);
+}
+
+#endif //SIMPLIFY_H
@@ -0,0 +1,35 @@
+#ifndef STARTUPREPORT_H
+#define STARTUPREPORT_H
+
+#include <string>
+
+/*
+ * Wall time, peak RSS and bytes read for every phase between process start and the first presented frame.
+ * Only the main thread's phases are recorded, calls from other threads are ignored.
+ */
+namespace StartupReport
+{
+    void BeginPhase(const std::string &name);
+    void EndPhase();
+
+    /* Closes the report, phases begun after this are ignored so runtime loads do not end up in it */
+    void Finish();
+    bool IsFinished();
+
+    void Print();
+    bool WriteJson(const char *fileName);
+
+    class Phase
+    {
+    public:
+        explicit Phase(const std::string &name) { BeginPhase(name); }
+        ~Phase() { EndPhase(); }
+
+        Phase(const Phase&) = delete;
+        Phase(Phase&&) = delete;
+        Phase& operator=(const Phase&) = delete;
+        Phase& operator=(Phase&&) = delete;
+    };
+}
+
+#endif //STARTUPREPORT_H
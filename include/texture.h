@@ -3,9 +3,18 @@
 
 class Texture
 {
+public:
+    // Decoded pixels, produced off the GL thread and handed to LoadFromImage
+    struct Image
+    {
+        unsigned char *data;
+        int width, height, channels;
+    };
+
 private:
     unsigned int mTextureID;
     unsigned int mTextureType;
+    unsigned int mDepthSamplerID;
 
 public:
     Texture();
@@ -18,12 +27,22 @@ public:
 
     bool LoadFromData(int width, int height, int channels, void *data);
     bool LoadFromFile(const char *fileName);
+    bool LoadFromImage(const char *fileName, Image &image);
     bool LoadCubemapFromData(int width, int height, int channels, void *pX, void *nX, void *pY, void *nY, void *pZ, void *nZ);
     bool LoadCubemapFromFiles(const char *files[6]);
     bool LoadDepthFromData(int width, int height, void *data);
+    bool LoadDepthCubemap(int size);
     void Bind(unsigned int slot = 0) const;
+    void BindDepth(unsigned int slot) const;
 
     unsigned int GetID() const;
+
+    // Safe on any thread, the image is freed by LoadFromImage or FreeImage
+    static bool Decode(const char *fileName, Image &image);
+
+    // Same for an encoded image already in memory, the name only labels it
+    static bool Decode(const char *name, const unsigned char *data, long long size, Image &image);
+    static void FreeImage(Image &image);
 };
 
 #endif //TEXTURE_H
\ No newline at end of file
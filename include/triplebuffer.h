@@ -0,0 +1,49 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+/*
+ * Lock free hand-off between one producer and one consumer thread. The producer fills the back slot and publishes it,
+ * the consumer picks up the newest published slot, and neither ever waits for the other or sees a slot being written.
+ */
+template<typename T>
+class TripleBuffer
+{
+private:
+    static const int IndexMask = 3;
+    static const int Fresh = 4;
+
+    T mSlots[3];
+
+    // Slot shared between the threads, flagged Fresh while it holds a publish the consumer has not taken
+    std::atomic<int> mMiddle;
+    int mBack, mFront;
+
+public:
+    TripleBuffer() : mMiddle(1), mBack(0), mFront(2) {}
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer(TripleBuffer&&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(TripleBuffer&&) = delete;
+
+    // Producer side
+    T &GetBack() { return mSlots[mBack]; }
+    void Publish() { mBack = mMiddle.exchange(mBack | Fresh, std::memory_order_acq_rel) & IndexMask; }
+
+    // Consumer side, returns false and keeps the current front when nothing new was published
+    bool Consume()
+    {
+        if (!(mMiddle.load(std::memory_order_acquire) & Fresh))
+            return false;
+
+        mFront = mMiddle.exchange(mFront, std::memory_order_acq_rel) & IndexMask;
+        return true;
+    }
+
+    T &GetFront() { return mSlots[mFront]; }
+    const T &GetFront() const { return mSlots[mFront]; }
+};
+
+#endif //TRIPLEBUFFER_H
@@ -0,0 +1,37 @@
+#ifndef UPLOADCONTEXT_H
+#define UPLOADCONTEXT_H
+
+#include <functional>
+
+struct GLFWwindow;
+
+/*
+ * Loader threads with hidden windows whose contexts share objects with the main one, so buffers and textures can be
+ * created while the GL thread keeps drawing. Every upload is followed by a fence, and its completion callback only
+ * runs on the GL thread once that fence has signaled. Vertex arrays are not shared between contexts, so completion
+ * callbacks are where they get made. Without contexts every upload runs inline on the submitting thread.
+ */
+namespace UploadContext
+{
+    // Main thread, with the main context current. 0 contexts keeps everything inline
+    bool Initialize(GLFWwindow *shared, int numContexts = 2);
+
+    // Main thread, after Flush, completion callbacks of uploads still in flight are dropped
+    void Shutdown();
+
+    int GetContextCount();
+
+    // Upload runs on a loader thread with its context current and reports success,
+    // ready runs on the GL thread from Poll or Flush once the GPU has finished the upload's commands
+    void Submit(const char *name, std::function<bool()> upload, std::function<void(bool loaded)> ready);
+
+    // GL thread, once per frame, runs the callbacks of every finished upload without waiting on the rest
+    void Poll();
+
+    // GL thread, blocks until every submitted upload has finished and its callback ran
+    void Flush();
+
+    int GetPending();
+}
+
+#endif //UPLOADCONTEXT_H
@@ -17,6 +17,10 @@ namespace Utils
     void Warning(const char *message);
     void Error(int code, const char *message);
     char *ReadFile(const char *fileName);
+
+    unsigned long long PeakResidentBytes();
+    // Everything the process read through the OS, so stb_image, cyTriMesh and the LOD cache are all counted
+    unsigned long long ProcessBytesRead();
 }
 
 #endif  // LOG_H
\ No newline at end of file
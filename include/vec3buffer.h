@@ -0,0 +1,50 @@
+#ifndef VEC3BUFFER_H
+#define VEC3BUFFER_H
+
+#include "frustum.h"
+
+#include <cyMatrix.h>
+#include <cyVector.h>
+
+// Points stored as separate x, y and z arrays so bulk kernels work on four of them per instruction
+class Vec3Buffer
+{
+private:
+    float *mData;
+    int mCount, mStride, mCapacity;
+
+public:
+    Vec3Buffer();
+    ~Vec3Buffer();
+
+    Vec3Buffer(const Vec3Buffer&) = delete;
+    Vec3Buffer(Vec3Buffer&&) = delete;
+    Vec3Buffer& operator=(const Vec3Buffer&) = delete;
+    Vec3Buffer& operator=(Vec3Buffer&&) = delete;
+
+    // Keeps the allocation when shrinking, so scratch buffers can be reused across meshes and frames
+    void Resize(int count);
+
+    // Gathers from or scatters to interleaved xyz data, the stride is in floats
+    void Assign(const float *xyz, int count, int stride);
+    void Store(float *xyz, int stride) const;
+
+    void Set(int i, const cyVec3f &v);
+    cyVec3f Get(int i) const;
+
+    Bounds ComputeBounds() const;
+    Bounds ComputeBounds(int first, int count) const;
+    void Normalize();
+    void Transform(const cyMatrix4f &matrix, Vec3Buffer &result) const;
+
+    // Boxes given by matching min and max entries, results are the world aligned boxes around the transformed ones
+    static void TransformBounds(const cyMatrix4f &matrix, const Vec3Buffer &mins, const Vec3Buffer &maxs,
+                                Vec3Buffer &resultMins, Vec3Buffer &resultMaxs);
+
+    int GetCount() const;
+    const float *X() const;
+    const float *Y() const;
+    const float *Z() const;
+};
+
+#endif //VEC3BUFFER_H
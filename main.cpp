@@ -10,14 +10,31 @@
 
 #include "utils.h"
 #include "application.h"
+#include "glstate.h"
+#include "profiler.h"
+#include "startupreport.h"
+#include "renderstats.h"
+#include "resources.h"
+#include "jobsystem.h"
+#include "uploadcontext.h"
+
+#include <cstdlib>
 
 GLFWwindow *window;
 
 int main(int argc, char **argv)
 {
     if (argc < 2)
-        Utils::Error(1, "Missing required arguments. Correct usage: Project7 <obj_path>");
-    
+        Utils::Error(1, "Missing required arguments. Correct usage: Project7 <obj_or_glb_path> [shadow_filter] [streamed_model ...]");
+
+    PROFILE_THREAD("main");
+
+    /* JOB_THREADS=1 runs every job inline in submission order, which keeps debugging repeatable */
+    const char *jobThreads = getenv("JOB_THREADS");
+    JobSystem::Initialize(jobThreads ? atoi(jobThreads) : 0);
+    Utils::Info(("Job system running on " + std::to_string(JobSystem::GetThreadCount()) + " threads").c_str());
+
+    StartupReport::BeginPhase("GLFW init and context");
     if (!glfwInit())
         Utils::Error(1, "Unable to initialize GLFW");
 
@@ -37,37 +54,96 @@ int main(int argc, char **argv)
 
     glfwMakeContextCurrent(window);
     //glfwSwapInterval(0);
+    StartupReport::EndPhase();
 
     /* Initialize GLEW */
+    StartupReport::BeginPhase("glad load");
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
         Utils::Error(1, "Failed to initialize GLEW");
+    StartupReport::EndPhase();
 
     /* Setup OpenGL */
     glClearColor(0, 0, 0, 1);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_MULTISAMPLE);
+    GLState::Enable(GL_DEPTH_TEST);
+    GLState::Enable(GL_MULTISAMPLE);
+
+    /* Loader contexts share objects with this window's, UPLOAD_CONTEXTS=0 keeps every upload on the GL thread */
+    const char *uploadContexts = getenv("UPLOAD_CONTEXTS");
+    UploadContext::Initialize(window, uploadContexts ? atoi(uploadContexts) : 2);
 
     int width, height;
     glfwGetFramebufferSize(window, &width, &height);
 
-    Application app(width, height, argv[1]);
-
-    glfwSetWindowUserPointer(window, &app);
-    glfwSetKeyCallback(window, Application::KeyCallback);
-    glfwSetFramebufferSizeCallback(window, Application::ResizeCallback);
-    glfwSetCursorPosCallback(window, Application::CursorPosCallback);
-    glfwSetMouseButtonCallback(window, Application::MouseButtonCallback);
-    Application::ResizeCallback(window, width, height);
-
-    while(!glfwWindowShouldClose(window))
     {
-        app.Update();
+        StartupReport::BeginPhase("Application setup");
+        /* PROGRESSIVE_LOAD=1 shows the model one sub-mesh at a time instead of waiting for all of it */
+        const char *progressive = getenv("PROGRESSIVE_LOAD");
+        Application app(width, height, argv[1], argc > 2 ? argv[2] : nullptr, progressive && atoi(progressive));
+        StartupReport::EndPhase();
+
+        glfwSetWindowUserPointer(window, &app);
+        glfwSetKeyCallback(window, Application::KeyCallback);
+        glfwSetFramebufferSizeCallback(window, Application::ResizeCallback);
+        glfwSetCursorPosCallback(window, Application::CursorPosCallback);
+        glfwSetMouseButtonCallback(window, Application::MouseButtonCallback);
+        Application::ResizeCallback(window, width, height);
+
+        /* PAGE_BUDGET_MB draws the extra models out of core, paging them in within that much GPU memory each */
+        const char *pageBudget = getenv("PAGE_BUDGET_MB");
+        if (pageBudget)
+        {
+            for (int i = 3; i < argc; i++)
+                app.AddPagedModel(argv[i], atoll(pageBudget) * 1024 * 1024);
+        }
+
+        /* Update and culling move to the simulation thread, this one only submits what it publishes */
+        app.StartSimulation();
+
+        /* Otherwise extra models load behind the first frames instead of in front of them */
+        for (int i = 3; !pageBudget && i < argc; i++)
+            app.StreamModel(argv[i]);
+
+        StartupReport::BeginPhase("First frame present");
+        while(!glfwWindowShouldClose(window))
+        {
+            UploadContext::Poll();
+            app.Draw();
+
+            glfwPollEvents();
+            glfwSwapBuffers(window);
+
+            /* Time to first frame ends once the first swap has gone out */
+            if (!StartupReport::IsFinished())
+            {
+                glFinish();
+                StartupReport::Finish();
+                StartupReport::Print();
+                if (!StartupReport::WriteJson("startup_report.json"))
+                    Utils::Warning("Unable to write startup_report.json");
+            }
+        }
+
+        app.StopSimulation();
+
+        if (!app.WriteTimingsJson("frame_timings.json"))
+            Utils::Warning("Unable to write frame_timings.json");
+
+        if (!RenderStats::WriteJson("render_stats.json"))
+            Utils::Warning("Unable to write render_stats.json");
+
+        if (!Profiler::WriteChromeTrace("profile_trace.json"))
+            Utils::Warning("Unable to write profile_trace.json");
+
+        glfwSetWindowUserPointer(window, nullptr);
+    }
 
-        app.Draw();
+    UploadContext::Shutdown();
+    JobSystem::Shutdown();
 
-        glfwPollEvents();
-        glfwSwapBuffers(window);
-    }
+    /* Every resource is owned by the application, so anything left now was never freed */
+    int leaks = Resources::ReportLeaks();
+    if (leaks)
+        Utils::Warning((std::to_string(leaks) + " resources leaked").c_str());
 
     glfwDestroyWindow(window);
     glfwTerminate();
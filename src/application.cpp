@@ -1,21 +1,94 @@
 #include "utils.h"
 #include "application.h"
+#include "glstate.h"
+#include "profiler.h"
+#include "renderstats.h"
+#include "resources.h"
+#include "matrixmath.h"
+#include "uploadcontext.h"
 
-Application::Application(int width, int height, const char* modelFile)
-    : mWidth(width), mHeight(height)
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+Application::Application(int width, int height, const char* modelFile, const char* shadowFilter, bool progressive)
+    : mWidth(width), mHeight(height), mShadowMode(ShadowModes::Spot), mShadowFilter(ShadowFilters::PCF16),
+      mNumStreamed(0)
 {
-    if (!mModelShader.LoadFromSource(Shaders::ShadowVS, Shaders::ShadowFS))
-        Utils::Error(1, "Unable to load model shaders.");
+    PROFILE_SCOPE("Application::Application");
+
+    if (shadowFilter)
+    {
+        mShadowFilter = ShadowFilters::Find(shadowFilter);
+        if (mShadowFilter < 0)
+            Utils::Error(1, "Unknown shadow filter.");
+    }
+
+    /* Every filter is its own shader variant so no kernel pays for branches it does not use */
+    for (int mode = 0; mode < ShadowModes::Count; mode++)
+    {
+        for (int i = 0; i < ShadowFilters::Count; i++)
+        {
+            std::string defines = std::string(ShadowModes::Modes[mode].defines) + ShadowFilters::Filters[i].defines;
+
+            if (!mModelShaders[mode][i].LoadFromSource(Shaders::ShadowVS, Shaders::ShadowFS, defines.c_str()))
+                Utils::Error(1, "Unable to load model shaders.");
+
+            defines += "#define INSTANCED\n";
+            if (!mInstancedShaders[mode][i].LoadFromSource(Shaders::ShadowVS, Shaders::ShadowFS, defines.c_str()))
+                Utils::Error(1, "Unable to load instanced model shaders.");
+
+            mFilterTimers[mode][i].Create();
+        }
+    }
 
     if (!mDepthShader.LoadFromSource(Shaders::DepthVS, Shaders::DepthFS))
         Utils::Error(1, "Unable to load depth shaders.");
 
-    if (!mModel.LoadFromFile(modelFile))
+    if (!mDepthInstancedShader.LoadFromSource(Shaders::DepthVS, Shaders::DepthFS, "#define INSTANCED\n"))
+        Utils::Error(1, "Unable to load instanced depth shaders.");
+
+    if (!(progressive ? mModel.LoadProgressive(modelFile) : mModel.LoadFromFile(modelFile)))
         Utils::Error(1, "Unable to load model.");
 
+    if (!mDepthCubeShader.LoadFromSource(Shaders::DepthCubeVS, Shaders::DepthCubeGS, Shaders::DepthCubeFS, nullptr))
+        Utils::Error(1, "Unable to load depth cube shaders.");
+
+    if (!mDepthCubeInstancedShader.LoadFromSource(Shaders::DepthCubeVS, Shaders::DepthCubeGS, Shaders::DepthCubeFS,
+                                                  "#define INSTANCED\n"))
+        Utils::Error(1, "Unable to load instanced depth cube shaders.");
+
     if (!mDepthbuffer.CreateDepthOnly(1024, 1024))
         Utils::Error(1, "Unable to create depthbuffer.");
 
+    if (!mDepthCube.CreateDepthCube(512))
+        Utils::Error(1, "Unable to create depth cube.");
+
+    if (!mShadowAtlas.Create(2048, 128))
+        Utils::Error(1, "Unable to create shadow atlas.");
+
+    /* Three orbiting and three static lights share the atlas */
+    const cyVec3f lightColors[NumAtlasLights] = {{0.6f, 0.5f, 0.4f}, {0.3f, 0.4f, 0.6f}, {0.5f, 0.3f, 0.3f},
+                                                 {0.3f, 0.5f, 0.3f}, {0.4f, 0.4f, 0.4f}, {0.3f, 0.3f, 0.5f}};
+    for (int i = 0; i < NumAtlasLights; i++)
+    {
+        ShadowLight &light = mAtlasLights[i];
+        light.color = lightColors[i];
+        light.radius = 3.0f;
+        light.hasTile = false;
+        light.valid = false;
+        light.lastUpdate = 0;
+        light.coverage = 0;
+        light.priority = 0;
+    }
+    mShadowScheduler.SetBudget(2);
+
+    for (int i = 0; i < FrameTimings::NumPasses; i++)
+        mPassTimers[i].Create(true);
+
+    if (!mOverlay.Create())
+        Utils::Error(1, "Unable to create overlay.");
+
     mPlaneMesh.Create(Meshes::PlaneMeshVertices, 6);
     mPlaneMaterial.bAmbience = false;
     mPlaneMaterial.bDiffuse = false;
@@ -24,10 +97,12 @@ Application::Application(int width, int height, const char* modelFile)
     mPlaneMaterial.kAmbience = cyVec3f(0.5f, 0.5f, 0.5f);
     mPlaneMaterial.kDiffuse = cyVec3f(0.7f, 0.7f, 0.7f);
     mPlaneMaterial.kSpecular = cyVec3f(1, 1, 1);
+    mPlaneMaterial.bCastShadows = false;
 
     mDepthViewMaterial.bAmbience = false;
     mDepthViewMaterial.bDiffuse = true;
     mDepthViewMaterial.bSpecular = false;
+    mDepthViewMaterial.bCastShadows = false;
     mDepthViewMaterial.tDiffuse = &mDepthbuffer.GetTexture();
 
     cyVec3f modelSize = mModel.GetSize();
@@ -40,31 +115,215 @@ Application::Application(int width, int height, const char* modelFile)
     mLightProjection = cyMatrix4f::Perspective(45 * DEG2RADF, 1, 1, 9);
     mLightView = cyMatrix4f::View(mLight, cyVec3f(0, 0, 0), cyVec3f(0, 1, 0));
     mLightTransform = cyMatrix4f::Translation({0.5f, 0.5f, 0.5f - 0.005f}) * cyMatrix4f::Scale(0.5f);
+    mCubeProjection = cyMatrix4f::Perspective(90 * DEG2RADF, 1, 0.05f, mCubeFar);
+    mAtlasProjection = cyMatrix4f::Perspective(60 * DEG2RADF, 1, 0.5f, 10);
+
+    /* Small copies with random headings spread over the ground plane */
+    const int crowdCount = CrowdSide * CrowdSide;
+    const float crowdSpacing = 3.8f / CrowdSide;
+    auto *crowdTransforms = new cyMatrix4f[crowdCount];
+    unsigned int seed = 1;
+    for (int i = 0; i < crowdCount; i++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        float yaw = (float)(seed >> 8) / (float)(1 << 24) * 2.0f * (float)M_PI;
+        cyVec3f position(((float)(i % CrowdSide) + 0.5f) * crowdSpacing - 1.9f, 0,
+                         ((float)(i / CrowdSide) + 0.5f) * crowdSpacing - 1.9f);
+
+        crowdTransforms[i] = cyMatrix4f::Translation(position) * cyMatrix4f::Scale(crowdSpacing * 0.8f) *
+                             cyMatrix4f::RotationY(yaw);
+    }
+
+    /* The model's own world transform is shared by every copy, so it is applied as one batch */
+    MatrixMath::Multiply(crowdTransforms, 1, &mModelWorld, 0, crowdTransforms, crowdCount);
+
+    if (!mCrowd.Create(crowdTransforms, crowdCount, mModel.GetBounds()))
+        Utils::Error(1, "Unable to create crowd instances.");
+
+    delete[] crowdTransforms;
+
+    mNumLodErrors = mModel.GetLodErrors(mLodErrors);
+    mLodErrorMeshes = mModel.GetLoadProgress().meshes;
+
+    /* The simulation starts from the settings above, Resize fills in the real projection before it runs */
+    mInput.mouse = cyVec2d(0, 0);
+    mInput.prevMouse = cyVec2d(0, 0);
+    mInput.leftDown = false;
+    mInput.rightDown = false;
+    mInput.projection.SetPerspective(45.0f, (float)width / (float)height, 0.01f, 1000.0f);
+    mInput.height = height;
+    mInput.shadowMode = mShadowMode;
+    mInput.shadowFilter = mShadowFilter;
+    mInput.crowdMode = mCrowdMode;
+    mInput.useLods = mUseLods;
+    mInput.coneCulling = mModel.GetConeCulling();
+}
+
+static void Accumulate(double &average, double sample)
+{
+    /* Same smoothing window as the GPU timers */
+    average += (sample - average) / 120.0;
+}
+
+Application::~Application()
+{
+    StopSimulation();
+
+    /* A callback still in flight would mark a deleted model ready */
+    UploadContext::Flush();
+
+    int numStreamed = mNumStreamed.load(std::memory_order_acquire);
+    for (int i = 0; i < numStreamed; i++)
+        delete mStreamed[i];
+
+    for (int i = 0; i < mNumPaged; i++)
+        delete mPaged[i];
+}
+
+bool Application::StreamModel(const char *modelFile)
+{
+    int index = mNumStreamed.load(std::memory_order_relaxed);
+    if (index == MaxStreamedModels)
+    {
+        Utils::Warning("Too many streamed models, skipping the rest.");
+        return false;
+    }
+
+    mStreamed[index] = new Model();
+    mStreamedPlaced[index] = false;
+    mStreamed[index]->LoadAsync(modelFile);
+
+    /* Publishes the slot to the simulation thread */
+    mNumStreamed.store(index + 1, std::memory_order_release);
+    return true;
+}
+
+bool Application::AddPagedModel(const char *modelFile, long long budgetBytes)
+{
+    if (mNumPaged == MaxPagedModels)
+    {
+        Utils::Warning("Too many paged models, skipping the rest.");
+        return false;
+    }
+
+    auto *model = new PagedModel();
+    if (!model->LoadFromFile(modelFile, budgetBytes))
+    {
+        Utils::Warning(("Unable to load paged model " + std::string(modelFile)).c_str());
+        delete model;
+        return false;
+    }
+
+    /* Half a slot off the streamed ring so the two kinds never overlap */
+    Bounds bounds = model->GetBounds();
+    cyVec3f size = bounds.max - bounds.min;
+    float scale = 0.5f / MAX(size.x, MAX(size.y, size.z));
+    float angle = ((float)mNumPaged + 0.5f) / (float)MaxStreamedModels * 2.0f * (float)M_PI;
+    cyVec3f center = (bounds.min + bounds.max) * 0.5f;
+
+    mPagedWorld[mNumPaged] = cyMatrix4f::Translation({sinf(angle) * 1.4f, 0, cosf(angle) * 1.4f}) *
+                             cyMatrix4f::Scale(scale) * cyMatrix4f::Translation({0, 0.5f, 0}) *
+                             cyMatrix4f::RotationX(-90 * DEG2RAD) * cyMatrix4f::Translation(-center);
+    mPaged[mNumPaged++] = model;
+    return true;
+}
+
+void Application::StartSimulation()
+{
+    if (mSimulation.joinable())
+        return;
+
+    mStopping = false;
+    mSimulation = std::thread(&Application::SimulationLoop, this);
+}
+
+void Application::StopSimulation()
+{
+    if (!mSimulation.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mFrameMutex);
+        mStopping = true;
+    }
+    mFrameSignal.notify_all();
+    mSimulation.join();
+}
+
+void Application::SimulationLoop()
+{
+    PROFILE_THREAD("simulation");
+
+    while (true)
+    {
+        double updateStart = glfwGetTime();
+
+        Update();
+
+        FramePacket &frame = mFrames.GetBack();
+        BuildFrame(frame);
+        frame.updateMs = (glfwGetTime() - updateStart) * 1000.0;
+        mFrames.Publish();
+
+        /* Stay one frame ahead: build the next packet while the GL thread draws this one, then wait for it to be taken */
+        std::unique_lock<std::mutex> lock(mFrameMutex);
+        mPublished++;
+        mFrameSignal.notify_all();
+        mFrameSignal.wait(lock, [this]() { return mConsumed == mPublished || mStopping; });
+
+        if (mStopping)
+            return;
+    }
 }
 
 void Application::Update()
 {
-    if (mMouseLeftDown)
+    PROFILE_SCOPE("Application::Update");
+
+    /* Take this frame's input in one go, the callbacks keep writing it on the GL thread */
+    cyVec2d mouseDelta(0, 0);
+    bool leftDown, rightDown, coneCulling;
     {
-        cyVec2d mouseDelta;
-        mouseDelta.x = mMouse.x - mPrevMouse.x;
-        mouseDelta.y = mMouse.y - mPrevMouse.y;
+        std::lock_guard<std::mutex> lock(mInputMutex);
 
-        mModelYaw -= (float)(mouseDelta.x * mMouseSensitivity);
-        mModelPitch += (float)(mouseDelta.y * mMouseSensitivity);
-        mModelPitch = CLAMP(-89.0f, mModelPitch, 89.0f);
+        leftDown = mInput.leftDown;
+        rightDown = mInput.rightDown;
+        if (leftDown || rightDown)
+        {
+            mouseDelta.x = mInput.mouse.x - mInput.prevMouse.x;
+            mouseDelta.y = mInput.mouse.y - mInput.prevMouse.y;
+            mInput.prevMouse = mInput.mouse;
+        }
 
-        mPrevMouse = mMouse;
+        mModelProjection = mInput.projection;
+        mViewHeight = mInput.height;
+        mShadowMode = mInput.shadowMode;
+        mShadowFilter = mInput.shadowFilter;
+        mCrowdMode = mInput.crowdMode;
+        mUseLods = mInput.useLods;
+        coneCulling = mInput.coneCulling;
     }
 
-    if (mMouseRightDown)
+    mModel.SetConeCulling(coneCulling);
+
+    /* Sub-meshes of a progressive load bring their own LOD chains, the crowd buckets follow them */
+    int loadedMeshes = mModel.GetLoadProgress().meshes;
+    if (loadedMeshes != mLodErrorMeshes)
     {
-        double mouseYDelta = mMouse.y - mPrevMouse.y;
+        mNumLodErrors = mModel.GetLodErrors(mLodErrors);
+        mLodErrorMeshes = loadedMeshes;
+    }
 
-        mModelRadius += (float)(mouseYDelta * mZoomSensitivity);
+    if (leftDown)
+    {
+        mModelYaw -= (float)(mouseDelta.x * mMouseSensitivity);
+        mModelPitch += (float)(mouseDelta.y * mMouseSensitivity);
+        mModelPitch = CLAMP(-89.0f, mModelPitch, 89.0f);
+    }
+    else if (rightDown)
+    {
+        mModelRadius += (float)(mouseDelta.y * mZoomSensitivity);
         mModelRadius = MAX(mModelRadius, 0.01f);
-
-        mPrevMouse = mMouse;
     }
 
     /* Calculate Model Scene Camera Position */
@@ -79,43 +338,817 @@ void Application::Update()
     mLight.y = 2;
     mLight.z = cosf(mLightRotation) * 2;
     mLightView.SetView(mLight, cyVec3f(0, 0, 0), cyVec3f(0, 1, 0));
+
+    /* Cube face order matches GL_TEXTURE_CUBE_MAP_POSITIVE_X + layer */
+    if (mShadowMode == ShadowModes::Point)
+    {
+        const cyVec3f directions[6] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+        const cyVec3f ups[6] = {{0, -1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}, {0, -1, 0}, {0, -1, 0}};
+
+        for (int i = 0; i < 6; i++)
+        {
+            mCubeMatrices[i] = mCubeProjection * cyMatrix4f::View(mLight, mLight + directions[i], ups[i]);
+            mCubeFrusta[i].Extract(mCubeMatrices[i]);
+        }
+    }
+
+    if (mShadowMode == ShadowModes::Atlas)
+        UpdateAtlasLights();
+
+    /* Models whose upload finished since the last frame take their place on the ring, sized like the main one */
+    int numStreamed = mNumStreamed.load(std::memory_order_acquire);
+    for (int i = 0; i < numStreamed; i++)
+    {
+        if (mStreamedPlaced[i] || !mStreamed[i]->IsReady())
+            continue;
+
+        cyVec3f size = mStreamed[i]->GetSize();
+        float scale = 0.5f / MAX(size.x, MAX(size.y, size.z));
+        float angle = (float)i / (float)MaxStreamedModels * 2.0f * (float)M_PI;
+
+        mStreamedWorld[i] = cyMatrix4f::Translation({sinf(angle) * 1.4f, 0, cosf(angle) * 1.4f}) *
+                            cyMatrix4f::Scale(scale) * cyMatrix4f::Translation({0, 0.5f, 0}) *
+                            cyMatrix4f::RotationX(-90 * DEG2RAD);
+        mStreamedPlaced[i] = true;
+    }
+}
+
+void Application::EnqueueStreamed(FramePacket &frame, Shader &shader, bool useMaterials, const cyMatrix4f *viewProjection,
+                                  const Frustum *layers, int numLayers, const cyVec3f &viewPosition, float lodScale,
+                                  CullStats &stats)
+{
+    int numStreamed = mNumStreamed.load(std::memory_order_acquire);
+    for (int i = 0; i < numStreamed; i++)
+    {
+        if (!mStreamedPlaced[i])
+            continue;
+
+        cyVec4f p = MatrixMath::Inverse(mStreamedWorld[i]) * cyVec4f(viewPosition, 1);
+        cyVec3f localView = cyVec3f(p.x, p.y, p.z) / p.w;
+
+        if (layers)
+            mStreamed[i]->EnqueueLayered(frame.queue, shader, mStreamedWorld[i], layers, numLayers, localView, lodScale,
+                                         stats);
+        else
+            mStreamed[i]->Enqueue(frame.queue, shader, useMaterials, mStreamedWorld[i],
+                                  Frustum(*viewProjection * mStreamedWorld[i]), localView, lodScale, stats);
+    }
+
+    for (int i = 0; i < mNumPaged; i++)
+    {
+        cyVec4f p = MatrixMath::Inverse(mPagedWorld[i]) * cyVec4f(viewPosition, 1);
+        cyVec3f localView = cyVec3f(p.x, p.y, p.z) / p.w;
+
+        if (layers)
+            mPaged[i]->EnqueueLayered(frame.queue, shader, mPagedWorld[i], layers, numLayers, localView, lodScale, stats);
+        else
+            mPaged[i]->Enqueue(frame.queue, shader, useMaterials, mPagedWorld[i], Frustum(*viewProjection * mPagedWorld[i]),
+                               localView, lodScale, stats);
+    }
+}
+
+cyVec3f Application::ToModelSpace(const cyVec3f &position) const
+{
+    cyVec4f p = MatrixMath::Inverse(mModelWorld) * cyVec4f(position, 1);
+    return cyVec3f(p.x, p.y, p.z) / p.w;
+}
+
+float Application::ShadowLodScale(const cyMatrix4f &projection, int resolution) const
+{
+    /* Shadow maps tolerate a coarser error than the camera, a couple of texels is invisible after filtering */
+    return mUseLods ? projection.cell[5] * (float)resolution * 0.5f / ShadowLodTexels : 0.0f;
+}
+
+void Application::EnqueueCrowd(FramePacket &frame, Shader &shader, bool useMaterials, const Frustum *frusta,
+                               int numFrusta, const cyVec3f &viewPosition, float lodScale, CullStats &stats)
+{
+    /* Crowd frusta and positions are in world space, instance bounds are stored there */
+    int numVisible = mCrowd.Cull(frusta, numFrusta, viewPosition, lodScale, mLodErrors, mNumLodErrors, frame.instances);
+
+    stats.tested += mCrowd.GetCount();
+    stats.visible += numVisible;
+    mModel.EnqueueInstanced(frame.queue, shader, useMaterials, mCrowd, stats);
+}
+
+void Application::UpdateAtlasLights()
+{
+    float time = (float)glfwGetTime();
+    int atlasSize = mShadowAtlas.GetSize(), minTileSize = mShadowAtlas.GetMinTileSize();
+    int sizes[NumAtlasLights];
+    long long area = 0;
+
+    for (int i = 0; i < NumAtlasLights; i++)
+    {
+        ShadowLight &light = mAtlasLights[i];
+
+        float speed = i < 3 ? 0.3f * (float)(i + 1) : 0.0f;
+        float angle = time * speed + (float)i * 2.0f * (float)M_PI / NumAtlasLights;
+        light.position = cyVec3f(sinf(angle) * 2.5f, 1.5f + 0.25f * (float)(i % 3), cosf(angle) * 2.5f);
+        light.view.SetView(light.position, cyVec3f(0, 0, 0), cyVec3f(0, 1, 0));
+        light.projection = mAtlasProjection;
+
+        /* Rough fraction of the screen lit by this light */
+        float distance = (light.position - mCamera).Length();
+        float extent = light.radius * mModelProjection.cell[5] / MAX(distance, light.radius);
+        light.coverage = MIN(1.0f, extent * extent * 0.25f);
+
+        /* Grow the tile right away, but only shrink once it is far too big */
+        int desired = minTileSize;
+        while (desired < atlasSize / 2 && (float)desired < sqrtf(light.coverage) * (float)atlasSize)
+            desired *= 2;
+
+        bool keep = light.hasTile && desired <= light.tile.size && desired * 4 > light.tile.size;
+        sizes[i] = keep ? light.tile.size : desired;
+        area += (long long)sizes[i] * sizes[i];
+    }
+
+    /* Every light has to fit, the ones covering the least of the screen give up resolution first */
+    while (area > (long long)atlasSize * atlasSize)
+    {
+        int smallest = -1;
+        for (int i = 0; i < NumAtlasLights; i++)
+        {
+            if (sizes[i] > minTileSize && (smallest < 0 || mAtlasLights[i].coverage < mAtlasLights[smallest].coverage))
+                smallest = i;
+        }
+
+        if (smallest < 0)
+            break;
+
+        area -= (long long)sizes[smallest] * sizes[smallest] * 3 / 4;
+        sizes[smallest] /= 2;
+    }
+
+    int order[NumAtlasLights];
+    int numChanged = 0;
+    for (int i = 0; i < NumAtlasLights; i++)
+    {
+        ShadowLight &light = mAtlasLights[i];
+        if (light.hasTile && light.tile.size == sizes[i])
+            continue;
+
+        if (light.hasTile)
+            mShadowAtlas.Free(light.tile);
+
+        light.hasTile = false;
+        light.valid = false;
+        order[numChanged++] = i;
+    }
+
+    /* Largest first, so power of two tiles that fit by area also fit in the buddy allocator */
+    auto larger = [&sizes](int a, int b) { return sizes[a] > sizes[b]; };
+    std::sort(order, order + numChanged, larger);
+
+    bool placed = true;
+    for (int i = 0; i < numChanged && placed; i++)
+    {
+        ShadowLight &light = mAtlasLights[order[i]];
+        placed = light.hasTile = mShadowAtlas.Allocate(sizes[order[i]], light.tile);
+    }
+
+    if (placed)
+        return;
+
+    /* The tiles that were kept fragmented the atlas, packing all of them again always fits the plan */
+    for (int i = 0; i < NumAtlasLights; i++)
+    {
+        ShadowLight &light = mAtlasLights[i];
+        if (light.hasTile)
+            mShadowAtlas.Free(light.tile);
+
+        light.hasTile = false;
+        light.valid = false;
+        order[i] = i;
+    }
+
+    std::sort(order, order + NumAtlasLights, larger);
+    for (int i = 0; i < NumAtlasLights; i++)
+    {
+        ShadowLight &light = mAtlasLights[order[i]];
+        light.hasTile = mShadowAtlas.Allocate(sizes[order[i]], light.tile);
+    }
+}
+
+void Application::EnqueueAtlasShadows(FramePacket &frame)
+{
+    /* Only a bounded number of views is refreshed, the rest keep last frame's depth */
+    mNumScheduledLights = mShadowScheduler.Schedule(mAtlasLights, NumAtlasLights, mScheduledLights);
+
+    Shader *depthShader = mCrowdMode ? &mDepthInstancedShader : &mDepthShader;
+
+    for (int i = 0; i < mNumScheduledLights; i++)
+    {
+        ShadowLight &light = mAtlasLights[mScheduledLights[i]];
+        float lodScale = ShadowLodScale(light.projection, light.tile.size);
+        bool first = i == 0, last = i == mNumScheduledLights - 1;
+
+        /* Passes read the packet's copy of the light, it is taken once the whole frame is queued */
+        const ShadowLight *snapshot = &frame.atlasLights[mScheduledLights[i]];
+
+        /* Every tile is its own pass, the atlas is bound by the first and released by the last */
+        frame.queue.BeginPass([this, depthShader, snapshot, first]()
+                              {
+                                  if (first)
+                                  {
+                                      mPassTimers[FrameTimings::Shadow].Begin();
+                                      mShadowAtlas.Begin();
+                                  }
+                                  mShadowAtlas.BeginTile(snapshot->tile);
+                                  depthShader->Use();
+                                  depthShader->UploadUniform("uProjection", snapshot->projection);
+                                  depthShader->UploadUniform("uView", snapshot->view);
+                              },
+                              [this, last]()
+                              {
+                                  if (last)
+                                  {
+                                      mShadowAtlas.End(mWidth, mHeight);
+                                      mPassTimers[FrameTimings::Shadow].End();
+                                  }
+                              });
+
+        if (mCrowdMode)
+        {
+            Frustum frustum(light.projection * light.view);
+            EnqueueCrowd(frame, *depthShader, false, &frustum, 1, light.position, lodScale, frame.shadowStats);
+        }
+        else
+        {
+            mModel.Enqueue(frame.queue, *depthShader, false, mModelWorld,
+                           Frustum(light.projection * light.view * mModelWorld), ToModelSpace(light.position), lodScale,
+                           frame.shadowStats);
+
+            cyMatrix4f lightViewProjection = light.projection * light.view;
+            EnqueueStreamed(frame, *depthShader, false, &lightViewProjection, nullptr, 0, light.position, lodScale,
+                            frame.shadowStats);
+        }
+
+        mShadowScheduler.MarkUpdated(light);
+    }
+}
+
+void Application::BuildFrame(FramePacket &frame)
+{
+    PROFILE_SCOPE("Application::BuildFrame");
+
+    frame.shadowStats = {};
+    frame.cameraStats = {};
+
+    /* Every pass only pushes packets here, they are sorted and recorded together once the frame is complete */
+    frame.queue.Clear();
+    frame.instances.clear();
+
+    const FramePacket *packet = &frame;
+
+    if (mShadowMode == ShadowModes::Point)
+    {
+        /* All six faces in one pass, each mesh only goes to the faces it overlaps */
+        Shader *cubeShader = mCrowdMode ? &mDepthCubeInstancedShader : &mDepthCubeShader;
+        bool crowdMode = mCrowdMode;
+
+        frame.queue.BeginPass([this, packet, cubeShader, crowdMode]()
+                              {
+                                  mPassTimers[FrameTimings::Shadow].Begin();
+                                  mDepthCube.Begin();
+                                  glClear(GL_DEPTH_BUFFER_BIT);
+
+                                  cubeShader->Use();
+                                  cubeShader->UploadUniform("uLayerMatrices", packet->cubeMatrices, 6);
+                                  cubeShader->UploadUniform("uLightPos", packet->light);
+                                  cubeShader->UploadUniform("uCubeFar", mCubeFar);
+
+                                  /* Instances share one draw, so every face is enabled and the geometry shader rejects per layer */
+                                  if (crowdMode)
+                                      cubeShader->UploadUniform("uLayerMask", 0x3f);
+                              },
+                              [this]()
+                              {
+                                  mDepthCube.End(mWidth, mHeight);
+                                  mPassTimers[FrameTimings::Shadow].End();
+                              });
+
+        if (mCrowdMode)
+        {
+            EnqueueCrowd(frame, *cubeShader, false, mCubeFrusta, 6, mLight, ShadowLodScale(mCubeProjection, 512),
+                         frame.shadowStats);
+        }
+        else
+        {
+            mModel.EnqueueLayered(frame.queue, *cubeShader, mModelWorld, mCubeFrusta, 6, ToModelSpace(mLight),
+                                  ShadowLodScale(mCubeProjection, 512), frame.shadowStats);
+            EnqueueStreamed(frame, *cubeShader, false, nullptr, mCubeFrusta, 6, mLight,
+                            ShadowLodScale(mCubeProjection, 512), frame.shadowStats);
+        }
+    }
+    else if (mShadowMode == ShadowModes::Atlas)
+    {
+        EnqueueAtlasShadows(frame);
+    }
+    else
+    {
+        Shader *depthShader = mCrowdMode ? &mDepthInstancedShader : &mDepthShader;
+
+        frame.queue.BeginPass([this, packet, depthShader]()
+                              {
+                                  mPassTimers[FrameTimings::Shadow].Begin();
+                                  mDepthbuffer.Begin();
+                                  glClear(GL_DEPTH_BUFFER_BIT);
+
+                                  depthShader->Use();
+                                  depthShader->UploadUniform("uProjection", mLightProjection);
+                                  depthShader->UploadUniform("uView", packet->lightView);
+                              },
+                              [this]()
+                              {
+                                  mDepthbuffer.End(mWidth, mHeight);
+                                  mPassTimers[FrameTimings::Shadow].End();
+                              });
+
+        if (mCrowdMode)
+        {
+            Frustum frustum(mLightProjection * mLightView);
+            EnqueueCrowd(frame, *depthShader, false, &frustum, 1, mLight, ShadowLodScale(mLightProjection, 1024),
+                         frame.shadowStats);
+        }
+        else
+        {
+            mModel.Enqueue(frame.queue, *depthShader, false, mModelWorld, Frustum(mLightProjection * mLightView * mModelWorld),
+                           ToModelSpace(mLight), ShadowLodScale(mLightProjection, 1024), frame.shadowStats);
+
+            cyMatrix4f lightViewProjection = mLightProjection * mLightView;
+            EnqueueStreamed(frame, *depthShader, false, &lightViewProjection, nullptr, 0, mLight,
+                            ShadowLodScale(mLightProjection, 1024), frame.shadowStats);
+        }
+    }
+
+    Shader *modelShader = &mModelShaders[mShadowMode][mShadowFilter];
+    Shader *instancedShader = mCrowdMode ? &mInstancedShaders[mShadowMode][mShadowFilter] : nullptr;
+    GpuTimer *filterTimer = &mFilterTimers[mShadowMode][mShadowFilter];
+
+    frame.queue.BeginPass([this, packet, modelShader, instancedShader, filterTimer]()
+                          {
+                              glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+                              mPassTimers[FrameTimings::Lit].Begin();
+                              filterTimer->Begin();
+
+                              UploadLitUniforms(*modelShader, *packet);
+                              if (instancedShader)
+                                  UploadLitUniforms(*instancedShader, *packet);
+                          },
+                          [this, filterTimer]()
+                          {
+                              filterTimer->End();
+                              mPassTimers[FrameTimings::Lit].End();
+                          });
+
+    float cameraLodScale = mUseLods ? mModelProjection.cell[5] * (float)mViewHeight * 0.5f / CameraLodPixels : 0.0f;
+    if (mCrowdMode)
+    {
+        Frustum frustum(mModelProjection * mModelView);
+        EnqueueCrowd(frame, *instancedShader, true, &frustum, 1, mCamera, cameraLodScale, frame.cameraStats);
+    }
+    else
+    {
+        mModel.Enqueue(frame.queue, *modelShader, true, mModelWorld, Frustum(mModelProjection * mModelView * mModelWorld),
+                       ToModelSpace(mCamera), cameraLodScale, frame.cameraStats);
+
+        cyMatrix4f viewProjection = mModelProjection * mModelView;
+        EnqueueStreamed(frame, *modelShader, true, &viewProjection, nullptr, 0, mCamera, cameraLodScale,
+                        frame.cameraStats);
+    }
+
+    DrawPacket plane = {};
+    plane.shader = modelShader;
+    plane.mesh = &mPlaneMesh;
+    plane.material = &mPlaneMaterial;
+    plane.model = &mPlaneWorld;
+    plane.layerMask = -1;
+    plane.type = DrawPacket::Arrays;
+    frame.queue.Push(plane, mCamera.Length());
+
+    /* Everything the passes read on the GL thread, taken after scheduling so atlas lights carry this frame's updates */
+    frame.projection = mModelProjection;
+    frame.view = mModelView;
+    frame.lightView = mLightView;
+    for (int i = 0; i < 6; i++)
+        frame.cubeMatrices[i] = mCubeMatrices[i];
+    frame.camera = mCamera;
+    frame.light = mLight;
+    frame.shadowMode = mShadowMode;
+    frame.shadowFilter = mShadowFilter;
+    frame.crowdMode = mCrowdMode;
+    for (int i = 0; i < NumAtlasLights; i++)
+        frame.atlasLights[i] = mAtlasLights[i];
+
+    /* Every pass has asked for its pages by now */
+    for (int i = 0; i < mNumPaged; i++)
+        mPaged[i]->UpdateResidency();
+
+    /* Command recording runs here on the job system, the GL thread only replays the buffers */
+    frame.queue.Record();
 }
 
 void Application::Draw()
 {
-    mDepthbuffer.Begin();
-    glClear(GL_DEPTH_BUFFER_BIT);
+    PROFILE_SCOPE("Application::Draw");
+
+    double frameStart = glfwGetTime();
+    if (mLastFrameTime > 0)
+        Accumulate(mCpuFrameMs, (frameStart - mLastFrameTime) * 1000.0);
+    mLastFrameTime = frameStart;
+    mFrameCount++;
+
+    /* Take the newest packet, the simulation starts on the next one as soon as this one is taken */
+    {
+        PROFILE_SCOPE("Application::WaitForFrame");
+        std::unique_lock<std::mutex> lock(mFrameMutex);
+        mFrameSignal.wait(lock, [this]() { return mPublished > mConsumed; });
+        mFrames.Consume();
+        mConsumed = mPublished;
+    }
+    mFrameSignal.notify_all();
+
+    for (int i = 0; i < mNumPaged; i++)
+        mPaged[i]->Service();
+
+    double drawStart = glfwGetTime();
+    FramePacket &frame = mFrames.GetFront();
+    Accumulate(mCpuUpdateMs, frame.updateMs);
+
+    GLState::BeginFrame();
+    RenderStats::BeginFrame();
+
+    for (int i = 0; i < FrameTimings::NumPasses; i++)
+        mPassTimers[i].Poll();
+
+    for (int mode = 0; mode < ShadowModes::Count; mode++)
+    {
+        for (int i = 0; i < ShadowFilters::Count; i++)
+            mFilterTimers[mode][i].Poll();
+    }
+
+    if (frame.crowdMode)
+        mCrowd.Upload(frame.instances);
+
+    mPassTimers[FrameTimings::Total].Begin();
+    {
+        PROFILE_SCOPE("RenderQueue::Submit");
+        frame.queue.Submit();
+    }
+
+    if (mShowOverlay)
+    {
+        PROFILE_SCOPE("Application::DrawOverlay");
+        mPassTimers[FrameTimings::Overlay].Begin();
+        DrawOverlay(frame);
+        mPassTimers[FrameTimings::Overlay].End();
+    }
+    mPassTimers[FrameTimings::Total].End();
+
+    Accumulate(mCpuDrawMs, (glfwGetTime() - drawStart) * 1000.0);
+}
+
+void Application::DrawOverlay(const FramePacket &frame)
+{
+    static const char *passNames[FrameTimings::NumPasses] = {"Shadow", "Lit", "Overlay", "GPU total"};
+
+    FrameTimings timings = GetFrameTimings();
+    double budget = MAX(16.7, MAX(timings.gpuMs[FrameTimings::Total], timings.cpuFrameMs));
+    char value[64];
+
+    Model::LoadProgress progress = mModel.GetLoadProgress();
+    bool loading = progress.meshes < progress.numMeshes || progress.textures < progress.numTextures;
+
+    int panelHeight = (loading ? 430 : 390) + (mNumPaged ? 40 : 0);
+
+    mOverlay.Begin("Frame", mWidth, MIN(mHeight, panelHeight));
+
+    snprintf(value, sizeof(value), "%.1f", timings.cpuFrameMs > 0 ? 1000.0 / timings.cpuFrameMs : 0.0);
+    mOverlay.Text("FPS", value);
+    mOverlay.Bar("CPU frame", timings.cpuFrameMs, budget);
+    mOverlay.Bar("CPU update", timings.cpuUpdateMs, budget);
+    mOverlay.Bar("CPU draw", timings.cpuDrawMs, budget);
+
+    for (int i = 0; i < FrameTimings::NumPasses; i++)
+        mOverlay.Bar(passNames[i], timings.gpuMs[i], budget);
+
+    mOverlay.Text("Light", ShadowModes::Modes[frame.shadowMode].name);
+    mOverlay.Text("Filter", ShadowFilters::Filters[frame.shadowFilter].name);
+
+    snprintf(value, sizeof(value), "%d", frame.cameraStats.triangles);
+    mOverlay.Text("Camera triangles", value);
+    snprintf(value, sizeof(value), "%d", frame.shadowStats.triangles);
+    mOverlay.Text("Shadow triangles", value);
+    snprintf(value, sizeof(value), "%d", frame.queue.GetStats().packets);
+    mOverlay.Text("Draw packets", value);
+
+    /* Averaged over the window so the numbers hold still long enough to read */
+    RenderStats::Frame average = RenderStats::GetWindowAverage();
+    snprintf(value, sizeof(value), "%lld", average.values[RenderStats::DrawCalls]);
+    mOverlay.Text("Draw calls", value);
+    snprintf(value, sizeof(value), "%lld", average.values[RenderStats::UniformUploads]);
+    mOverlay.Text("Uniform uploads", value);
+    snprintf(value, sizeof(value), "%.1f KB", average.values[RenderStats::BufferBytes] / 1024.0);
+    mOverlay.Text("Buffer uploads", value);
+
+    if (loading)
+    {
+        snprintf(value, sizeof(value), "%d / %d", progress.meshes, progress.numMeshes);
+        mOverlay.Text("Meshes loaded", value);
+        snprintf(value, sizeof(value), "%d / %d", progress.textures, progress.numTextures);
+        mOverlay.Text("Textures loaded", value);
+    }
+
+    if (mNumPaged)
+    {
+        PagedModel::Residency total = {};
+        for (int i = 0; i < mNumPaged; i++)
+        {
+            PagedModel::Residency residency = mPaged[i]->GetResidency();
+            total.residentPages += residency.residentPages;
+            total.numPages += residency.numPages;
+            total.residentBytes += residency.residentBytes;
+            total.budgetBytes += residency.budgetBytes;
+        }
+
+        snprintf(value, sizeof(value), "%d / %d", total.residentPages, total.numPages);
+        mOverlay.Text("Resident pages", value);
+        snprintf(value, sizeof(value), "%.0f / %.0f MB", total.residentBytes / 1048576.0, total.budgetBytes / 1048576.0);
+        mOverlay.Text("Page memory", value);
+    }
+
+    mOverlay.End();
+}
+
+FrameTimings Application::GetFrameTimings() const
+{
+    FrameTimings timings = {};
+
+    for (int i = 0; i < FrameTimings::NumPasses; i++)
+        timings.gpuMs[i] = mPassTimers[i].GetAverageMs();
+
+    timings.cpuFrameMs = mCpuFrameMs;
+    timings.cpuUpdateMs = mCpuUpdateMs;
+    timings.cpuDrawMs = mCpuDrawMs;
+
+    return timings;
+}
+
+bool Application::WriteTimingsJson(const char *fileName) const
+{
+    static const char *passNames[FrameTimings::NumPasses] = {"shadow", "lit", "overlay", "total"};
 
-    mDepthShader.Use();
-    mDepthShader.UploadUniform("uProjection", mLightProjection);
-    mDepthShader.UploadUniform("uView", mLightView);
-    mDepthShader.UploadUniform("uModel", mModelWorld);
-    mModel.Draw(mDepthShader, false);
+    FILE *file = fopen(fileName, "w");
+    if (!file)
+        return false;
 
-    mDepthbuffer.End(mWidth, mHeight);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    FrameTimings timings = GetFrameTimings();
 
-    mModelShader.Use();
-    mModelShader.UploadUniform("uProjection", mModelProjection);
-    mModelShader.UploadUniform("uView", mModelView);
-    mModelShader.UploadUniform("uModel", mModelWorld);
-    mModelShader.UploadUniform("uLightProjection", mLightProjection);
-    mModelShader.UploadUniform("uLightView", mLightView);
-    mModelShader.UploadUniform("uLightTransform", mLightTransform);
-    mModelShader.UploadUniform("uLightPos", mLight);
-    mModelShader.UploadUniform("uViewPos", mCamera);
-    mModelShader.UploadUniform("uShadowMap", 3);
-    mDepthbuffer.GetTexture().Bind(3);
-    mModel.Draw(mModelShader, true);
+    fprintf(file, "{\n  \"frames\": %ld,\n", mFrameCount);
+    fprintf(file, "  \"cpu\": {\"frame_ms\": %.4f, \"update_ms\": %.4f, \"draw_ms\": %.4f},\n", timings.cpuFrameMs,
+            timings.cpuUpdateMs, timings.cpuDrawMs);
 
-    mModelShader.UploadUniform("uModel", mPlaneWorld);
-    mPlaneMesh.Draw(mModelShader, mPlaneMaterial);
+    fprintf(file, "  \"gpu\": {\n");
+    for (int i = 0; i < FrameTimings::NumPasses; i++)
+    {
+        fprintf(file, "    \"%s\": {\"last_ms\": %.4f, \"average_ms\": %.4f, \"samples\": %ld}%s\n", passNames[i],
+                mPassTimers[i].GetLastMs(), mPassTimers[i].GetAverageMs(), mPassTimers[i].GetSamples(),
+                i + 1 < FrameTimings::NumPasses ? "," : "");
+    }
+    fprintf(file, "  },\n");
+
+    fprintf(file, "  \"filters\": [\n");
+    for (int mode = 0; mode < ShadowModes::Count; mode++)
+    {
+        for (int i = 0; i < ShadowFilters::Count; i++)
+        {
+            const GpuTimer &timer = mFilterTimers[mode][i];
+            bool last = mode + 1 == ShadowModes::Count && i + 1 == ShadowFilters::Count;
+
+            fprintf(file, "    {\"light\": \"%s\", \"filter\": \"%s\", \"average_ms\": %.4f, \"samples\": %ld}%s\n",
+                    ShadowModes::Modes[mode].name, ShadowFilters::Filters[i].name, timer.GetAverageMs(),
+                    timer.GetSamples(), last ? "" : ",");
+        }
+    }
+    fprintf(file, "  ]\n}\n");
+
+    fclose(file);
+    return true;
+}
+
+void Application::UploadLitUniforms(Shader &shader, const FramePacket &frame)
+{
+    shader.Use();
+    shader.UploadUniform("uProjection", frame.projection);
+    shader.UploadUniform("uView", frame.view);
+    shader.UploadUniform("uLightProjection", mLightProjection);
+    shader.UploadUniform("uLightView", frame.lightView);
+    shader.UploadUniform("uLightTransform", mLightTransform);
+    shader.UploadUniform("uLightPos", frame.light);
+    shader.UploadUniform("uViewPos", frame.camera);
+    shader.UploadUniform("uShadowMap", 3);
+    shader.UploadUniform("uFilterRadius", 1.5f);
+    shader.UploadUniform("uShadowDepth", 4);
+    shader.UploadUniform("uLightSize", 0.04f);
+    shader.UploadUniform("uLightNear", 1.0f);
+    shader.UploadUniform("uLightFar", 9.0f);
+    shader.UploadUniform("uShadowCube", 5);
+    shader.UploadUniform("uCubeFar", mCubeFar);
+    mDepthCube.GetTexture().Bind(5);
+
+    if (frame.shadowMode == ShadowModes::Atlas)
+    {
+        cyVec3f positions[NumAtlasLights], colors[NumAtlasLights];
+        cyMatrix4f matrices[NumAtlasLights];
+        cyVec4f tiles[NumAtlasLights];
+
+        for (int i = 0; i < NumAtlasLights; i++)
+        {
+            const ShadowLight &light = frame.atlasLights[i];
+            bool shadowed = light.hasTile && light.valid;
+
+            positions[i] = light.position;
+            colors[i] = light.color;
+            matrices[i] = shadowed ? mShadowAtlas.GetTileTransform(light.tile, 0.005f) * light.renderedViewProjection : cyMatrix4f(1);
+            tiles[i] = shadowed ? mShadowAtlas.GetTileRect(light.tile) : cyVec4f(-1, -1, -1, -1);
+        }
+
+        shader.UploadUniform("uLightCount", NumAtlasLights);
+        shader.UploadUniform("uLightPositions", positions, NumAtlasLights);
+        shader.UploadUniform("uLightColors", colors, NumAtlasLights);
+        shader.UploadUniform("uLightMatrices", matrices, NumAtlasLights);
+        shader.UploadUniform("uLightTiles", tiles, NumAtlasLights);
+        mShadowAtlas.GetTexture().Bind(3);
+        mShadowAtlas.GetTexture().BindDepth(4);
+    }
+    else
+    {
+        mDepthbuffer.GetTexture().Bind(3);
+        mDepthbuffer.GetTexture().BindDepth(4);
+    }
+}
+
+void Application::PrintFilterTable() const
+{
+    char line[128];
+    const FramePacket &frame = mFrames.GetFront();
+
+    Utils::Info("Light  Filter     Taps  Blocker taps  Lit pass (ms)  Samples");
+    for (int mode = 0; mode < ShadowModes::Count; mode++)
+    {
+        for (int i = 0; i < ShadowFilters::Count; i++)
+        {
+            const ShadowFilters::Info &filter = ShadowFilters::Filters[i];
+            const GpuTimer &timer = mFilterTimers[mode][i];
+            bool current = mode == frame.shadowMode && i == frame.shadowFilter;
+
+            snprintf(line, sizeof(line), "%-6s %-10s %4d  %12d  %13.3f  %7ld%s", ShadowModes::Modes[mode].name,
+                     filter.name, filter.taps, filter.blockerTaps, timer.GetAverageMs(), timer.GetSamples(),
+                     current ? "  *" : "");
+            Utils::Info(line);
+        }
+    }
+}
+
+void Application::PrintCullStats() const
+{
+    char line[128];
+    const FramePacket &frame = mFrames.GetFront();
+    const CullStats &shadowStats = frame.shadowStats, &cameraStats = frame.cameraStats;
+
+    snprintf(line, sizeof(line), "Shadow pass: %d tested, %d drawn, %d culled, %d non-casting", shadowStats.tested,
+             shadowStats.visible, shadowStats.tested - shadowStats.visible - shadowStats.skipped, shadowStats.skipped);
+    Utils::Info(line);
+
+    snprintf(line, sizeof(line), "Camera pass: %d tested, %d drawn, %d culled", cameraStats.tested, cameraStats.visible,
+             cameraStats.tested - cameraStats.visible);
+    Utils::Info(line);
+
+    const CullStats *passes[2] = {&shadowStats, &cameraStats};
+    const char *names[2] = {"Shadow", "Camera"};
+    for (int i = 0; i < 2; i++)
+    {
+        snprintf(line, sizeof(line), "%s meshlets: %d/%d drawn, %d/%d triangles submitted, %d simplified draws", names[i],
+                 passes[i]->meshletsVisible, passes[i]->meshletsTested, passes[i]->triangles, passes[i]->trianglesTotal,
+                 passes[i]->lodDraws);
+        Utils::Info(line);
+    }
+
+    const QueueStats &queue = frame.queue.GetStats();
+    snprintf(line, sizeof(line), "Render queue: %d packets in %d passes, %d program, %d material, %d transform changes",
+             queue.packets, queue.passes, queue.programChanges, queue.materialChanges, queue.modelChanges);
+    Utils::Info(line);
+}
+
+void Application::PrintStateStats() const
+{
+    char line[128];
+    const GLState::Stats &stats = GLState::GetLastFrameStats();
+    int issued = 0, filtered = 0;
+
+    Utils::Info("GL state        Issued  Filtered");
+    for (int i = 0; i < GLState::Count; i++)
+    {
+        snprintf(line, sizeof(line), "%-14s %7d  %8d", GLState::CategoryNames[i], stats.issued[i], stats.filtered[i]);
+        Utils::Info(line);
+
+        issued += stats.issued[i];
+        filtered += stats.filtered[i];
+    }
+
+    snprintf(line, sizeof(line), "%-14s %7d  %8d", "total", issued, filtered);
+    Utils::Info(line);
+
+    const RenderStats::Frame &last = RenderStats::GetLastFrame();
+    RenderStats::Frame average = RenderStats::GetWindowAverage();
+    RenderStats::Frame maximum = RenderStats::GetWindowMax();
+
+    snprintf(line, sizeof(line), "%-21s %10s %10s %10s", "GL work", "last", "average", "max");
+    Utils::Info(line);
+    for (int i = 0; i < RenderStats::Count; i++)
+    {
+        snprintf(line, sizeof(line), "%-21s %10lld %10lld %10lld", RenderStats::CounterNames[i], last.values[i],
+                 average.values[i], maximum.values[i]);
+        Utils::Info(line);
+    }
 }
 
-void Application::KeyCallback(GLFWwindow *, int key, int, int action, int)
+void Application::KeyCallback(GLFWwindow *handle, int key, int, int action, int)
 {
-    if (key == GLFW_KEY_ESCAPE && action == GLFW_RELEASE)
-        Utils::Error(0, "Exiting");
+    void *p = glfwGetWindowUserPointer(handle);
+    if (!p) return;
+
+    auto *pApp = (Application *)p;
+
+    if (action != GLFW_RELEASE)
+        return;
+
+    /* Settings the simulation reads go through the input block, it picks them up on its next frame */
+    std::unique_lock<std::mutex> lock(pApp->mInputMutex);
+    Input &input = pApp->mInput;
+
+    if (key == GLFW_KEY_F)
+    {
+        input.shadowFilter = (input.shadowFilter + 1) % ShadowFilters::Count;
+        Utils::Info(ShadowFilters::Filters[input.shadowFilter].name);
+    }
+
+    if (key == GLFW_KEY_L)
+    {
+        input.shadowMode = (input.shadowMode + 1) % ShadowModes::Count;
+        Utils::Info(ShadowModes::Modes[input.shadowMode].name);
+    }
+
+    if (key == GLFW_KEY_B)
+    {
+        input.coneCulling = !input.coneCulling;
+        Utils::Info(input.coneCulling ? "Cone culling on" : "Cone culling off");
+    }
+
+    if (key == GLFW_KEY_I)
+    {
+        input.crowdMode = !input.crowdMode;
+        Utils::Info(input.crowdMode ? "Crowd on" : "Crowd off");
+    }
+
+    if (key == GLFW_KEY_O)
+    {
+        input.useLods = !input.useLods;
+        Utils::Info(input.useLods ? "LODs on" : "LODs off");
+    }
+
+    lock.unlock();
+
+    if (key == GLFW_KEY_T)
+        pApp->PrintFilterTable();
+
+    if (key == GLFW_KEY_C)
+        pApp->PrintCullStats();
+
+    if (key == GLFW_KEY_G)
+        pApp->PrintStateStats();
+
+    if (key == GLFW_KEY_M)
+        Resources::PrintTopConsumers(15);
+
+    if (key == GLFW_KEY_K)
+    {
+        if (Profiler::WriteChromeTrace("profile_trace.json"))
+            Utils::Info("Wrote profile_trace.json");
+        else
+            Utils::Warning("Unable to write profile_trace.json");
+    }
+
+    if (key == GLFW_KEY_P)
+        pApp->mShowOverlay = !pApp->mShowOverlay;
+
+    /* Leave through the main loop so timings get written and everything is destroyed with a live context */
+    if (key == GLFW_KEY_ESCAPE)
+    {
+        pApp->PrintFilterTable();
+        glfwSetWindowShouldClose(handle, GLFW_TRUE);
+    }
 }
 
 void Application::ResizeCallback(GLFWwindow *handle, int width, int height)
@@ -125,8 +1158,14 @@ void Application::ResizeCallback(GLFWwindow *handle, int width, int height)
 
     auto *pApp = (Application *)p;
 
-    glViewport(0, 0, width, height);
-    pApp->mModelProjection.SetPerspective(45.0f, (float)width / (float)height, 0.01f, 1000.0f);
+    pApp->mWidth = width;
+    pApp->mHeight = height;
+
+    GLState::Viewport(0, 0, width, height);
+
+    std::lock_guard<std::mutex> lock(pApp->mInputMutex);
+    pApp->mInput.projection.SetPerspective(45.0f, (float)width / (float)height, 0.01f, 1000.0f);
+    pApp->mInput.height = height;
 }
 
 void Application::CursorPosCallback(GLFWwindow *handle, double x, double y)
@@ -136,9 +1175,10 @@ void Application::CursorPosCallback(GLFWwindow *handle, double x, double y)
 
     auto *pApp = (Application *)p;
 
-    pApp->mPrevMouse = pApp->mMouse;
-    pApp->mMouse.x = x;
-    pApp->mMouse.y = y;
+    std::lock_guard<std::mutex> lock(pApp->mInputMutex);
+    pApp->mInput.prevMouse = pApp->mInput.mouse;
+    pApp->mInput.mouse.x = x;
+    pApp->mInput.mouse.y = y;
 }
 
 void Application::MouseButtonCallback(GLFWwindow *handle, int button, int action, int)
@@ -148,9 +1188,11 @@ void Application::MouseButtonCallback(GLFWwindow *handle, int button, int action
 
     auto *pApp = (Application *)p;
 
+    std::lock_guard<std::mutex> lock(pApp->mInputMutex);
+
     if (button == GLFW_MOUSE_BUTTON_LEFT)
-        pApp->mMouseLeftDown = action;
+        pApp->mInput.leftDown = action;
 
     if (button == GLFW_MOUSE_BUTTON_RIGHT)
-        pApp->mMouseRightDown = action;
+        pApp->mInput.rightDown = action;
 }
@@ -0,0 +1,189 @@
+#include "commandbuffer.h"
+#include "mesh.h"
+#include "renderstats.h"
+
+#include <glad/glad.h>
+
+CommandBuffer::Command &CommandBuffer::Append(Op op)
+{
+    mCommands.push_back(Command());
+
+    Command &command = mCommands.back();
+    command.op = op;
+    command.location = -1;
+    command.first = 0;
+    command.count = 0;
+    command.instances = 0;
+    command.buffer = 0;
+    command.shader = nullptr;
+    command.mesh = nullptr;
+    command.texture = nullptr;
+    return command;
+}
+
+void CommandBuffer::Clear()
+{
+    mCommands.clear();
+    mValues.clear();
+    mRangeFirsts.clear();
+    mRangeCounts.clear();
+}
+
+void CommandBuffer::Use(Shader &shader)
+{
+    Append(ProgramBind).shader = &shader;
+}
+
+void CommandBuffer::Bind(unsigned int unit, const Texture &texture)
+{
+    Command &command = Append(TextureBind);
+    command.location = (int)unit;
+    command.texture = &texture;
+}
+
+void CommandBuffer::Uniform(int location, int value)
+{
+    if (location == -1)
+        return;
+
+    Command &command = Append(Int);
+    command.location = location;
+    command.count = value;
+}
+
+void CommandBuffer::Uniform(int location, float value)
+{
+    if (location == -1)
+        return;
+
+    Command &command = Append(Float);
+    command.location = location;
+    command.first = (int)mValues.size();
+    mValues.push_back(value);
+}
+
+void CommandBuffer::Uniform(int location, const cyVec3f &value)
+{
+    if (location == -1)
+        return;
+
+    Command &command = Append(Vec3);
+    command.location = location;
+    command.first = (int)mValues.size();
+    mValues.insert(mValues.end(), &value.x, &value.x + 3);
+}
+
+void CommandBuffer::Uniform(int location, const cyMatrix4f &value)
+{
+    if (location == -1)
+        return;
+
+    Command &command = Append(Matrix);
+    command.location = location;
+    command.first = (int)mValues.size();
+    mValues.insert(mValues.end(), value.cell, value.cell + 16);
+}
+
+void CommandBuffer::Instances(const Mesh &mesh, unsigned int buffer, int firstInstance)
+{
+    Command &command = Append(InstanceBind);
+    command.mesh = &mesh;
+    command.buffer = buffer;
+    command.instances = firstInstance;
+}
+
+void CommandBuffer::Draw(const Mesh &mesh, Shader &shader, int numInstances)
+{
+    Command &command = Append(Arrays);
+    command.mesh = &mesh;
+    command.shader = &shader;
+    command.instances = numInstances;
+}
+
+void CommandBuffer::DrawRanges(const Mesh &mesh, Shader &shader, const int *firsts, const int *counts, int numRanges)
+{
+    // Copied so the buffer stays valid after the queue that owned the ranges is cleared
+    Command &command = Append(Ranges);
+    command.mesh = &mesh;
+    command.shader = &shader;
+    command.first = (int)mRangeFirsts.size();
+    command.count = numRanges;
+
+    mRangeFirsts.insert(mRangeFirsts.end(), firsts, firsts + numRanges);
+    mRangeCounts.insert(mRangeCounts.end(), counts, counts + numRanges);
+}
+
+void CommandBuffer::DrawElements(const Mesh &mesh, Shader &shader, int firstIndex, int numIndices, int numInstances)
+{
+    Command &command = Append(Elements);
+    command.mesh = &mesh;
+    command.shader = &shader;
+    command.first = firstIndex;
+    command.count = numIndices;
+    command.instances = numInstances;
+}
+
+void CommandBuffer::Replay() const
+{
+    for (const Command &command : mCommands)
+    {
+        switch (command.op)
+        {
+            case ProgramBind:
+                command.shader->Use();
+                break;
+
+            case TextureBind:
+                command.texture->Bind((unsigned int)command.location);
+                break;
+
+            case Int:
+                glUniform1i(command.location, command.count);
+                RenderStats::Add(RenderStats::UniformUploads);
+                break;
+
+            case Float:
+                glUniform1f(command.location, mValues[command.first]);
+                RenderStats::Add(RenderStats::UniformUploads);
+                break;
+
+            case Vec3:
+                glUniform3fv(command.location, 1, &mValues[command.first]);
+                RenderStats::Add(RenderStats::UniformUploads);
+                break;
+
+            case Matrix:
+                glUniformMatrix4fv(command.location, 1, false, &mValues[command.first]);
+                RenderStats::Add(RenderStats::UniformUploads);
+                break;
+
+            case InstanceBind:
+                command.mesh->BindInstances(command.buffer, command.instances);
+                break;
+
+            case Arrays:
+                if (command.instances)
+                    command.mesh->DrawInstanced(*command.shader, command.instances);
+                else
+                    command.mesh->Draw(*command.shader);
+                break;
+
+            case Ranges:
+                command.mesh->DrawRanges(*command.shader, &mRangeFirsts[command.first], &mRangeCounts[command.first],
+                                         command.count);
+                break;
+
+            case Elements:
+                if (command.instances)
+                    command.mesh->DrawElementsInstanced(*command.shader, command.first, command.count, command.instances);
+                else
+                    command.mesh->DrawElements(*command.shader, command.first, command.count);
+                break;
+        }
+    }
+}
+
+int CommandBuffer::GetCount() const
+{
+    return (int)mCommands.size();
+}
@@ -1,6 +1,9 @@
 #include "framebuffer.h"
+#include "glstate.h"
+#include "resources.h"
 
 #include <glad/glad.h>
+#include <string>
 
 Framebuffer::Framebuffer()
     : mFramebufferID(0), mTexture(), mDepthbufferID(0), mWidth(0), mHeight(0)
@@ -10,8 +13,13 @@ Framebuffer::Framebuffer()
 
 Framebuffer::~Framebuffer()
 {
+    Resources::Release(Resources::Renderbuffers, this);
+
     if (mFramebufferID)
+    {
+        GLState::ForgetFramebuffer(mFramebufferID);
         glDeleteFramebuffers(1, &mFramebufferID);
+    }
 
     if (mDepthbufferID)
         glDeleteRenderbuffers(1, &mDepthbufferID);
@@ -23,15 +31,18 @@ bool Framebuffer::Create(int width, int height, bool depth)
     mHeight = height;
 
     glGenFramebuffers(1, &mFramebufferID);
-    glBindFramebuffer(GL_FRAMEBUFFER, mFramebufferID);
+    GLState::BindFramebuffer(mFramebufferID);
 
     mTexture.LoadFromData(mWidth, mHeight, 3, nullptr);
+    Resources::SetLabel(Resources::Textures, &mTexture,
+                        "framebuffer color " + std::to_string(width) + "x" + std::to_string(height));
 
     if (depth)
     {
         glGenRenderbuffers(1, &mDepthbufferID);
         glBindRenderbuffer(GL_RENDERBUFFER, mDepthbufferID);
         glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, mWidth, mHeight);
+        Resources::Track(Resources::Renderbuffers, this, Resources::TextureBytes(mWidth, mHeight, 4), "framebuffer depth");
 
         glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, mDepthbufferID);
     }
@@ -44,7 +55,7 @@ bool Framebuffer::Create(int width, int height, bool depth)
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
         return false;
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    GLState::BindFramebuffer(0);
 
     return true;
 }
@@ -55,12 +66,38 @@ bool Framebuffer::CreateDepthOnly(int width, int height)
     mHeight = height;
 
     glGenFramebuffers(1, &mFramebufferID);
-    glBindFramebuffer(GL_FRAMEBUFFER, mFramebufferID);
+    GLState::BindFramebuffer(mFramebufferID);
 
     mTexture.LoadDepthFromData(mWidth, mHeight, nullptr);
-    mDepthbufferID = mTexture.GetID();
+    Resources::SetLabel(Resources::Textures, &mTexture, "shadow map " + std::to_string(width) + "x" + std::to_string(height));
+
+    // The texture owns the depth storage, mDepthbufferID stays 0 so the destructor leaves it to the texture
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mTexture.GetID(), 0);
+
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        return false;
+
+    GLState::BindFramebuffer(0);
+
+    return true;
+}
+
+bool Framebuffer::CreateDepthCube(int size)
+{
+    mWidth = size;
+    mHeight = size;
+
+    glGenFramebuffers(1, &mFramebufferID);
+    GLState::BindFramebuffer(mFramebufferID);
+
+    mTexture.LoadDepthCubemap(size);
+    Resources::SetLabel(Resources::Textures, &mTexture, "shadow cube " + std::to_string(size));
 
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mDepthbufferID, 0);
+    // Layered attachment, the geometry shader picks the face with gl_Layer
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mTexture.GetID(), 0);
 
     glDrawBuffer(GL_NONE);
     glReadBuffer(GL_NONE);
@@ -68,21 +105,21 @@ bool Framebuffer::CreateDepthOnly(int width, int height)
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
         return false;
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    GLState::BindFramebuffer(0);
 
     return true;
 }
 
 void Framebuffer::Begin() const
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, mFramebufferID);
-    glViewport(0, 0, mWidth, mHeight);
+    GLState::BindFramebuffer(mFramebufferID);
+    GLState::Viewport(0, 0, mWidth, mHeight);
 }
 
 void Framebuffer::End(int width, int height)
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glViewport(0, 0, width, height);
+    GLState::BindFramebuffer(0);
+    GLState::Viewport(0, 0, width, height);
 }
 
 Texture &Framebuffer::GetTexture()
@@ -0,0 +1,155 @@
+#include "frustum.h"
+
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64)
+#include <xmmintrin.h>
+#define FRUSTUM_SSE
+#endif
+
+Bounds Bounds::Transform(const cyMatrix4f &matrix) const
+{
+    // Transform the center and grow the extent by the absolute rotation/scale part
+    cyVec3f center = (min + max) * 0.5f;
+    cyVec3f extent = (max - min) * 0.5f;
+
+    const float *m = matrix.cell;
+
+    cyVec3f newCenter(m[0] * center.x + m[4] * center.y + m[8] * center.z + m[12],
+                      m[1] * center.x + m[5] * center.y + m[9] * center.z + m[13],
+                      m[2] * center.x + m[6] * center.y + m[10] * center.z + m[14]);
+
+    cyVec3f newExtent(fabsf(m[0]) * extent.x + fabsf(m[4]) * extent.y + fabsf(m[8]) * extent.z,
+                      fabsf(m[1]) * extent.x + fabsf(m[5]) * extent.y + fabsf(m[9]) * extent.z,
+                      fabsf(m[2]) * extent.x + fabsf(m[6]) * extent.y + fabsf(m[10]) * extent.z);
+
+    Bounds result;
+    result.min = newCenter - newExtent;
+    result.max = newCenter + newExtent;
+    return result;
+}
+
+Frustum::Frustum(const cyMatrix4f &viewProjection)
+{
+    Extract(viewProjection);
+}
+
+void Frustum::Extract(const cyMatrix4f &viewProjection)
+{
+    const float *m = viewProjection.cell;
+
+    cyVec4f row0(m[0], m[4], m[8], m[12]);
+    cyVec4f row1(m[1], m[5], m[9], m[13]);
+    cyVec4f row2(m[2], m[6], m[10], m[14]);
+    cyVec4f row3(m[3], m[7], m[11], m[15]);
+
+    mPlanes[0] = row3 + row0;   // left
+    mPlanes[1] = row3 - row0;   // right
+    mPlanes[2] = row3 + row1;   // bottom
+    mPlanes[3] = row3 - row1;   // top
+    mPlanes[4] = row3 + row2;   // near
+    mPlanes[5] = row3 - row2;   // far
+
+    for (int i = 0; i < 6; i++)
+    {
+        float length = sqrtf(mPlanes[i].x * mPlanes[i].x + mPlanes[i].y * mPlanes[i].y + mPlanes[i].z * mPlanes[i].z);
+        mPlanes[i] /= length;
+    }
+}
+
+bool Frustum::TestBox(const Bounds &bounds) const
+{
+    for (int i = 0; i < 6; i++)
+    {
+        const cyVec4f &plane = mPlanes[i];
+
+        // Corner furthest along the plane normal
+        float x = plane.x > 0 ? bounds.max.x : bounds.min.x;
+        float y = plane.y > 0 ? bounds.max.y : bounds.min.y;
+        float z = plane.z > 0 ? bounds.max.z : bounds.min.z;
+
+        if (plane.x * x + plane.y * y + plane.z * z + plane.w < 0)
+            return false;
+    }
+
+    return true;
+}
+
+bool Frustum::TestSphere(const cyVec3f &center, float radius) const
+{
+    for (int i = 0; i < 6; i++)
+    {
+        const cyVec4f &plane = mPlanes[i];
+
+        if (plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w < -radius)
+            return false;
+    }
+
+    return true;
+}
+
+int Frustum::TestBoxes(const float *minX, const float *minY, const float *minZ,
+                       const float *maxX, const float *maxY, const float *maxZ, int count, unsigned char *visible) const
+{
+    int numVisible = 0;
+    int i = 0;
+
+#ifdef FRUSTUM_SSE
+    // Four boxes per iteration, the plane is shared so the corner selection is per axis, not per lane
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+
+        for (int p = 0; p < 6; p++)
+        {
+            const cyVec4f &plane = mPlanes[p];
+
+            __m128 x = _mm_loadu_ps((plane.x > 0 ? maxX : minX) + i);
+            __m128 y = _mm_loadu_ps((plane.y > 0 ? maxY : minY) + i);
+            __m128 z = _mm_loadu_ps((plane.z > 0 ? maxZ : minZ) + i);
+
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+                                         _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_setzero_ps()));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (int j = 0; j < 4; j++)
+        {
+            visible[i + j] = (unsigned char)((mask >> j) & 1);
+            numVisible += visible[i + j];
+        }
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        Bounds bounds;
+        bounds.min = cyVec3f(minX[i], minY[i], minZ[i]);
+        bounds.max = cyVec3f(maxX[i], maxY[i], maxZ[i]);
+
+        visible[i] = (unsigned char)TestBox(bounds);
+        numVisible += visible[i];
+    }
+
+    return numVisible;
+}
+
+const cyVec4f &Frustum::GetPlane(int i) const
+{
+    return mPlanes[i];
+}
+
+unsigned int Frustum::FaceMask(const Frustum *frusta, int count, const Bounds &bounds)
+{
+    unsigned int mask = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (frusta[i].TestBox(bounds))
+            mask |= 1u << i;
+    }
+
+    return mask;
+}
@@ -0,0 +1,161 @@
+#include "geometry.h"
+#include "utils.h"
+#include "profiler.h"
+#include "jobsystem.h"
+
+#include <cmath>
+#include <mutex>
+#include <vector>
+
+const char *Geometry::WeightingNames[Geometry::Count] = {"area", "angle"};
+
+namespace
+{
+    // Below this many items per batch the job overhead is larger than the work
+    const int MinItemsPerBatch = 16384;
+
+    bool RunsParallel(int count, int numThreads)
+    {
+        return numThreads > 1 && !JobSystem::IsSingleThreaded() && count >= MinItemsPerBatch * 2;
+    }
+
+    template<typename Function>
+    void ParallelFor(const char *name, int count, int numThreads, const Function &function)
+    {
+        if (RunsParallel(count, numThreads))
+            JobSystem::ParallelFor(name, count, MinItemsPerBatch, function);
+        else
+            function(0, count);
+    }
+
+    float CornerAngle(const cyVec3f &corner, const cyVec3f &a, const cyVec3f &b)
+    {
+        cyVec3f u = a - corner, v = b - corner;
+        float lengths = u.Length() * v.Length();
+        if (lengths <= 0)
+            return 0;
+
+        float cosine = u.Dot(v) / lengths;
+        return acosf(MAX(-1.0f, MIN(1.0f, cosine)));
+    }
+}
+
+int Geometry::DefaultThreads()
+{
+    return JobSystem::GetThreadCount();
+}
+
+void Geometry::ComputeNormals(const cyVec3f *positions, int numVertices, const cyTriMesh::TriFace *faces, int numFaces,
+                              Weighting weighting, int numThreads, cyVec3f *normals)
+{
+    PROFILE_SCOPE("Geometry::ComputeNormals");
+
+    // Weighted face normal per face for area weighting, per corner for angle weighting
+    int perFace = weighting == Area ? 1 : 3;
+    std::vector<cyVec3f> weighted((size_t)numFaces * perFace);
+
+    ParallelFor("Face normals", numFaces, numThreads, [&](int first, int last)
+    {
+        for (int i = first; i < last; i++)
+        {
+            const cyVec3f &a = positions[faces[i].v[0]];
+            const cyVec3f &b = positions[faces[i].v[1]];
+            const cyVec3f &c = positions[faces[i].v[2]];
+            cyVec3f n = (b - a) ^ (c - a);
+
+            if (weighting == Area)
+            {
+                weighted[i] = n;
+                continue;
+            }
+
+            float length = n.Length();
+            n = length > 0 ? n / length : cyVec3f(0, 0, 0);
+            weighted[(size_t)i * 3 + 0] = n * CornerAngle(a, b, c);
+            weighted[(size_t)i * 3 + 1] = n * CornerAngle(b, c, a);
+            weighted[(size_t)i * 3 + 2] = n * CornerAngle(c, a, b);
+        }
+    });
+
+    const unsigned int *indices = numFaces ? faces[0].v : nullptr;
+
+    // One thread gains nothing from the adjacency table, scattering straight into the normals is cheaper
+    if (!RunsParallel(numVertices, numThreads))
+    {
+        for (int v = 0; v < numVertices; v++)
+            normals[v].Set(0, 0, 0);
+        for (int i = 0; i < numFaces * 3; i++)
+            normals[indices[i]] += weighted[(size_t)(perFace == 1 ? i / 3 : i)];
+        for (int v = 0; v < numVertices; v++)
+        {
+            float length = normals[v].Length();
+            normals[v] = length > 0 ? normals[v] / length : cyVec3f(0, 0, 0);
+        }
+        return;
+    }
+
+    // Vertex to face or corner table in CSR form, filled in face order so the sums match the serial loop
+    std::vector<int> offsets((size_t)numVertices + 1, 0);
+    std::vector<int> adjacency((size_t)numFaces * 3);
+
+    for (int i = 0; i < numFaces * 3; i++)
+        offsets[indices[i] + 1]++;
+    for (int v = 0; v < numVertices; v++)
+        offsets[v + 1] += offsets[v];
+
+    std::vector<int> cursor(offsets.begin(), offsets.end() - 1);
+    for (int i = 0; i < numFaces * 3; i++)
+        adjacency[cursor[indices[i]]++] = perFace == 1 ? i / 3 : i;
+
+    ParallelFor("Vertex normals", numVertices, numThreads, [&](int first, int last)
+    {
+        for (int v = first; v < last; v++)
+        {
+            cyVec3f sum(0, 0, 0);
+            for (int k = offsets[v]; k < offsets[v + 1]; k++)
+                sum += weighted[adjacency[k]];
+
+            float length = sum.Length();
+            normals[v] = length > 0 ? sum / length : cyVec3f(0, 0, 0);
+        }
+    });
+}
+
+void Geometry::ComputeNormals(cyTriMesh &mesh, Weighting weighting, int numThreads)
+{
+    int numFaces = (int)mesh.NF();
+    int numVertices = (int)mesh.NV();
+
+    mesh.SetNumNormals((unsigned int)numVertices);
+    if (!numVertices || !numFaces)
+        return;
+
+    ComputeNormals(&mesh.V(0), numVertices, &mesh.F(0), numFaces, weighting, numThreads, &mesh.VN(0));
+
+    for (int i = 0; i < numFaces; i++)
+        mesh.FN(i) = mesh.F(i);
+}
+
+Bounds Geometry::ComputeBounds(const Vec3Buffer &positions, int numThreads)
+{
+    PROFILE_SCOPE("Geometry::ComputeBounds");
+
+    int count = positions.GetCount();
+    Bounds bounds = positions.ComputeBounds(0, MIN(count, 1));
+    std::mutex mutex;
+
+    // Each batch reduces its own range with the SIMD kernel, the few partial boxes are merged under the lock
+    ParallelFor("Bounds", count, numThreads, [&](int first, int last)
+    {
+        if (last <= first)
+            return;
+
+        Bounds partial = positions.ComputeBounds(first, last - first);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        bounds.min.Set(MIN(bounds.min.x, partial.min.x), MIN(bounds.min.y, partial.min.y), MIN(bounds.min.z, partial.min.z));
+        bounds.max.Set(MAX(bounds.max.x, partial.max.x), MAX(bounds.max.y, partial.max.y), MAX(bounds.max.z, partial.max.z));
+    });
+
+    return bounds;
+}
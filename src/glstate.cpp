@@ -0,0 +1,235 @@
+#include "glstate.h"
+#include "renderstats.h"
+
+#include <cstring>
+#include <glad/glad.h>
+
+namespace
+{
+    // Capabilities the cache tracks, anything else goes straight to GL
+    const unsigned int TrackedCapabilities[] = {GL_DEPTH_TEST, GL_MULTISAMPLE, GL_SCISSOR_TEST, GL_CULL_FACE, GL_BLEND};
+    const int NumCapabilities = sizeof(TrackedCapabilities) / sizeof(TrackedCapabilities[0]);
+
+    // Texture targets with a slot per unit, others are always issued
+    const unsigned int Targets[] = {GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP};
+    const int NumTargets = sizeof(Targets) / sizeof(Targets[0]);
+
+    // Values that can never be a real binding, so the first call after Invalidate always goes through
+    const unsigned int Unknown = 0xffffffffu;
+
+    struct State
+    {
+        unsigned int program;
+        unsigned int vertexArray;
+        unsigned int activeUnit;
+        unsigned int textures[GLState::MaxTextureUnits][NumTargets];
+        unsigned int samplers[GLState::MaxTextureUnits];
+        unsigned int framebuffer;
+        int viewport[4];
+        int scissor[4];
+        int capabilities[NumCapabilities];  // -1 unknown, 0 disabled, 1 enabled
+    };
+
+    // Every thread with a context of its own keeps its own copy, the main context's is the one that matters
+    thread_local State state;
+    thread_local GLState::Stats current = {};
+    thread_local bool initialized = false;
+    GLState::Stats lastFrame = {};
+
+    void Reset()
+    {
+        memset(&state, 0xff, sizeof(state));
+        for (int i = 0; i < NumCapabilities; i++)
+            state.capabilities[i] = -1;
+        initialized = true;
+    }
+
+    bool Changed(GLState::Category category, bool changed)
+    {
+        if (!initialized)
+            Reset();
+
+        if (changed)
+            current.issued[category]++;
+        else
+            current.filtered[category]++;
+
+        return changed;
+    }
+
+    int FindTarget(unsigned int target)
+    {
+        for (int i = 0; i < NumTargets; i++)
+        {
+            if (Targets[i] == target)
+                return i;
+        }
+        return -1;
+    }
+
+    int FindCapability(unsigned int capability)
+    {
+        for (int i = 0; i < NumCapabilities; i++)
+        {
+            if (TrackedCapabilities[i] == capability)
+                return i;
+        }
+        return -1;
+    }
+
+    void SetCapability(unsigned int capability, bool enabled)
+    {
+        int index = FindCapability(capability);
+
+        if (!Changed(GLState::Capabilities, index < 0 || state.capabilities[index] != (enabled ? 1 : 0)))
+            return;
+
+        if (index >= 0)
+            state.capabilities[index] = enabled ? 1 : 0;
+
+        if (enabled)
+            glEnable(capability);
+        else
+            glDisable(capability);
+    }
+}
+
+const char *GLState::CategoryNames[GLState::Count] = {"program", "vertex array", "active texture", "texture", "sampler",
+                                                      "framebuffer", "viewport", "scissor", "capability"};
+
+void GLState::UseProgram(unsigned int program)
+{
+    if (!Changed(Programs, state.program != program))
+        return;
+
+    state.program = program;
+    glUseProgram(program);
+    RenderStats::Add(RenderStats::ProgramSwitches);
+}
+
+void GLState::BindVertexArray(unsigned int vertexArray)
+{
+    if (!Changed(VertexArrays, state.vertexArray != vertexArray))
+        return;
+
+    state.vertexArray = vertexArray;
+    glBindVertexArray(vertexArray);
+}
+
+void GLState::BindTexture(unsigned int unit, unsigned int target, unsigned int texture)
+{
+    int index = FindTarget(target);
+    bool cached = unit < (unsigned int)MaxTextureUnits && index >= 0;
+
+    if (!Changed(Textures, !cached || state.textures[unit][index] != texture))
+        return;
+
+    if (Changed(ActiveTextures, state.activeUnit != unit))
+    {
+        state.activeUnit = unit;
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    if (cached)
+        state.textures[unit][index] = texture;
+    glBindTexture(target, texture);
+    RenderStats::Add(RenderStats::TextureBinds);
+}
+
+void GLState::BindSampler(unsigned int unit, unsigned int sampler)
+{
+    bool cached = unit < (unsigned int)MaxTextureUnits;
+
+    if (!Changed(Samplers, !cached || state.samplers[unit] != sampler))
+        return;
+
+    if (cached)
+        state.samplers[unit] = sampler;
+    glBindSampler(unit, sampler);
+}
+
+void GLState::BindFramebuffer(unsigned int framebuffer)
+{
+    if (!Changed(Framebuffers, state.framebuffer != framebuffer))
+        return;
+
+    state.framebuffer = framebuffer;
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    RenderStats::Add(RenderStats::FramebufferSwitches);
+}
+
+void GLState::Viewport(int x, int y, int width, int height)
+{
+    int *v = state.viewport;
+    if (!Changed(Viewports, v[0] != x || v[1] != y || v[2] != width || v[3] != height))
+        return;
+
+    v[0] = x; v[1] = y; v[2] = width; v[3] = height;
+    glViewport(x, y, width, height);
+}
+
+void GLState::Scissor(int x, int y, int width, int height)
+{
+    int *s = state.scissor;
+    if (!Changed(Scissors, s[0] != x || s[1] != y || s[2] != width || s[3] != height))
+        return;
+
+    s[0] = x; s[1] = y; s[2] = width; s[3] = height;
+    glScissor(x, y, width, height);
+}
+
+void GLState::Enable(unsigned int capability)
+{
+    SetCapability(capability, true);
+}
+
+void GLState::Disable(unsigned int capability)
+{
+    SetCapability(capability, false);
+}
+
+void GLState::ForgetProgram(unsigned int program)
+{
+    if (state.program == program)
+        state.program = Unknown;
+}
+
+void GLState::ForgetVertexArray(unsigned int vertexArray)
+{
+    if (state.vertexArray == vertexArray)
+        state.vertexArray = Unknown;
+}
+
+void GLState::ForgetTexture(unsigned int texture)
+{
+    for (int unit = 0; unit < MaxTextureUnits; unit++)
+    {
+        for (int i = 0; i < NumTargets; i++)
+        {
+            if (state.textures[unit][i] == texture)
+                state.textures[unit][i] = Unknown;
+        }
+    }
+}
+
+void GLState::ForgetFramebuffer(unsigned int framebuffer)
+{
+    if (state.framebuffer == framebuffer)
+        state.framebuffer = Unknown;
+}
+
+void GLState::Invalidate()
+{
+    Reset();
+}
+
+void GLState::BeginFrame()
+{
+    lastFrame = current;
+    current = {};
+}
+
+const GLState::Stats &GLState::GetLastFrameStats()
+{
+    return lastFrame;
+}
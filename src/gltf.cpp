@@ -0,0 +1,763 @@
+#include "gltf.h"
+#include "utils.h"
+#include "profiler.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const unsigned int GlbMagic = 0x46546c67; // "glTF"
+static const unsigned int JsonChunk = 0x4e4f534a; // "JSON"
+static const unsigned int BinaryChunk = 0x004e4942; // "BIN\0"
+
+static const int Triangles = 4;
+
+namespace
+{
+    // Just enough JSON for the glTF header chunk, which is small next to the geometry it describes
+    struct Json
+    {
+        enum Type
+        {
+            Null, Bool, Number, String, Array, Object
+        };
+
+        Type type = Null;
+        double number = 0;
+        std::string string;
+        std::vector<Json> items;
+        std::vector<std::string> keys;
+
+        const Json *Find(const char *key) const
+        {
+            for (size_t i = 0; i < keys.size(); i++)
+            {
+                if (keys[i] == key)
+                    return &items[i];
+            }
+            return nullptr;
+        }
+
+        const Json *At(int index) const
+        {
+            return type == Array && index >= 0 && index < (int)items.size() ? &items[index] : nullptr;
+        }
+
+        double GetNumber(const char *key, double fallback) const
+        {
+            const Json *value = Find(key);
+            return value && value->type == Number ? value->number : fallback;
+        }
+
+        // Clamped before the cast, an out of range double is undefined behaviour there. Clamped values fail any
+        // later size check, NaN gets the fallback
+        int GetInt(const char *key, int fallback) const
+        {
+            double value = GetNumber(key, fallback);
+            return value == value ? (int)CLAMP(-2147483648.0, value, 2147483647.0) : fallback;
+        }
+
+        long long GetLong(const char *key, long long fallback) const
+        {
+            double value = GetNumber(key, (double)fallback);
+            return value == value ? (long long)CLAMP(-9007199254740992.0, value, 9007199254740992.0) : fallback;
+        }
+
+        int Count(const char *key) const
+        {
+            const Json *value = Find(key);
+            return value && value->type == Array ? (int)value->items.size() : 0;
+        }
+    };
+
+    class JsonParser
+    {
+    private:
+        const char *mCursor, *mEnd;
+        int mDepth;
+
+        void SkipSpace()
+        {
+            while (mCursor < mEnd && (*mCursor == ' ' || *mCursor == '\t' || *mCursor == '\n' || *mCursor == '\r'))
+                mCursor++;
+        }
+
+        bool Match(const char *word)
+        {
+            size_t length = strlen(word);
+            if ((size_t)(mEnd - mCursor) < length || strncmp(mCursor, word, length) != 0)
+                return false;
+
+            mCursor += length;
+            return true;
+        }
+
+        static void AppendUtf8(std::string &out, unsigned int code)
+        {
+            if (code < 0x80)
+                out += (char)code;
+            else if (code < 0x800)
+            {
+                out += (char)(0xc0 | (code >> 6));
+                out += (char)(0x80 | (code & 0x3f));
+            }
+            else
+            {
+                out += (char)(0xe0 | (code >> 12));
+                out += (char)(0x80 | ((code >> 6) & 0x3f));
+                out += (char)(0x80 | (code & 0x3f));
+            }
+        }
+
+        bool ParseString(std::string &out)
+        {
+            if (mCursor >= mEnd || *mCursor != '"')
+                return false;
+
+            mCursor++;
+            while (mCursor < mEnd && *mCursor != '"')
+            {
+                char c = *mCursor++;
+                if (c != '\\')
+                {
+                    out += c;
+                    continue;
+                }
+
+                if (mCursor >= mEnd)
+                    return false;
+
+                c = *mCursor++;
+                switch (c)
+                {
+                    case 'b': out += '\b'; break;
+                    case 'f': out += '\f'; break;
+                    case 'n': out += '\n'; break;
+                    case 'r': out += '\r'; break;
+                    case 't': out += '\t'; break;
+                    case 'u':
+                    {
+                        // Only names and URIs are strings here, surrogate pairs are not combined
+                        if (mEnd - mCursor < 4)
+                            return false;
+                        char hex[5] = {mCursor[0], mCursor[1], mCursor[2], mCursor[3], 0};
+                        AppendUtf8(out, (unsigned int)strtoul(hex, nullptr, 16));
+                        mCursor += 4;
+                        break;
+                    }
+                    default: out += c; break;
+                }
+            }
+
+            if (mCursor >= mEnd)
+                return false;
+
+            mCursor++;
+            return true;
+        }
+
+        bool ParseValue(Json &value)
+        {
+            // Deep nesting only comes from a broken or hostile file
+            if (++mDepth > 64)
+                return false;
+
+            SkipSpace();
+            if (mCursor >= mEnd)
+                return false;
+
+            bool result = true;
+            char c = *mCursor;
+
+            if (c == '{')
+            {
+                value.type = Json::Object;
+                mCursor++;
+                SkipSpace();
+
+                if (mCursor < mEnd && *mCursor == '}')
+                    mCursor++;
+                else
+                {
+                    while (result)
+                    {
+                        SkipSpace();
+                        value.keys.emplace_back();
+                        value.items.emplace_back();
+                        result = ParseString(value.keys.back());
+
+                        SkipSpace();
+                        result = result && mCursor < mEnd && *mCursor++ == ':' && ParseValue(value.items.back());
+
+                        SkipSpace();
+                        if (!result || mCursor >= mEnd)
+                            result = false;
+                        else if (*mCursor == '}')
+                        {
+                            mCursor++;
+                            break;
+                        }
+                        else if (*mCursor++ != ',')
+                            result = false;
+                    }
+                }
+            }
+            else if (c == '[')
+            {
+                value.type = Json::Array;
+                mCursor++;
+                SkipSpace();
+
+                if (mCursor < mEnd && *mCursor == ']')
+                    mCursor++;
+                else
+                {
+                    while (result)
+                    {
+                        value.items.emplace_back();
+                        result = ParseValue(value.items.back());
+
+                        SkipSpace();
+                        if (!result || mCursor >= mEnd)
+                            result = false;
+                        else if (*mCursor == ']')
+                        {
+                            mCursor++;
+                            break;
+                        }
+                        else if (*mCursor++ != ',')
+                            result = false;
+                    }
+                }
+            }
+            else if (c == '"')
+            {
+                value.type = Json::String;
+                result = ParseString(value.string);
+            }
+            else if (Match("true"))
+            {
+                value.type = Json::Bool;
+                value.number = 1;
+            }
+            else if (Match("false"))
+            {
+                value.type = Json::Bool;
+            }
+            else if (Match("null"))
+            {
+                value.type = Json::Null;
+            }
+            else
+            {
+                // The chunk is copied into a terminated string, so strtod cannot run past it
+                char *end;
+                value.type = Json::Number;
+                value.number = strtod(mCursor, &end);
+                result = end != mCursor;
+                mCursor = end;
+            }
+
+            mDepth--;
+            return result;
+        }
+
+    public:
+        JsonParser(const char *text, size_t length)
+            : mCursor(text), mEnd(text + length), mDepth(0)
+        {
+        }
+
+        bool Parse(Json &root)
+        {
+            if (!ParseValue(root))
+                return false;
+
+            SkipSpace();
+            return mCursor == mEnd;
+        }
+    };
+
+    int NumComponents(const std::string &type)
+    {
+        if (type == "SCALAR")
+            return 1;
+        if (type == "VEC2")
+            return 2;
+        if (type == "VEC3")
+            return 3;
+        if (type == "VEC4")
+            return 4;
+        return 0;
+    }
+}
+
+GlbFile::GlbFile()
+    : mData(nullptr), mSize(0), mBinary(nullptr), mBinarySize(0)
+#ifdef _WIN32
+      , mFile(INVALID_HANDLE_VALUE), mMapping(nullptr)
+#endif
+{
+}
+
+GlbFile::~GlbFile()
+{
+    Close();
+}
+
+bool GlbFile::IsGlb(const char *fileName)
+{
+    size_t length = strlen(fileName);
+    if (length < 4)
+        return false;
+
+    const char *extension = fileName + length - 4;
+    return extension[0] == '.' && tolower(extension[1]) == 'g' && tolower(extension[2]) == 'l' &&
+           tolower(extension[3]) == 'b';
+}
+
+int GlbFile::ComponentSize(unsigned int componentType)
+{
+    switch (componentType)
+    {
+        case Byte:
+        case UnsignedByte:
+            return 1;
+        case Short:
+        case UnsignedShort:
+            return 2;
+        case UnsignedInt:
+        case Float:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+unsigned int GlbFile::GetIndex(const Accessor &indices, int i)
+{
+    const unsigned char *value = indices.view + indices.offset + (size_t)i * ComponentSize(indices.componentType);
+
+    if (indices.componentType == UnsignedInt)
+    {
+        unsigned int index;
+        memcpy(&index, value, sizeof(index));
+        return index;
+    }
+
+    if (indices.componentType == UnsignedShort)
+    {
+        unsigned short index;
+        memcpy(&index, value, sizeof(index));
+        return index;
+    }
+
+    return *value;
+}
+
+bool GlbFile::Map(const char *fileName)
+{
+#ifdef _WIN32
+    mFile = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+                        nullptr);
+    if (mFile == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mFile, &size) || !size.QuadPart)
+        return false;
+
+    mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mMapping)
+        return false;
+
+    mData = (unsigned char *)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+    mSize = size.QuadPart;
+#else
+    int file = open(fileName, O_RDONLY);
+    if (file < 0)
+        return false;
+
+    struct stat info = {};
+    if (fstat(file, &info) != 0 || !info.st_size)
+    {
+        close(file);
+        return false;
+    }
+
+    // The mapping keeps the file alive, and the pages are about to be read front to back by the uploads
+    void *data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+
+    if (data == MAP_FAILED)
+        return false;
+
+    madvise(data, (size_t)info.st_size, MADV_WILLNEED);
+    mData = (unsigned char *)data;
+    mSize = (long long)info.st_size;
+#endif
+
+    return mData != nullptr;
+}
+
+void GlbFile::Close()
+{
+#ifdef _WIN32
+    if (mData)
+        UnmapViewOfFile(mData);
+    if (mMapping)
+        CloseHandle(mMapping);
+    if (mFile != INVALID_HANDLE_VALUE)
+        CloseHandle(mFile);
+
+    mMapping = nullptr;
+    mFile = INVALID_HANDLE_VALUE;
+#else
+    if (mData)
+        munmap(mData, (size_t)mSize);
+#endif
+
+    mData = nullptr;
+    mSize = 0;
+    mBinary = nullptr;
+    mBinarySize = 0;
+
+    mPrimitives.clear();
+    mMaterials.clear();
+    mImages.clear();
+}
+
+bool GlbFile::Open(const char *fileName)
+{
+    PROFILE_SCOPE("GlbFile::Open");
+
+    Close();
+
+    if (!Map(fileName))
+    {
+        Utils::Warning((std::string("Unable to map ") + fileName).c_str());
+        Close();
+        return false;
+    }
+
+    // 12 byte header, then a JSON chunk and an optional binary chunk, each with an 8 byte header of its own
+    unsigned int header[3] = {};
+    if (mSize >= 20)
+        memcpy(header, mData, sizeof(header));
+
+    if (header[0] != GlbMagic || header[1] != 2 || header[2] > mSize)
+    {
+        Utils::Warning((std::string(fileName) + " is not a glTF 2.0 binary file.").c_str());
+        Close();
+        return false;
+    }
+
+    long long length = header[2];
+    const char *json = nullptr;
+    long long jsonLength = 0;
+
+    for (long long offset = 12; offset + 8 <= length;)
+    {
+        unsigned int chunk[2];
+        memcpy(chunk, mData + offset, sizeof(chunk));
+        offset += 8;
+
+        if (offset + chunk[0] > length)
+            break;
+
+        if (chunk[1] == JsonChunk && !json)
+        {
+            json = (const char *)mData + offset;
+            jsonLength = chunk[0];
+        }
+        else if (chunk[1] == BinaryChunk && !mBinary)
+        {
+            mBinary = mData + offset;
+            mBinarySize = chunk[0];
+        }
+
+        // Chunks are padded to four bytes
+        offset += (chunk[0] + 3) & ~3u;
+    }
+
+    std::string directory;
+    const char *pathEnd = strrchr(fileName, '\\');
+    if (!pathEnd)
+        pathEnd = strrchr(fileName, '/');
+    if (pathEnd)
+        directory.assign(fileName, pathEnd + 1);
+
+    if (!json || !Parse(json, jsonLength, directory))
+    {
+        Utils::Warning((std::string("Unable to parse ") + fileName).c_str());
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+bool GlbFile::Parse(const char *json, long long length, const std::string &directory)
+{
+    Json root;
+    std::string text(json, (size_t)length);
+    if (!JsonParser(text.c_str(), text.size()).Parse(root) || root.type != Json::Object)
+        return false;
+
+    const Json *buffers = root.Find("buffers");
+    const Json *views = root.Find("bufferViews");
+    const Json *accessors = root.Find("accessors");
+
+    // Only the buffer stored in the binary chunk is mapped, external .bin files are not read
+    auto resolveView = [&](int index, const unsigned char *&data, long long &size, int &stride)
+    {
+        const Json *view = views ? views->At(index) : nullptr;
+        if (!view || view->GetInt("buffer", -1) != 0)
+            return false;
+
+        const Json *buffer = buffers ? buffers->At(0) : nullptr;
+        if (!mBinary || !buffer || buffer->Find("uri"))
+            return false;
+
+        long long offset = view->GetLong("byteOffset", 0);
+        size = view->GetLong("byteLength", 0);
+        stride = view->GetInt("byteStride", 0);
+        if (offset < 0 || size < 0 || offset + size > mBinarySize)
+            return false;
+
+        data = mBinary + offset;
+        return true;
+    };
+
+    auto resolveAccessor = [&](int index, Accessor &accessor)
+    {
+        const Json *source = accessors ? accessors->At(index) : nullptr;
+        const Json *type = source ? source->Find("type") : nullptr;
+        if (!source || !type || source->Find("sparse"))
+            return false;
+
+        long long viewSize;
+        accessor.offset = source->GetLong("byteOffset", 0);
+        accessor.count = source->GetInt("count", 0);
+        accessor.components = NumComponents(type->string);
+        accessor.componentType = (unsigned int)source->GetInt("componentType", 0);
+        const Json *normalized = source->Find("normalized");
+        accessor.normalized = normalized && normalized->number != 0;
+
+        if (!resolveView(source->GetInt("bufferView", -1), accessor.view, viewSize, accessor.stride))
+            return false;
+
+        // Strides as the spec allows them, no element may overlap the next or run backwards
+        long long elementSize = (long long)accessor.components * ComponentSize(accessor.componentType);
+        if (accessor.stride && (accessor.stride < 4 || accessor.stride > 252 || accessor.stride % 4 ||
+                                accessor.stride < elementSize))
+            return false;
+
+        // Every element the GPU will fetch has to lie inside the view
+        long long stride = accessor.stride ? accessor.stride : elementSize;
+        return elementSize > 0 && accessor.count > 0 && accessor.offset >= 0 &&
+               accessor.offset + stride * (accessor.count - 1) + elementSize <= viewSize;
+    };
+
+    const Json *images = root.Find("images");
+    for (int i = 0; i < root.Count("images"); i++)
+    {
+        const Json &source = *images->At(i);
+        const Json *uri = source.Find("uri");
+
+        // Data URIs are not decoded, an image that resolves to nothing leaves its materials untextured
+        Image image = {nullptr, 0, std::string()};
+        int stride;
+        if (uri && uri->type == Json::String && uri->string.compare(0, 5, "data:") != 0)
+            image.path = directory + uri->string;
+        else if (!uri)
+            resolveView(source.GetInt("bufferView", -1), image.data, image.size, stride);
+
+        mImages.push_back(image);
+    }
+
+    const Json *textures = root.Find("textures");
+    const Json *materials = root.Find("materials");
+    for (int i = 0; i < root.Count("materials"); i++)
+    {
+        const Json &source = *materials->At(i);
+        const Json *pbr = source.Find("pbrMetallicRoughness");
+
+        Material material = {cyVec3f(1, 1, 1), 1, 1, -1};
+        if (pbr)
+        {
+            const Json *factor = pbr->Find("baseColorFactor");
+            if (factor && factor->type == Json::Array && factor->items.size() >= 3)
+                material.baseColor.Set((float)factor->items[0].number, (float)factor->items[1].number,
+                                       (float)factor->items[2].number);
+
+            material.metallic = (float)pbr->GetNumber("metallicFactor", 1);
+            material.roughness = (float)pbr->GetNumber("roughnessFactor", 1);
+
+            // Only the first texture coordinate set is uploaded
+            const Json *baseColor = pbr->Find("baseColorTexture");
+            const Json *texture = baseColor && baseColor->GetInt("texCoord", 0) == 0 && textures ?
+                                  textures->At(baseColor->GetInt("index", -1)) : nullptr;
+            int image = texture ? texture->GetInt("source", -1) : -1;
+            if (image >= 0 && image < (int)mImages.size() && (mImages[image].data || !mImages[image].path.empty()))
+                material.baseColorImage = image;
+        }
+
+        mMaterials.push_back(material);
+    }
+
+    const Json *meshes = root.Find("meshes");
+    for (int m = 0; m < root.Count("meshes"); m++)
+    {
+        const Json *primitives = meshes->At(m)->Find("primitives");
+        for (int p = 0; primitives && p < (int)primitives->items.size(); p++)
+        {
+            const Json &source = primitives->items[p];
+            const Json *attributes = source.Find("attributes");
+            if (source.GetInt("mode", Triangles) != Triangles || !attributes)
+            {
+                Utils::Warning("Skipping a glTF primitive that is not a triangle list.");
+                continue;
+            }
+
+            Primitive primitive = {};
+            primitive.material = source.GetInt("material", -1);
+            if (primitive.material >= (int)mMaterials.size())
+                primitive.material = -1;
+
+            int position = attributes->GetInt("POSITION", -1);
+            if (!resolveAccessor(position, primitive.position) || primitive.position.components != 3 ||
+                primitive.position.componentType != Float)
+            {
+                Utils::Warning("Skipping a glTF primitive without usable positions.");
+                continue;
+            }
+
+            int count = primitive.position.count;
+
+            // Optional parts that do not check out are dropped rather than the whole primitive
+            if (attributes->Find("NORMAL") &&
+                (!resolveAccessor(attributes->GetInt("NORMAL", -1), primitive.normal) ||
+                 primitive.normal.components != 3 || primitive.normal.componentType != Float ||
+                 primitive.normal.count != count))
+                primitive.normal = Accessor();
+
+            if (attributes->Find("TEXCOORD_0") &&
+                (!resolveAccessor(attributes->GetInt("TEXCOORD_0", -1), primitive.texture) ||
+                 primitive.texture.components != 2 || primitive.texture.count != count ||
+                 (primitive.texture.componentType != Float && !primitive.texture.normalized)))
+                primitive.texture = Accessor();
+
+            if (source.Find("indices"))
+            {
+                if (!resolveAccessor(source.GetInt("indices", -1), primitive.indices) ||
+                    primitive.indices.components != 1 || primitive.indices.count % 3 ||
+                    (primitive.indices.componentType != UnsignedByte &&
+                     primitive.indices.componentType != UnsignedShort &&
+                     primitive.indices.componentType != UnsignedInt))
+                {
+                    Utils::Warning("Skipping a glTF primitive with unusable indices.");
+                    continue;
+                }
+
+                // Index buffers have no stride in GL
+                if (primitive.indices.stride && primitive.indices.stride != ComponentSize(primitive.indices.componentType))
+                {
+                    Utils::Warning("Skipping a glTF primitive with strided indices.");
+                    continue;
+                }
+
+                // Indices reach both the GPU and the CPU normal pass, so one past the vertices would read out of bounds
+                int v = 0;
+                while (v < primitive.indices.count && GetIndex(primitive.indices, v) < (unsigned int)count)
+                    v++;
+
+                if (v < primitive.indices.count)
+                {
+                    Utils::Warning("Skipping a glTF primitive with out of range indices.");
+                    continue;
+                }
+            }
+            else if (count % 3)
+            {
+                Utils::Warning("Skipping a glTF primitive with a partial triangle.");
+                continue;
+            }
+
+            const Json *accessor = accessors->At(position);
+            const Json *min = accessor->Find("min");
+            const Json *max = accessor->Find("max");
+            if (min && max && min->type == Json::Array && max->type == Json::Array && min->items.size() == 3 &&
+                max->items.size() == 3)
+            {
+                primitive.min.Set((float)min->items[0].number, (float)min->items[1].number, (float)min->items[2].number);
+                primitive.max.Set((float)max->items[0].number, (float)max->items[1].number, (float)max->items[2].number);
+            }
+            else
+            {
+                // Required by the format, but cheap to recover from
+                int stride = primitive.position.stride ? primitive.position.stride : 12;
+                const unsigned char *element = primitive.position.view + primitive.position.offset;
+                primitive.min = cyVec3f(1e30f, 1e30f, 1e30f);
+                primitive.max = cyVec3f(-1e30f, -1e30f, -1e30f);
+
+                for (int v = 0; v < count; v++, element += stride)
+                {
+                    cyVec3f point;
+                    memcpy(&point, element, sizeof(point));
+                    primitive.min.x = MIN(primitive.min.x, point.x);
+                    primitive.min.y = MIN(primitive.min.y, point.y);
+                    primitive.min.z = MIN(primitive.min.z, point.z);
+                    primitive.max.x = MAX(primitive.max.x, point.x);
+                    primitive.max.y = MAX(primitive.max.y, point.y);
+                    primitive.max.z = MAX(primitive.max.z, point.z);
+                }
+            }
+
+            mPrimitives.push_back(primitive);
+        }
+    }
+
+    return true;
+}
+
+int GlbFile::GetNumPrimitives() const
+{
+    return (int)mPrimitives.size();
+}
+
+const GlbFile::Primitive &GlbFile::GetPrimitive(int i) const
+{
+    return mPrimitives[i];
+}
+
+int GlbFile::GetNumMaterials() const
+{
+    return (int)mMaterials.size();
+}
+
+const GlbFile::Material &GlbFile::GetMaterial(int i) const
+{
+    return mMaterials[i];
+}
+
+int GlbFile::GetNumImages() const
+{
+    return (int)mImages.size();
+}
+
+const GlbFile::Image &GlbFile::GetImage(int i) const
+{
+    return mImages[i];
+}
@@ -0,0 +1,114 @@
+#include "gputimer.h"
+
+#include <glad/glad.h>
+
+GpuTimer::GpuTimer()
+    : mQueries(), mEndQueries(), mTimestamps(false), mHead(0), mNumPending(0), mCurrent(-1), mLastMs(0), mAverageMs(0),
+      mSamples(0)
+{
+}
+
+GpuTimer::~GpuTimer()
+{
+    if (mQueries[0])
+        glDeleteQueries(QueryCount, mQueries);
+
+    if (mEndQueries[0])
+        glDeleteQueries(QueryCount, mEndQueries);
+}
+
+void GpuTimer::Create(bool timestamps)
+{
+    mTimestamps = timestamps;
+    glGenQueries(QueryCount, mQueries);
+
+    if (mTimestamps)
+        glGenQueries(QueryCount, mEndQueries);
+}
+
+void GpuTimer::Begin()
+{
+    Poll();
+
+    // Take the slot after the newest pending query, skip the frame rather than block on an old result
+    mCurrent = -1;
+    if (mNumPending == QueryCount)
+        return;
+
+    mCurrent = (mHead + mNumPending) % QueryCount;
+
+    if (mTimestamps)
+        glQueryCounter(mQueries[mCurrent], GL_TIMESTAMP);
+    else
+        glBeginQuery(GL_TIME_ELAPSED, mQueries[mCurrent]);
+}
+
+void GpuTimer::End()
+{
+    if (mCurrent == -1)
+        return;
+
+    if (mTimestamps)
+        glQueryCounter(mEndQueries[mCurrent], GL_TIMESTAMP);
+    else
+        glEndQuery(GL_TIME_ELAPSED);
+    mNumPending++;
+    mCurrent = -1;
+}
+
+void GpuTimer::Poll()
+{
+    // Results arrive in issue order, stop at the first one that is not ready so mLastMs follows the frames
+    while (mNumPending > 0)
+    {
+        int i = mHead;
+
+        // The end counter is written last, once it is available so is the start
+        GLint available = 0;
+        glGetQueryObjectiv(mTimestamps ? mEndQueries[i] : mQueries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+
+        if (!available)
+            break;
+
+        GLuint64 elapsed = 0;
+        if (mTimestamps)
+        {
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(mQueries[i], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(mEndQueries[i], GL_QUERY_RESULT, &end);
+            elapsed = end > start ? end - start : 0;
+        }
+        else
+        {
+            glGetQueryObjectui64v(mQueries[i], GL_QUERY_RESULT, &elapsed);
+        }
+        mHead = (mHead + 1) % QueryCount;
+        mNumPending--;
+
+        mLastMs = (double)elapsed / 1000000.0;
+        mSamples++;
+        mAverageMs += (mLastMs - mAverageMs) / (double)(mSamples < 120 ? mSamples : 120);
+    }
+}
+
+void GpuTimer::Reset()
+{
+    mLastMs = 0;
+    mAverageMs = 0;
+    mSamples = 0;
+}
+
+double GpuTimer::GetLastMs() const
+{
+    return mLastMs;
+}
+
+double GpuTimer::GetAverageMs() const
+{
+    return mAverageMs;
+}
+
+long GpuTimer::GetSamples() const
+{
+    return mSamples;
+}
@@ -0,0 +1,214 @@
+#include "instancebuffer.h"
+#include "utils.h"
+#include "renderstats.h"
+#include "resources.h"
+#include "jobsystem.h"
+
+#include <cstring>
+#include <glad/glad.h>
+
+InstanceBuffer::InstanceBuffer()
+    : mVBO(0), mCount(0), mStride(0), mCapacity(0), mTransforms(nullptr), mScales(nullptr), mVisible(nullptr),
+      mCombined(nullptr), mLods(nullptr), mBatches(nullptr), mNumBatches(0), mNumBuckets(0), mBucketFirst(),
+      mBucketCount(), mBucketDistance()
+{
+}
+
+InstanceBuffer::~InstanceBuffer()
+{
+    Resources::Release(Resources::Buffers, this);
+    Resources::Release(Resources::Staging, this);
+    glDeleteBuffers(1, &mVBO);
+
+    delete[] mBatches;
+    delete[] mLods;
+    delete[] mCombined;
+    delete[] mVisible;
+    delete[] mScales;
+    delete[] mTransforms;
+}
+
+bool InstanceBuffer::Create(const cyMatrix4f *transforms, int count, const Bounds &bounds)
+{
+    if (count <= 0)
+        return false;
+
+    mCount = count;
+    mCapacity = count * MaxCullsPerFrame;
+    mStride = (count + 3) & ~3;
+    mTransforms = new cyMatrix4f[count];
+    mScales = new float[count];
+    mVisible = new unsigned char[mStride];
+    mCombined = new unsigned char[mStride];
+    mLods = new unsigned char[count];
+    mNumBatches = (count + CullBatchSize - 1) / CullBatchSize;
+    mBatches = new BatchStats[mNumBatches];
+
+    mMin.Resize(count);
+    mMax.Resize(count);
+
+    for (int i = 0; i < count; i++)
+    {
+        const float *m = transforms[i].cell;
+        Bounds world = bounds.Transform(transforms[i]);
+
+        mTransforms[i] = transforms[i];
+        mMin.Set(i, world.min);
+        mMax.Set(i, world.max);
+
+        // LOD errors are in model space, the largest axis scale converts them to world space conservatively
+        float sx = cyVec3f(m[0], m[1], m[2]).Length();
+        float sy = cyVec3f(m[4], m[5], m[6]).Length();
+        float sz = cyVec3f(m[8], m[9], m[10]).Length();
+        mScales[i] = MAX(sx, MAX(sy, sz));
+    }
+
+    glGenBuffers(1, &mVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+    glBufferData(GL_ARRAY_BUFFER, (long)(mCapacity * sizeof(cyMatrix4f)), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    Resources::Track(Resources::Buffers, this, (long long)(mCapacity * sizeof(cyMatrix4f)), "instance transforms");
+    Resources::Track(Resources::Staging, this, (long long)(count * sizeof(cyMatrix4f) + mStride * 6 * sizeof(float) +
+                                                           count * sizeof(float) + mStride * 2 + count +
+                                                           mNumBatches * sizeof(BatchStats)),
+                     "instance cull data");
+
+    return true;
+}
+
+void InstanceBuffer::Upload(const std::vector<cyMatrix4f> &instances)
+{
+    // Orphan the store so the previous frame's draws keep reading their own copy
+    glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+    glBufferData(GL_ARRAY_BUFFER, (long)(mCapacity * sizeof(cyMatrix4f)), nullptr, GL_STREAM_DRAW);
+    if (!instances.empty())
+    {
+        glBufferSubData(GL_ARRAY_BUFFER, 0, (long)(instances.size() * sizeof(cyMatrix4f)), instances.data());
+        RenderStats::Add(RenderStats::BufferBytes, (long long)(instances.size() * sizeof(cyMatrix4f)));
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+int InstanceBuffer::Cull(const Frustum *frusta, int numFrusta, const cyVec3f &viewPosition, float lodScale,
+                         const float *lodErrors, int numLods, std::vector<cyMatrix4f> &instances)
+{
+    const float *minX = mMin.X(), *minY = mMin.Y(), *minZ = mMin.Z();
+    const float *maxX = mMax.X(), *maxY = mMax.Y(), *maxZ = mMax.Z();
+
+    mNumBuckets = MAX(1, MIN(numLods, MaxBuckets));
+
+    // Out of room for this frame, nothing is drawn rather than overwriting queued instances
+    int used = (int)instances.size();
+    bool full = used + mCount > mCapacity;
+    if (full)
+        Utils::Warning("Instance buffer is full for this frame.");
+
+    JobSystem::ParallelFor("Instance cull", mNumBatches, 1, [&](int firstBatch, int lastBatch)
+    {
+        for (int b = firstBatch; b < lastBatch; b++)
+        {
+            int first = b * CullBatchSize;
+            int count = MIN(CullBatchSize, mCount - first);
+            BatchStats &batch = mBatches[b];
+
+            // An instance is kept if any of the frusta sees it, which covers the six faces of a cube map pass
+            memset(mCombined + first, !numFrusta && !full ? 1 : 0, (size_t)count);
+            for (int f = 0; f < numFrusta && !full; f++)
+            {
+                frusta[f].TestBoxes(minX + first, minY + first, minZ + first, maxX + first, maxY + first, maxZ + first,
+                                    count, mVisible + first);
+                for (int i = first; i < first + count; i++)
+                    mCombined[i] |= mVisible[i];
+            }
+
+            memset(batch.count, 0, sizeof(batch.count));
+            for (int k = 0; k < MaxBuckets; k++)
+                batch.distance[k] = -1;
+
+            for (int i = first; i < first + count; i++)
+            {
+                if (!mCombined[i])
+                    continue;
+
+                cyVec3f d(MAX(0.0f, MAX(minX[i] - viewPosition.x, viewPosition.x - maxX[i])),
+                          MAX(0.0f, MAX(minY[i] - viewPosition.y, viewPosition.y - maxY[i])),
+                          MAX(0.0f, MAX(minZ[i] - viewPosition.z, viewPosition.z - maxZ[i])));
+                float distance = d.Length();
+
+                int lod = 0;
+                while (lodScale > 0 && lod + 1 < mNumBuckets && lodErrors[lod + 1] * mScales[i] * lodScale <= distance)
+                    lod++;
+
+                mLods[i] = (unsigned char)lod;
+                batch.count[lod]++;
+                if (batch.distance[lod] < 0 || distance < batch.distance[lod])
+                    batch.distance[lod] = distance;
+            }
+        }
+    });
+
+    memset(mBucketCount, 0, sizeof(mBucketCount));
+    for (int k = 0; k < MaxBuckets; k++)
+        mBucketDistance[k] = -1;
+
+    for (int b = 0; b < mNumBatches; b++)
+    {
+        for (int k = 0; k < mNumBuckets; k++)
+        {
+            mBucketCount[k] += mBatches[b].count[k];
+            float distance = mBatches[b].distance[k];
+            if (distance >= 0 && (mBucketDistance[k] < 0 || distance < mBucketDistance[k]))
+                mBucketDistance[k] = distance;
+        }
+    }
+
+    // Counting sort by LOD so every bucket is one contiguous range of the instance buffer
+    int numVisible = 0;
+    int next[MaxBuckets];
+    for (int k = 0; k < mNumBuckets; k++)
+    {
+        next[k] = numVisible;
+        mBucketFirst[k] = used + numVisible;
+        numVisible += mBucketCount[k];
+    }
+
+    instances.resize((size_t)(used + numVisible));
+    for (int i = 0; i < mCount; i++)
+    {
+        if (mCombined[i])
+            instances[used + next[mLods[i]]++] = mTransforms[i];
+    }
+
+    return numVisible;
+}
+
+unsigned int InstanceBuffer::GetID() const
+{
+    return mVBO;
+}
+
+int InstanceBuffer::GetCount() const
+{
+    return mCount;
+}
+
+int InstanceBuffer::GetNumBuckets() const
+{
+    return mNumBuckets;
+}
+
+int InstanceBuffer::GetBucketFirst(int bucket) const
+{
+    return mBucketFirst[bucket];
+}
+
+int InstanceBuffer::GetBucketCount(int bucket) const
+{
+    return mBucketCount[bucket];
+}
+
+float InstanceBuffer::GetBucketDistance(int bucket) const
+{
+    return mBucketDistance[bucket];
+}
@@ -0,0 +1,402 @@
+#include "jobsystem.h"
+#include "profiler.h"
+#include "utils.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct JobSystem::Job
+{
+    std::function<void()> function;
+    const char *name;
+
+    // Unfinished dependencies, plus one until the job is submitted
+    std::atomic<int> pending;
+
+    // One for the creator until Wait, one for the system until the job finished
+    std::atomic<int> references;
+
+    std::mutex mutex;
+    bool finished;
+    std::atomic<bool> done;
+    std::vector<Job *> continuations;
+};
+
+namespace
+{
+    using JobSystem::Job;
+
+    // Lock free work stealing deque from Le et al., the owner pushes and pops at the bottom, thieves take the top
+    class Deque
+    {
+    private:
+        static const long long Capacity = 4096;
+
+        std::atomic<long long> mTop, mBottom;
+        std::atomic<Job *> mItems[Capacity];
+
+    public:
+        Deque() : mTop(0), mBottom(0)
+        {
+            for (long long i = 0; i < Capacity; i++)
+                mItems[i].store(nullptr, std::memory_order_relaxed);
+        }
+
+        bool Push(Job *job)
+        {
+            long long bottom = mBottom.load(std::memory_order_relaxed);
+            long long top = mTop.load(std::memory_order_acquire);
+            if (bottom - top >= Capacity)
+                return false;
+
+            mItems[bottom & (Capacity - 1)].store(job, std::memory_order_release);
+            std::atomic_thread_fence(std::memory_order_release);
+            mBottom.store(bottom + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        Job *Pop()
+        {
+            long long bottom = mBottom.load(std::memory_order_relaxed) - 1;
+            mBottom.store(bottom, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long long top = mTop.load(std::memory_order_relaxed);
+
+            if (top > bottom)
+            {
+                mBottom.store(bottom + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            Job *job = mItems[bottom & (Capacity - 1)].load(std::memory_order_relaxed);
+
+            // Last item, race the thieves for it
+            if (top == bottom)
+            {
+                if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    job = nullptr;
+                mBottom.store(bottom + 1, std::memory_order_relaxed);
+            }
+
+            return job;
+        }
+
+        Job *Steal()
+        {
+            long long top = mTop.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long long bottom = mBottom.load(std::memory_order_acquire);
+
+            if (top >= bottom)
+                return nullptr;
+
+            Job *job = mItems[top & (Capacity - 1)].load(std::memory_order_acquire);
+            if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return nullptr;
+
+            return job;
+        }
+    };
+
+    struct Worker
+    {
+        Deque deque;
+        std::atomic<long long> executed, stolen;
+        std::string name;
+    };
+
+    int numThreads = 1;
+    std::vector<Worker *> workers;
+    std::vector<std::thread> threads;
+    JobSystem::Hooks hooks = {nullptr, nullptr};
+
+    // Jobs made ready by threads outside the pool
+    std::mutex injectedMutex;
+    std::deque<Job *> injected;
+
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<int> queued(0);
+    std::atomic<bool> quit(false);
+
+    thread_local int workerIndex = -1;
+
+    void Execute(Job *job);
+
+    void Release(Job *job)
+    {
+        if (job->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete job;
+    }
+
+    void Enqueue(Job *job)
+    {
+        if (numThreads <= 1)
+        {
+            Execute(job);
+            return;
+        }
+
+        if (workerIndex < 0 || !workers[workerIndex]->deque.Push(job))
+        {
+            std::lock_guard<std::mutex> lock(injectedMutex);
+            injected.push_back(job);
+        }
+
+        // Incremented before taking the lock, so a worker checking under the lock cannot miss it
+        queued.fetch_add(1, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wake.notify_one();
+    }
+
+    Job *FindJob()
+    {
+        Job *job = nullptr;
+
+        if (workerIndex >= 0)
+            job = workers[workerIndex]->deque.Pop();
+
+        if (!job)
+        {
+            std::lock_guard<std::mutex> lock(injectedMutex);
+            if (!injected.empty())
+            {
+                job = injected.front();
+                injected.pop_front();
+            }
+        }
+
+        // Steal starting after our own index so thieves spread over the victims
+        for (int i = 1; !job && i <= numThreads; i++)
+        {
+            int victim = (MAX(workerIndex, 0) + i) % numThreads;
+            if (victim == workerIndex)
+                continue;
+
+            job = workers[victim]->deque.Steal();
+            if (job && workerIndex >= 0)
+                workers[workerIndex]->stolen.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (job)
+            queued.fetch_sub(1, std::memory_order_relaxed);
+
+        return job;
+    }
+
+    void Execute(Job *job)
+    {
+        {
+            PROFILE_SCOPE(job->name);
+
+            if (hooks.begin)
+                hooks.begin(job->name, workerIndex);
+
+            job->function();
+            job->function = nullptr;
+
+            if (hooks.end)
+                hooks.end(job->name, workerIndex);
+        }
+
+        if (workerIndex >= 0 && workerIndex < (int)workers.size())
+            workers[workerIndex]->executed.fetch_add(1, std::memory_order_relaxed);
+
+        std::vector<Job *> continuations;
+        {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->finished = true;
+            continuations.swap(job->continuations);
+        }
+        job->done.store(true, std::memory_order_release);
+
+        for (Job *next : continuations)
+        {
+            if (next->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                Enqueue(next);
+        }
+
+        Release(job);
+    }
+
+    void WorkerLoop(int index)
+    {
+        workerIndex = index;
+        PROFILE_THREAD(workers[index]->name.c_str());
+
+        while (!quit.load(std::memory_order_acquire))
+        {
+            Job *job = FindJob();
+            if (job)
+            {
+                Execute(job);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, []() { return queued.load(std::memory_order_acquire) > 0 || quit.load(); });
+        }
+    }
+}
+
+void JobSystem::Initialize(int threadCount)
+{
+    if (!workers.empty())
+        Shutdown();
+
+    if (threadCount <= 0)
+    {
+        unsigned int hardware = std::thread::hardware_concurrency();
+        threadCount = hardware ? (int)hardware : 1;
+    }
+
+    numThreads = threadCount;
+    quit.store(false);
+    queued.store(0);
+    workerIndex = 0;
+
+    // Names are set up before any thread starts, the profiler keeps the pointers
+    for (int i = 0; i < numThreads; i++)
+    {
+        workers.push_back(new Worker());
+        workers[i]->executed.store(0);
+        workers[i]->stolen.store(0);
+        workers[i]->name = i ? "Worker " + std::to_string(i) : "main";
+    }
+
+    for (int i = 1; i < numThreads; i++)
+        threads.emplace_back(WorkerLoop, i);
+}
+
+void JobSystem::Shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        quit.store(true);
+        wake.notify_all();
+    }
+
+    for (std::thread &thread : threads)
+        thread.join();
+    threads.clear();
+
+    for (Worker *worker : workers)
+        delete worker;
+    workers.clear();
+
+    numThreads = 1;
+    workerIndex = -1;
+}
+
+int JobSystem::GetThreadCount()
+{
+    return numThreads;
+}
+
+bool JobSystem::IsSingleThreaded()
+{
+    return numThreads <= 1;
+}
+
+int JobSystem::GetWorkerIndex()
+{
+    return workerIndex;
+}
+
+void JobSystem::SetHooks(const Hooks &newHooks)
+{
+    hooks = newHooks;
+}
+
+JobSystem::Stats JobSystem::GetStats(int worker)
+{
+    Stats stats = {0, 0};
+    if (worker >= 0 && worker < (int)workers.size())
+    {
+        stats.executed = workers[worker]->executed.load(std::memory_order_relaxed);
+        stats.stolen = workers[worker]->stolen.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+JobSystem::Job *JobSystem::Create(const char *name, std::function<void()> function)
+{
+    Job *job = new Job();
+    job->function = std::move(function);
+    job->name = name;
+    job->pending.store(1);
+    job->references.store(2);
+    job->finished = false;
+    job->done.store(false);
+    return job;
+}
+
+void JobSystem::AddDependency(Job *job, Job *dependency)
+{
+    job->pending.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(dependency->mutex);
+    if (dependency->finished)
+        job->pending.fetch_sub(1, std::memory_order_relaxed);
+    else
+        dependency->continuations.push_back(job);
+}
+
+void JobSystem::Submit(Job *job)
+{
+    if (job->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        Enqueue(job);
+}
+
+void JobSystem::Wait(Job *job)
+{
+    while (!job->done.load(std::memory_order_acquire))
+    {
+        Job *other = numThreads > 1 ? FindJob() : nullptr;
+        if (other)
+            Execute(other);
+        else
+            std::this_thread::yield();
+    }
+
+    Release(job);
+}
+
+void JobSystem::Run(const char *name, std::function<void()> function)
+{
+    Job *job = Create(name, std::move(function));
+    job->references.store(1);
+    Submit(job);
+}
+
+void JobSystem::ParallelFor(const char *name, int count, int minBatch, const std::function<void(int, int)> &function)
+{
+    // A few batches per thread leaves room for stealing when batches take uneven time
+    int numBatches = MIN(numThreads * 4, count / MAX(1, minBatch));
+
+    if (numThreads <= 1 || numBatches <= 1)
+    {
+        if (count > 0)
+            function(0, count);
+        return;
+    }
+
+    std::vector<Job *> jobs((size_t)numBatches - 1);
+    for (int b = 1; b < numBatches; b++)
+    {
+        int first = (int)((long long)count * b / numBatches);
+        int last = (int)((long long)count * (b + 1) / numBatches);
+        jobs[b - 1] = Create(name, [&function, first, last]() { function(first, last); });
+        Submit(jobs[b - 1]);
+    }
+
+    function(0, (int)((long long)count / numBatches));
+
+    for (Job *job : jobs)
+        Wait(job);
+}
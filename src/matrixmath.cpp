@@ -0,0 +1,165 @@
+#include "matrixmath.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define MATRIXMATH_X86
+#elif defined(__x86_64__) || defined(__i386__)
+#define MATRIXMATH_X86
+#endif
+
+namespace
+{
+    void ScalarMultiply(const float *left, int leftStep, const float *right, int rightStep, float *result, int count)
+    {
+        const cyMatrix4f *l = (const cyMatrix4f *)left;
+        const cyMatrix4f *r = (const cyMatrix4f *)right;
+        cyMatrix4f *out = (cyMatrix4f *)result;
+
+        for (int i = 0; i < count; i++)
+            out[i] = l[i * leftStep] * r[i * rightStep];
+    }
+
+    void ScalarInverse(const float *matrix, float *result)
+    {
+        *(cyMatrix4f *)result = ((const cyMatrix4f *)matrix)->GetInverse();
+    }
+
+    void ScalarTransformPoints(const float *matrix, const float *points, float *result, int count)
+    {
+        const cyMatrix4f &m = *(const cyMatrix4f *)matrix;
+
+        for (int i = 0; i < count; i++)
+        {
+            cyVec4f p = m * cyVec4f(points[i * 3 + 0], points[i * 3 + 1], points[i * 3 + 2], 1.0f);
+            result[i * 3 + 0] = p.x;
+            result[i * 3 + 1] = p.y;
+            result[i * 3 + 2] = p.z;
+        }
+    }
+
+    const MatrixMath::Kernels scalarKernels = {ScalarMultiply, ScalarInverse, ScalarTransformPoints};
+
+    bool Detect(MatrixMath::Isa isa)
+    {
+#if defined(MATRIXMATH_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        int maxLeaf = info[0];
+
+        __cpuid(info, 1);
+        bool sse41 = (info[2] & (1 << 19)) != 0;
+        bool fma = (info[2] & (1 << 12)) != 0;
+        bool osAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+
+        bool avx2 = false;
+        if (maxLeaf >= 7)
+        {
+            __cpuidex(info, 7, 0);
+            avx2 = (info[1] & (1 << 5)) != 0;
+        }
+
+        if (isa == MatrixMath::SSE41)
+            return sse41;
+        if (isa == MatrixMath::AVX2)
+            return avx2 && fma && osAvx;
+        return true;
+#elif defined(MATRIXMATH_X86)
+        // The builtins also check that the OS saves the AVX registers
+        __builtin_cpu_init();
+        if (isa == MatrixMath::SSE41)
+            return __builtin_cpu_supports("sse4.1");
+        if (isa == MatrixMath::AVX2)
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        return true;
+#else
+        return isa == MatrixMath::Scalar;
+#endif
+    }
+
+    const MatrixMath::Kernels *Table(MatrixMath::Isa isa)
+    {
+        switch (isa)
+        {
+            case MatrixMath::AVX2:
+                return MatrixMath::Avx2Kernels();
+            case MatrixMath::SSE41:
+                return MatrixMath::Sse41Kernels();
+            default:
+                return MatrixMath::ScalarKernels();
+        }
+    }
+
+    MatrixMath::Isa BestIsa(MatrixMath::Isa limit)
+    {
+        for (int isa = limit; isa > MatrixMath::Scalar; isa--)
+        {
+            if (MatrixMath::IsSupported((MatrixMath::Isa)isa))
+                return (MatrixMath::Isa)isa;
+        }
+        return MatrixMath::Scalar;
+    }
+
+    struct Dispatch
+    {
+        MatrixMath::Isa isa;
+        const MatrixMath::Kernels *kernels;
+
+        Dispatch() : isa(BestIsa(MatrixMath::AVX2)), kernels(Table(isa)) {}
+    };
+
+    Dispatch &GetDispatch()
+    {
+        static Dispatch dispatch;
+        return dispatch;
+    }
+}
+
+const char *MatrixMath::IsaNames[MatrixMath::Count] = {"scalar", "sse4.1", "avx2"};
+
+const MatrixMath::Kernels *MatrixMath::ScalarKernels()
+{
+    return &scalarKernels;
+}
+
+bool MatrixMath::IsSupported(Isa isa)
+{
+    static const bool supported[Count] = {true, Sse41Kernels() && Detect(SSE41), Avx2Kernels() && Detect(AVX2)};
+    return supported[isa];
+}
+
+MatrixMath::Isa MatrixMath::GetIsa()
+{
+    return GetDispatch().isa;
+}
+
+void MatrixMath::SetIsa(Isa isa)
+{
+    Dispatch &dispatch = GetDispatch();
+    dispatch.isa = BestIsa(isa);
+    dispatch.kernels = Table(dispatch.isa);
+}
+
+cyMatrix4f MatrixMath::Multiply(const cyMatrix4f &left, const cyMatrix4f &right)
+{
+    cyMatrix4f result;
+    GetDispatch().kernels->multiply(left.cell, 0, right.cell, 0, result.cell, 1);
+    return result;
+}
+
+void MatrixMath::Multiply(const cyMatrix4f *left, int leftStep, const cyMatrix4f *right, int rightStep,
+                          cyMatrix4f *result, int count)
+{
+    GetDispatch().kernels->multiply(left->cell, leftStep, right->cell, rightStep, result->cell, count);
+}
+
+cyMatrix4f MatrixMath::Inverse(const cyMatrix4f &matrix)
+{
+    cyMatrix4f result;
+    GetDispatch().kernels->inverse(matrix.cell, result.cell);
+    return result;
+}
+
+void MatrixMath::TransformPoints(const cyMatrix4f &matrix, const cyVec3f *points, cyVec3f *result, int count)
+{
+    GetDispatch().kernels->transformPoints(matrix.cell, &points->x, &result->x, count);
+}
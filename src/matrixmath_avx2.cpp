@@ -0,0 +1,95 @@
+#include "matrixmath.h"
+
+#if defined(__AVX2__) && defined(__FMA__) || (defined(_MSC_VER) && defined(__AVX2__))
+#include <immintrin.h>
+
+namespace
+{
+    // Two result columns per register: the left columns are repeated in both lanes and the
+    // in-lane permute spreads one weight from each of the two right columns
+    inline __m256 CombinePair(const __m256 *columns, __m256 weights)
+    {
+        __m256 result = _mm256_mul_ps(columns[0], _mm256_permute_ps(weights, 0x00));
+        result = _mm256_fmadd_ps(columns[1], _mm256_permute_ps(weights, 0x55), result);
+        result = _mm256_fmadd_ps(columns[2], _mm256_permute_ps(weights, 0xaa), result);
+        return _mm256_fmadd_ps(columns[3], _mm256_permute_ps(weights, 0xff), result);
+    }
+
+    void MultiplyMatrices(const float *left, int leftStep, const float *right, int rightStep, float *result, int count)
+    {
+        __m256 columns[4];
+
+        for (int i = 0; i < count; i++)
+        {
+            const float *l = left + i * leftStep * 16;
+            const float *r = right + i * rightStep * 16;
+
+            // A shared left matrix stays in registers for the whole batch
+            if (i == 0 || leftStep)
+            {
+                for (int c = 0; c < 4; c++)
+                    columns[c] = _mm256_broadcast_ps((const __m128 *)(l + c * 4));
+            }
+
+            __m256 low = CombinePair(columns, _mm256_loadu_ps(r));
+            __m256 high = CombinePair(columns, _mm256_loadu_ps(r + 8));
+
+            _mm256_storeu_ps(result + i * 16, low);
+            _mm256_storeu_ps(result + i * 16 + 8, high);
+        }
+    }
+
+    inline void StorePoint(float *out, __m128 v)
+    {
+        _mm_storel_pi((__m64 *)out, v);
+        _mm_store_ss(out + 2, _mm_movehl_ps(v, v));
+    }
+
+    inline __m256 Splat(float low, float high)
+    {
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(low)), _mm_set1_ps(high), 1);
+    }
+
+    void TransformPointArray(const float *matrix, const float *points, float *result, int count)
+    {
+        __m256 c0 = _mm256_broadcast_ps((const __m128 *)(matrix + 0));
+        __m256 c1 = _mm256_broadcast_ps((const __m128 *)(matrix + 4));
+        __m256 c2 = _mm256_broadcast_ps((const __m128 *)(matrix + 8));
+        __m256 c3 = _mm256_broadcast_ps((const __m128 *)(matrix + 12));
+
+        // Two points per iteration, one in each lane
+        int i = 0;
+        for (; i + 2 <= count; i += 2)
+        {
+            const float *p = points + i * 3;
+            __m256 v = _mm256_fmadd_ps(c0, Splat(p[0], p[3]),
+                                       _mm256_fmadd_ps(c1, Splat(p[1], p[4]), _mm256_fmadd_ps(c2, Splat(p[2], p[5]), c3)));
+
+            StorePoint(result + i * 3, _mm256_castps256_ps128(v));
+            StorePoint(result + i * 3 + 3, _mm256_extractf128_ps(v, 1));
+        }
+
+        if (i < count)
+        {
+            const float *p = points + i * 3;
+            __m128 v = _mm_fmadd_ps(_mm256_castps256_ps128(c0), _mm_set1_ps(p[0]),
+                                    _mm_fmadd_ps(_mm256_castps256_ps128(c1), _mm_set1_ps(p[1]),
+                                                 _mm_fmadd_ps(_mm256_castps256_ps128(c2), _mm_set1_ps(p[2]),
+                                                              _mm256_castps256_ps128(c3))));
+            StorePoint(result + i * 3, v);
+        }
+    }
+}
+
+const MatrixMath::Kernels *MatrixMath::Avx2Kernels()
+{
+    // A 4x4 inverse fills one SSE register per row already, so AVX2 shares the SSE4.1 kernel
+    static const Kernels kernels = {MultiplyMatrices, Sse41Kernels()->inverse, TransformPointArray};
+    return &kernels;
+}
+#else
+const MatrixMath::Kernels *MatrixMath::Avx2Kernels()
+{
+    return nullptr;
+}
+#endif
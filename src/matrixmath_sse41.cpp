@@ -0,0 +1,141 @@
+#include "matrixmath.h"
+
+#if defined(__SSE4_1__) || (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+#include <smmintrin.h>
+
+#define SHUFFLE(x, y, z, w) ((x) | ((y) << 2) | ((z) << 4) | ((w) << 6))
+
+namespace
+{
+    // Matrices are column major, so each __m128 is one column and a product is a sum of scaled columns
+    inline __m128 Combine(const __m128 *columns, const float *weights)
+    {
+        __m128 result = _mm_mul_ps(columns[0], _mm_set1_ps(weights[0]));
+        result = _mm_add_ps(result, _mm_mul_ps(columns[1], _mm_set1_ps(weights[1])));
+        result = _mm_add_ps(result, _mm_mul_ps(columns[2], _mm_set1_ps(weights[2])));
+        return _mm_add_ps(result, _mm_mul_ps(columns[3], _mm_set1_ps(weights[3])));
+    }
+
+    void MultiplyMatrices(const float *left, int leftStep, const float *right, int rightStep, float *result, int count)
+    {
+        __m128 columns[4];
+
+        for (int i = 0; i < count; i++)
+        {
+            const float *l = left + i * leftStep * 16;
+            const float *r = right + i * rightStep * 16;
+
+            // A shared left matrix stays in registers for the whole batch
+            if (i == 0 || leftStep)
+            {
+                for (int c = 0; c < 4; c++)
+                    columns[c] = _mm_loadu_ps(l + c * 4);
+            }
+
+            // Compute all four before storing so the result may alias either input
+            __m128 c0 = Combine(columns, r + 0), c1 = Combine(columns, r + 4);
+            __m128 c2 = Combine(columns, r + 8), c3 = Combine(columns, r + 12);
+
+            float *out = result + i * 16;
+            _mm_storeu_ps(out + 0, c0);
+            _mm_storeu_ps(out + 4, c1);
+            _mm_storeu_ps(out + 8, c2);
+            _mm_storeu_ps(out + 12, c3);
+        }
+    }
+
+    // 2x2 blocks packed as (m00, m01, m10, m11)
+    inline __m128 Mat2Mul(__m128 a, __m128 b)
+    {
+        return _mm_add_ps(_mm_mul_ps(a, _mm_shuffle_ps(b, b, SHUFFLE(0, 3, 0, 3))),
+                          _mm_mul_ps(_mm_shuffle_ps(a, a, SHUFFLE(1, 0, 3, 2)), _mm_shuffle_ps(b, b, SHUFFLE(2, 1, 2, 1))));
+    }
+
+    // adj(a) * b
+    inline __m128 Mat2AdjMul(__m128 a, __m128 b)
+    {
+        return _mm_sub_ps(_mm_mul_ps(_mm_shuffle_ps(a, a, SHUFFLE(3, 3, 0, 0)), b),
+                          _mm_mul_ps(_mm_shuffle_ps(a, a, SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(b, b, SHUFFLE(2, 3, 0, 1))));
+    }
+
+    // a * adj(b)
+    inline __m128 Mat2MulAdj(__m128 a, __m128 b)
+    {
+        return _mm_sub_ps(_mm_mul_ps(a, _mm_shuffle_ps(b, b, SHUFFLE(3, 0, 3, 0))),
+                          _mm_mul_ps(_mm_shuffle_ps(a, a, SHUFFLE(1, 0, 3, 2)), _mm_shuffle_ps(b, b, SHUFFLE(2, 1, 2, 1))));
+    }
+
+    // Block inverse through 2x2 adjugates. Written for rows, but inverse and transpose commute so columns work too
+    void InvertMatrix(const float *matrix, float *result)
+    {
+        __m128 r0 = _mm_loadu_ps(matrix + 0), r1 = _mm_loadu_ps(matrix + 4);
+        __m128 r2 = _mm_loadu_ps(matrix + 8), r3 = _mm_loadu_ps(matrix + 12);
+
+        __m128 a = _mm_movelh_ps(r0, r1), b = _mm_movehl_ps(r1, r0);
+        __m128 c = _mm_movelh_ps(r2, r3), d = _mm_movehl_ps(r3, r2);
+
+        // Determinants of the four blocks as (|A|, |B|, |C|, |D|)
+        __m128 even02 = _mm_shuffle_ps(r0, r2, SHUFFLE(0, 2, 0, 2)), odd02 = _mm_shuffle_ps(r0, r2, SHUFFLE(1, 3, 1, 3));
+        __m128 even13 = _mm_shuffle_ps(r1, r3, SHUFFLE(0, 2, 0, 2)), odd13 = _mm_shuffle_ps(r1, r3, SHUFFLE(1, 3, 1, 3));
+        __m128 detSub = _mm_sub_ps(_mm_mul_ps(even02, odd13), _mm_mul_ps(odd02, even13));
+        __m128 detA = _mm_shuffle_ps(detSub, detSub, SHUFFLE(0, 0, 0, 0));
+        __m128 detB = _mm_shuffle_ps(detSub, detSub, SHUFFLE(1, 1, 1, 1));
+        __m128 detC = _mm_shuffle_ps(detSub, detSub, SHUFFLE(2, 2, 2, 2));
+        __m128 detD = _mm_shuffle_ps(detSub, detSub, SHUFFLE(3, 3, 3, 3));
+
+        __m128 dc = Mat2AdjMul(d, c);
+        __m128 ab = Mat2AdjMul(a, b);
+
+        __m128 x = _mm_sub_ps(_mm_mul_ps(detD, a), Mat2Mul(b, dc));
+        __m128 w = _mm_sub_ps(_mm_mul_ps(detA, d), Mat2Mul(c, ab));
+        __m128 y = _mm_sub_ps(_mm_mul_ps(detB, c), Mat2MulAdj(d, ab));
+        __m128 z = _mm_sub_ps(_mm_mul_ps(detC, b), Mat2MulAdj(a, dc));
+
+        // |M| = |A||D| + |B||C| - tr(adj(A)B adj(D)C), the trace is one dot product
+        __m128 trace = _mm_dp_ps(ab, _mm_shuffle_ps(dc, dc, SHUFFLE(0, 2, 1, 3)), 0xff);
+        __m128 det = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(detA, detD), _mm_mul_ps(detB, detC)), trace);
+
+        __m128 scale = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), det);
+        x = _mm_mul_ps(x, scale);
+        y = _mm_mul_ps(y, scale);
+        z = _mm_mul_ps(z, scale);
+        w = _mm_mul_ps(w, scale);
+
+        // The adjugate swizzle and the store layout fold into one shuffle per row
+        _mm_storeu_ps(result + 0, _mm_shuffle_ps(x, y, SHUFFLE(3, 1, 3, 1)));
+        _mm_storeu_ps(result + 4, _mm_shuffle_ps(x, y, SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(result + 8, _mm_shuffle_ps(z, w, SHUFFLE(3, 1, 3, 1)));
+        _mm_storeu_ps(result + 12, _mm_shuffle_ps(z, w, SHUFFLE(2, 0, 2, 0)));
+    }
+
+    void TransformPointArray(const float *matrix, const float *points, float *result, int count)
+    {
+        __m128 c0 = _mm_loadu_ps(matrix + 0), c1 = _mm_loadu_ps(matrix + 4);
+        __m128 c2 = _mm_loadu_ps(matrix + 8), c3 = _mm_loadu_ps(matrix + 12);
+
+        for (int i = 0; i < count; i++)
+        {
+            const float *p = points + i * 3;
+            __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p[0])), _mm_mul_ps(c1, _mm_set1_ps(p[1]))),
+                                  _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p[2])), c3));
+
+            // Two stores instead of one wide one, so w never spills into the next point
+            float *out = result + i * 3;
+            _mm_storel_pi((__m64 *)out, v);
+            _mm_store_ss(out + 2, _mm_movehl_ps(v, v));
+        }
+    }
+
+    const MatrixMath::Kernels kernels = {MultiplyMatrices, InvertMatrix, TransformPointArray};
+}
+
+const MatrixMath::Kernels *MatrixMath::Sse41Kernels()
+{
+    return &kernels;
+}
+#else
+const MatrixMath::Kernels *MatrixMath::Sse41Kernels()
+{
+    return nullptr;
+}
+#endif
@@ -1,47 +1,204 @@
 #include "mesh.h"
+#include "commandbuffer.h"
+#include "glstate.h"
+#include "renderstats.h"
+#include "resources.h"
+#include "utils.h"
 
+#include <cstddef>
+#include <string>
+#include <cyMatrix.h>
 #include <glad/glad.h>
 
+// One multi-draw is one API call, but every range is fetched
+static void CountRanges(const int *counts, int numRanges)
+{
+    long long vertices = 0;
+    for (int i = 0; i < numRanges; i++)
+        vertices += counts[i];
+
+    RenderStats::AddDraw(vertices);
+}
+
 Mesh::Mesh()
-    : mVAO(0), mVBO(0), mNumVertices(0)
+    : mVAO(0), mVBO(0), mIBO(0), mNumVertices(0), mNumIndices(0), mIndexType(GL_UNSIGNED_INT),
+      mIndexSize(sizeof(unsigned int))
 {
+    mFormats[0] = {0, sizeof(Vertex), 3, GL_FLOAT, false, true};
+    mFormats[1] = {offsetof(Vertex, normal), sizeof(Vertex), 3, GL_FLOAT, false, true};
+    mFormats[2] = {offsetof(Vertex, texture), sizeof(Vertex), 2, GL_FLOAT, false, true};
+}
+
+static int TypeSize(unsigned int type)
+{
+    switch (type)
+    {
+        case GL_BYTE:
+        case GL_UNSIGNED_BYTE:
+            return 1;
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT:
+            return 2;
+        default:
+            return 4;
+    }
 }
 
 Mesh::~Mesh()
 {
+    Resources::Release(Resources::Buffers, this);
+    glDeleteBuffers(1, &mIBO);
     glDeleteBuffers(1, &mVBO);
+    GLState::ForgetVertexArray(mVAO);
     glDeleteVertexArrays(1, &mVAO);
 }
 
 void Mesh::Create(const Vertex *vertices, int numVertices)
+{
+    CreateBuffers(vertices, numVertices);
+    CreateVertexArray();
+}
+
+void Mesh::CreateIndexed(const Vertex *vertices, int numVertices, const unsigned int *indices, int numIndices)
+{
+    CreateIndexedBuffers(vertices, numVertices, indices, numIndices);
+    CreateVertexArray();
+}
+
+void Mesh::CreateBuffers(const Vertex *vertices, int numVertices)
 {
     mNumVertices = numVertices;
 
-    glGenVertexArrays(1, &mVAO);
     glGenBuffers(1, &mVBO);
-
-    glBindVertexArray(mVAO);
     glBindBuffer(GL_ARRAY_BUFFER, mVBO);
     glBufferData(GL_ARRAY_BUFFER, (long)(mNumVertices * sizeof(Vertex)), vertices, GL_STATIC_DRAW);
+    RenderStats::Add(RenderStats::BufferBytes, (long long)(mNumVertices * sizeof(Vertex)));
+    Resources::Track(Resources::Buffers, this, (long long)(mNumVertices * sizeof(Vertex)),
+                     "mesh " + std::to_string(mNumVertices) + " vertices");
+}
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), nullptr);
-    glEnableVertexAttribArray(0);
+void Mesh::CreateIndexedBuffers(const Vertex *vertices, int numVertices, const unsigned int *indices, int numIndices)
+{
+    CreateBuffers(vertices, numVertices);
 
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)(offsetof(Vertex, normal)));
-    glEnableVertexAttribArray(1);
+    mNumIndices = numIndices;
 
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)(offsetof(Vertex, texture)));
-    glEnableVertexAttribArray(2);
+    glGenBuffers(1, &mIBO);
 
-    glBindVertexArray(0);
+    // The element binding is vertex array state and there is no vertex array yet, so the data goes in through the copy target
+    glBindBuffer(GL_COPY_WRITE_BUFFER, mIBO);
+    glBufferData(GL_COPY_WRITE_BUFFER, (long)(mNumIndices * sizeof(unsigned int)), indices, GL_STATIC_DRAW);
+    RenderStats::Add(RenderStats::BufferBytes, (long long)(mNumIndices * sizeof(unsigned int)));
+    Resources::Track(Resources::Buffers, this, (long long)(mNumVertices * sizeof(Vertex) + mNumIndices * sizeof(unsigned int)),
+                     "indexed mesh " + std::to_string(mNumVertices) + " vertices");
 }
 
-void Mesh::Draw(Shader &shader, Material &material) const
+void Mesh::CreateViewBuffers(const Attribute attributes[3], int numVertices, const void *indices, int numIndices,
+                             unsigned int indexType)
 {
-    if (!mNumVertices)
+    mNumVertices = numVertices;
+
+    // Byte range each attribute reaches, attributes interleaved in one view share a single upload of it
+    const unsigned char *views[3];
+    long long first[3], last[3], placed[3];
+    int viewOf[3];
+    int numViews = 0;
+
+    for (int k = 0; k < 3; k++)
+    {
+        const Attribute &attribute = attributes[k];
+        mFormats[k].enabled = attribute.view != nullptr;
+        if (!mFormats[k].enabled)
+            continue;
+
+        int elementSize = attribute.components * TypeSize(attribute.type);
+        mFormats[k].stride = attribute.stride ? attribute.stride : elementSize;
+        mFormats[k].components = attribute.components;
+        mFormats[k].type = attribute.type;
+        mFormats[k].normalized = attribute.normalized;
+
+        long long begin = attribute.offset;
+        long long end = attribute.offset + (long long)mFormats[k].stride * (numVertices - 1) + elementSize;
+
+        int v = 0;
+        while (v < numViews && views[v] != attribute.view)
+            v++;
+
+        if (v == numViews)
+        {
+            views[v] = (const unsigned char *)attribute.view;
+            first[v] = begin;
+            last[v] = end;
+            numViews++;
+        }
+
+        first[v] = MIN(first[v], begin);
+        last[v] = MAX(last[v], end);
+        viewOf[k] = v;
+    }
+
+    // Ranges go back to back, kept four byte aligned since a glTF view only promises its component alignment
+    long long size = 0;
+    for (int v = 0; v < numViews; v++)
+    {
+        placed[v] = size;
+        size += (last[v] - first[v] + 3) & ~3ll;
+    }
+
+    for (int k = 0; k < 3; k++)
+    {
+        if (mFormats[k].enabled)
+            mFormats[k].offset = placed[viewOf[k]] + attributes[k].offset - first[viewOf[k]];
+    }
+
+    glGenBuffers(1, &mVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+    glBufferData(GL_ARRAY_BUFFER, (long)size, nullptr, GL_STATIC_DRAW);
+
+    for (int v = 0; v < numViews; v++)
+        glBufferSubData(GL_ARRAY_BUFFER, (long)placed[v], (long)(last[v] - first[v]), views[v] + first[v]);
+
+    mNumIndices = numIndices;
+    mIndexType = indexType;
+    mIndexSize = TypeSize(indexType);
+
+    glGenBuffers(1, &mIBO);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, mIBO);
+    glBufferData(GL_COPY_WRITE_BUFFER, (long)((long long)mNumIndices * mIndexSize), indices, GL_STATIC_DRAW);
+
+    long long bytes = size + (long long)mNumIndices * mIndexSize;
+    RenderStats::Add(RenderStats::BufferBytes, bytes);
+    Resources::Track(Resources::Buffers, this, bytes, "view mesh " + std::to_string(mNumVertices) + " vertices");
+}
+
+void Mesh::CreateVertexArray()
+{
+    if (!mVBO || mVAO)
         return;
 
-    shader.Use();
+    glGenVertexArrays(1, &mVAO);
+
+    GLState::BindVertexArray(mVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+
+    for (unsigned int k = 0; k < 3; k++)
+    {
+        const AttributeFormat &format = mFormats[k];
+        if (!format.enabled)
+            continue;
+
+        // Integer types only reach the shader as floats, scaled to 0..1 when normalized
+        glVertexAttribPointer(k, format.components, format.type, format.normalized ? GL_TRUE : GL_FALSE, format.stride,
+                              (void *)(size_t)format.offset);
+        glEnableVertexAttribArray(k);
+    }
+
+    if (mIBO)
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIBO);
+}
+
+void Mesh::UploadMaterial(Shader &shader, Material &material)
+{
     shader.UploadUniform("uMaterial.kDiffuse", material.kDiffuse);
     shader.UploadUniform("uMaterial.kAmbience", material.kAmbience);
     shader.UploadUniform("uMaterial.kSpecular", material.kSpecular);
@@ -58,23 +215,170 @@ void Mesh::Draw(Shader &shader, Material &material) const
     if (material.bAmbience)
         material.tAmbience->Bind(1);
     if (material.bSpecular)
-        material.tAmbience->Bind(2);
+        material.tSpecular->Bind(2);
+}
 
-    glBindVertexArray(mVAO);
+void Mesh::RecordMaterial(CommandBuffer &commands, const Shader &shader, const Material &material)
+{
+    commands.Uniform(shader.GetUniformLocation("uMaterial.kDiffuse"), material.kDiffuse);
+    commands.Uniform(shader.GetUniformLocation("uMaterial.kAmbience"), material.kAmbience);
+    commands.Uniform(shader.GetUniformLocation("uMaterial.kSpecular"), material.kSpecular);
+    commands.Uniform(shader.GetUniformLocation("uMaterial.kShininess"), material.kShininess);
+    commands.Uniform(shader.GetUniformLocation("uMaterial.bDiffuse"), (int)material.bDiffuse);
+    commands.Uniform(shader.GetUniformLocation("uMaterial.mTextureDiffuse"), 0);
+    commands.Uniform(shader.GetUniformLocation("uMaterial.bAmbience"), (int)material.bAmbience);
+    commands.Uniform(shader.GetUniformLocation("uMaterial.mTextureAmbience"), 1);
+    commands.Uniform(shader.GetUniformLocation("uMaterial.bSpecular"), (int)material.bSpecular);
+    commands.Uniform(shader.GetUniformLocation("uMaterial.mTextureSpecular"), 2);
 
-    glDrawArrays(GL_TRIANGLES, 0, mNumVertices);
+    if (material.bDiffuse)
+        commands.Bind(0, *material.tDiffuse);
+    if (material.bAmbience)
+        commands.Bind(1, *material.tAmbience);
+    if (material.bSpecular)
+        commands.Bind(2, *material.tSpecular);
+}
+
+void Mesh::Draw(Shader &shader, Material &material) const
+{
+    if (!mNumVertices)
+        return;
 
-    glBindVertexArray(0);
+    UploadMaterial(shader, material);
+
+    Draw(shader);
 }
 
-void Mesh::Draw(Shader &shader) const
+void Mesh::Draw(Shader &) const
 {
     if (!mNumVertices)
         return;
 
-    glBindVertexArray(mVAO);
+    GLState::BindVertexArray(mVAO);
+
+    if (mIBO)
+    {
+        glDrawElements(GL_TRIANGLES, mNumIndices, mIndexType, nullptr);
+        RenderStats::AddDraw(mNumIndices);
+        return;
+    }
 
     glDrawArrays(GL_TRIANGLES, 0, mNumVertices);
+    RenderStats::AddDraw(mNumVertices);
+}
+
+void Mesh::DrawRanges(Shader &shader, Material &material, const int *firsts, const int *counts, int numRanges) const
+{
+    if (!numRanges)
+        return;
+
+    UploadMaterial(shader, material);
+
+    GLState::BindVertexArray(mVAO);
+
+    glMultiDrawArrays(GL_TRIANGLES, firsts, counts, numRanges);
+    CountRanges(counts, numRanges);
+}
+
+void Mesh::DrawRanges(Shader &, const int *firsts, const int *counts, int numRanges) const
+{
+    if (!numRanges)
+        return;
+
+    GLState::BindVertexArray(mVAO);
+
+    glMultiDrawArrays(GL_TRIANGLES, firsts, counts, numRanges);
+    CountRanges(counts, numRanges);
+}
+
+void Mesh::DrawElements(Shader &shader, Material &material, int firstIndex, int numIndices) const
+{
+    if (!numIndices || !mNumIndices)
+        return;
+
+    UploadMaterial(shader, material);
+
+    GLState::BindVertexArray(mVAO);
+
+    glDrawElements(GL_TRIANGLES, numIndices, mIndexType, (void *)((size_t)firstIndex * mIndexSize));
+    RenderStats::AddDraw(numIndices);
+}
+
+void Mesh::DrawElements(Shader &, int firstIndex, int numIndices) const
+{
+    if (!numIndices || !mNumIndices)
+        return;
+
+    GLState::BindVertexArray(mVAO);
+
+    glDrawElements(GL_TRIANGLES, numIndices, mIndexType, (void *)((size_t)firstIndex * mIndexSize));
+    RenderStats::AddDraw(numIndices);
+}
+
+void Mesh::BindInstances(unsigned int buffer, int firstInstance) const
+{
+    // GL 3.3 has no base instance, so each instance range is selected by moving the attribute offset
+    size_t offset = (size_t)firstInstance * sizeof(cyMatrix4f);
+
+    GLState::BindVertexArray(mVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+    for (int column = 0; column < 4; column++)
+    {
+        glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(cyMatrix4f),
+                              (void *)(offset + column * sizeof(cyVec4f)));
+        glEnableVertexAttribArray(3 + column);
+        glVertexAttribDivisor(3 + column, 1);
+    }
+}
+
+void Mesh::DrawInstanced(Shader &shader, Material &material, int numInstances) const
+{
+    if (!mNumVertices || !numInstances)
+        return;
+
+    UploadMaterial(shader, material);
+
+    GLState::BindVertexArray(mVAO);
+
+    glDrawArraysInstanced(GL_TRIANGLES, 0, mNumVertices, numInstances);
+    RenderStats::AddDraw(mNumVertices, numInstances);
+}
+
+void Mesh::DrawInstanced(Shader &, int numInstances) const
+{
+    if (!mNumVertices || !numInstances)
+        return;
+
+    GLState::BindVertexArray(mVAO);
+
+    glDrawArraysInstanced(GL_TRIANGLES, 0, mNumVertices, numInstances);
+    RenderStats::AddDraw(mNumVertices, numInstances);
+}
+
+void Mesh::DrawElementsInstanced(Shader &shader, Material &material, int firstIndex, int numIndices,
+                                 int numInstances) const
+{
+    if (!numIndices || !mNumIndices || !numInstances)
+        return;
+
+    UploadMaterial(shader, material);
+
+    GLState::BindVertexArray(mVAO);
+
+    glDrawElementsInstanced(GL_TRIANGLES, numIndices, mIndexType, (void *)((size_t)firstIndex * mIndexSize),
+                            numInstances);
+    RenderStats::AddDraw(numIndices, numInstances);
+}
+
+void Mesh::DrawElementsInstanced(Shader &, int firstIndex, int numIndices, int numInstances) const
+{
+    if (!numIndices || !mNumIndices || !numInstances)
+        return;
+
+    GLState::BindVertexArray(mVAO);
 
-    glBindVertexArray(0);
+    glDrawElementsInstanced(GL_TRIANGLES, numIndices, mIndexType, (void *)((size_t)firstIndex * mIndexSize),
+                            numInstances);
+    RenderStats::AddDraw(numIndices, numInstances);
 }
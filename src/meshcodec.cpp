@@ -0,0 +1,910 @@
+#include "meshcodec.h"
+#include "jobsystem.h"
+#include "matrixmath.h"
+#include "profiler.h"
+#include "utils.h"
+
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define MESHCODEC_SSE2
+#endif
+
+static const unsigned int Magic = 0x4d4f4547; // "GEOM"
+static const unsigned int Version = 3;
+
+// Big enough that the frequency table is noise, small enough that a mesh splits into a chunk per worker
+static const int ChunkSize = 1 << 18;
+
+static const int ProbabilityBits = MeshCodec::RansProbabilityBits;
+static const unsigned int ProbabilityScale = 1u << ProbabilityBits;
+static const unsigned int RansLow = MeshCodec::RansLow;
+static const int RansLanes = MeshCodec::RansLanes;
+
+static const float QuantizeMax = 65535.0f;
+
+enum ChunkMode
+{
+    Raw, Constant, Rans
+};
+
+struct FileHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    long long sourceSize;
+    long long sourceTime;
+    unsigned int numLibraries;
+    unsigned int numVertices, numFaces, numNormals, numTextures, numMaterials;
+    unsigned int numChunks;
+    long long rawBytes;
+    float positionMin[3], positionScale[3];
+    float textureMin[2], textureScale[2];
+};
+
+// Size and time of a material library, its name as the OBJ gives it follows
+struct FileLibrary
+{
+    long long size;
+    long long time;
+};
+
+// Material colors as cyTriMesh keeps them, the strings follow each one
+struct FileMaterial
+{
+    float ka[3], kd[3], ks[3];
+    float ns;
+    int faceEnd;
+};
+
+namespace
+{
+    struct Reader
+    {
+        const unsigned char *data;
+        size_t size, offset;
+
+        bool Read(void *out, size_t bytes)
+        {
+            if (bytes > size - offset)
+                return false;
+
+            memcpy(out, data + offset, bytes);
+            offset += bytes;
+            return true;
+        }
+
+        bool ReadString(std::string &string)
+        {
+            unsigned int length;
+            if (!Read(&length, sizeof(length)) || length > size - offset)
+                return false;
+
+            string.assign((const char *)data + offset, length);
+            offset += length;
+            return true;
+        }
+
+        bool ReadString(cyTriMesh::Str &string)
+        {
+            std::string text;
+            if (!ReadString(text))
+                return false;
+
+            string = text.empty() ? nullptr : text.c_str();
+            return true;
+        }
+    };
+
+    void Write(std::vector<unsigned char> &out, const void *data, size_t bytes)
+    {
+        out.insert(out.end(), (const unsigned char *)data, (const unsigned char *)data + bytes);
+    }
+
+    void WriteString(std::vector<unsigned char> &out, const char *string)
+    {
+        unsigned int length = string ? (unsigned int)strlen(string) : 0;
+        Write(out, &length, sizeof(length));
+        Write(out, string, length);
+    }
+
+    // Plane layout of the payload, in file order
+    struct Layout
+    {
+        size_t positions, normals, textures, faces, normalFaces, textureFaces, size;
+
+        Layout(const FileHeader &header)
+        {
+            size_t corners = (size_t)header.numFaces * 3;
+            positions = 0;
+            normals = positions + (size_t)header.numVertices * 6;
+            textures = normals + (size_t)header.numNormals * 4;
+            faces = textures + (size_t)header.numTextures * 4;
+            normalFaces = faces + corners * 4;
+            textureFaces = normalFaces + (header.numNormals ? corners * 4 : 0);
+            size = textureFaces + (header.numTextures ? corners * 4 : 0);
+        }
+    };
+}
+
+static FileLibrary GetSource(const char *fileName)
+{
+    struct stat info = {};
+    stat(fileName, &info);
+    return {(long long)info.st_size, (long long)info.st_mtime};
+}
+
+static std::string GetDirectory(const char *fileName)
+{
+    const char *pathEnd = strrchr(fileName, '/');
+    if (!pathEnd)
+        pathEnd = strrchr(fileName, '\\');
+
+    return pathEnd ? std::string(fileName, pathEnd + 1) : std::string();
+}
+
+// The mtllib lines of an OBJ, named the way cyTriMesh resolves them against the OBJ's directory
+static std::vector<std::string> FindLibraries(const char *objFileName)
+{
+    std::vector<std::string> libraries;
+    FILE *in = fopen(objFileName, "r");
+    if (!in)
+        return libraries;
+
+    char line[4096];
+    bool lineStart = true;
+    while (fgets(line, sizeof(line), in))
+    {
+        size_t length = strlen(line);
+        bool isLineStart = lineStart;
+        lineStart = length && line[length - 1] == '\n';
+
+        if (!isLineStart || strncmp(line, "mtllib", 6) || !isspace((unsigned char)line[6]))
+            continue;
+
+        while (length && isspace((unsigned char)line[length - 1]))
+            length--;
+
+        size_t first = 6;
+        while (first < length && isspace((unsigned char)line[first]))
+            first++;
+
+        if (first < length)
+            libraries.push_back(std::string(line + first, length - first));
+    }
+
+    fclose(in);
+    return libraries;
+}
+
+// --- Delta, zigzag and byte planes ---
+
+static void EncodeStream16(const unsigned short *values, int count, unsigned char *lo, unsigned char *hi)
+{
+    unsigned short previous = 0;
+    for (int i = 0; i < count; i++)
+    {
+        unsigned short delta = (unsigned short)(values[i] - previous);
+        unsigned short zigzag = (unsigned short)((delta << 1) ^ (unsigned short)((short)delta >> 15));
+        lo[i] = (unsigned char)zigzag;
+        hi[i] = (unsigned char)(zigzag >> 8);
+        previous = values[i];
+    }
+}
+
+static void EncodeStream32(const unsigned int *values, int count, unsigned char *planes, size_t planeSize)
+{
+    unsigned int previous = 0;
+    for (int i = 0; i < count; i++)
+    {
+        unsigned int delta = values[i] - previous;
+        unsigned int zigzag = (delta << 1) ^ (unsigned int)((int)delta >> 31);
+        for (int b = 0; b < 4; b++)
+            planes[b * planeSize + i] = (unsigned char)(zigzag >> (b * 8));
+        previous = values[i];
+    }
+}
+
+// Interleaves the planes back into zigzag deltas, undoes the zigzag and sums the deltas up, 16 values per step
+static void DecodeStream16(const unsigned char *lo, const unsigned char *hi, int count, unsigned short *out)
+{
+    int i = 0;
+    unsigned short previous = 0;
+
+#ifdef MESHCODEC_SSE2
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i carry = zero;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i l = _mm_loadu_si128((const __m128i *)(lo + i));
+        __m128i h = _mm_loadu_si128((const __m128i *)(hi + i));
+        __m128i values[2] = {_mm_unpacklo_epi8(l, h), _mm_unpackhi_epi8(l, h)};
+
+        for (int k = 0; k < 2; k++)
+        {
+            __m128i x = values[k];
+            x = _mm_xor_si128(_mm_srli_epi16(x, 1), _mm_sub_epi16(zero, _mm_and_si128(x, one)));
+
+            // Inclusive prefix sum over the eight lanes, then the running total of everything before them
+            x = _mm_add_epi16(x, _mm_slli_si128(x, 2));
+            x = _mm_add_epi16(x, _mm_slli_si128(x, 4));
+            x = _mm_add_epi16(x, _mm_slli_si128(x, 8));
+            x = _mm_add_epi16(x, carry);
+            _mm_storeu_si128((__m128i *)(out + i + k * 8), x);
+
+            carry = _mm_shuffle_epi32(_mm_shufflehi_epi16(x, 0xff), 0xff);
+        }
+    }
+
+    if (i)
+        previous = out[i - 1];
+#endif
+
+    for (; i < count; i++)
+    {
+        unsigned short zigzag = (unsigned short)(lo[i] | (hi[i] << 8));
+        unsigned short delta = (unsigned short)((zigzag >> 1) ^ (unsigned short)(-(zigzag & 1)));
+        previous = (unsigned short)(previous + delta);
+        out[i] = previous;
+    }
+}
+
+static void DecodeStream32(const unsigned char *planes, size_t planeSize, int count, unsigned int *out)
+{
+    const unsigned char *b0 = planes, *b1 = planes + planeSize, *b2 = planes + planeSize * 2, *b3 = planes + planeSize * 3;
+    int i = 0;
+    unsigned int previous = 0;
+
+#ifdef MESHCODEC_SSE2
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i carry = zero;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i p0 = _mm_loadu_si128((const __m128i *)(b0 + i));
+        __m128i p1 = _mm_loadu_si128((const __m128i *)(b1 + i));
+        __m128i p2 = _mm_loadu_si128((const __m128i *)(b2 + i));
+        __m128i p3 = _mm_loadu_si128((const __m128i *)(b3 + i));
+
+        __m128i low01 = _mm_unpacklo_epi8(p0, p1), high01 = _mm_unpackhi_epi8(p0, p1);
+        __m128i low23 = _mm_unpacklo_epi8(p2, p3), high23 = _mm_unpackhi_epi8(p2, p3);
+        __m128i values[4] = {_mm_unpacklo_epi16(low01, low23), _mm_unpackhi_epi16(low01, low23),
+                             _mm_unpacklo_epi16(high01, high23), _mm_unpackhi_epi16(high01, high23)};
+
+        for (int k = 0; k < 4; k++)
+        {
+            __m128i x = values[k];
+            x = _mm_xor_si128(_mm_srli_epi32(x, 1), _mm_sub_epi32(zero, _mm_and_si128(x, one)));
+
+            x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+            x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+            x = _mm_add_epi32(x, carry);
+            _mm_storeu_si128((__m128i *)(out + i + k * 4), x);
+
+            carry = _mm_shuffle_epi32(x, 0xff);
+        }
+    }
+
+    if (i)
+        previous = out[i - 1];
+#endif
+
+    for (; i < count; i++)
+    {
+        unsigned int zigzag = b0[i] | (b1[i] << 8) | (b2[i] << 16) | ((unsigned int)b3[i] << 24);
+        previous += (zigzag >> 1) ^ (0u - (zigzag & 1));
+        out[i] = previous;
+    }
+}
+
+// --- Order-0 rANS with 32 interleaved states, 16 bit renormalization ---
+
+// Scales the counts to ProbabilityScale, every present symbol keeps at least one slot
+static void NormalizeFrequencies(const unsigned int *counts, int total, unsigned int *freq)
+{
+    int sum = 0;
+    for (int s = 0; s < 256; s++)
+    {
+        freq[s] = counts[s] ? MAX(1u, (unsigned int)((unsigned long long)counts[s] * ProbabilityScale / total)) : 0;
+        sum += (int)freq[s];
+    }
+
+    // Rounding is settled on the most frequent symbols, which feel it least
+    while (sum != (int)ProbabilityScale)
+    {
+        int largest = 0;
+        for (int s = 1; s < 256; s++)
+        {
+            if (freq[s] > freq[largest])
+                largest = s;
+        }
+
+        if (sum > (int)ProbabilityScale)
+        {
+            int step = MIN(sum - (int)ProbabilityScale, (int)freq[largest] / 2);
+            freq[largest] -= (unsigned int)MAX(step, 1);
+            sum -= MAX(step, 1);
+        }
+        else
+        {
+            freq[largest] += ProbabilityScale - (unsigned int)sum;
+            sum = (int)ProbabilityScale;
+        }
+    }
+}
+
+static inline void RansPut(unsigned int &state, unsigned char *&cursor, unsigned int start, unsigned int freq)
+{
+    // With 16 bits out at a time a single shift always brings the state back in range
+    if (state >= ((RansLow >> ProbabilityBits) << 16) * freq)
+    {
+        cursor -= 2;
+        cursor[0] = (unsigned char)state;
+        cursor[1] = (unsigned char)(state >> 8);
+        state >>= 16;
+    }
+
+    state = ((state / freq) << ProbabilityBits) + state % freq + start;
+}
+
+// Returns the chunk as stored, mode byte first
+static void EncodeChunk(const unsigned char *in, int count, std::vector<unsigned char> &out)
+{
+    unsigned int counts[256] = {};
+    for (int i = 0; i < count; i++)
+        counts[in[i]]++;
+
+    out.clear();
+
+    if (counts[in[0]] == (unsigned int)count)
+    {
+        out.push_back(Constant);
+        out.push_back(in[0]);
+        return;
+    }
+
+    unsigned int freq[256], start[256];
+    NormalizeFrequencies(counts, count, freq);
+    start[0] = 0;
+    for (int s = 1; s < 256; s++)
+        start[s] = start[s - 1] + freq[s - 1];
+
+    // Written back to front, worst case is a little over one byte per symbol, in 16 bit words
+    std::vector<unsigned char> buffer((size_t)count + 64);
+    unsigned char *end = buffer.data() + buffer.size();
+    unsigned char *cursor = end;
+
+    // Symbol i belongs to state i % RansLanes, the decoder reads the words back in symbol order
+    unsigned int states[RansLanes];
+    for (int k = 0; k < RansLanes; k++)
+        states[k] = RansLow;
+
+    for (int i = count - 1; i >= 0; i--)
+    {
+        unsigned char s = in[i];
+        RansPut(states[i % RansLanes], cursor, start[s], freq[s]);
+
+        if (cursor - buffer.data() < 8)
+            break;
+    }
+
+    size_t header = 1 + 256 * sizeof(unsigned short) + sizeof(states);
+    if (cursor - buffer.data() < 8 || header + (size_t)(end - cursor) >= (size_t)count + 1)
+    {
+        out.push_back(Raw);
+        out.insert(out.end(), in, in + count);
+        return;
+    }
+
+    out.push_back(Rans);
+    for (int s = 0; s < 256; s++)
+    {
+        unsigned short f = (unsigned short)freq[s];
+        Write(out, &f, sizeof(f));
+    }
+    Write(out, states, sizeof(states));
+    out.insert(out.end(), cursor, end);
+}
+
+// CPU detection is shared with MatrixMath, whose AVX2 level covers what the kernel uses
+static MeshCodec::RansDecoder GetRansDecoder()
+{
+    static const MeshCodec::RansDecoder decoder =
+        MatrixMath::IsSupported(MatrixMath::AVX2) ? MeshCodec::Avx2RansDecoder() : nullptr;
+    return decoder;
+}
+
+static bool DecodeChunk(const unsigned char *in, size_t size, unsigned char *out, int count,
+                        MeshCodec::RansDecoder decoder)
+{
+    if (!size)
+        return false;
+
+    const unsigned char *end = in + size;
+
+    if (in[0] == Raw)
+    {
+        if (size != (size_t)count + 1)
+            return false;
+        memcpy(out, in + 1, (size_t)count);
+        return true;
+    }
+
+    if (in[0] == Constant)
+    {
+        if (size != 2)
+            return false;
+        memset(out, in[1], (size_t)count);
+        return true;
+    }
+
+    unsigned int states[RansLanes];
+    size_t header = 1 + 256 * sizeof(unsigned short) + sizeof(states);
+    if (in[0] != Rans || size < header)
+        return false;
+
+    // One lookup per symbol: frequency in the top 12 bits, slot offset within the symbol's range, then the symbol.
+    // A Rans chunk has at least two symbols so no frequency reaches ProbabilityScale
+    unsigned int slots[ProbabilityScale];
+    unsigned int next = 0;
+
+    for (int s = 0; s < 256; s++)
+    {
+        unsigned short f;
+        memcpy(&f, in + 1 + s * sizeof(f), sizeof(f));
+
+        if (f >= ProbabilityScale || next + f > ProbabilityScale)
+            return false;
+
+        for (unsigned int k = 0; k < f; k++)
+            slots[next + k] = ((unsigned int)f << 20) | (k << 8) | (unsigned int)s;
+        next += f;
+    }
+
+    if (next != ProbabilityScale)
+        return false;
+
+    memcpy(states, in + 1 + 256 * sizeof(unsigned short), sizeof(states));
+    const unsigned char *cursor = in + header;
+    const unsigned int mask = ProbabilityScale - 1;
+
+    // The kernel takes the bulk, this loop the rounds close to the end of the input and the partial last round
+    int i = decoder ? decoder(slots, states, cursor, end, out, count) : 0;
+    for (; i < count; i++)
+    {
+        unsigned int &state = states[i % RansLanes];
+        unsigned int entry = slots[state & mask];
+        out[i] = (unsigned char)entry;
+        state = (entry >> 20) * (state >> ProbabilityBits) + ((entry >> 8) & mask);
+
+        if (state < RansLow)
+        {
+            if (end - cursor < 2)
+                return false;
+            state = (state << 16) | cursor[0] | (cursor[1] << 8);
+            cursor += 2;
+        }
+    }
+
+    // Every byte the encoder wrote has to be read back, anything else means the chunk is damaged
+    return cursor == end;
+}
+
+// --- Quantization ---
+
+static unsigned short Quantize(float value, float min, float inverseScale)
+{
+    float q = (value - min) * inverseScale + 0.5f;
+    return (unsigned short)CLAMP(0.0f, q, QuantizeMax);
+}
+
+static void RangeOf(const cyVec3f *values, int count, int components, float *min, float *scale)
+{
+    for (int c = 0; c < components; c++)
+    {
+        float low = count ? values[0][c] : 0, high = low;
+        for (int i = 1; i < count; i++)
+        {
+            low = MIN(low, values[i][c]);
+            high = MAX(high, values[i][c]);
+        }
+
+        min[c] = low;
+        scale[c] = (high - low) / QuantizeMax;
+    }
+}
+
+// Octahedral mapping, the lower hemisphere is folded over the diagonals
+static void EncodeNormal(const cyVec3f &n, unsigned short &u, unsigned short &v)
+{
+    float length = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    float x = length > 0 ? n.x / length : 0;
+    float y = length > 0 ? n.y / length : 0;
+
+    if (length > 0 && n.z < 0)
+    {
+        float foldedX = (1 - fabsf(y)) * (x >= 0 ? 1 : -1);
+        float foldedY = (1 - fabsf(x)) * (y >= 0 ? 1 : -1);
+        x = foldedX;
+        y = foldedY;
+    }
+
+    u = Quantize(x, -1, QuantizeMax / 2);
+    v = Quantize(y, -1, QuantizeMax / 2);
+}
+
+static cyVec3f DecodeNormal(unsigned short u, unsigned short v)
+{
+    cyVec3f n(u * (2 / QuantizeMax) - 1, v * (2 / QuantizeMax) - 1, 0);
+    n.z = 1 - fabsf(n.x) - fabsf(n.y);
+
+    float t = MAX(-n.z, 0.0f);
+    n.x += n.x >= 0 ? -t : t;
+    n.y += n.y >= 0 ? -t : t;
+    return n.GetNormalized();
+}
+
+// --- Files ---
+
+bool MeshCodec::Save(const char *fileName, const cyTriMesh &mesh, const char *objFileName, Stats *stats)
+{
+    PROFILE_SCOPE("MeshCodec::Save");
+
+    FileLibrary source = GetSource(objFileName);
+    std::vector<std::string> libraries = FindLibraries(objFileName);
+    std::string directory = GetDirectory(objFileName);
+
+    FileHeader header = {};
+    header.magic = Magic;
+    header.version = Version;
+    header.sourceSize = source.size;
+    header.sourceTime = source.time;
+    header.numLibraries = (unsigned int)libraries.size();
+    header.numVertices = mesh.NV();
+    header.numFaces = mesh.NF();
+    header.numNormals = mesh.NVN();
+    header.numTextures = mesh.NVT();
+    header.numMaterials = mesh.NM();
+
+    if (mesh.NV())
+        RangeOf(&mesh.V(0), (int)mesh.NV(), 3, header.positionMin, header.positionScale);
+    if (mesh.NVT())
+        RangeOf(&mesh.VT(0), (int)mesh.NVT(), 2, header.textureMin, header.textureScale);
+
+    Layout layout(header);
+    std::vector<unsigned char> payload(layout.size);
+    std::vector<unsigned short> quantized((size_t)MAX(mesh.NV(), MAX(mesh.NVN(), mesh.NVT())) * 2);
+    unsigned short *first = quantized.data(), *second = first + quantized.size() / 2;
+    int corners = (int)mesh.NF() * 3;
+
+    for (int c = 0; c < 3; c++)
+    {
+        float inverseScale = header.positionScale[c] > 0 ? 1 / header.positionScale[c] : 0;
+        for (int i = 0; i < (int)mesh.NV(); i++)
+            first[i] = Quantize(mesh.V(i)[c], header.positionMin[c], inverseScale);
+
+        unsigned char *plane = &payload[layout.positions + (size_t)c * 2 * mesh.NV()];
+        EncodeStream16(first, (int)mesh.NV(), plane, plane + mesh.NV());
+    }
+
+    for (int i = 0; i < (int)mesh.NVN(); i++)
+        EncodeNormal(mesh.VN(i), first[i], second[i]);
+
+    for (int c = 0; c < 2 && mesh.NVN(); c++)
+    {
+        unsigned char *plane = &payload[layout.normals + (size_t)c * 2 * mesh.NVN()];
+        EncodeStream16(c ? second : first, (int)mesh.NVN(), plane, plane + mesh.NVN());
+    }
+
+    for (int c = 0; c < 2 && mesh.NVT(); c++)
+    {
+        float inverseScale = header.textureScale[c] > 0 ? 1 / header.textureScale[c] : 0;
+        for (int i = 0; i < (int)mesh.NVT(); i++)
+            first[i] = Quantize(mesh.VT(i)[c], header.textureMin[c], inverseScale);
+
+        unsigned char *plane = &payload[layout.textures + (size_t)c * 2 * mesh.NVT()];
+        EncodeStream16(first, (int)mesh.NVT(), plane, plane + mesh.NVT());
+    }
+
+    if (corners)
+    {
+        EncodeStream32(mesh.F(0).v, corners, &payload[layout.faces], (size_t)corners);
+        if (mesh.NVN())
+            EncodeStream32(mesh.FN(0).v, corners, &payload[layout.normalFaces], (size_t)corners);
+        if (mesh.NVT())
+            EncodeStream32(mesh.FT(0).v, corners, &payload[layout.textureFaces], (size_t)corners);
+    }
+
+    header.rawBytes = (long long)payload.size();
+    header.numChunks = (unsigned int)((payload.size() + ChunkSize - 1) / ChunkSize);
+
+    std::vector<std::vector<unsigned char>> chunks(header.numChunks);
+    JobSystem::ParallelFor("MeshCodec encode", (int)header.numChunks, 1, [&](int firstChunk, int lastChunk)
+    {
+        for (int c = firstChunk; c < lastChunk; c++)
+        {
+            size_t offset = (size_t)c * ChunkSize;
+            EncodeChunk(&payload[offset], (int)MIN((size_t)ChunkSize, payload.size() - offset), chunks[c]);
+        }
+    });
+
+    std::vector<unsigned char> file;
+    Write(file, &header, sizeof(header));
+
+    for (const std::string &library : libraries)
+    {
+        FileLibrary stored = GetSource((directory + library).c_str());
+        Write(file, &stored, sizeof(stored));
+        WriteString(file, library.c_str());
+    }
+
+    for (int i = 0; i < (int)mesh.NM(); i++)
+    {
+        const cyTriMesh::Mtl &source = mesh.M(i);
+        FileMaterial material = {};
+        memcpy(material.ka, source.Ka, sizeof(material.ka));
+        memcpy(material.kd, source.Kd, sizeof(material.kd));
+        memcpy(material.ks, source.Ks, sizeof(material.ks));
+        material.ns = source.Ns;
+        material.faceEnd = mesh.GetMaterialFirstFace(i) + mesh.GetMaterialFaceCount(i);
+        Write(file, &material, sizeof(material));
+
+        WriteString(file, source.name.data);
+        WriteString(file, source.map_Ka.data);
+        WriteString(file, source.map_Kd.data);
+        WriteString(file, source.map_Ks.data);
+    }
+
+    for (const std::vector<unsigned char> &chunk : chunks)
+    {
+        unsigned int size = (unsigned int)chunk.size();
+        Write(file, &size, sizeof(size));
+    }
+
+    for (const std::vector<unsigned char> &chunk : chunks)
+        Write(file, chunk.data(), chunk.size());
+
+    FILE *out = fopen(fileName, "wb");
+    if (!out)
+        return false;
+
+    bool written = fwrite(file.data(), 1, file.size(), out) == file.size();
+    written = fclose(out) == 0 && written;
+
+    // A partial file would only be rejected on the next run, better not to leave it around
+    if (!written)
+        remove(fileName);
+
+    if (stats)
+    {
+        stats->rawBytes = header.rawBytes;
+        stats->compressedBytes = (long long)file.size();
+    }
+
+    return written;
+}
+
+bool MeshCodec::Load(const char *fileName, TriMesh &mesh, const char *objFileName, Stats *stats)
+{
+    PROFILE_SCOPE("MeshCodec::Load");
+
+    FileLibrary source = GetSource(objFileName);
+
+    FILE *in = fopen(fileName, "rb");
+    if (!in)
+        return false;
+
+    FileHeader header = {};
+    bool valid = fread(&header, sizeof(header), 1, in) == 1 && header.magic == Magic && header.version == Version &&
+                 header.sourceSize == source.size && header.sourceTime == source.time;
+
+    std::vector<unsigned char> file;
+    if (valid)
+    {
+        fseek(in, 0, SEEK_END);
+        long size = ftell(in);
+        fseek(in, 0, SEEK_SET);
+
+        file.resize(size > 0 ? (size_t)size : 0);
+        valid = !file.empty() && fread(file.data(), 1, file.size(), in) == file.size();
+    }
+
+    fclose(in);
+
+    // Counts come from the file, so they are checked against what the payload and the rest of the file can hold
+    // before anything is sized by them. Every library, material and chunk takes at least its fixed part in the file
+    Layout layout(header);
+    unsigned long long remaining = file.size() > sizeof(header) ? file.size() - sizeof(header) : 0;
+    unsigned long long smallest = (unsigned long long)header.numLibraries * (sizeof(FileLibrary) + sizeof(unsigned int)) +
+                                  (unsigned long long)header.numMaterials * (sizeof(FileMaterial) + 4 * sizeof(unsigned int)) +
+                                  (unsigned long long)header.numChunks * (sizeof(unsigned int) + 2);
+    valid = valid && header.rawBytes == (long long)layout.size && header.numFaces <= (1u << 30) &&
+            header.numChunks == (layout.size + ChunkSize - 1) / ChunkSize && smallest <= remaining;
+
+    if (!valid)
+        return false;
+
+    Reader reader = {file.data(), file.size(), sizeof(header)};
+
+    // A material library edited since the copy was made means the materials in it are stale
+    std::string directory = GetDirectory(objFileName);
+    for (unsigned int i = 0; valid && i < header.numLibraries; i++)
+    {
+        FileLibrary stored;
+        std::string library;
+        valid = reader.Read(&stored, sizeof(stored)) && reader.ReadString(library);
+
+        FileLibrary current = GetSource((directory + library).c_str());
+        valid = valid && current.size == stored.size && current.time == stored.time;
+    }
+
+    if (!valid)
+        return false;
+
+    mesh.Clear();
+    mesh.SetNumVertex(header.numVertices);
+    mesh.SetNumFaces(header.numFaces);
+    mesh.SetNumNormals(header.numNormals);
+    mesh.SetNumTexVerts(header.numTextures);
+    mesh.SetNumMtls(header.numMaterials);
+
+    for (int i = 0; valid && i < (int)header.numMaterials; i++)
+    {
+        cyTriMesh::Mtl &material = mesh.M(i);
+        FileMaterial stored = {};
+        valid = reader.Read(&stored, sizeof(stored)) && reader.ReadString(material.name) &&
+                reader.ReadString(material.map_Ka) && reader.ReadString(material.map_Kd) &&
+                reader.ReadString(material.map_Ks) && stored.faceEnd >= (i ? mesh.GetMaterialFirstFace(i) : 0) &&
+                stored.faceEnd <= (int)header.numFaces;
+
+        memcpy(material.Ka, stored.ka, sizeof(stored.ka));
+        memcpy(material.Kd, stored.kd, sizeof(stored.kd));
+        memcpy(material.Ks, stored.ks, sizeof(stored.ks));
+        material.Ns = stored.ns;
+        mesh.SetMaterialFaceEnd(i, stored.faceEnd);
+    }
+
+    std::vector<unsigned int> chunkSizes(header.numChunks);
+    std::vector<size_t> chunkOffsets(header.numChunks);
+    valid = valid && reader.Read(chunkSizes.data(), chunkSizes.size() * sizeof(unsigned int));
+
+    size_t offset = reader.offset;
+    for (size_t c = 0; valid && c < chunkSizes.size(); c++)
+    {
+        chunkOffsets[c] = offset;
+        offset += chunkSizes[c];
+        valid = offset <= file.size();
+    }
+
+    if (!valid)
+    {
+        mesh.Clear();
+        return false;
+    }
+
+    // Entropy stage, every chunk on its own
+    std::vector<unsigned char> payload(layout.size);
+    std::atomic<bool> decoded(true);
+    MeshCodec::RansDecoder decoder = GetRansDecoder();
+
+    JobSystem::ParallelFor("MeshCodec decode", (int)header.numChunks, 1, [&](int firstChunk, int lastChunk)
+    {
+        for (int c = firstChunk; c < lastChunk; c++)
+        {
+            size_t start = (size_t)c * ChunkSize;
+            int count = (int)MIN((size_t)ChunkSize, payload.size() - start);
+            if (!DecodeChunk(&file[chunkOffsets[c]], chunkSizes[c], &payload[start], count, decoder))
+                decoded.store(false, std::memory_order_relaxed);
+        }
+    });
+
+    if (!decoded.load())
+    {
+        mesh.Clear();
+        return false;
+    }
+
+    // Streams rebuild in parallel, each one a serial prefix sum
+    int numVertices = (int)header.numVertices, numNormals = (int)header.numNormals;
+    int numTextures = (int)header.numTextures, corners = (int)header.numFaces * 3;
+
+    JobSystem::ParallelFor("MeshCodec streams", 6, 1, [&](int firstStream, int lastStream)
+    {
+        std::vector<unsigned short> first, second;
+
+        for (int stream = firstStream; stream < lastStream; stream++)
+        {
+            switch (stream)
+            {
+                case 0:
+                {
+                    first.resize((size_t)numVertices);
+                    for (int c = 0; c < 3; c++)
+                    {
+                        const unsigned char *plane = &payload[layout.positions + (size_t)c * 2 * numVertices];
+                        DecodeStream16(plane, plane + numVertices, numVertices, first.data());
+
+                        for (int i = 0; i < numVertices; i++)
+                            mesh.V(i)[c] = header.positionMin[c] + first[i] * header.positionScale[c];
+                    }
+                    break;
+                }
+                case 1:
+                {
+                    first.resize((size_t)numNormals);
+                    second.resize((size_t)numNormals);
+                    const unsigned char *plane = &payload[layout.normals];
+                    DecodeStream16(plane, plane + numNormals, numNormals, first.data());
+                    DecodeStream16(plane + 2 * numNormals, plane + 3 * numNormals, numNormals, second.data());
+
+                    for (int i = 0; i < numNormals; i++)
+                        mesh.VN(i) = DecodeNormal(first[i], second[i]);
+                    break;
+                }
+                case 2:
+                {
+                    first.resize((size_t)numTextures);
+                    for (int c = 0; c < 2; c++)
+                    {
+                        const unsigned char *plane = &payload[layout.textures + (size_t)c * 2 * numTextures];
+                        DecodeStream16(plane, plane + numTextures, numTextures, first.data());
+
+                        for (int i = 0; i < numTextures; i++)
+                            mesh.VT(i)[c] = header.textureMin[c] + first[i] * header.textureScale[c];
+                    }
+                    for (int i = 0; i < numTextures; i++)
+                        mesh.VT(i).z = 0;
+                    break;
+                }
+                case 3:
+                    if (corners)
+                        DecodeStream32(&payload[layout.faces], (size_t)corners, corners, mesh.F(0).v);
+                    break;
+                case 4:
+                    if (corners && numNormals)
+                        DecodeStream32(&payload[layout.normalFaces], (size_t)corners, corners, mesh.FN(0).v);
+                    break;
+                case 5:
+                    if (corners && numTextures)
+                        DecodeStream32(&payload[layout.textureFaces], (size_t)corners, corners, mesh.FT(0).v);
+                    break;
+            }
+        }
+    });
+
+    // Indices are used unchecked downstream, a damaged file must not get that far
+    for (int f = 0; valid && f < (int)header.numFaces; f++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            valid = valid && mesh.F(f).v[k] < header.numVertices &&
+                    (!numNormals || mesh.FN(f).v[k] < header.numNormals) &&
+                    (!numTextures || mesh.FT(f).v[k] < header.numTextures);
+        }
+    }
+
+    if (!valid)
+    {
+        mesh.Clear();
+        return false;
+    }
+
+    if (stats)
+    {
+        stats->rawBytes = header.rawBytes;
+        stats->compressedBytes = (long long)file.size();
+    }
+
+    return true;
+}
@@ -0,0 +1,101 @@
+#include "meshcodec.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+namespace
+{
+    // For every renormalization mask of eight lanes, the input word each lane takes: the lanes that read do so in
+    // lane order, so lane k takes the word after the ones read by the lanes below it
+    struct WordPermutations
+    {
+        int lanes[256][8];
+        int bytes[256];
+
+        WordPermutations()
+        {
+            for (int mask = 0; mask < 256; mask++)
+            {
+                int word = 0;
+                for (int k = 0; k < 8; k++)
+                {
+                    lanes[mask][k] = word;
+                    if (mask & (1 << k))
+                        word++;
+                }
+                bytes[mask] = word * 2;
+            }
+        }
+    };
+
+    const WordPermutations permutations;
+
+    // One step of eight states: look the slots up, advance the states, and pull a 16 bit word into the ones that fell
+    // below RansLow. A step never needs more than one word per lane
+    inline __m256i Step(__m256i x, const unsigned int *slots, const unsigned char *&cursor, __m256i &symbols)
+    {
+        const __m256i mask = _mm256_set1_epi32((int)((1u << MeshCodec::RansProbabilityBits) - 1));
+        const __m256i low = _mm256_set1_epi32((int)(MeshCodec::RansLow - 1));
+
+        __m256i entry = _mm256_i32gather_epi32((const int *)slots, _mm256_and_si256(x, mask), 4);
+        symbols = _mm256_and_si256(entry, _mm256_set1_epi32(0xff));
+
+        __m256i freq = _mm256_srli_epi32(entry, 20);
+        __m256i bias = _mm256_and_si256(_mm256_srli_epi32(entry, 8), mask);
+        x = _mm256_add_epi32(_mm256_mullo_epi32(freq, _mm256_srli_epi32(x, MeshCodec::RansProbabilityBits)), bias);
+
+        // Unsigned x < RansLow, states reach above 2^31 so a signed compare would not do
+        __m256i renormalize = _mm256_cmpeq_epi32(_mm256_min_epu32(x, low), x);
+        int lanes = _mm256_movemask_ps(_mm256_castsi256_ps(renormalize));
+
+        __m256i words = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)cursor));
+        words = _mm256_permutevar8x32_epi32(words, _mm256_loadu_si256((const __m256i *)permutations.lanes[lanes]));
+        cursor += permutations.bytes[lanes];
+
+        return _mm256_blendv_epi8(x, _mm256_or_si256(_mm256_slli_epi32(x, 16), words), renormalize);
+    }
+
+    int DecodeRans(const unsigned int *slots, unsigned int *states, const unsigned char *&cursor,
+                   const unsigned char *end, unsigned char *out, int count)
+    {
+        // Four independent registers keep enough gathers in flight to hide their latency
+        static_assert(MeshCodec::RansLanes == 32, "the kernel keeps the states in four registers");
+
+        __m256i x[4];
+        for (int r = 0; r < 4; r++)
+            x[r] = _mm256_loadu_si256((const __m256i *)(states + r * 8));
+
+        // Each step loads 16 bytes, so there have to be 64 left for a whole round
+        const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+        int i = 0;
+        for (; i + MeshCodec::RansLanes <= count && end - cursor >= 64; i += MeshCodec::RansLanes)
+        {
+            __m256i symbols[4];
+            for (int r = 0; r < 4; r++)
+                x[r] = Step(x[r], slots, cursor, symbols[r]);
+
+            // 32 bit symbols down to bytes, packing works within 128 bit halves so the dwords are put back in order
+            __m256i bytes = _mm256_packus_epi16(_mm256_packus_epi32(symbols[0], symbols[1]),
+                                                _mm256_packus_epi32(symbols[2], symbols[3]));
+            _mm256_storeu_si256((__m256i *)(out + i), _mm256_permutevar8x32_epi32(bytes, order));
+        }
+
+        for (int r = 0; r < 4; r++)
+            _mm256_storeu_si256((__m256i *)(states + r * 8), x[r]);
+        return i;
+    }
+}
+
+MeshCodec::RansDecoder MeshCodec::Avx2RansDecoder()
+{
+    return DecodeRans;
+}
+
+#else
+
+MeshCodec::RansDecoder MeshCodec::Avx2RansDecoder()
+{
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,253 @@
+#include "meshlet.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64)
+#include <xmmintrin.h>
+#define MESHLET_SSE
+#endif
+
+enum
+{
+    CenterX = 0, CenterY, CenterZ, Radius, AxisX, AxisY, AxisZ, Cutoff, NumFields
+};
+
+static unsigned int SpreadBits(unsigned int v)
+{
+    // 10 bits spread out to every third bit for a 30 bit Morton code
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+static cyVec3f FaceNormal(const Mesh::Vertex *triangle)
+{
+    cyVec3f n = (triangle[1].position - triangle[0].position) ^ (triangle[2].position - triangle[0].position);
+    float length = n.Length();
+    return length > 0 ? n / length : cyVec3f(0, 0, 0);
+}
+
+MeshletList::MeshletList()
+    : mCount(0), mStride(0), mData(nullptr), mFirstVertex(nullptr), mNumVertices(nullptr), mVisible(nullptr)
+{
+}
+
+MeshletList::~MeshletList()
+{
+    delete[] mData;
+    delete[] mFirstVertex;
+    delete[] mNumVertices;
+    delete[] mVisible;
+}
+
+void MeshletList::Build(Mesh::Vertex *vertices, int numVertices, int trianglesPerMeshlet)
+{
+    int numTriangles = numVertices / 3;
+
+    if (!numTriangles)
+        return;
+
+    cyVec3f boundMin = vertices[0].position, boundMax = vertices[0].position;
+    for (int i = 1; i < numVertices; i++)
+    {
+        const cyVec3f &p = vertices[i].position;
+        boundMin.Set(MIN(boundMin.x, p.x), MIN(boundMin.y, p.y), MIN(boundMin.z, p.z));
+        boundMax.Set(MAX(boundMax.x, p.x), MAX(boundMax.y, p.y), MAX(boundMax.z, p.z));
+    }
+
+    cyVec3f extent = boundMax - boundMin;
+    cyVec3f scale(extent.x > 0 ? 1023.0f / extent.x : 0, extent.y > 0 ? 1023.0f / extent.y : 0,
+                  extent.z > 0 ? 1023.0f / extent.z : 0);
+
+    // Group triangles by dominant normal direction first so cones stay narrow, then by Morton order
+    std::vector<unsigned long long> keys((size_t)numTriangles);
+    for (int t = 0; t < numTriangles; t++)
+    {
+        const Mesh::Vertex *triangle = vertices + t * 3;
+        cyVec3f n = FaceNormal(triangle);
+        cyVec3f c = (triangle[0].position + triangle[1].position + triangle[2].position) / 3.0f - boundMin;
+
+        int axis = fabsf(n.x) > fabsf(n.y) ? (fabsf(n.x) > fabsf(n.z) ? 0 : 2) : (fabsf(n.y) > fabsf(n.z) ? 1 : 2);
+        unsigned long long bucket = (unsigned long long)(axis * 2 + (n[axis] < 0 ? 1 : 0));
+
+        unsigned int morton = SpreadBits((unsigned int)(c.x * scale.x)) |
+                              (SpreadBits((unsigned int)(c.y * scale.y)) << 1) |
+                              (SpreadBits((unsigned int)(c.z * scale.z)) << 2);
+
+        // Bucket and the top 29 Morton bits share the high word, the triangle index is the low word
+        keys[t] = ((bucket << 29 | morton >> 1) << 32) | (unsigned long long)t;
+    }
+
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<Mesh::Vertex> sorted(vertices, vertices + numTriangles * 3);
+    for (int t = 0; t < numTriangles; t++)
+    {
+        int source = (int)(keys[t] & 0xffffffffu);
+        std::copy(sorted.begin() + source * 3, sorted.begin() + source * 3 + 3, vertices + t * 3);
+    }
+
+    mCount = (numTriangles + trianglesPerMeshlet - 1) / trianglesPerMeshlet;
+    mStride = (mCount + 3) & ~3;
+    mData = new float[mStride * NumFields]();
+    mFirstVertex = new int[mCount];
+    mNumVertices = new int[mCount];
+    mVisible = new unsigned char[mStride];
+
+    for (int m = 0; m < mCount; m++)
+    {
+        int firstTriangle = m * trianglesPerMeshlet;
+        int count = MIN(trianglesPerMeshlet, numTriangles - firstTriangle);
+        const Mesh::Vertex *meshletVertices = vertices + firstTriangle * 3;
+
+        mFirstVertex[m] = firstTriangle * 3;
+        mNumVertices[m] = count * 3;
+
+        cyVec3f low = meshletVertices[0].position, high = meshletVertices[0].position;
+        cyVec3f axis(0, 0, 0);
+        for (int t = 0; t < count; t++)
+        {
+            for (int v = 0; v < 3; v++)
+            {
+                const cyVec3f &p = meshletVertices[t * 3 + v].position;
+                low.Set(MIN(low.x, p.x), MIN(low.y, p.y), MIN(low.z, p.z));
+                high.Set(MAX(high.x, p.x), MAX(high.y, p.y), MAX(high.z, p.z));
+            }
+            axis += FaceNormal(meshletVertices + t * 3);
+        }
+
+        cyVec3f center = (low + high) * 0.5f;
+        float radius = 0;
+        for (int v = 0; v < count * 3; v++)
+            radius = MAX(radius, (meshletVertices[v].position - center).Length());
+
+        // Smallest cosine between the average normal and any triangle normal gives the cone spread
+        float axisLength = axis.Length();
+        float minDot = 1;
+        if (axisLength > 0)
+        {
+            axis /= axisLength;
+            for (int t = 0; t < count; t++)
+                minDot = MIN(minDot, axis.Dot(FaceNormal(meshletVertices + t * 3)));
+        }
+        else
+        {
+            minDot = -1;
+        }
+
+        mData[CenterX * mStride + m] = center.x;
+        mData[CenterY * mStride + m] = center.y;
+        mData[CenterZ * mStride + m] = center.z;
+        mData[Radius * mStride + m] = radius;
+        mData[AxisX * mStride + m] = axis.x;
+        mData[AxisY * mStride + m] = axis.y;
+        mData[AxisZ * mStride + m] = axis.z;
+        mData[Cutoff * mStride + m] = minDot <= 0.1f ? 1.0f : sqrtf(1.0f - minDot * minDot);
+    }
+}
+
+int MeshletList::Cull(const Frustum &frustum, const cyVec3f &viewPosition, bool coneCulling)
+{
+    const float *cx = mData + CenterX * mStride;
+    const float *cy = mData + CenterY * mStride;
+    const float *cz = mData + CenterZ * mStride;
+    const float *r = mData + Radius * mStride;
+    const float *ax = mData + AxisX * mStride;
+    const float *ay = mData + AxisY * mStride;
+    const float *az = mData + AxisZ * mStride;
+    const float *cutoff = mData + Cutoff * mStride;
+
+    int numVisible = 0;
+
+#ifdef MESHLET_SSE
+    // Arrays are padded to a multiple of four, so there is no scalar tail
+    for (int i = 0; i < mStride; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(cx + i), y = _mm_loadu_ps(cy + i), z = _mm_loadu_ps(cz + i);
+        __m128 radius = _mm_loadu_ps(r + i);
+        __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), radius);
+        __m128 visible = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+
+        for (int p = 0; p < 6; p++)
+        {
+            const cyVec4f &plane = frustum.GetPlane(p);
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+                                         _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+            visible = _mm_and_ps(visible, _mm_cmpge_ps(distance, negRadius));
+        }
+
+        if (coneCulling)
+        {
+            __m128 dx = _mm_sub_ps(x, _mm_set1_ps(viewPosition.x));
+            __m128 dy = _mm_sub_ps(y, _mm_set1_ps(viewPosition.y));
+            __m128 dz = _mm_sub_ps(z, _mm_set1_ps(viewPosition.z));
+            __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+            __m128 facing = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_loadu_ps(ax + i)), _mm_mul_ps(dy, _mm_loadu_ps(ay + i))),
+                                       _mm_mul_ps(dz, _mm_loadu_ps(az + i)));
+            __m128 limit = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(cutoff + i), length), radius);
+            visible = _mm_andnot_ps(_mm_cmpge_ps(facing, limit), visible);
+        }
+
+        int mask = _mm_movemask_ps(visible);
+        for (int j = 0; j < 4; j++)
+            mVisible[i + j] = (unsigned char)((mask >> j) & 1);
+    }
+
+    for (int i = 0; i < mCount; i++)
+        numVisible += mVisible[i];
+#else
+    for (int i = 0; i < mCount; i++)
+    {
+        bool visible = frustum.TestSphere(cyVec3f(cx[i], cy[i], cz[i]), r[i]);
+
+        if (visible && coneCulling)
+        {
+            cyVec3f d(cx[i] - viewPosition.x, cy[i] - viewPosition.y, cz[i] - viewPosition.z);
+            visible = d.Dot(cyVec3f(ax[i], ay[i], az[i])) < cutoff[i] * d.Length() + r[i];
+        }
+
+        mVisible[i] = (unsigned char)visible;
+        numVisible += mVisible[i];
+    }
+#endif
+
+    return numVisible;
+}
+
+int MeshletList::Emit(int *firsts, int *counts, int &numVertices) const
+{
+    int numRanges = 0;
+    numVertices = 0;
+
+    for (int i = 0; i < mCount; i++)
+    {
+        if (!mVisible[i])
+            continue;
+
+        numVertices += mNumVertices[i];
+
+        // Neighbouring meshlets are contiguous in the vertex buffer, so they merge into one range
+        if (numRanges && firsts[numRanges - 1] + counts[numRanges - 1] == mFirstVertex[i])
+        {
+            counts[numRanges - 1] += mNumVertices[i];
+            continue;
+        }
+
+        firsts[numRanges] = mFirstVertex[i];
+        counts[numRanges] = mNumVertices[i];
+        numRanges++;
+    }
+
+    return numRanges;
+}
+
+int MeshletList::GetCount() const
+{
+    return mCount;
+}
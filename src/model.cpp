@@ -1,222 +1,1097 @@
 #include "model.h"
 #include "cyTriMesh.h"
+#include "utils.h"
+#include "simplify.h"
+#include "profiler.h"
+#include "startupreport.h"
+#include "resources.h"
+#include "jobsystem.h"
+#include "uploadcontext.h"
+#include "gltf.h"
+#include "meshcodec.h"
+
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+static const int TrianglesPerMeshlet = 64;
+
+// Each LOD aims at half the triangles of the previous one and the chain stops once that stops paying off
+static const int MinLodTriangles = 64;
+static const unsigned int LodCacheMagic = 0x31444f4c; // "LOD1"
+static const unsigned int LodCacheVersion = 1;
+
+struct LodCacheHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    long long sourceSize;
+    long long sourceTime;
+    int numMeshes;
+    int reserved;
+};
+
+// Written with fwrite, so every byte of the header has to be a member
+static_assert(sizeof(LodCacheHeader) == 32, "LodCacheHeader must not have padding");
+
+struct Model::LoadState
+{
+    MeshCodec::TriMesh mesh;
+    std::string directory;
+    std::vector<std::string> texturePaths;
+
+    // Sub-meshes are built in file order, so the LOD cache is read and written front to back
+    std::string cachePath;
+    FILE *cacheIn = nullptr;
+    FILE *cacheOut = nullptr;
+
+    // Scratch positions shared by the whole file and every sub-mesh
+    Vec3Buffer positions;
+
+    ~LoadState()
+    {
+        if (cacheIn)
+            fclose(cacheIn);
+        if (cacheOut)
+            fclose(cacheOut);
+    }
+
+    bool HasTextures(int mesh) const
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            if (!texturePaths[mesh * 3 + k].empty())
+                return true;
+        }
+        return false;
+    }
+};
 
 Model::Model()
-    : mMeshes(nullptr), mMaterials(nullptr), mNumMeshes(0)
+    : mMeshes(nullptr), mMaterials(nullptr), mBounds(nullptr), mNumMeshes(0), mBaseMaterials(nullptr),
+      mMeshStates(nullptr), mNumLoaded(0), mNumTexturesLoaded(0), mNumTextures(0), mVisible(nullptr), mNumCulled(0),
+      mMeshlets(nullptr), mRangeFirsts(nullptr), mRangeCounts(nullptr), mNumVertices(nullptr), mConeCulling(true),
+      mLodMeshes(nullptr), mLods(nullptr), mIndexed(false), mImageTextures(nullptr), mNumImages(0), mLoadThreads(0),
+      mNormalWeighting(Geometry::Area), mReady(false)
 {
 }
 
 Model::~Model()
 {
+    // Material textures are owned by the model, every OBJ material has its own
+    for (int i = 0; i < (mMaterials && !mImageTextures ? mNumMeshes : 0); i++)
+    {
+        delete mMaterials[i].tDiffuse;
+        delete mMaterials[i].tAmbience;
+        delete mMaterials[i].tSpecular;
+    }
+
+    for (int i = 0; i < mNumImages; i++)
+        delete mImageTextures[i];
+
+    delete[] mImageTextures;
+    delete[] mLods;
+    delete[] mLodMeshes;
+    delete[] mNumVertices;
+    delete[] mRangeCounts;
+    delete[] mRangeFirsts;
+    delete[] mMeshlets;
+    delete[] mVisible;
+    delete[] mMeshStates;
+    delete[] mBaseMaterials;
+    delete[] mBounds;
     delete[] mMaterials;
     delete[] mMeshes;
 }
 
+static Bounds ComputeBounds(const Mesh::Vertex *vertices, int numVertices, Vec3Buffer &positions)
+{
+    positions.Assign(&vertices[0].position.x, numVertices, sizeof(Mesh::Vertex) / sizeof(float));
+    return positions.ComputeBounds();
+}
+
+void Model::SetLoadThreads(int threads)
+{
+    mLoadThreads = threads;
+}
+
+void Model::SetNormalWeighting(Geometry::Weighting weighting)
+{
+    mNormalWeighting = weighting;
+}
+
 bool Model::LoadFromFile(const char *fileName)
 {
-    cyTriMesh cyMesh;
+    LoadState state;
+    if (!LoadData(state, fileName))
+        return false;
+
+    for (int i = 0; i < mNumMeshes; i++)
+        Publish(i, Geometry | Textured);
+
+    mReady.store(true, std::memory_order_release);
+    return true;
+}
+
+void Model::LoadAsync(const char *fileName)
+{
+    std::string name = fileName;
+
+    UploadContext::Submit("Model::LoadAsync",
+                          [this, name]()
+                          {
+                              LoadState state;
+                              return LoadData(state, name.c_str());
+                          },
+                          [this, name](bool loaded)
+                          {
+                              if (!loaded)
+                              {
+                                  Utils::Warning(("Unable to load " + name).c_str());
+                                  return;
+                              }
+
+                              for (int i = 0; i < mNumMeshes; i++)
+                                  Publish(i, Geometry | Textured);
+
+                              mReady.store(true, std::memory_order_release);
+                          });
+}
+
+bool Model::LoadProgressive(const char *fileName)
+{
+    // Nothing in a GLB load is worth spreading over frames, its buffers come straight from the mapped file
+    if (GlbFile::IsGlb(fileName))
+        return LoadFromFile(fileName);
+
+    PROFILE_SCOPE("Model::LoadProgressive");
+    StartupReport::Phase phase("Model parse");
+
+    auto state = std::make_shared<LoadState>();
+    if (!Parse(*state, fileName))
+        return false;
+
+    // Nothing is drawable yet, but the model can already be sized and queued
+    mReady.store(true, std::memory_order_release);
+    SubmitMesh(state, 0);
+    return true;
+}
+
+void Model::SubmitMesh(std::shared_ptr<LoadState> state, int mesh)
+{
+    bool hasTextures = state->HasTextures(mesh);
+
+    UploadContext::Submit("Model::BuildMesh",
+                          [this, state, mesh, hasTextures]() mutable
+                          {
+                              BuildMesh(*state, mesh);
+
+                              // Textures decode and upload on another context while the next sub-mesh builds
+                              if (hasTextures)
+                              {
+                                  UploadContext::Submit("Model::LoadTextures",
+                                                        [this, state, mesh]() mutable
+                                                        {
+                                                            LoadTextures(*state, mesh, mesh + 1);
+                                                            state.reset();
+                                                            return true;
+                                                        },
+                                                        [this, mesh](bool) { Publish(mesh, Textured); });
+                              }
+
+                              if (mesh + 1 < mNumMeshes)
+                                  SubmitMesh(state, mesh + 1);
+
+                              // Whichever stage finishes last frees the parsed file on its loader, not on the GL thread
+                              state.reset();
+                              return true;
+                          },
+                          [this, mesh, hasTextures](bool)
+                          {
+                              Publish(mesh, hasTextures ? Geometry : Geometry | Textured);
+                          });
+}
+
+bool Model::IsReady() const
+{
+    return mReady.load(std::memory_order_acquire);
+}
+
+Model::LoadProgress Model::GetLoadProgress() const
+{
+    LoadProgress progress;
+    progress.meshes = mNumLoaded.load(std::memory_order_acquire);
+    progress.numMeshes = mNumMeshes;
+    progress.textures = mNumTexturesLoaded.load(std::memory_order_acquire);
+    progress.numTextures = mNumTextures;
+    return progress;
+}
+
+void Model::Publish(int mesh, int state)
+{
+    if (state & Geometry)
+    {
+        mMeshes[mesh].CreateVertexArray();
+        mLodMeshes[mesh].CreateVertexArray();
+    }
+
+    if (state & Textured)
+    {
+        const Mesh::Material &material = mMaterials[mesh];
+        int numTextures = (material.tDiffuse ? 1 : 0) + (material.tAmbience ? 1 : 0) + (material.tSpecular ? 1 : 0);
+        mNumTexturesLoaded.fetch_add(numTextures, std::memory_order_release);
+    }
+
+    mMeshStates[mesh].fetch_or(state, std::memory_order_release);
+
+    // Uploads on different contexts can finish out of order, the prefix only grows over sub-meshes with geometry
+    int loaded = mNumLoaded.load(std::memory_order_relaxed);
+    while (loaded < mNumMeshes && (mMeshStates[loaded].load(std::memory_order_relaxed) & Geometry))
+        loaded++;
+
+    mNumLoaded.store(loaded, std::memory_order_release);
+}
+
+Mesh::Material *Model::GetDrawMaterial(int mesh)
+{
+    return (mMeshStates[mesh].load(std::memory_order_acquire) & Textured) ? &mMaterials[mesh] : &mBaseMaterials[mesh];
+}
+
+bool Model::LoadData(LoadState &state, const char *fileName)
+{
+    PROFILE_SCOPE("Model::LoadData");
+    StartupReport::Phase phase("Model load");
+
+    if (GlbFile::IsGlb(fileName))
+        return LoadGlb(fileName);
+
+    if (!Parse(state, fileName))
+        return false;
+
+    for (int i = 0; i < mNumMeshes; i++)
+        BuildMesh(state, i);
+
+    LoadTextures(state, 0, mNumMeshes);
+
+    return true;
+}
+
+bool Model::Parse(LoadState &state, const char *fileName)
+{
+    cyTriMesh &cyMesh = state.mesh;
 
     // get the path from filename
-    char *directory = nullptr;
     char const *pathEnd = strrchr(fileName, '\\');
     if (!pathEnd) 
         pathEnd = strrchr(fileName, '/');
     if (pathEnd) 
+        state.directory.assign(fileName, pathEnd + 1);
+
+    int threads = mLoadThreads > 0 ? mLoadThreads : Geometry::DefaultThreads();
+
+    // The compressed copy holds the mesh as it is once its normals are done, so a hit skips both the parse and them
+    std::string geometryPath = std::string(fileName) + ".geom";
+    bool decoded;
     {
-        int n = int(pathEnd - fileName) + 1;
-        directory = new char[n + 1];
-        strncpy(directory, fileName, n);
-        directory[n] = '\0';
+        StartupReport::Phase decode("Geometry decode");
+        decoded = MeshCodec::Load(geometryPath.c_str(), state.mesh, fileName);
     }
 
-    if (!cyMesh.LoadFromFileObj(fileName, true))
-        return false;
+    if (!decoded)
+    {
+        {
+            PROFILE_SCOPE("cyTriMesh::LoadFromFileObj");
+            StartupReport::Phase parse("OBJ parse");
+            if (!cyMesh.LoadFromFileObj(fileName, true))
+                return false;
+        }
 
-    // Ensure model has normals
-    if (!cyMesh.HasNormals())
-        cyMesh.ComputeNormals();
+        // Ensure model has normals
+        if (!cyMesh.HasNormals())
+        {
+            StartupReport::Phase normals("Normal computation");
+            Geometry::ComputeNormals(cyMesh, mNormalWeighting, threads);
+        }
+        else if (cyMesh.NVN())
+        {
+            // Exported normals are not always unit length and the shaders assume they are
+            Vec3Buffer normals;
+            normals.Assign(&cyMesh.VN(0).x, (int)cyMesh.NVN(), 3);
+            normals.Normalize();
+            normals.Store(&cyMesh.VN(0).x, 3);
+        }
 
-    cyMesh.ComputeBoundingBox();
+        StartupReport::Phase encode("Geometry encode");
+        if (!MeshCodec::Save(geometryPath.c_str(), cyMesh, fileName))
+            Utils::Warning("Unable to write geometry cache.");
+    }
 
-    cyVec3f boundMin = cyMesh.GetBoundMin();
-    cyVec3f boundMax = cyMesh.GetBoundMax();
+    if (cyMesh.NV())
+        state.positions.Assign(&cyMesh.V(0).x, (int)cyMesh.NV(), 3);
 
-    mScale.x = boundMax.x - boundMin.x;
-    mScale.y = boundMax.y - boundMin.y;
-    mScale.z = boundMax.z - boundMin.z;
+    mModelBounds = Geometry::ComputeBounds(state.positions, threads);
+    mScale = mModelBounds.max - mModelBounds.min;
 
     mNumMeshes = (int)cyMesh.NM();
 
     if (!cyMesh.NM())
         mNumMeshes = 1;
 
-    mMaterials = new Mesh::Material[mNumMeshes];
+    Allocate(mNumMeshes);
+
+    for (int i = 0; i < mNumMeshes; i++)
+        mNumVertices[i] = (cyMesh.NM() ? cyMesh.GetMaterialFaceCount(i) : (int)cyMesh.NF()) * 3;
+
+    state.texturePaths.resize((size_t)mNumMeshes * 3);
+    for (int i = 0; i < (int)cyMesh.NM(); i++)
+    {
+        const char *maps[3] = {cyMesh.M(i).map_Kd, cyMesh.M(i).map_Ka, cyMesh.M(i).map_Ks};
+        for (int k = 0; k < 3; k++)
+        {
+            if (maps[k])
+            {
+                state.texturePaths[i * 3 + k] = state.directory + maps[k];
+                mNumTextures++;
+            }
+        }
+    }
+
+    // Simplified LODs are cached next to the model and regenerated whenever the source file changes
+    state.cachePath = std::string(fileName) + ".lod";
+    struct stat sourceInfo = {};
+    stat(fileName, &sourceInfo);
+
+    LodCacheHeader header = {LodCacheMagic, LodCacheVersion, (long long)sourceInfo.st_size,
+                             (long long)sourceInfo.st_mtime, mNumMeshes, 0};
+    LodCacheHeader cached = {};
+    state.cacheIn = fopen(state.cachePath.c_str(), "rb");
+
+    if (state.cacheIn && (fread(&cached, sizeof(cached), 1, state.cacheIn) != 1 || cached.magic != header.magic ||
+                          cached.version != header.version || cached.sourceSize != header.sourceSize ||
+                          cached.sourceTime != header.sourceTime || cached.numMeshes != header.numMeshes))
+    {
+        fclose(state.cacheIn);
+        state.cacheIn = nullptr;
+    }
+
+    if (!state.cacheIn)
+    {
+        state.cacheOut = fopen(state.cachePath.c_str(), "wb");
+        if (state.cacheOut)
+            fwrite(&header, sizeof(header), 1, state.cacheOut);
+        else
+            Utils::Warning("Unable to write LOD cache.");
+    }
+
+    BuildCullData();
+
+    return true;
+}
+
+void Model::Allocate(int numMeshes)
+{
+    mNumMeshes = numMeshes;
+
+    mMaterials = new Mesh::Material[mNumMeshes]();
+    mBaseMaterials = new Mesh::Material[mNumMeshes]();
+    mMeshStates = new std::atomic<int>[mNumMeshes];
     mMeshes = new Mesh[mNumMeshes];
+    mBounds = new Bounds[mNumMeshes];
+    mMeshlets = new MeshletList[mNumMeshes];
+    mNumVertices = new int[mNumMeshes];
+    mLodMeshes = new Mesh[mNumMeshes];
+    mLods = new LodChain[mNumMeshes];
 
-    if (cyMesh.NM())
+    for (int i = 0; i < mNumMeshes; i++)
+        mMeshStates[i].store(0, std::memory_order_relaxed);
+}
+
+static Mesh::Attribute MakeAttribute(const GlbFile::Accessor &accessor)
+{
+    Mesh::Attribute attribute = {accessor.view, accessor.offset, accessor.stride, accessor.components,
+                                 accessor.componentType, accessor.normalized};
+    return attribute;
+}
+
+// Metallic roughness mapped onto the Blinn-Phong material. The metallic roughness texture is not read, so metallic
+// only tints the specular color and the diffuse keeps the full base color
+static void ConvertMaterial(const GlbFile::Material &source, Mesh::Material &material)
+{
+    float metallic = CLAMP(0.0f, source.metallic, 1.0f);
+    float roughness = CLAMP(0.05f, source.roughness, 1.0f);
+
+    material.kDiffuse = source.baseColor;
+    material.kAmbience = source.baseColor;
+    material.kSpecular = cyVec3f(0.04f, 0.04f, 0.04f) * (1 - metallic) + source.baseColor * metallic;
+
+    // Beckmann to Phong equivalence with alpha = roughness squared
+    material.kShininess = CLAMP(1.0f, 2 / (roughness * roughness * roughness * roughness) - 2, 512.0f);
+    material.bCastShadows = true;
+}
+
+bool Model::LoadGlb(const char *fileName)
+{
+    PROFILE_SCOPE("Model::LoadGlb");
+
+    GlbFile file;
+    {
+        StartupReport::Phase parse("GLB parse");
+        if (!file.Open(fileName))
+            return false;
+    }
+
+    if (!file.GetNumPrimitives())
     {
-        for (int i = 0; i < mNumMeshes; i++)
+        Utils::Warning((std::string(fileName) + " has no triangles.").c_str());
+        return false;
+    }
+
+    Allocate(file.GetNumPrimitives());
+    mIndexed = true;
+    mModelBounds = {cyVec3f(1e30f, 1e30f, 1e30f), cyVec3f(-1e30f, -1e30f, -1e30f)};
+
+    // Only primitives without indices or normals need anything built on the CPU
+    std::vector<unsigned int> sequence;
+    std::vector<cyTriMesh::TriFace> faces;
+    std::vector<cyVec3f> positions, normals;
+    int threads = mLoadThreads > 0 ? mLoadThreads : Geometry::DefaultThreads();
+
+    StartupReport::BeginPhase("GLB upload");
+    for (int i = 0; i < mNumMeshes; i++)
+    {
+        const GlbFile::Primitive &primitive = file.GetPrimitive(i);
+        const GlbFile::Accessor &index = primitive.indices;
+        int numVertices = primitive.position.count;
+
+        Mesh::Attribute attributes[3] = {MakeAttribute(primitive.position), MakeAttribute(primitive.normal),
+                                         MakeAttribute(primitive.texture)};
+
+        const void *indices = index.view ? index.view + index.offset : nullptr;
+        int numIndices = index.view ? index.count : numVertices;
+        unsigned int indexType = index.view ? index.componentType : (unsigned int)GlbFile::UnsignedInt;
+
+        if (!indices)
         {
-            int faceCount = cyMesh.GetMaterialFaceCount(i);
-            int firstFace = cyMesh.GetMaterialFirstFace(i);
+            sequence.resize((size_t)numVertices);
+            for (int v = 0; v < numVertices; v++)
+                sequence[v] = (unsigned int)v;
+            indices = sequence.data();
+        }
 
-            auto *vertices = new Mesh::Vertex[faceCount * 3];
+        if (!primitive.normal.view)
+        {
+            int stride = primitive.position.stride ? primitive.position.stride : (int)sizeof(cyVec3f);
+            const unsigned char *position = primitive.position.view + primitive.position.offset;
+            positions.resize((size_t)numVertices);
+            for (int v = 0; v < numVertices; v++)
+                memcpy(&positions[v], position + (size_t)v * stride, sizeof(cyVec3f));
 
-            for (int j = 0; j < faceCount; j++)
-            {
-                int fIndex = firstFace + j;
-                int vIndex = j * 3;
-
-                cyTriMesh::TriFace vFace = cyMesh.F(fIndex);
-
-                vertices[vIndex + 0].position = cyMesh.V((int)vFace.v[0]);
-                vertices[vIndex + 1].position = cyMesh.V((int)vFace.v[1]);
-                vertices[vIndex + 2].position = cyMesh.V((int)vFace.v[2]);
-
-                if (cyMesh.HasNormals())
-                {
-                    cyTriMesh::TriFace nFace = cyMesh.FN(fIndex);
-
-                    vertices[vIndex + 0].normal = cyMesh.VN((int)nFace.v[0]);
-                    vertices[vIndex + 1].normal = cyMesh.VN((int)nFace.v[1]);
-                    vertices[vIndex + 2].normal = cyMesh.VN((int)nFace.v[2]);
-                }
-
-                if (cyMesh.HasTextureVertices())
-                {
-                    cyTriMesh::TriFace tFace = cyMesh.FT(fIndex);
-                    vertices[vIndex + 0].texture = cyMesh.VT((int)tFace.v[0]).XY();
-                    vertices[vIndex + 1].texture = cyMesh.VT((int)tFace.v[1]).XY();
-                    vertices[vIndex + 2].texture = cyMesh.VT((int)tFace.v[2]).XY();
-                }
-            }
+            // GlbFile only keeps primitives whose indices are below the vertex count
+            faces.resize((size_t)numIndices / 3);
+            for (int t = 0; t < numIndices; t++)
+                faces[t / 3].v[t % 3] = index.view ? GlbFile::GetIndex(index, t) : (unsigned int)t;
 
-            mMeshes[i].Create(vertices, faceCount * 3);
+            normals.resize((size_t)numVertices);
+            Geometry::ComputeNormals(positions.data(), numVertices, faces.data(), numIndices / 3, mNormalWeighting,
+                                     threads, normals.data());
+            attributes[1] = {normals.data(), 0, 0, 3, GlbFile::Float, false};
+        }
 
-            cyTriMesh::Mtl mat = cyMesh.M(i);
+        mMeshes[i].CreateViewBuffers(attributes, numVertices, indices, numIndices, indexType);
+        Resources::SetLabel(Resources::Buffers, &mMeshes[i], "GLB primitive " + std::to_string(i));
 
-            // Convert float[3] to cyVec3f
-            mMaterials[i].bAmbience = false;
-            mMaterials[i].bDiffuse = false;
-            mMaterials[i].bSpecular = false;
-            mMaterials[i].kAmbience = *((cyVec3f *) mat.Ka);
-            mMaterials[i].kDiffuse = *((cyVec3f *) mat.Kd);
-            mMaterials[i].kSpecular = *((cyVec3f *) mat.Ks);
-            mMaterials[i].kShininess = 20;
+        // A single level whose index range is the whole primitive
+        mNumVertices[i] = numIndices;
+        mLods[i].numLods = 1;
+        mLods[i].firstIndex[0] = 0;
+        mLods[i].numIndices[0] = numIndices;
+        mLods[i].error[0] = 0;
 
-            if (mat.map_Kd)
-            {
-                char *diffusePath = new char[strlen(directory) + strlen(mat.map_Kd) + 1];
-                memset(diffusePath, 0, strlen(directory) + strlen(mat.map_Kd) + 1);
+        mBounds[i] = {primitive.min, primitive.max};
+        mModelBounds.min.x = MIN(mModelBounds.min.x, primitive.min.x);
+        mModelBounds.min.y = MIN(mModelBounds.min.y, primitive.min.y);
+        mModelBounds.min.z = MIN(mModelBounds.min.z, primitive.min.z);
+        mModelBounds.max.x = MAX(mModelBounds.max.x, primitive.max.x);
+        mModelBounds.max.y = MAX(mModelBounds.max.y, primitive.max.y);
+        mModelBounds.max.z = MAX(mModelBounds.max.z, primitive.max.z);
 
-                strncpy(diffusePath, directory, strlen(directory));
-                strcat(diffusePath, mat.map_Kd);
+        // Primitives without a material get the format's default, plain white
+        GlbFile::Material source = {cyVec3f(1, 1, 1), 1, 1, -1};
+        ConvertMaterial(primitive.material >= 0 ? file.GetMaterial(primitive.material) : source, mMaterials[i]);
+        mBaseMaterials[i] = mMaterials[i];
+    }
+    StartupReport::EndPhase();
 
-                mMaterials[i].bDiffuse = true;
-                mMaterials[i].tDiffuse = new Texture();
-                mMaterials[i].tDiffuse->LoadFromFile(diffusePath);
+    mScale = mModelBounds.max - mModelBounds.min;
+    BuildCullData();
+    LoadGlbTextures(file);
 
-                delete[] diffusePath;
-            }
+    return true;
+}
 
-            if (mat.map_Ka)
-            {
-                char *ambiencePath = new char[strlen(directory) + strlen(mat.map_Ka) + 1];
-                memset(ambiencePath, 0, strlen(directory) + strlen(mat.map_Ka) + 1);
+void Model::LoadGlbTextures(const GlbFile &file)
+{
+    mNumImages = file.GetNumImages();
+    mImageTextures = new Texture *[mNumImages]();
 
-                strncpy(ambiencePath, directory, strlen(directory));
-                strcat(ambiencePath, mat.map_Ka);
+    // Each image decodes once, however many sub-meshes use it
+    std::vector<Texture::Image> images((size_t)mNumImages);
+    std::vector<bool> used((size_t)mNumImages, false);
+    for (int i = 0; i < mNumMeshes; i++)
+    {
+        int material = file.GetPrimitive(i).material;
+        if (material >= 0 && file.GetMaterial(material).baseColorImage >= 0)
+            used[file.GetMaterial(material).baseColorImage] = true;
+    }
 
-                mMaterials[i].bAmbience = true;
-                mMaterials[i].tAmbience = new Texture();
-                mMaterials[i].tAmbience->LoadFromFile(ambiencePath);
+    for (int t = 0; t < mNumImages; t++)
+        images[t].data = nullptr;
 
-                delete[] ambiencePath;
-            }
+    StartupReport::BeginPhase("Texture decode");
+    JobSystem::ParallelFor("Texture decode", mNumImages, 1, [&](int firstImage, int lastImage)
+    {
+        for (int t = firstImage; t < lastImage; t++)
+        {
+            const GlbFile::Image &image = file.GetImage(t);
+            if (!used[t])
+                continue;
 
-            if (mat.map_Ks)
-            {
-                char *specularPath = new char[strlen(directory) + strlen(mat.map_Ks) + 1];
-                memset(specularPath, 0, strlen(directory) + strlen(mat.map_Ks) + 1);
+            if (image.data)
+                Texture::Decode(("GLB image " + std::to_string(t)).c_str(), image.data, image.size, images[t]);
+            else
+                Texture::Decode(image.path.c_str(), images[t]);
+        }
+    });
+    StartupReport::EndPhase();
 
-                strncpy(specularPath, directory, strlen(directory));
-                strcat(specularPath, mat.map_Ks);
+    for (int t = 0; t < mNumImages; t++)
+    {
+        if (!images[t].data)
+            continue;
 
-                mMaterials[i].bSpecular = true;
-                mMaterials[i].tSpecular = new Texture();
-                mMaterials[i].tSpecular->LoadFromFile(specularPath);
+        const GlbFile::Image &image = file.GetImage(t);
+        std::string name = image.data ? "GLB image " + std::to_string(t) : image.path;
 
-                delete[] specularPath;
-            }
+        mImageTextures[t] = new Texture();
+        if (!mImageTextures[t]->LoadFromImage(name.c_str(), images[t]))
+        {
+            delete mImageTextures[t];
+            mImageTextures[t] = nullptr;
+        }
+    }
+
+    // glTF has a single base color where the OBJ materials have separate ambient and diffuse maps
+    for (int i = 0; i < mNumMeshes; i++)
+    {
+        int material = file.GetPrimitive(i).material;
+        Texture *texture = material >= 0 && file.GetMaterial(material).baseColorImage >= 0 ?
+                           mImageTextures[file.GetMaterial(material).baseColorImage] : nullptr;
+        if (!texture)
+            continue;
+
+        mMaterials[i].bDiffuse = mMaterials[i].bAmbience = true;
+        mMaterials[i].tDiffuse = mMaterials[i].tAmbience = texture;
+        mNumTextures += 2;
+    }
+}
+
+void Model::BuildMesh(LoadState &state, int mesh)
+{
+    PROFILE_SCOPE("Model::BuildMesh");
+
+    cyTriMesh &cyMesh = state.mesh;
+    int numVertices = mNumVertices[mesh];
+    int firstFace = cyMesh.NM() ? cyMesh.GetMaterialFirstFace(mesh) : 0;
+
+    auto *vertices = new Mesh::Vertex[numVertices];
+    Resources::Track(Resources::Staging, vertices, (long long)(numVertices * sizeof(Mesh::Vertex)),
+                     "expanded vertices");
+
+    StartupReport::BeginPhase("Vertex expansion");
+    for (int j = 0; j < numVertices / 3; j++)
+    {
+        int fIndex = firstFace + j;
+        int vIndex = j * 3;
+
+        cyTriMesh::TriFace vFace = cyMesh.F(fIndex);
+
+        vertices[vIndex + 0].position = cyMesh.V((int)vFace.v[0]);
+        vertices[vIndex + 1].position = cyMesh.V((int)vFace.v[1]);
+        vertices[vIndex + 2].position = cyMesh.V((int)vFace.v[2]);
+
+        if (cyMesh.HasNormals())
+        {
+            cyTriMesh::TriFace nFace = cyMesh.FN(fIndex);
+
+            vertices[vIndex + 0].normal = cyMesh.VN((int)nFace.v[0]);
+            vertices[vIndex + 1].normal = cyMesh.VN((int)nFace.v[1]);
+            vertices[vIndex + 2].normal = cyMesh.VN((int)nFace.v[2]);
+        }
 
-            delete[] vertices;
+        if (cyMesh.HasTextureVertices())
+        {
+            cyTriMesh::TriFace tFace = cyMesh.FT(fIndex);
+            vertices[vIndex + 0].texture = cyMesh.VT((int)tFace.v[0]).XY();
+            vertices[vIndex + 1].texture = cyMesh.VT((int)tFace.v[1]).XY();
+            vertices[vIndex + 2].texture = cyMesh.VT((int)tFace.v[2]).XY();
         }
     }
+    StartupReport::EndPhase();
+
+    bool cached = state.cacheIn != nullptr;
+    BuildLods(mesh, vertices, numVertices, state.cacheIn, state.cacheOut);
+
+    // BuildLods drops a corrupt cache, the file goes too so the next run writes a fresh one instead of reading it again
+    if (cached && !state.cacheIn)
+        remove(state.cachePath.c_str());
+    mMeshlets[mesh].Build(vertices, numVertices, TrianglesPerMeshlet);
+    mMeshes[mesh].CreateBuffers(vertices, numVertices);
+    mBounds[mesh] = ComputeBounds(vertices, numVertices, state.positions);
+
+    Mesh::Material &material = mMaterials[mesh];
+    material.bAmbience = false;
+    material.bDiffuse = false;
+    material.bSpecular = false;
+    material.kShininess = 20;
+    material.bCastShadows = true;
+
+    if (cyMesh.NM())
+    {
+        cyTriMesh::Mtl mat = cyMesh.M(mesh);
+
+        std::string meshName = mat.name ? std::string(mat.name) : std::to_string(mesh);
+        Resources::SetLabel(Resources::Buffers, &mMeshes[mesh], "mesh " + meshName);
+        Resources::SetLabel(Resources::Buffers, &mLodMeshes[mesh], "LOD chain " + meshName);
+
+        // Convert float[3] to cyVec3f
+        material.kAmbience = *((cyVec3f *) mat.Ka);
+        material.kDiffuse = *((cyVec3f *) mat.Kd);
+        material.kSpecular = *((cyVec3f *) mat.Ks);
+    }
     else
     {
-        int faceCount = cyMesh.NF();
-        int firstFace = 0;
+        material.kAmbience = {1, 1, 1};
+        material.kDiffuse = {1, 1, 1};
+        material.kSpecular = {1, 1, 1};
+    }
+
+    // Textures only ever land in mMaterials, this copy stays flat for as long as the sub-mesh draws without them
+    mBaseMaterials[mesh] = material;
+
+    Resources::Release(Resources::Staging, vertices);
+    delete[] vertices;
+}
 
-        auto *vertices = new Mesh::Vertex[faceCount * 3];
+void Model::LoadTextures(LoadState &state, int first, int last)
+{
+    // Material textures decode in parallel, only the uploads below run in order
+    int numImages = (last - first) * 3;
+    const std::string *paths = &state.texturePaths[(size_t)first * 3];
+    std::vector<Texture::Image> images((size_t)numImages);
+    for (int t = 0; t < numImages; t++)
+        images[t].data = nullptr;
 
-        for (int j = 0; j < faceCount; j++)
+    StartupReport::BeginPhase("Texture decode");
+    JobSystem::ParallelFor("Texture decode", numImages, 1, [&](int firstImage, int lastImage)
+    {
+        for (int t = firstImage; t < lastImage; t++)
         {
-            int fIndex = firstFace + j;
-            int vIndex = j * 3;
+            if (!paths[t].empty())
+                Texture::Decode(paths[t].c_str(), images[t]);
+        }
+    });
+    StartupReport::EndPhase();
 
-            cyTriMesh::TriFace vFace = cyMesh.F(fIndex);
+    for (int i = first; i < last; i++)
+    {
+        Mesh::Material &material = mMaterials[i];
+        bool *enabled[3] = {&material.bDiffuse, &material.bAmbience, &material.bSpecular};
+        Texture **textures[3] = {&material.tDiffuse, &material.tAmbience, &material.tSpecular};
 
-            vertices[vIndex + 0].position = cyMesh.V((int)vFace.v[0]);
-            vertices[vIndex + 1].position = cyMesh.V((int)vFace.v[1]);
-            vertices[vIndex + 2].position = cyMesh.V((int)vFace.v[2]);
+        for (int k = 0; k < 3; k++)
+        {
+            int t = (i - first) * 3 + k;
+            if (paths[t].empty())
+                continue;
 
-            if (cyMesh.HasNormals())
-            {
-                cyTriMesh::TriFace nFace = cyMesh.FN(fIndex);
+            *enabled[k] = true;
+            *textures[k] = new Texture();
+            (*textures[k])->LoadFromImage(paths[t].c_str(), images[t]);
+        }
+    }
+}
 
-                vertices[vIndex + 0].normal = cyMesh.VN((int)nFace.v[0]);
-                vertices[vIndex + 1].normal = cyMesh.VN((int)nFace.v[1]);
-                vertices[vIndex + 2].normal = cyMesh.VN((int)nFace.v[2]);
-            }
+void Model::BuildCullData()
+{
+    // Sized from the face counts so the scratch exists before any sub-mesh has built its meshlets
+    int maxMeshlets = 0;
+    for (int i = 0; i < mNumMeshes; i++)
+        maxMeshlets = MAX(maxMeshlets, (mNumVertices[i] / 3 + TrianglesPerMeshlet - 1) / TrianglesPerMeshlet);
 
-            if (cyMesh.HasTextureVertices())
-            {
-                cyTriMesh::TriFace tFace = cyMesh.FT(fIndex);
-                vertices[vIndex + 0].texture = cyMesh.VT((int)tFace.v[0]).XY();
-                vertices[vIndex + 1].texture = cyMesh.VT((int)tFace.v[1]).XY();
-                vertices[vIndex + 2].texture = cyMesh.VT((int)tFace.v[2]).XY();
-            }
+    mRangeFirsts = new int[maxMeshlets];
+    mRangeCounts = new int[maxMeshlets];
+    mVisible = new unsigned char[(mNumMeshes + 3) & ~3];
+}
+
+void Model::SyncCullData()
+{
+    int numLoaded = mNumLoaded.load(std::memory_order_acquire);
+    if (numLoaded == mNumCulled)
+        return;
+
+    mCullMin.Resize(numLoaded);
+    mCullMax.Resize(numLoaded);
+
+    for (int i = 0; i < numLoaded; i++)
+    {
+        mCullMin.Set(i, mBounds[i].min);
+        mCullMax.Set(i, mBounds[i].max);
+    }
+
+    mNumCulled = numLoaded;
+}
+
+void Model::BuildLods(int mesh, const Mesh::Vertex *vertices, int numVertices, FILE *&cacheIn, FILE *cacheOut)
+{
+    PROFILE_SCOPE("Model::BuildLods");
+    StartupReport::Phase phase("LOD chain");
+
+    LodChain &chain = mLods[mesh];
+    std::vector<Mesh::Vertex> unique;
+    std::vector<unsigned int> indices;
+
+    chain.numLods = 1;
+    chain.firstIndex[0] = 0;
+    chain.numIndices[0] = numVertices;
+    chain.error[0] = 0;
+
+    if (cacheIn)
+    {
+        int numUnique = 0, numLods = 0, numIndices = 0;
+        bool valid = fread(&numUnique, sizeof(int), 1, cacheIn) == 1 && numUnique >= 0 && numUnique <= numVertices;
+
+        if (valid)
+        {
+            unique.resize((size_t)numUnique);
+            valid = fread(unique.data(), sizeof(Mesh::Vertex), unique.size(), cacheIn) == unique.size() &&
+                    fread(&numLods, sizeof(int), 1, cacheIn) == 1 && numLods >= 1 && numLods <= MaxLods &&
+                    fread(chain.error + 1, sizeof(float), (size_t)(numLods - 1), cacheIn) == (size_t)(numLods - 1) &&
+                    fread(chain.numIndices + 1, sizeof(int), (size_t)(numLods - 1), cacheIn) == (size_t)(numLods - 1);
+        }
+
+        for (int k = 1; valid && k < numLods; k++)
+        {
+            chain.firstIndex[k] = numIndices;
+            numIndices += chain.numIndices[k];
+            valid = chain.numIndices[k] >= 0 && chain.numIndices[k] <= numVertices;
+        }
+
+        if (valid)
+        {
+            indices.resize((size_t)numIndices);
+            valid = fread(indices.data(), sizeof(unsigned int), indices.size(), cacheIn) == indices.size();
+        }
+
+        for (size_t k = 0; valid && k < indices.size(); k++)
+            valid = indices[k] < unique.size();
+
+        if (valid)
+        {
+            chain.numLods = numLods;
+            if (numIndices)
+                mLodMeshes[mesh].CreateIndexedBuffers(unique.data(), (int)unique.size(), indices.data(), numIndices);
+            return;
         }
 
-        mMeshes[0].Create(vertices, faceCount * 3);
-        mMaterials[0].kAmbience = {1, 1, 1};
-        mMaterials[0].kDiffuse = {1, 1, 1};
-        mMaterials[0].kSpecular = {1, 1, 1};
-        mMaterials[0].kShininess = 20;
-        mMaterials[0].bAmbience = false;
-        mMaterials[0].bDiffuse = false;
-        mMaterials[0].bSpecular = false;
+        // Later meshes cannot be trusted either, the caller removes the file so the next run rebuilds it
+        Utils::Warning("LOD cache is corrupt, regenerating.");
+        fclose(cacheIn);
+        cacheIn = nullptr;
+        chain.numLods = 1;
+        unique.clear();
+        indices.clear();
+    }
+
+    std::vector<unsigned int> current, next;
+    Simplify::Weld(vertices, numVertices, unique, current);
+
+    float error = 0;
+    while (chain.numLods < MaxLods)
+    {
+        int numTriangles = (int)current.size() / 3;
+        if (numTriangles / 2 < MinLodTriangles)
+            break;
+
+        float collapseError = Simplify::Collapse(unique, current, numTriangles / 2, next);
 
-        delete[] vertices;
+        // Locked seams and borders can leave too little to collapse for another level to be worth it
+        if (next.size() * 10 > current.size() * 9)
+            break;
+
+        // Every level is simplified from the previous one, so the distance to the original is bounded by the sum
+        error += collapseError;
+
+        chain.firstIndex[chain.numLods] = (int)indices.size();
+        chain.numIndices[chain.numLods] = (int)next.size();
+        chain.error[chain.numLods] = error;
+        chain.numLods++;
+
+        indices.insert(indices.end(), next.begin(), next.end());
+        current.swap(next);
     }
 
-    delete[] directory;
+    if (!indices.empty())
+        mLodMeshes[mesh].CreateIndexedBuffers(unique.data(), (int)unique.size(), indices.data(), (int)indices.size());
 
-    return true;
+    if (cacheOut)
+    {
+        int numUnique = (int)unique.size();
+        fwrite(&numUnique, sizeof(int), 1, cacheOut);
+        fwrite(unique.data(), sizeof(Mesh::Vertex), unique.size(), cacheOut);
+        fwrite(&chain.numLods, sizeof(int), 1, cacheOut);
+        fwrite(chain.error + 1, sizeof(float), (size_t)(chain.numLods - 1), cacheOut);
+        fwrite(chain.numIndices + 1, sizeof(int), (size_t)(chain.numLods - 1), cacheOut);
+        fwrite(indices.data(), sizeof(unsigned int), indices.size(), cacheOut);
+    }
 }
 
-void Model::Draw(Shader &shader, bool useMaterials)
+int Model::SelectLod(int mesh, const cyVec3f &viewPosition, float lodScale) const
 {
-    for (int i = 0; i < mNumMeshes; i++)
+    if (lodScale <= 0)
+        return 0;
+
+    // Distance from the viewer to the closest point of the sub-mesh bounds
+    const Bounds &bounds = mBounds[mesh];
+    cyVec3f d(MAX(0.0f, MAX(bounds.min.x - viewPosition.x, viewPosition.x - bounds.max.x)),
+              MAX(0.0f, MAX(bounds.min.y - viewPosition.y, viewPosition.y - bounds.max.y)),
+              MAX(0.0f, MAX(bounds.min.z - viewPosition.z, viewPosition.z - bounds.max.z)));
+    float distance = d.Length();
+
+    // lodScale turns an object space error at unit distance into the allowed number of pixels or texels
+    const LodChain &chain = mLods[mesh];
+    int lod = 0;
+    while (lod + 1 < chain.numLods && chain.error[lod + 1] * lodScale <= distance)
+        lod++;
+
+    return lod;
+}
+
+static float WorldScale(const cyMatrix4f &world)
+{
+    return cyVec3f(world.cell[0], world.cell[1], world.cell[2]).Length();
+}
+
+static DrawPacket MakePacket(Shader &shader, const Mesh &mesh, Mesh::Material *material, const cyMatrix4f *world)
+{
+    DrawPacket packet = {};
+    packet.shader = &shader;
+    packet.mesh = &mesh;
+    packet.material = material;
+    packet.model = world;
+    packet.layerMask = -1;
+    packet.type = DrawPacket::Arrays;
+    return packet;
+}
+
+void Model::Enqueue(RenderQueue &queue, Shader &shader, bool useMaterials, const cyMatrix4f &world,
+                    const Frustum &frustum, const cyVec3f &viewPosition, float lodScale, CullStats &stats)
+{
+    SyncCullData();
+
+    // The frustum is expected in model space, so the stored bounds are tested as they are
+    frustum.TestBoxes(mCullMin.X(), mCullMin.Y(), mCullMin.Z(), mCullMax.X(), mCullMax.Y(), mCullMax.Z(), mNumCulled,
+                      mVisible);
+
+    float worldScale = WorldScale(world);
+
+    for (int i = 0; i < mNumCulled; i++)
+    {
+        stats.tested++;
+
+        if (!useMaterials && !mMaterials[i].bCastShadows)
+        {
+            stats.skipped++;
+            continue;
+        }
+
+        stats.trianglesTotal += mNumVertices[i] / 3;
+
+        if (!mVisible[i])
+            continue;
+
+        stats.visible++;
+
+        float depth = ((mBounds[i].min + mBounds[i].max) * 0.5f - viewPosition).Length() * worldScale;
+        Mesh::Material *material = useMaterials ? GetDrawMaterial(i) : nullptr;
+
+        // Far enough away the coarse LOD is drawn whole, meshlet culling only pays off at full detail
+        int lod = SelectLod(i, viewPosition, lodScale);
+        if (lod > 0 || mIndexed)
+        {
+            const LodChain &chain = mLods[i];
+            stats.lodDraws += lod > 0 ? 1 : 0;
+            stats.triangles += chain.numIndices[lod] / 3;
+
+            DrawPacket packet = MakePacket(shader, lod > 0 ? mLodMeshes[i] : mMeshes[i], material, &world);
+            packet.type = DrawPacket::Elements;
+            packet.first = chain.firstIndex[lod];
+            packet.count = chain.numIndices[lod];
+            queue.Push(packet, depth);
+            continue;
+        }
+
+        // Visible sub-meshes are refined per meshlet and drawn as a list of vertex ranges
+        int numVertices;
+        stats.meshletsTested += mMeshlets[i].GetCount();
+        stats.meshletsVisible += mMeshlets[i].Cull(frustum, viewPosition, mConeCulling);
+        int numRanges = mMeshlets[i].Emit(mRangeFirsts, mRangeCounts, numVertices);
+        stats.triangles += numVertices / 3;
+
+        if (!numRanges)
+            continue;
+
+        DrawPacket packet = MakePacket(shader, mMeshes[i], material, &world);
+        packet.type = DrawPacket::Ranges;
+        packet.first = queue.PushRanges(mRangeFirsts, mRangeCounts, numRanges);
+        packet.count = numRanges;
+        queue.Push(packet, depth);
+    }
+}
+
+void Model::EnqueueLayered(RenderQueue &queue, Shader &shader, const cyMatrix4f &world, const Frustum *layers,
+                           int numLayers, const cyVec3f &viewPosition, float lodScale, CullStats &stats)
+{
+    SyncCullData();
+
+    float worldScale = WorldScale(world);
+
+    // Every sub-mesh box goes to world space in one pass instead of one Bounds::Transform per mesh
+    Vec3Buffer::TransformBounds(world, mCullMin, mCullMax, mWorldMin, mWorldMax);
+
+    for (int i = 0; i < mNumCulled; i++)
     {
-        if (useMaterials)
-            mMeshes[i].Draw(shader, mMaterials[i]);
+        stats.tested++;
+
+        if (!mMaterials[i].bCastShadows)
+        {
+            stats.skipped++;
+            continue;
+        }
+
+        stats.trianglesTotal += mNumVertices[i] / 3;
+
+        // Only send the mesh to the layers whose frustum it touches
+        Bounds worldBounds = {mWorldMin.Get(i), mWorldMax.Get(i)};
+        unsigned int mask = Frustum::FaceMask(layers, numLayers, worldBounds);
+
+        if (!mask)
+            continue;
+
+        stats.visible++;
+
+        float depth = ((mBounds[i].min + mBounds[i].max) * 0.5f - viewPosition).Length() * worldScale;
+        int lod = SelectLod(i, viewPosition, lodScale);
+
+        DrawPacket packet = MakePacket(shader, lod > 0 ? mLodMeshes[i] : mMeshes[i], nullptr, &world);
+        packet.layerMask = (int)mask;
+
+        if (lod > 0 || mIndexed)
+        {
+            stats.lodDraws += lod > 0 ? 1 : 0;
+            stats.triangles += mLods[i].numIndices[lod] / 3;
+            packet.type = DrawPacket::Elements;
+            packet.first = mLods[i].firstIndex[lod];
+            packet.count = mLods[i].numIndices[lod];
+        }
         else
-            mMeshes[i].Draw(shader);
+        {
+            stats.triangles += mNumVertices[i] / 3;
+        }
+
+        queue.Push(packet, depth);
     }
 }
 
+void Model::EnqueueInstanced(RenderQueue &queue, Shader &shader, bool useMaterials, const InstanceBuffer &instances,
+                             CullStats &stats)
+{
+    SyncCullData();
+
+    // Instances arrive grouped by LOD, each group is one instanced draw per sub-mesh
+    for (int bucket = 0; bucket < instances.GetNumBuckets(); bucket++)
+    {
+        int numInstances = instances.GetBucketCount(bucket);
+        if (!numInstances)
+            continue;
+
+        for (int i = 0; i < mNumCulled; i++)
+        {
+            if (!useMaterials && !mMaterials[i].bCastShadows)
+                continue;
+
+            const LodChain &chain = mLods[i];
+            int lod = MIN(bucket, chain.numLods - 1);
+            stats.trianglesTotal += numInstances * mNumVertices[i] / 3;
+
+            DrawPacket packet = MakePacket(shader, lod > 0 ? mLodMeshes[i] : mMeshes[i],
+                                           useMaterials ? GetDrawMaterial(i) : nullptr, nullptr);
+            packet.instanceBuffer = instances.GetID();
+            packet.firstInstance = instances.GetBucketFirst(bucket);
+            packet.numInstances = numInstances;
+
+            if (lod > 0 || mIndexed)
+            {
+                stats.lodDraws += lod > 0 ? 1 : 0;
+                stats.triangles += numInstances * chain.numIndices[lod] / 3;
+                packet.type = DrawPacket::Elements;
+                packet.first = chain.firstIndex[lod];
+                packet.count = chain.numIndices[lod];
+            }
+            else
+            {
+                stats.triangles += numInstances * mNumVertices[i] / 3;
+            }
+
+            queue.Push(packet, instances.GetBucketDistance(bucket));
+        }
+    }
+}
+
+void Model::SetConeCulling(bool enabled)
+{
+    mConeCulling = enabled;
+}
+
+bool Model::GetConeCulling() const
+{
+    return mConeCulling;
+}
+
 cyVec3f Model::GetSize()
 {
     return mScale;
 }
+
+Bounds Model::GetBounds() const
+{
+    return mModelBounds;
+}
+
+int Model::GetLodErrors(float *errors) const
+{
+    // Whole-model error per level, sub-meshes with shorter chains stay on their last level
+    int numLoaded = mNumLoaded.load(std::memory_order_acquire);
+    int numLods = 1;
+    for (int i = 0; i < numLoaded; i++)
+        numLods = MAX(numLods, mLods[i].numLods);
+
+    for (int k = 0; k < numLods; k++)
+    {
+        errors[k] = 0;
+        for (int i = 0; i < numLoaded; i++)
+            errors[k] = MAX(errors[k], mLods[i].error[MIN(k, mLods[i].numLods - 1)]);
+    }
+
+    return numLods;
+}
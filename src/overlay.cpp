@@ -0,0 +1,237 @@
+#include "overlay.h"
+#include "glstate.h"
+#include "renderstats.h"
+#include "resources.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <glad/glad.h>
+
+#define NK_INCLUDE_FIXED_TYPES
+#define NK_INCLUDE_DEFAULT_ALLOCATOR
+#define NK_INCLUDE_VERTEX_BUFFER_OUTPUT
+#define NK_INCLUDE_FONT_BAKING
+#define NK_INCLUDE_DEFAULT_FONT
+#define NK_IMPLEMENTATION
+#include <nuklear.h>
+
+static const int MaxVertexMemory = 256 * 1024;
+static const int MaxElementMemory = 64 * 1024;
+
+struct OverlayVertex
+{
+    float position[2];
+    float texture[2];
+    nk_byte color[4];
+};
+
+Overlay::Overlay()
+    : mContext(nullptr), mAtlas(nullptr), mCommands(nullptr), mNullTexture(nullptr), mVAO(0), mVBO(0), mEBO(0), mVertices(nullptr),
+      mElements(nullptr), mWidth(0), mHeight(0), mOpen(false)
+{
+}
+
+Overlay::~Overlay()
+{
+    if (mContext)
+    {
+        nk_free(mContext);
+        nk_buffer_free(mCommands);
+        nk_font_atlas_clear(mAtlas);
+    }
+
+    Resources::Release(Resources::Buffers, this);
+    Resources::Release(Resources::Staging, this);
+
+    delete mContext;
+    delete mCommands;
+    delete mNullTexture;
+    delete mAtlas;
+    delete[] mVertices;
+    delete[] mElements;
+
+    GLState::ForgetVertexArray(mVAO);
+    glDeleteBuffers(1, &mEBO);
+    glDeleteBuffers(1, &mVBO);
+    glDeleteVertexArrays(1, &mVAO);
+}
+
+bool Overlay::Create()
+{
+    if (!mShader.LoadFromSource(Shaders::OverlayVS, Shaders::OverlayFS))
+        return false;
+
+    mContext = new nk_context();
+    mAtlas = new nk_font_atlas();
+    mCommands = new nk_buffer();
+    mNullTexture = new nk_draw_null_texture();
+
+    int width, height;
+    nk_font_atlas_init_default(mAtlas);
+    nk_font_atlas_begin(mAtlas);
+    nk_font *font = nk_font_atlas_add_default(mAtlas, 13, nullptr);
+    const void *image = nk_font_atlas_bake(mAtlas, &width, &height, NK_FONT_ATLAS_RGBA32);
+
+    if (!image || !mFont.LoadFromData(width, height, 4, (void *)image))
+        return false;
+
+    nk_font_atlas_end(mAtlas, nk_handle_id((int)mFont.GetID()), mNullTexture);
+    Resources::SetLabel(Resources::Textures, &mFont, "overlay font");
+
+    if (!nk_init_default(mContext, &font->handle))
+        return false;
+
+    nk_buffer_init_default(mCommands);
+    mContext->style.window.fixed_background = nk_style_item_color(nk_rgba(20, 20, 20, 200));
+
+    mVertices = new char[MaxVertexMemory];
+    mElements = new char[MaxElementMemory];
+
+    glGenVertexArrays(1, &mVAO);
+    glGenBuffers(1, &mVBO);
+    glGenBuffers(1, &mEBO);
+
+    GLState::BindVertexArray(mVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+    glBufferData(GL_ARRAY_BUFFER, MaxVertexMemory, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, MaxElementMemory, nullptr, GL_STREAM_DRAW);
+    Resources::Track(Resources::Buffers, this, MaxVertexMemory + MaxElementMemory, "overlay stream");
+    Resources::Track(Resources::Staging, this, MaxVertexMemory + MaxElementMemory, "overlay vertices");
+
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex), (void *)offsetof(OverlayVertex, position));
+    glEnableVertexAttribArray(0);
+
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex), (void *)offsetof(OverlayVertex, texture));
+    glEnableVertexAttribArray(1);
+
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(OverlayVertex), (void *)offsetof(OverlayVertex, color));
+    glEnableVertexAttribArray(2);
+
+    return true;
+}
+
+void Overlay::Begin(const char *title, int width, int height)
+{
+    mWidth = width;
+    mHeight = height;
+
+    // The panel takes no input, an empty input frame keeps nuklear's state machine going
+    nk_input_begin(mContext);
+    nk_input_end(mContext);
+
+    mOpen = nk_begin(mContext, title, nk_rect(10, 10, 280, (float)height - 20),
+                     NK_WINDOW_BORDER | NK_WINDOW_TITLE | NK_WINDOW_NO_SCROLLBAR | NK_WINDOW_NO_INPUT) != 0;
+}
+
+void Overlay::Text(const char *label, const char *value)
+{
+    if (!mOpen)
+        return;
+
+    nk_layout_row_dynamic(mContext, 16, 2);
+    nk_label(mContext, label, NK_TEXT_LEFT);
+    nk_label(mContext, value, NK_TEXT_RIGHT);
+}
+
+void Overlay::Bar(const char *label, double value, double max)
+{
+    if (!mOpen)
+        return;
+
+    char text[32];
+    snprintf(text, sizeof(text), "%.3f", value);
+
+    nk_layout_row_begin(mContext, NK_DYNAMIC, 16, 3);
+    nk_layout_row_push(mContext, 0.35f);
+    nk_label(mContext, label, NK_TEXT_LEFT);
+    nk_layout_row_push(mContext, 0.4f);
+    nk_size progress = (nk_size)(max > 0 ? 1000.0 * (value < max ? value : max) / max : 0);
+    nk_progress(mContext, &progress, 1000, nk_false);
+    nk_layout_row_push(mContext, 0.25f);
+    nk_label(mContext, text, NK_TEXT_RIGHT);
+    nk_layout_row_end(mContext);
+}
+
+void Overlay::End()
+{
+    nk_end(mContext);
+    Render();
+    nk_clear(mContext);
+    mOpen = false;
+}
+
+void Overlay::Render()
+{
+    static const nk_draw_vertex_layout_element layout[] = {
+            {NK_VERTEX_POSITION, NK_FORMAT_FLOAT, NK_OFFSETOF(OverlayVertex, position)},
+            {NK_VERTEX_TEXCOORD, NK_FORMAT_FLOAT, NK_OFFSETOF(OverlayVertex, texture)},
+            {NK_VERTEX_COLOR, NK_FORMAT_R8G8B8A8, NK_OFFSETOF(OverlayVertex, color)},
+            {NK_VERTEX_LAYOUT_END}
+    };
+
+    nk_convert_config config;
+    memset(&config, 0, sizeof(config));
+    config.vertex_layout = layout;
+    config.vertex_size = sizeof(OverlayVertex);
+    config.vertex_alignment = NK_ALIGNOF(OverlayVertex);
+    config.circle_segment_count = 22;
+    config.curve_segment_count = 22;
+    config.arc_segment_count = 22;
+    config.global_alpha = 1.0f;
+    config.null = *mNullTexture;
+    config.shape_AA = NK_ANTI_ALIASING_ON;
+    config.line_AA = NK_ANTI_ALIASING_ON;
+
+    nk_buffer vertices, elements;
+    nk_buffer_init_fixed(&vertices, mVertices, MaxVertexMemory);
+    nk_buffer_init_fixed(&elements, mElements, MaxElementMemory);
+    if (nk_convert(mContext, mCommands, &vertices, &elements, &config) != NK_CONVERT_SUCCESS)
+        return;
+
+    GLState::Enable(GL_BLEND);
+    GLState::Disable(GL_DEPTH_TEST);
+    GLState::Disable(GL_CULL_FACE);
+    GLState::Enable(GL_SCISSOR_TEST);
+    glBlendEquation(GL_FUNC_ADD);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    cyMatrix4f projection;
+    projection.SetIdentity();
+    projection.cell[0] = 2.0f / (float)mWidth;
+    projection.cell[5] = -2.0f / (float)mHeight;
+    projection.cell[12] = -1.0f;
+    projection.cell[13] = 1.0f;
+
+    mShader.Use();
+    mShader.UploadUniform("uProjection", projection);
+    mShader.UploadUniform("uTexture", 0);
+
+    GLState::BindVertexArray(mVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, (long)vertices.needed, mVertices);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, (long)elements.needed, mElements);
+    RenderStats::Add(RenderStats::BufferBytes, (long long)(vertices.needed + elements.needed));
+
+    const nk_draw_command *command;
+    size_t offset = 0;
+    nk_draw_foreach(command, mContext, mCommands)
+    {
+        if (!command->elem_count)
+            continue;
+
+        GLState::BindTexture(0, GL_TEXTURE_2D, (unsigned int)command->texture.id);
+        GLState::Scissor((int)command->clip_rect.x, mHeight - (int)(command->clip_rect.y + command->clip_rect.h),
+                         (int)command->clip_rect.w, (int)command->clip_rect.h);
+        glDrawElements(GL_TRIANGLES, (int)command->elem_count, GL_UNSIGNED_SHORT, (void *)offset);
+        RenderStats::AddDraw(command->elem_count);
+        offset += command->elem_count * sizeof(nk_draw_index);
+    }
+
+    nk_buffer_clear(mCommands);
+
+    GLState::Disable(GL_SCISSOR_TEST);
+    GLState::Enable(GL_DEPTH_TEST);
+    GLState::Disable(GL_BLEND);
+}
@@ -0,0 +1,747 @@
+#include "pagedmodel.h"
+#include "utils.h"
+#include "simplify.h"
+#include "geometry.h"
+#include "jobsystem.h"
+#include "profiler.h"
+#include "resources.h"
+#include "uploadcontext.h"
+
+#include <cyTriMesh.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Pages stay small enough to stream one per loader in a frame or two and big enough to keep draws few
+static const int PageTriangles = 32768;
+static const int MaxDepth = 16;
+
+static const int MaxLoadsInFlight = 8;
+
+// Frames the GL thread can be behind the simulation thread, see Application::SimulationLoop and TripleBuffer
+static const long RetireFrames = 3;
+
+static const unsigned int PageFileMagic = 0x31474150; // "PAG1"
+static const unsigned int PageFileVersion = 1;
+
+struct PageFileHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    long long sourceSize;
+    long long sourceTime;
+    int numNodes;
+    int numTriangles;
+};
+
+namespace
+{
+    struct BuildNode
+    {
+        Bounds bounds;
+        float error;
+        int firstChild, numChildren;
+        int depth;
+        std::vector<Mesh::Vertex> vertices;
+    };
+
+    Bounds VertexBounds(const std::vector<Mesh::Vertex> &vertices)
+    {
+        Bounds bounds = {vertices[0].position, vertices[0].position};
+        for (const Mesh::Vertex &v : vertices)
+        {
+            bounds.min.Set(MIN(bounds.min.x, v.position.x), MIN(bounds.min.y, v.position.y), MIN(bounds.min.z, v.position.z));
+            bounds.max.Set(MAX(bounds.max.x, v.position.x), MAX(bounds.max.y, v.position.y), MAX(bounds.max.z, v.position.z));
+        }
+        return bounds;
+    }
+
+    void SplitNode(std::vector<BuildNode> &nodes, int index, std::vector<Mesh::Vertex> &vertices, int depth)
+    {
+        Bounds bounds = VertexBounds(vertices);
+        nodes[index].bounds = bounds;
+        nodes[index].error = 0;
+        nodes[index].firstChild = 0;
+        nodes[index].numChildren = 0;
+        nodes[index].depth = depth;
+
+        int numTriangles = (int)vertices.size() / 3;
+        if (numTriangles <= PageTriangles || depth == MaxDepth)
+        {
+            nodes[index].vertices.swap(vertices);
+            return;
+        }
+
+        // Triangles go to the octant holding their centroid, so every triangle lives in exactly one leaf
+        cyVec3f center = (bounds.min + bounds.max) * 0.5f;
+        std::vector<Mesh::Vertex> octants[8];
+        for (int t = 0; t < numTriangles; t++)
+        {
+            const Mesh::Vertex *triangle = &vertices[t * 3];
+            cyVec3f c = (triangle[0].position + triangle[1].position + triangle[2].position) / 3.0f;
+            int octant = (c.x > center.x ? 1 : 0) | (c.y > center.y ? 2 : 0) | (c.z > center.z ? 4 : 0);
+            octants[octant].insert(octants[octant].end(), triangle, triangle + 3);
+        }
+
+        // Coincident centroids cannot be separated, the node stays a leaf however big it is
+        int numOctants = 0;
+        for (int o = 0; o < 8; o++)
+            numOctants += octants[o].empty() ? 0 : 1;
+
+        if (numOctants < 2)
+        {
+            nodes[index].vertices.swap(vertices);
+            return;
+        }
+
+        std::vector<Mesh::Vertex>().swap(vertices);
+
+        // Children are appended together so they stay contiguous in the file
+        int firstChild = (int)nodes.size();
+        nodes.resize(nodes.size() + numOctants);
+        nodes[index].firstChild = firstChild;
+        nodes[index].numChildren = numOctants;
+
+        int child = firstChild;
+        for (int o = 0; o < 8; o++)
+        {
+            if (!octants[o].empty())
+                SplitNode(nodes, child++, octants[o], depth + 1);
+        }
+    }
+
+    void BuildCoarsePage(std::vector<BuildNode> &nodes, int index)
+    {
+        BuildNode &node = nodes[index];
+
+        std::vector<Mesh::Vertex> children;
+        float childError = 0;
+        for (int c = node.firstChild; c < node.firstChild + node.numChildren; c++)
+        {
+            children.insert(children.end(), nodes[c].vertices.begin(), nodes[c].vertices.end());
+            childError = MAX(childError, nodes[c].error);
+        }
+
+        // Children share the vertices along their cuts, welding joins them again so only the node's border is locked
+        std::vector<Mesh::Vertex> unique;
+        std::vector<unsigned int> indices, simplified;
+        Simplify::Weld(children.data(), (int)children.size(), unique, indices);
+        float error = Simplify::Collapse(unique, indices, PageTriangles, simplified);
+
+        node.vertices.resize(simplified.size());
+        for (size_t i = 0; i < simplified.size(); i++)
+            node.vertices[i] = unique[simplified[i]];
+
+        // Same bound as the LOD chains, the error of every level below adds up
+        node.error = childError + error;
+    }
+
+    bool ReadAt(int file, void *data, size_t size, long long offset)
+    {
+#ifdef _WIN32
+        // The CRT has no positioned read, loaders take turns on the shared file position
+        static std::mutex mutex;
+        std::lock_guard<std::mutex> lock(mutex);
+        return _lseeki64(file, offset, SEEK_SET) == offset && _read(file, data, (unsigned int)size) == (int)size;
+#else
+        // Positioned reads share no file offset, so every loader reads the same descriptor at once
+        char *bytes = (char *)data;
+        while (size)
+        {
+            ssize_t count = pread(file, bytes, size, (off_t)offset);
+            if (count <= 0)
+                return false;
+
+            bytes += count;
+            size -= (size_t)count;
+            offset += count;
+        }
+        return true;
+#endif
+    }
+
+    bool ReadHeader(const char *pageFile, PageFileHeader &header)
+    {
+        FILE *file = fopen(pageFile, "rb");
+        if (!file)
+            return false;
+
+        bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == PageFileMagic &&
+                     header.version == PageFileVersion && header.numNodes > 0;
+        fclose(file);
+        return valid;
+    }
+
+    bool EndsWith(const std::string &text, const char *suffix)
+    {
+        size_t length = strlen(suffix);
+        return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+    }
+}
+
+PagedModel::PagedModel()
+    : mNodes(nullptr), mNumNodes(0), mNumTriangles(0), mFile(-1), mMaterial(), mStates(nullptr), mMeshes(nullptr),
+      mLastUsed(nullptr), mRequestFrame(nullptr), mFrame(1), mBudget(0), mServiceCount(0), mInFlight(0),
+      mResidentPages(0), mResidentBytes(0)
+{
+    // Scans come without materials, they get the same flat white as a material-less Model
+    mMaterial.kAmbience = {1, 1, 1};
+    mMaterial.kDiffuse = {1, 1, 1};
+    mMaterial.kSpecular = {1, 1, 1};
+    mMaterial.kShininess = 20;
+    mMaterial.bCastShadows = true;
+}
+
+PagedModel::~PagedModel()
+{
+    Close();
+}
+
+void PagedModel::Close()
+{
+    for (int i = 0; i < (mMeshes ? mNumNodes : 0); i++)
+        delete mMeshes[i];
+
+    if (mFile >= 0)
+    {
+#ifdef _WIN32
+        _close(mFile);
+#else
+        close(mFile);
+#endif
+    }
+
+    delete[] mRequestFrame;
+    delete[] mLastUsed;
+    delete[] mMeshes;
+    delete[] mStates;
+    delete[] mNodes;
+
+    mNodes = nullptr;
+    mStates = nullptr;
+    mMeshes = nullptr;
+    mLastUsed = nullptr;
+    mRequestFrame = nullptr;
+    mFile = -1;
+    mNumNodes = 0;
+    mNumTriangles = 0;
+    mResidentPages = 0;
+    mResidentBytes = 0;
+}
+
+bool PagedModel::Build(const char *objFile, const char *pageFile)
+{
+    PROFILE_SCOPE("PagedModel::Build");
+
+    std::vector<BuildNode> nodes(1);
+    int numTriangles;
+    {
+        cyTriMesh cyMesh;
+        if (!cyMesh.LoadFromFileObj(objFile, false) || !cyMesh.NF())
+            return false;
+
+        if (!cyMesh.HasNormals())
+            Geometry::ComputeNormals(cyMesh, Geometry::Area, Geometry::DefaultThreads());
+
+        numTriangles = (int)cyMesh.NF();
+
+        std::vector<Mesh::Vertex> vertices((size_t)numTriangles * 3);
+        for (int f = 0; f < numTriangles; f++)
+        {
+            cyTriMesh::TriFace vFace = cyMesh.F(f);
+            cyTriMesh::TriFace nFace = cyMesh.FN(f);
+            for (int k = 0; k < 3; k++)
+            {
+                Mesh::Vertex &v = vertices[f * 3 + k];
+                v.position = cyMesh.V((int)vFace.v[k]);
+                v.normal = cyMesh.VN((int)nFace.v[k]).GetNormalized();
+                v.texture = cyVec2f(0, 0);
+            }
+        }
+
+        SplitNode(nodes, 0, vertices, 0);
+    }
+
+    // Inner pages are simplified from their children, so each level waits for the one below it
+    int maxDepth = 0;
+    for (const BuildNode &node : nodes)
+        maxDepth = MAX(maxDepth, node.depth);
+
+    for (int depth = maxDepth - 1; depth >= 0; depth--)
+    {
+        std::vector<int> level;
+        for (int i = 0; i < (int)nodes.size(); i++)
+        {
+            if (nodes[i].depth == depth && nodes[i].numChildren)
+                level.push_back(i);
+        }
+
+        JobSystem::ParallelFor("Page simplify", (int)level.size(), 1, [&](int first, int last)
+        {
+            for (int i = first; i < last; i++)
+                BuildCoarsePage(nodes, level[i]);
+        });
+    }
+
+    // Written next to the target and renamed over it, so a failed build never leaves a valid header in front of
+    // missing pages
+    std::string partialFile = std::string(pageFile) + ".tmp";
+    FILE *file = fopen(partialFile.c_str(), "wb");
+    if (!file)
+        return false;
+
+    struct stat sourceInfo = {};
+    stat(objFile, &sourceInfo);
+
+    PageFileHeader header = {PageFileMagic, PageFileVersion, (long long)sourceInfo.st_size,
+                             (long long)sourceInfo.st_mtime, (int)nodes.size(), numTriangles};
+
+    std::vector<Node> table(nodes.size());
+    long long offset = (long long)(sizeof(header) + table.size() * sizeof(Node));
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        table[i].bounds = nodes[i].bounds;
+        table[i].error = nodes[i].error;
+        table[i].firstChild = nodes[i].firstChild;
+        table[i].numChildren = nodes[i].numChildren;
+        table[i].numVertices = (int)nodes[i].vertices.size();
+        table[i].offset = offset;
+        offset += (long long)(nodes[i].vertices.size() * sizeof(Mesh::Vertex));
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(table.data(), sizeof(Node), table.size(), file) == table.size();
+    for (size_t i = 0; written && i < nodes.size(); i++)
+        written = fwrite(nodes[i].vertices.data(), sizeof(Mesh::Vertex), nodes[i].vertices.size(), file) ==
+                  nodes[i].vertices.size();
+
+    written = fclose(file) == 0 && written;
+
+    // Windows does not rename over an existing file
+    if (written && rename(partialFile.c_str(), pageFile) != 0)
+    {
+        remove(pageFile);
+        written = rename(partialFile.c_str(), pageFile) == 0;
+    }
+
+    if (!written)
+        remove(partialFile.c_str());
+
+    return written;
+}
+
+bool PagedModel::LoadFromFile(const char *fileName, long long budgetBytes)
+{
+    PROFILE_SCOPE("PagedModel::LoadFromFile");
+
+    mBudget = budgetBytes;
+
+    std::string pageFile = fileName;
+    if (EndsWith(pageFile, ".pages"))
+        return Open(pageFile.c_str());
+
+    // Same staleness rule as the LOD cache
+    pageFile += ".pages";
+
+    struct stat sourceInfo = {};
+    stat(fileName, &sourceInfo);
+
+    PageFileHeader header = {};
+    bool current = ReadHeader(pageFile.c_str(), header) && header.sourceSize == (long long)sourceInfo.st_size &&
+                   header.sourceTime == (long long)sourceInfo.st_mtime;
+
+    // A current header in front of a damaged file gets the same treatment as a stale one
+    if (current && Open(pageFile.c_str()))
+        return true;
+
+    Utils::Info(("Building page file " + pageFile).c_str());
+    return Build(fileName, pageFile.c_str()) && Open(pageFile.c_str());
+}
+
+bool PagedModel::Open(const char *pageFile)
+{
+    PageFileHeader header = {};
+    if (!ReadHeader(pageFile, header))
+        return false;
+
+    struct stat fileInfo = {};
+    stat(pageFile, &fileInfo);
+    long long fileSize = (long long)fileInfo.st_size;
+
+    // Every failure below releases what was set up so far, LoadFromFile may rebuild and open again
+    mNumNodes = header.numNodes;
+    mNumTriangles = header.numTriangles;
+    mNodes = new Node[mNumNodes];
+
+    FILE *file = fopen(pageFile, "rb");
+    bool valid = file && fseek(file, (long)sizeof(header), SEEK_SET) == 0 &&
+                 fread(mNodes, sizeof(Node), (size_t)mNumNodes, file) == (size_t)mNumNodes;
+    if (file)
+        fclose(file);
+
+    // A truncated file still has its node table, the pages themselves have to be there too
+    for (int i = 0; valid && i < mNumNodes; i++)
+    {
+        const Node &node = mNodes[i];
+        valid = node.numVertices >= 0 && node.numVertices % 3 == 0 && node.numChildren >= 0 && node.numChildren <= 8 &&
+                (!node.numChildren || (node.firstChild > i && node.firstChild + node.numChildren <= mNumNodes)) &&
+                node.offset >= 0 && node.offset + PageBytes(i) <= fileSize;
+    }
+
+    if (!valid)
+    {
+        Utils::Warning("Page file is corrupt.");
+        Close();
+        return false;
+    }
+
+#ifdef _WIN32
+    mFile = _open(pageFile, _O_RDONLY | _O_BINARY);
+#else
+    mFile = open(pageFile, O_RDONLY);
+#endif
+    if (mFile < 0)
+    {
+        Close();
+        return false;
+    }
+
+    mStates = new std::atomic<int>[mNumNodes];
+    mMeshes = new Mesh *[mNumNodes]();
+    mLastUsed = new long[mNumNodes]();
+    mRequestFrame = new long[mNumNodes]();
+
+    for (int i = 0; i < mNumNodes; i++)
+        mStates[i].store(NonResident, std::memory_order_relaxed);
+
+    // The root is what everything falls back to, so it is read right away and never evicted
+    auto *vertices = new Mesh::Vertex[mNodes[0].numVertices];
+    if (!ReadPage(0, vertices))
+    {
+        delete[] vertices;
+        Close();
+        return false;
+    }
+
+    mMeshes[0] = new Mesh();
+    mMeshes[0]->Create(vertices, mNodes[0].numVertices);
+    delete[] vertices;
+
+    mStates[0].store(Resident, std::memory_order_release);
+    mResidentPages = 1;
+    mResidentBytes = PageBytes(0);
+
+    return true;
+}
+
+long long PagedModel::PageBytes(int node) const
+{
+    return (long long)mNodes[node].numVertices * (long long)sizeof(Mesh::Vertex);
+}
+
+bool PagedModel::ReadPage(int node, Mesh::Vertex *vertices) const
+{
+    return ReadAt(mFile, vertices, (size_t)PageBytes(node), mNodes[node].offset);
+}
+
+unsigned int PagedModel::TestNode(int node, const CullSetup &cull) const
+{
+    const Bounds &bounds = mNodes[node].bounds;
+    if (!cull.world)
+        return cull.frusta[0].TestBox(bounds) ? 1u : 0u;
+
+    return Frustum::FaceMask(cull.frusta, cull.numFrusta, bounds.Transform(*cull.world));
+}
+
+static float BoundsDistance(const Bounds &bounds, const cyVec3f &p)
+{
+    cyVec3f d(MAX(0.0f, MAX(bounds.min.x - p.x, p.x - bounds.max.x)),
+              MAX(0.0f, MAX(bounds.min.y - p.y, p.y - bounds.max.y)),
+              MAX(0.0f, MAX(bounds.min.z - p.z, p.z - bounds.max.z)));
+    return d.Length();
+}
+
+void PagedModel::Select(RenderQueue &queue, Shader &shader, Mesh::Material *material, const cyMatrix4f &world, int node,
+                        unsigned int mask, const CullSetup &cull, const cyVec3f &viewPosition, float lodScale,
+                        CullStats &stats)
+{
+    const Node &n = mNodes[node];
+    mLastUsed[node] = mFrame;
+
+    // Same rule as Model::SelectLod, a LOD scale of zero asks for full detail everywhere
+    float distance = BoundsDistance(n.bounds, viewPosition);
+    bool refine = n.numChildren && (lodScale <= 0 || n.error * lodScale > distance);
+
+    if (refine)
+    {
+        // Children are only entered once every visible one is resident, until then this page stands in for them
+        unsigned int masks[8];
+        bool ready = true;
+        for (int c = 0; c < n.numChildren; c++)
+        {
+            int child = n.firstChild + c;
+            stats.tested++;
+            masks[c] = TestNode(child, cull);
+
+            if (!masks[c])
+                continue;
+
+            // A resident child waiting on its siblings counts as used, or it would be evicted to make room for them
+            if (mStates[child].load(std::memory_order_acquire) == Resident)
+            {
+                mLastUsed[child] = mFrame;
+                continue;
+            }
+
+            ready = false;
+            if (mRequestFrame[child] != mFrame && mStates[child].load(std::memory_order_relaxed) == NonResident)
+            {
+                mRequestFrame[child] = mFrame;
+                mRequests.push_back(std::make_pair(BoundsDistance(mNodes[child].bounds, viewPosition), child));
+            }
+        }
+
+        if (ready)
+        {
+            for (int c = 0; c < n.numChildren; c++)
+            {
+                if (masks[c])
+                    Select(queue, shader, material, world, n.firstChild + c, masks[c], cull, viewPosition, lodScale,
+                           stats);
+            }
+            return;
+        }
+    }
+
+    stats.visible++;
+    stats.triangles += n.numVertices / 3;
+    if (n.numChildren)
+        stats.lodDraws++;
+
+    DrawPacket packet = {};
+    packet.shader = &shader;
+    packet.mesh = mMeshes[node];
+    packet.material = material;
+    packet.model = &world;
+    packet.layerMask = cull.world ? (int)mask : -1;
+    packet.type = DrawPacket::Arrays;
+
+    float worldScale = cyVec3f(world.cell[0], world.cell[1], world.cell[2]).Length();
+    float depth = ((n.bounds.min + n.bounds.max) * 0.5f - viewPosition).Length() * worldScale;
+    queue.Push(packet, depth);
+}
+
+void PagedModel::Enqueue(RenderQueue &queue, Shader &shader, bool useMaterials, const cyMatrix4f &world,
+                         const Frustum &frustum, const cyVec3f &viewPosition, float lodScale, CullStats &stats)
+{
+    if (!mNumNodes)
+        return;
+
+    CullSetup cull = {&frustum, 1, nullptr};
+    stats.tested++;
+    stats.trianglesTotal += mNumTriangles;
+
+    unsigned int mask = TestNode(0, cull);
+    if (mask)
+        Select(queue, shader, useMaterials ? &mMaterial : nullptr, world, 0, mask, cull, viewPosition, lodScale, stats);
+}
+
+void PagedModel::EnqueueLayered(RenderQueue &queue, Shader &shader, const cyMatrix4f &world, const Frustum *layers,
+                                int numLayers, const cyVec3f &viewPosition, float lodScale, CullStats &stats)
+{
+    if (!mNumNodes)
+        return;
+
+    CullSetup cull = {layers, numLayers, &world};
+    stats.tested++;
+    stats.trianglesTotal += mNumTriangles;
+
+    unsigned int mask = TestNode(0, cull);
+    if (mask)
+        Select(queue, shader, nullptr, world, 0, mask, cull, viewPosition, lodScale, stats);
+}
+
+void PagedModel::UpdateResidency()
+{
+    if (!mNumNodes)
+        return;
+
+    PROFILE_SCOPE("PagedModel::UpdateResidency");
+
+    std::vector<int> wanted, evicted;
+
+    if (!mRequests.empty())
+    {
+        // Closest pages first, only as many as the loaders can take before the next frame
+        std::sort(mRequests.begin(), mRequests.end());
+        if ((int)mRequests.size() > MaxLoadsInFlight)
+            mRequests.resize(MaxLoadsInFlight);
+
+        // Retired pages hold their memory until the GL thread frees them, so they still count against the budget
+        long long committed = 0, releasing = 0;
+        std::vector<std::pair<long, int>> candidates;
+        for (int i = 0; i < mNumNodes; i++)
+        {
+            int state = mStates[i].load(std::memory_order_acquire);
+            if (state == Loading || state == Resident || state == Retired)
+                committed += PageBytes(i);
+            if (state == Retired)
+                releasing += PageBytes(i);
+
+            // Anything not touched this frame can go, oldest first, except the root everything falls back to
+            if (state == Resident && i && mLastUsed[i] < mFrame)
+                candidates.push_back(std::make_pair(mLastUsed[i], i));
+        }
+
+        std::sort(candidates.begin(), candidates.end());
+        size_t next = 0;
+
+        for (const auto &request : mRequests)
+        {
+            long long bytes = PageBytes(request.second);
+            if (committed + bytes <= mBudget)
+            {
+                wanted.push_back(request.second);
+                committed += bytes;
+                continue;
+            }
+
+            // Evicted memory only comes back a few frames later, until then this and the remaining requests wait.
+            // With nothing old enough left to evict the parent pages simply keep drawing
+            while (committed - releasing + bytes > mBudget && next < candidates.size())
+            {
+                int victim = candidates[next++].second;
+                mStates[victim].store(Retired, std::memory_order_release);
+                evicted.push_back(victim);
+                releasing += PageBytes(victim);
+            }
+            break;
+        }
+
+        mRequests.clear();
+    }
+
+    {
+        // The wanted list is redone every frame, so loads the GL thread has not started yet are simply replaced
+        std::lock_guard<std::mutex> lock(mMutex);
+        mWanted.swap(wanted);
+        mEvicted.insert(mEvicted.end(), evicted.begin(), evicted.end());
+    }
+
+    mFrame++;
+}
+
+void PagedModel::LoadPage(int node)
+{
+    mInFlight++;
+
+    UploadContext::Submit("PagedModel::LoadPage",
+                          [this, node]()
+                          {
+                              int numVertices = mNodes[node].numVertices;
+                              auto *vertices = new Mesh::Vertex[numVertices];
+                              Resources::Track(Resources::Staging, vertices, PageBytes(node), "page vertices");
+
+                              bool loaded = ReadPage(node, vertices);
+                              if (loaded)
+                              {
+                                  mMeshes[node] = new Mesh();
+                                  mMeshes[node]->CreateBuffers(vertices, numVertices);
+                              }
+
+                              Resources::Release(Resources::Staging, vertices);
+                              delete[] vertices;
+                              return loaded;
+                          },
+                          [this, node](bool loaded)
+                          {
+                              mInFlight--;
+
+                              if (!loaded)
+                              {
+                                  // A page that cannot be read is not asked for again, its parent keeps drawing
+                                  Utils::Warning("Unable to read page.");
+                                  mStates[node].store(Failed, std::memory_order_release);
+                                  return;
+                              }
+
+                              mMeshes[node]->CreateVertexArray();
+                              mResidentPages++;
+                              mResidentBytes += PageBytes(node);
+                              mStates[node].store(Resident, std::memory_order_release);
+                          });
+}
+
+void PagedModel::Service()
+{
+    if (!mNumNodes)
+        return;
+
+    PROFILE_SCOPE("PagedModel::Service");
+
+    std::vector<int> wanted, evicted;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        wanted.swap(mWanted);
+        evicted.swap(mEvicted);
+    }
+
+    mServiceCount++;
+    for (int node : evicted)
+        mRetiring.push_back(std::make_pair(node, mServiceCount));
+
+    // Frames already published can still draw an evicted page, its buffers go once they have all been submitted
+    size_t kept = 0;
+    for (size_t i = 0; i < mRetiring.size(); i++)
+    {
+        int node = mRetiring[i].first;
+        if (mServiceCount - mRetiring[i].second < RetireFrames)
+        {
+            mRetiring[kept++] = mRetiring[i];
+            continue;
+        }
+
+        delete mMeshes[node];
+        mMeshes[node] = nullptr;
+        mResidentPages--;
+        mResidentBytes -= PageBytes(node);
+        mStates[node].store(NonResident, std::memory_order_release);
+    }
+    mRetiring.resize(kept);
+
+    for (int node : wanted)
+    {
+        if (mInFlight >= MaxLoadsInFlight)
+            break;
+
+        int expected = NonResident;
+        if (mStates[node].compare_exchange_strong(expected, Loading, std::memory_order_acq_rel))
+            LoadPage(node);
+    }
+}
+
+Bounds PagedModel::GetBounds() const
+{
+    return mNodes[0].bounds;
+}
+
+PagedModel::Residency PagedModel::GetResidency() const
+{
+    Residency residency;
+    residency.residentPages = mResidentPages;
+    residency.numPages = mNumNodes;
+    residency.residentBytes = mResidentBytes;
+    residency.budgetBytes = mBudget;
+    return residency;
+}
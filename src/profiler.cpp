@@ -0,0 +1,133 @@
+#include "profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    struct Event
+    {
+        const char *name;
+        unsigned long long start;
+        unsigned long long end;
+    };
+
+    // Power of two so the write position wraps with a mask, older zones are overwritten
+    const unsigned long long RingSize = 1 << 16;
+
+    struct ThreadBuffer
+    {
+        Event events[RingSize];
+        std::atomic<unsigned long long> written;
+        const char *name;
+        int id;
+    };
+
+    std::mutex registryMutex;
+    std::vector<ThreadBuffer *> registry;
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    ThreadBuffer *GetThreadBuffer()
+    {
+        // Registration locks once per thread, recording itself never does
+        thread_local ThreadBuffer *buffer = nullptr;
+
+        if (!buffer)
+        {
+            buffer = new ThreadBuffer();
+            buffer->written.store(0);
+            buffer->name = nullptr;
+
+            std::lock_guard<std::mutex> lock(registryMutex);
+            buffer->id = (int)registry.size() + 1;
+            registry.push_back(buffer);
+        }
+
+        return buffer;
+    }
+
+    void WriteEscaped(FILE *file, const char *text)
+    {
+        for (const char *c = text; *c; c++)
+        {
+            if (*c == '"' || *c == '\\')
+                fputc('\\', file);
+            fputc(*c, file);
+        }
+    }
+}
+
+unsigned long long Profiler::Now()
+{
+    return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Profiler::Record(const char *name, unsigned long long start, unsigned long long end)
+{
+    ThreadBuffer *buffer = GetThreadBuffer();
+
+    // Single producer per ring, the release store publishes the event to the exporter
+    unsigned long long index = buffer->written.load(std::memory_order_relaxed);
+    Event &event = buffer->events[index & (RingSize - 1)];
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    buffer->written.store(index + 1, std::memory_order_release);
+}
+
+void Profiler::SetThreadName(const char *name)
+{
+    GetThreadBuffer()->name = name;
+}
+
+bool Profiler::WriteChromeTrace(const char *fileName)
+{
+    FILE *file = fopen(fileName, "w");
+    if (!file)
+        return false;
+
+    std::vector<ThreadBuffer *> buffers;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        buffers = registry;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+
+    for (ThreadBuffer *buffer : buffers)
+    {
+        if (buffer->name)
+        {
+            fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"",
+                    first ? "" : ",\n", buffer->id);
+            WriteEscaped(file, buffer->name);
+            fprintf(file, "\"}}");
+            first = false;
+        }
+
+        // Zones recorded while exporting may tear the oldest entries, which is fine for a profiler
+        unsigned long long written = buffer->written.load(std::memory_order_acquire);
+        unsigned long long begin = written > RingSize ? written - RingSize : 0;
+
+        for (unsigned long long i = begin; i < written; i++)
+        {
+            const Event &event = buffer->events[i & (RingSize - 1)];
+
+            fprintf(file, "%s{\"name\": \"", first ? "" : ",\n");
+            WriteEscaped(file, event.name);
+            fprintf(file, "\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}", buffer->id,
+                    (double)event.start / 1000.0, (double)(event.end - event.start) / 1000.0);
+            first = false;
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    return true;
+}
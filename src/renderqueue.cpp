@@ -0,0 +1,295 @@
+#include "renderqueue.h"
+#include "jobsystem.h"
+#include "profiler.h"
+#include "utils.h"
+
+#include <cstring>
+
+/*
+ * Key layout, most significant first:
+ *   pass (4) | translucent (1) | program (7) | depth octave (8) | material (12) | mesh (12) | depth mantissa (20)
+ * Opaque draws go front to back one distance octave at a time, state changes are grouped inside each octave.
+ */
+static const int PassShift = 60;
+static const int TranslucentShift = 59;
+static const int ProgramShift = 52;
+static const int OctaveShift = 44;
+static const int MaterialShift = 32;
+static const int MeshShift = 20;
+
+enum
+{
+    ProgramTable = 0, MaterialTable, MeshTable
+};
+
+RenderQueue::RenderQueue()
+    : mRecorded(false), mDropped(0), mStats()
+{
+}
+
+RenderQueue::~RenderQueue()
+{
+    for (CommandBuffer *buffer : mBuffers)
+        delete buffer;
+}
+
+void RenderQueue::Clear()
+{
+    mPasses.clear();
+    mPackets.clear();
+    mKeys.clear();
+    mRangeFirsts.clear();
+    mRangeCounts.clear();
+    mChunks.clear();
+    mRecorded = false;
+    mDropped = 0;
+
+    // Ids are handed out per frame, so streamed and paged meshes coming and going never exhaust them
+    for (std::unordered_map<const void *, unsigned int> &ids : mIds)
+        ids.clear();
+}
+
+void RenderQueue::BeginPass(std::function<void()> begin, std::function<void()> end)
+{
+    Pass pass;
+    pass.begin = begin;
+    pass.end = end;
+    mPasses.push_back(pass);
+}
+
+unsigned int RenderQueue::Intern(int table, const void *pointer, unsigned int bits)
+{
+    if (!pointer)
+        return 0;
+
+    // Past the id bits only batching suffers, the wrapped id sorts two resources together
+    auto inserted = mIds[table].insert(std::make_pair(pointer, (unsigned int)mIds[table].size() + 1));
+    return inserted.first->second & ((1u << bits) - 1);
+}
+
+int RenderQueue::PushRanges(const int *firsts, const int *counts, int numRanges)
+{
+    int offset = (int)mRangeFirsts.size();
+    mRangeFirsts.insert(mRangeFirsts.end(), firsts, firsts + numRanges);
+    mRangeCounts.insert(mRangeCounts.end(), counts, counts + numRanges);
+    return offset;
+}
+
+void RenderQueue::Push(const DrawPacket &packet, float depth, bool translucent)
+{
+    if (mPasses.empty() || (int)mPasses.size() > MaxPasses)
+    {
+        mDropped++;
+        return;
+    }
+
+    // Non-negative floats order the same as their bit patterns
+    unsigned int depthBits = 0;
+    if (depth > 0)
+        memcpy(&depthBits, &depth, sizeof(depthBits));
+    if (translucent)
+        depthBits = ~depthBits;
+
+    unsigned long long key = 0;
+    key |= (unsigned long long)(mPasses.size() - 1) << PassShift;
+    key |= (unsigned long long)(translucent ? 1 : 0) << TranslucentShift;
+    key |= (unsigned long long)Intern(ProgramTable, packet.shader, 7) << ProgramShift;
+    key |= (unsigned long long)(depthBits >> 23 & 0xff) << OctaveShift;
+    key |= (unsigned long long)Intern(MaterialTable, packet.material, 12) << MaterialShift;
+    key |= (unsigned long long)Intern(MeshTable, packet.mesh, 12) << MeshShift;
+    key |= (unsigned long long)(depthBits >> 3 & 0xfffff);
+
+    mKeys.push_back(key);
+    mPackets.push_back(packet);
+}
+
+void RenderQueue::Sort()
+{
+    size_t count = mKeys.size();
+
+    mOrder.resize(count);
+    mSortedOrder.resize(count);
+    mSortedKeys.resize(count);
+    for (size_t i = 0; i < count; i++)
+        mOrder[i] = (unsigned int)i;
+
+    // LSD radix sort on bytes, a byte that is the same for every key is skipped
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        size_t histogram[256] = {};
+        for (size_t i = 0; i < count; i++)
+            histogram[(mKeys[i] >> shift) & 0xff]++;
+
+        if (histogram[(mKeys[0] >> shift) & 0xff] == count)
+            continue;
+
+        size_t offset = 0;
+        for (int b = 0; b < 256; b++)
+        {
+            size_t n = histogram[b];
+            histogram[b] = offset;
+            offset += n;
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t slot = histogram[(mKeys[i] >> shift) & 0xff]++;
+            mSortedKeys[slot] = mKeys[i];
+            mSortedOrder[slot] = mOrder[i];
+        }
+
+        mKeys.swap(mSortedKeys);
+        mOrder.swap(mSortedOrder);
+    }
+}
+
+void RenderQueue::RecordChunk(Chunk &chunk)
+{
+    CommandBuffer &commands = *chunk.commands;
+    commands.Clear();
+    chunk.stats = {};
+
+    // Start from what the previous packet of the pass leaves bound, so splitting adds no state changes.
+    // Pass setup uploads uniforms and binds programs, so nothing carries over from an earlier pass
+    const Shader *shader = nullptr;
+    const Mesh::Material *material = nullptr;
+    const cyMatrix4f *model = nullptr;
+    if (chunk.first > 0 && (int)(mKeys[chunk.first - 1] >> PassShift) == chunk.pass)
+    {
+        const DrawPacket &previous = mPackets[mOrder[chunk.first - 1]];
+        shader = previous.shader;
+        material = previous.material;
+        model = previous.model;
+    }
+
+    for (int i = chunk.first; i < chunk.last; i++)
+    {
+        DrawPacket &packet = mPackets[mOrder[i]];
+
+        if (packet.shader != shader)
+        {
+            commands.Use(*packet.shader);
+            shader = packet.shader;
+            material = nullptr;
+            model = nullptr;
+            chunk.stats.programChanges++;
+        }
+
+        if (packet.material && packet.material != material)
+        {
+            Mesh::RecordMaterial(commands, *packet.shader, *packet.material);
+            material = packet.material;
+            chunk.stats.materialChanges++;
+        }
+
+        if (packet.model && packet.model != model)
+        {
+            commands.Uniform(packet.shader->GetUniformLocation("uModel"), *packet.model);
+            model = packet.model;
+            chunk.stats.modelChanges++;
+        }
+
+        if (packet.layerMask >= 0)
+            commands.Uniform(packet.shader->GetUniformLocation("uLayerMask"), packet.layerMask);
+
+        if (packet.numInstances)
+        {
+            commands.Instances(*packet.mesh, packet.instanceBuffer, packet.firstInstance);
+
+            if (packet.type == DrawPacket::Elements)
+                commands.DrawElements(*packet.mesh, *packet.shader, packet.first, packet.count, packet.numInstances);
+            else
+                commands.Draw(*packet.mesh, *packet.shader, packet.numInstances);
+            continue;
+        }
+
+        if (packet.type == DrawPacket::Ranges)
+            commands.DrawRanges(*packet.mesh, *packet.shader, &mRangeFirsts[packet.first], &mRangeCounts[packet.first],
+                                packet.count);
+        else if (packet.type == DrawPacket::Elements)
+            commands.DrawElements(*packet.mesh, *packet.shader, packet.first, packet.count);
+        else
+            commands.Draw(*packet.mesh, *packet.shader);
+    }
+}
+
+void RenderQueue::Record()
+{
+    if (mRecorded)
+        return;
+
+    PROFILE_SCOPE("RenderQueue::Record");
+
+    if (mDropped)
+        Utils::Warning(("Render queue dropped " + std::to_string(mDropped) +
+                        " packets pushed outside a pass or past the pass limit.").c_str());
+
+    mStats = {};
+    mStats.packets = (int)mPackets.size();
+    mStats.passes = (int)mPasses.size();
+
+    if (!mPackets.empty())
+        Sort();
+
+    int count = (int)mPackets.size();
+    mChunks.clear();
+    for (int i = 0; i < count;)
+    {
+        Chunk chunk = {};
+        chunk.pass = (int)(mKeys[i] >> PassShift);
+        chunk.first = i;
+        chunk.last = i + 1;
+
+        int end = i + PacketsPerChunk < count ? i + PacketsPerChunk : count;
+        while (chunk.last < end && (int)(mKeys[chunk.last] >> PassShift) == chunk.pass)
+            chunk.last++;
+
+        mChunks.push_back(chunk);
+        i = chunk.last;
+    }
+
+    // Buffers are kept across frames so their storage is reused
+    while (mBuffers.size() < mChunks.size())
+        mBuffers.push_back(new CommandBuffer());
+    for (size_t i = 0; i < mChunks.size(); i++)
+        mChunks[i].commands = mBuffers[i];
+
+    JobSystem::ParallelFor("Record draws", (int)mChunks.size(), 1, [this](int first, int last)
+    {
+        for (int i = first; i < last; i++)
+            RecordChunk(mChunks[i]);
+    });
+
+    for (const Chunk &chunk : mChunks)
+    {
+        mStats.programChanges += chunk.stats.programChanges;
+        mStats.materialChanges += chunk.stats.materialChanges;
+        mStats.modelChanges += chunk.stats.modelChanges;
+    }
+
+    mRecorded = true;
+}
+
+void RenderQueue::Submit()
+{
+    Record();
+
+    // Passes without packets still run so their targets get cleared
+    size_t chunk = 0;
+    for (int pass = 0; pass < (int)mPasses.size(); pass++)
+    {
+        if (mPasses[pass].begin)
+            mPasses[pass].begin();
+
+        for (; chunk < mChunks.size() && mChunks[chunk].pass == pass; chunk++)
+            mChunks[chunk].commands->Replay();
+
+        if (mPasses[pass].end)
+            mPasses[pass].end();
+    }
+}
+
+const QueueStats &RenderQueue::GetStats() const
+{
+    return mStats;
+}
@@ -0,0 +1,113 @@
+#include "renderstats.h"
+
+#include <cstdio>
+
+namespace
+{
+    // Per thread so work on upload contexts stays out of the GL thread's frames
+    thread_local RenderStats::Frame current = {};
+    RenderStats::Frame last = {}, total = {};
+    RenderStats::Frame window[RenderStats::WindowFrames] = {};
+    int windowNext = 0, windowSize = 0;
+    long long frames = 0;
+    bool started = false;
+}
+
+const char *RenderStats::CounterNames[RenderStats::Count] = {"draw_calls", "triangles", "vertices", "uniform_uploads",
+                                                             "texture_binds", "program_switches", "buffer_bytes",
+                                                             "framebuffer_switches"};
+
+void RenderStats::Add(Counter counter, long long amount)
+{
+    current.values[counter] += amount;
+}
+
+void RenderStats::AddDraw(long long vertices, long long instances)
+{
+    current.values[DrawCalls]++;
+    current.values[Vertices] += vertices * instances;
+    current.values[Triangles] += vertices / 3 * instances;
+}
+
+void RenderStats::BeginFrame()
+{
+    // Whatever was counted before the first frame is loading work, not part of any frame
+    if (started)
+    {
+        last = current;
+        window[windowNext] = current;
+        windowNext = (windowNext + 1) % WindowFrames;
+        windowSize = windowSize < WindowFrames ? windowSize + 1 : WindowFrames;
+
+        for (int i = 0; i < Count; i++)
+            total.values[i] += current.values[i];
+        frames++;
+    }
+
+    started = true;
+    current = {};
+}
+
+const RenderStats::Frame &RenderStats::GetLastFrame()
+{
+    return last;
+}
+
+RenderStats::Frame RenderStats::GetWindowAverage()
+{
+    Frame average = {};
+    if (!windowSize)
+        return average;
+
+    for (int f = 0; f < windowSize; f++)
+    {
+        for (int i = 0; i < Count; i++)
+            average.values[i] += window[f].values[i];
+    }
+
+    for (int i = 0; i < Count; i++)
+        average.values[i] /= windowSize;
+
+    return average;
+}
+
+RenderStats::Frame RenderStats::GetWindowMax()
+{
+    Frame maximum = {};
+
+    for (int f = 0; f < windowSize; f++)
+    {
+        for (int i = 0; i < Count; i++)
+            maximum.values[i] = window[f].values[i] > maximum.values[i] ? window[f].values[i] : maximum.values[i];
+    }
+
+    return maximum;
+}
+
+int RenderStats::GetWindowSize()
+{
+    return windowSize;
+}
+
+bool RenderStats::WriteJson(const char *fileName)
+{
+    FILE *file = fopen(fileName, "w");
+    if (!file)
+        return false;
+
+    Frame average = GetWindowAverage();
+    Frame maximum = GetWindowMax();
+
+    fprintf(file, "{\n  \"frames\": %lld,\n  \"window_frames\": %d,\n  \"counters\": {\n", frames, windowSize);
+    for (int i = 0; i < Count; i++)
+    {
+        fprintf(file, "    \"%s\": {\"last\": %lld, \"window_average\": %lld, \"window_max\": %lld, \"run_total\": %lld, "
+                      "\"run_average\": %.2f}%s\n", CounterNames[i], last.values[i], average.values[i],
+                maximum.values[i], total.values[i], frames ? (double)total.values[i] / (double)frames : 0.0,
+                i + 1 < Count ? "," : "");
+    }
+    fprintf(file, "  }\n}\n");
+
+    fclose(file);
+    return true;
+}
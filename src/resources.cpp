@@ -0,0 +1,158 @@
+#include "resources.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+    struct Entry
+    {
+        long long bytes;
+        std::string label;
+    };
+
+    struct Consumer
+    {
+        Resources::Type type;
+        const Entry *entry;
+    };
+
+    std::mutex registryMutex;
+    std::unordered_map<const void *, Entry> entries[Resources::Count];
+    Resources::Totals totals = {};
+
+    std::string FormatBytes(long long bytes)
+    {
+        char text[32];
+        if (bytes >= 1048576)
+            snprintf(text, sizeof(text), "%.2f MB", bytes / 1048576.0);
+        else
+            snprintf(text, sizeof(text), "%.1f KB", bytes / 1024.0);
+        return text;
+    }
+}
+
+const char *Resources::TypeNames[Resources::Count] = {"texture", "buffer", "renderbuffer", "staging"};
+
+long long Resources::TextureBytes(int width, int height, int bytesPerTexel, int layers, bool mips)
+{
+    long long bytes = (long long)width * height * bytesPerTexel;
+
+    while (mips && (width > 1 || height > 1))
+    {
+        width = MAX(width / 2, 1);
+        height = MAX(height / 2, 1);
+        bytes += (long long)width * height * bytesPerTexel;
+    }
+
+    return bytes * layers;
+}
+
+void Resources::Track(Type type, const void *owner, long long bytes, const std::string &label)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    auto inserted = entries[type].insert(std::make_pair(owner, Entry{0, label}));
+    Entry &entry = inserted.first->second;
+
+    if (inserted.second)
+        totals.objects[type]++;
+    else if (!label.empty())
+        entry.label = label;
+
+    totals.current[type] += bytes - entry.bytes;
+    totals.peak[type] = MAX(totals.peak[type], totals.current[type]);
+    entry.bytes = bytes;
+}
+
+void Resources::SetLabel(Type type, const void *owner, const std::string &label)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    auto found = entries[type].find(owner);
+    if (found != entries[type].end())
+        found->second.label = label;
+}
+
+void Resources::Release(Type type, const void *owner)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    auto found = entries[type].find(owner);
+    if (found == entries[type].end())
+        return;
+
+    totals.current[type] -= found->second.bytes;
+    totals.objects[type]--;
+    entries[type].erase(found);
+}
+
+Resources::Totals Resources::GetTotals()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    return totals;
+}
+
+void Resources::PrintTopConsumers(int count)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    char line[256];
+
+    std::vector<Consumer> consumers;
+    for (int type = 0; type < Count; type++)
+    {
+        for (auto &entry : entries[type])
+            consumers.push_back(Consumer{(Type)type, &entry.second});
+    }
+
+    std::sort(consumers.begin(), consumers.end(), [](const Consumer &a, const Consumer &b)
+    {
+        return a.entry->bytes > b.entry->bytes;
+    });
+
+    Utils::Info("Top consumers");
+    for (int i = 0; i < count && i < (int)consumers.size(); i++)
+    {
+        snprintf(line, sizeof(line), "%-13s %12s  %s", TypeNames[consumers[i].type],
+                 FormatBytes(consumers[i].entry->bytes).c_str(),
+                 consumers[i].entry->label.empty() ? "(unnamed)" : consumers[i].entry->label.c_str());
+        Utils::Info(line);
+    }
+
+    snprintf(line, sizeof(line), "%-13s %8s %12s %12s", "Type", "objects", "current", "peak");
+    Utils::Info(line);
+    for (int type = 0; type < Count; type++)
+    {
+        snprintf(line, sizeof(line), "%-13s %8d %12s %12s", TypeNames[type], totals.objects[type],
+                 FormatBytes(totals.current[type]).c_str(), FormatBytes(totals.peak[type]).c_str());
+        Utils::Info(line);
+    }
+
+    snprintf(line, sizeof(line), "Process peak RSS %s", FormatBytes((long long)Utils::PeakResidentBytes()).c_str());
+    Utils::Info(line);
+}
+
+int Resources::ReportLeaks()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    char line[256];
+    int leaks = 0;
+
+    for (int type = 0; type < Count; type++)
+    {
+        for (auto &entry : entries[type])
+        {
+            snprintf(line, sizeof(line), "Leaked %s %s (%s)", TypeNames[type],
+                     entry.second.label.empty() ? "(unnamed)" : entry.second.label.c_str(),
+                     FormatBytes(entry.second.bytes).c_str());
+            Utils::Warning(line);
+            leaks++;
+        }
+    }
+
+    return leaks;
+}
@@ -1,7 +1,14 @@
 #include "shader.h"
 
 #include <glad/glad.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
 #include "utils.h"
+#include "glstate.h"
+#include "profiler.h"
+#include "startupreport.h"
+#include "renderstats.h"
 
 Shader::Shader()
     : mProgramID(0)
@@ -10,44 +17,97 @@ Shader::Shader()
 
 Shader::~Shader()
 {
+    GLState::ForgetProgram(mProgramID);
     glDeleteProgram(mProgramID);
 }
 
 void Shader::Use() const
 {
-    glUseProgram(mProgramID);
+    GLState::UseProgram(mProgramID);
 }
 
-bool Shader::LoadFromSource(const char *vertSrc, const char *fragSrc)
+static unsigned int CompileStage(unsigned int type, const char *src, const char *defines)
 {
     int success;
     char infoLog[512];
-    unsigned int vertex, fragment;
 
-    vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vertSrc, nullptr);
-    glCompileShader(vertex);
+    // Variants are selected by inserting #defines right after the #version line
+    std::string source = src;
+    if (defines)
+    {
+        size_t versionEnd = 0;
+        size_t version = source.find("#version");
+        if (version != std::string::npos)
+            versionEnd = source.find('\n', version) + 1;
+
+        source.insert(versionEnd, defines);
+    }
+
+    const char *sourcePtr = source.c_str();
+
+    unsigned int stage = glCreateShader(type);
+    glShaderSource(stage, 1, &sourcePtr, nullptr);
+    glCompileShader(stage);
 
-    glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
+    glGetShaderiv(stage, GL_COMPILE_STATUS, &success);
     if (!success)
     {
-        glGetShaderInfoLog(vertex, 512, nullptr, infoLog);
+        glGetShaderInfoLog(stage, 512, nullptr, infoLog);
         Utils::Info(infoLog);
     }
 
-    fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fragSrc, nullptr);
-    glCompileShader(fragment);
+    return stage;
+}
 
-    glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-    if (!success)
+// Startup report row for one program, the injected defines tell the variants apart
+static std::string PhaseName(const char *defines)
+{
+    static int count = 0;
+    std::string name = "Shader " + std::to_string(++count) + " compile/link";
+
+    if (!defines || !*defines)
+        return name;
+
+    std::string variant;
+    for (const char *c = defines; *c; c++)
     {
-        glGetShaderInfoLog(fragment, 512, nullptr, infoLog);
-        Utils::Info(infoLog);
+        if (!strncmp(c, "#define ", 8))
+            c += 7;
+        else if (*c == '\n')
+            variant += variant.empty() || variant.back() == ' ' ? "" : " ";
+        else
+            variant += *c;
     }
 
+    while (!variant.empty() && variant.back() == ' ')
+        variant.pop_back();
+
+    return name + " [" + variant + "]";
+}
+
+bool Shader::LoadFromSource(const char *vertSrc, const char *fragSrc, const char *defines)
+{
+    return LoadFromSource(vertSrc, nullptr, fragSrc, defines);
+}
+
+bool Shader::LoadFromSource(const char *vertSrc, const char *geomSrc, const char *fragSrc, const char *defines)
+{
+    PROFILE_SCOPE("Shader::LoadFromSource");
+    StartupReport::Phase phase(PhaseName(defines));
+
+    int success;
+    char infoLog[512];
+    unsigned int vertex, geometry = 0, fragment;
+
+    vertex = CompileStage(GL_VERTEX_SHADER, vertSrc, defines);
+    if (geomSrc)
+        geometry = CompileStage(GL_GEOMETRY_SHADER, geomSrc, defines);
+    fragment = CompileStage(GL_FRAGMENT_SHADER, fragSrc, defines);
+
     mProgramID = glCreateProgram();
     glAttachShader(mProgramID, vertex);
+    if (geometry)
+        glAttachShader(mProgramID, geometry);
     glAttachShader(mProgramID, fragment);
     glLinkProgram(mProgramID);
 
@@ -61,12 +121,56 @@ bool Shader::LoadFromSource(const char *vertSrc, const char *fragSrc)
 
     // Clean up
     glDeleteShader(vertex);
+    if (geometry)
+        glDeleteShader(geometry);
     glDeleteShader(fragment);
 
+    CacheUniforms();
+
     return true;
 }
 
-bool Shader::LoadFromFile(const char *vertFileName, const char *fragFileName)
+void Shader::CacheUniforms()
+{
+    int numUniforms = 0;
+    glGetProgramiv(mProgramID, GL_ACTIVE_UNIFORMS, &numUniforms);
+
+    mUniforms.clear();
+    mUniforms.reserve((size_t)numUniforms);
+
+    for (int i = 0; i < numUniforms; i++)
+    {
+        char name[256];
+        int length = 0, size = 0;
+        unsigned int type = 0;
+        glGetActiveUniform(mProgramID, (unsigned int)i, sizeof(name), &length, &size, &type, name);
+
+        // Arrays are reported as their first element, uploads address them by the plain name
+        std::string uniform(name, (size_t)length);
+        if (uniform.size() > 3 && !uniform.compare(uniform.size() - 3, 3, "[0]"))
+            uniform.resize(uniform.size() - 3);
+
+        mUniforms.push_back(std::make_pair(uniform, glGetUniformLocation(mProgramID, name)));
+    }
+
+    std::sort(mUniforms.begin(), mUniforms.end());
+}
+
+int Shader::GetUniformLocation(const char *name) const
+{
+    auto found = std::lower_bound(mUniforms.begin(), mUniforms.end(), name,
+                                  [](const std::pair<std::string, int> &uniform, const char *key)
+                                  {
+                                      return strcmp(uniform.first.c_str(), key) < 0;
+                                  });
+
+    if (found == mUniforms.end() || found->first != name)
+        return -1;
+
+    return found->second;
+}
+
+bool Shader::LoadFromFile(const char *vertFileName, const char *fragFileName, const char *defines)
 {
     char *vertexSrc = Utils::ReadFile(vertFileName);
     char *fragmentSrc = Utils::ReadFile(fragFileName);
@@ -74,7 +178,7 @@ bool Shader::LoadFromFile(const char *vertFileName, const char *fragFileName)
     if (!vertexSrc || !fragmentSrc)
         return false;
 
-    bool result = LoadFromSource(vertexSrc, fragmentSrc);
+    bool result = LoadFromSource(vertexSrc, fragmentSrc, defines);
 
     // Clean up
     delete[] vertexSrc;
@@ -85,108 +189,156 @@ bool Shader::LoadFromFile(const char *vertFileName, const char *fragFileName)
 
 bool Shader::UploadUniform(const char *name, bool value) const
 {
-    int location = glGetUniformLocation(mProgramID, name);
+    int location = GetUniformLocation(name);
 
     if (location == -1)
         return false;
 
     glUniform1i(location, value);
+    RenderStats::Add(RenderStats::UniformUploads);
 
     return true;
 }
 
 bool Shader::UploadUniform(const char *name, int value) const
 {
-    int location = glGetUniformLocation(mProgramID, name);
+    int location = GetUniformLocation(name);
 
     if (location == -1)
         return false;
 
     glUniform1i(location, value);
+    RenderStats::Add(RenderStats::UniformUploads);
 
     return true;
 }
 
 bool Shader::UploadUniform(const char *name, int *values, int count) const
 {
-    int location = glGetUniformLocation(mProgramID, name);
+    int location = GetUniformLocation(name);
 
     if (location == -1)
         return false;
 
     glUniform1iv(location, count, values);
+    RenderStats::Add(RenderStats::UniformUploads);
 
     return true;
 }
 
 bool Shader::UploadUniform(const char *name, float value) const
 {
-    int location = glGetUniformLocation(mProgramID, name);
+    int location = GetUniformLocation(name);
 
     if (location == -1)
         return false;
 
     glUniform1f(location, value);
+    RenderStats::Add(RenderStats::UniformUploads);
 
     return true;
 }
 
 bool Shader::UploadUniform(const char *name, float *values, int count) const
 {
-    int location = glGetUniformLocation(mProgramID, name);
+    int location = GetUniformLocation(name);
 
     if (location == -1)
         return false;
 
     glUniform1fv(location, count, values);
+    RenderStats::Add(RenderStats::UniformUploads);
 
     return true;
 }
 
 bool Shader::UploadUniform(const char *name, cyVec2f value) const
 {
-    int location = glGetUniformLocation(mProgramID, name);
+    int location = GetUniformLocation(name);
 
     if (location == -1)
         return false;
 
     glUniform2f(location, value.x, value.y);
+    RenderStats::Add(RenderStats::UniformUploads);
 
     return true;
 }
 
 bool Shader::UploadUniform(const char *name, cyVec3f value) const
 {
-    int location = glGetUniformLocation(mProgramID, name);
+    int location = GetUniformLocation(name);
 
     if (location == -1)
         return false;
 
     glUniform3f(location, value.x, value.y, value.z);
+    RenderStats::Add(RenderStats::UniformUploads);
+
+    return true;
+}
+
+bool Shader::UploadUniform(const char *name, const cyVec3f *values, int count) const
+{
+    int location = GetUniformLocation(name);
+
+    if (location == -1)
+        return false;
+
+    glUniform3fv(location, count, (const float *)values);
+    RenderStats::Add(RenderStats::UniformUploads);
 
     return true;
 }
 
 bool Shader::UploadUniform(const char *name, cyVec4f value) const
 {
-    int location = glGetUniformLocation(mProgramID, name);
+    int location = GetUniformLocation(name);
 
     if (location == -1)
         return false;
 
     glUniform4f(location, value.x, value.y, value.z, value.w);
+    RenderStats::Add(RenderStats::UniformUploads);
+
+    return true;
+}
+
+bool Shader::UploadUniform(const char *name, const cyVec4f *values, int count) const
+{
+    int location = GetUniformLocation(name);
+
+    if (location == -1)
+        return false;
+
+    glUniform4fv(location, count, (const float *)values);
+    RenderStats::Add(RenderStats::UniformUploads);
 
     return true;
 }
 
 bool Shader::UploadUniform(const char *name, cyMatrix4f value) const
 {
-    int location = glGetUniformLocation(mProgramID, name);
+    int location = GetUniformLocation(name);
 
     if (location == -1)
         return false;
 
     glUniformMatrix4fv(location, 1, false, (float *)&value);
+    RenderStats::Add(RenderStats::UniformUploads);
+
+    return true;
+}
+
+bool Shader::UploadUniform(const char *name, const cyMatrix4f *values, int count) const
+{
+    int location = GetUniformLocation(name);
+
+    if (location == -1)
+        return false;
+
+    glUniformMatrix4fv(location, count, false, (const float *)values);
+    RenderStats::Add(RenderStats::UniformUploads);
 
     return true;
 }
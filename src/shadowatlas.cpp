@@ -0,0 +1,227 @@
+#include "shadowatlas.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <glad/glad.h>
+
+#include "glstate.h"
+
+ShadowAtlas::ShadowAtlas()
+    : mSize(0), mMinTileSize(0), mNumLevels(0), mFreeLists(nullptr)
+{
+}
+
+ShadowAtlas::~ShadowAtlas()
+{
+    delete[] mFreeLists;
+}
+
+bool ShadowAtlas::Create(int size, int minTileSize)
+{
+    mSize = size;
+    mMinTileSize = minTileSize;
+
+    mNumLevels = 1;
+    for (int tileSize = size; tileSize > minTileSize; tileSize /= 2)
+        mNumLevels++;
+
+    mFreeLists = new std::vector<Tile>[mNumLevels];
+    mFreeLists[0].push_back({0, 0, size});
+
+    return mFramebuffer.CreateDepthOnly(size, size);
+}
+
+int ShadowAtlas::GetLevel(int tileSize) const
+{
+    int level = 0;
+    for (int size = mSize; size / 2 >= tileSize && level < mNumLevels - 1; size /= 2)
+        level++;
+
+    return level;
+}
+
+bool ShadowAtlas::Allocate(int tileSize, Tile &tile)
+{
+    int level = GetLevel(tileSize);
+
+    // Find the smallest free block that fits, then split it down to the requested size
+    int source = level;
+    while (source >= 0 && mFreeLists[source].empty())
+        source--;
+
+    if (source < 0)
+        return false;
+
+    Tile block = mFreeLists[source].back();
+    mFreeLists[source].pop_back();
+
+    while (source < level)
+    {
+        int half = block.size / 2;
+        source++;
+
+        mFreeLists[source].push_back({block.x + half, block.y, half});
+        mFreeLists[source].push_back({block.x, block.y + half, half});
+        mFreeLists[source].push_back({block.x + half, block.y + half, half});
+
+        block.size = half;
+    }
+
+    tile = block;
+    return true;
+}
+
+void ShadowAtlas::Free(const Tile &tile)
+{
+    int level = GetLevel(tile.size);
+    Tile block = tile;
+
+    // Merge with the three buddies as long as all of them are free
+    while (level > 0)
+    {
+        int parentSize = block.size * 2;
+        int parentX = block.x - block.x % parentSize;
+        int parentY = block.y - block.y % parentSize;
+
+        std::vector<Tile> &freeList = mFreeLists[level];
+        int buddies[3];
+        int found = 0;
+
+        for (int i = 0; i < (int)freeList.size() && found < 3; i++)
+        {
+            const Tile &other = freeList[i];
+            bool sameParent = other.x - other.x % parentSize == parentX && other.y - other.y % parentSize == parentY;
+
+            if (sameParent)
+                buddies[found++] = i;
+        }
+
+        if (found < 3)
+            break;
+
+        // Indices are ascending, erase back to front
+        for (int i = 2; i >= 0; i--)
+        {
+            freeList[buddies[i]] = freeList.back();
+            freeList.pop_back();
+        }
+
+        block = {parentX, parentY, parentSize};
+        level--;
+    }
+
+    mFreeLists[level].push_back(block);
+}
+
+void ShadowAtlas::Begin() const
+{
+    mFramebuffer.Begin();
+    GLState::Enable(GL_SCISSOR_TEST);
+}
+
+void ShadowAtlas::BeginTile(const Tile &tile) const
+{
+    GLState::Viewport(tile.x, tile.y, tile.size, tile.size);
+    GLState::Scissor(tile.x, tile.y, tile.size, tile.size);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void ShadowAtlas::End(int width, int height)
+{
+    GLState::Disable(GL_SCISSOR_TEST);
+    mFramebuffer.End(width, height);
+}
+
+cyMatrix4f ShadowAtlas::GetTileTransform(const Tile &tile, float bias) const
+{
+    // Clip space to the tile's region of the atlas texture
+    float scale = (float)tile.size / (float)mSize;
+    float x = (float)tile.x / (float)mSize;
+    float y = (float)tile.y / (float)mSize;
+
+    return cyMatrix4f::Translation({x + 0.5f * scale, y + 0.5f * scale, 0.5f - bias}) *
+           cyMatrix4f::Scale(0.5f * scale, 0.5f * scale, 0.5f);
+}
+
+cyVec4f ShadowAtlas::GetTileRect(const Tile &tile) const
+{
+    // Half a texel inset so filtering never reads a neighbouring tile
+    float texel = 1.0f / (float)mSize;
+
+    return {(float)tile.x * texel + 0.5f * texel, (float)tile.y * texel + 0.5f * texel,
+            (float)(tile.x + tile.size) * texel - 0.5f * texel, (float)(tile.y + tile.size) * texel - 0.5f * texel};
+}
+
+int ShadowAtlas::GetSize() const
+{
+    return mSize;
+}
+
+int ShadowAtlas::GetMinTileSize() const
+{
+    return mMinTileSize;
+}
+
+Texture &ShadowAtlas::GetTexture()
+{
+    return mFramebuffer.GetTexture();
+}
+
+ShadowScheduler::ShadowScheduler()
+    : mBudget(2), mFrame(0), mMotionWeight(4.0f)
+{
+}
+
+void ShadowScheduler::SetBudget(int viewsPerFrame)
+{
+    mBudget = viewsPerFrame;
+}
+
+int ShadowScheduler::GetBudget() const
+{
+    return mBudget;
+}
+
+int ShadowScheduler::Schedule(ShadowLight *lights, int numLights, int *scheduled)
+{
+    mFrame++;
+
+    int candidates = 0;
+    for (int i = 0; i < numLights; i++)
+    {
+        ShadowLight &light = lights[i];
+
+        if (!light.hasTile)
+        {
+            light.priority = 0;
+            continue;
+        }
+
+        float moved = (light.position - light.renderedPosition).Length() / light.radius;
+
+        // Lights without a valid map go first, static lights never need a refresh
+        if (!light.valid)
+            light.priority = FLT_MAX;
+        else if (moved < 0.0001f)
+            light.priority = 0;
+        else
+            light.priority = light.coverage * (1.0f + mMotionWeight * moved) * (float)(mFrame - light.lastUpdate);
+
+        if (light.priority > 0)
+            scheduled[candidates++] = i;
+    }
+
+    int count = std::min(candidates, mBudget);
+    std::partial_sort(scheduled, scheduled + count, scheduled + candidates,
+                      [lights](int a, int b) { return lights[a].priority > lights[b].priority; });
+
+    return count;
+}
+
+void ShadowScheduler::MarkUpdated(ShadowLight &light) const
+{
+    light.renderedPosition = light.position;
+    light.renderedViewProjection = light.projection * light.view;
+    light.lastUpdate = mFrame;
+    light.valid = true;
+}
@@ -0,0 +1,319 @@
+#include "simplify.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+
+namespace
+{
+    struct Quadric
+    {
+        double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+        Quadric() : a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0) {}
+
+        void AddPlane(double a, double b, double c, double d)
+        {
+            a2 += a * a; ab += a * b; ac += a * c; ad += a * d;
+            b2 += b * b; bc += b * c; bd += b * d;
+            c2 += c * c; cd += c * d;
+            d2 += d * d;
+        }
+
+        Quadric &operator+=(const Quadric &q)
+        {
+            a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+            b2 += q.b2; bc += q.bc; bd += q.bd;
+            c2 += q.c2; cd += q.cd;
+            d2 += q.d2;
+            return *this;
+        }
+
+        // Sum of squared distances from p to every accumulated plane
+        double Evaluate(const cyVec3f &p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            return a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x +
+                   b2 * y * y + 2 * bc * y * z + 2 * bd * y +
+                   c2 * z * z + 2 * cd * z + d2;
+        }
+    };
+
+    struct Candidate
+    {
+        double cost;
+        unsigned int from, to;
+        unsigned int version;
+
+        bool operator<(const Candidate &other) const { return cost > other.cost; }
+    };
+
+    struct VertexHash
+    {
+        size_t operator()(const Mesh::Vertex &v) const
+        {
+            const unsigned int *words = (const unsigned int *)&v;
+            size_t hash = 2166136261u;
+            for (size_t i = 0; i < sizeof(Mesh::Vertex) / sizeof(unsigned int); i++)
+                hash = (hash ^ words[i]) * 16777619u;
+            return hash;
+        }
+    };
+
+    struct VertexEqual
+    {
+        bool operator()(const Mesh::Vertex &a, const Mesh::Vertex &b) const
+        {
+            return memcmp(&a, &b, sizeof(Mesh::Vertex)) == 0;
+        }
+    };
+
+    struct PositionHash
+    {
+        size_t operator()(const cyVec3f &p) const
+        {
+            const unsigned int *words = (const unsigned int *)&p;
+            return ((size_t)words[0] * 73856093u) ^ ((size_t)words[1] * 19349663u) ^ ((size_t)words[2] * 83492791u);
+        }
+    };
+
+    struct PositionEqual
+    {
+        bool operator()(const cyVec3f &a, const cyVec3f &b) const
+        {
+            return a.x == b.x && a.y == b.y && a.z == b.z;
+        }
+    };
+
+    cyVec3f TriangleNormal(const cyVec3f &a, const cyVec3f &b, const cyVec3f &c)
+    {
+        return (b - a) ^ (c - a);
+    }
+}
+
+void Simplify::Weld(const Mesh::Vertex *vertices, int numVertices, std::vector<Mesh::Vertex> &unique,
+                    std::vector<unsigned int> &indices)
+{
+    std::unordered_map<Mesh::Vertex, unsigned int, VertexHash, VertexEqual> lookup;
+    lookup.reserve((size_t)numVertices);
+
+    unique.clear();
+    indices.resize((size_t)numVertices);
+
+    for (int i = 0; i < numVertices; i++)
+    {
+        auto inserted = lookup.insert(std::make_pair(vertices[i], (unsigned int)unique.size()));
+        if (inserted.second)
+            unique.push_back(vertices[i]);
+
+        indices[i] = inserted.first->second;
+    }
+}
+
+float Simplify::Collapse(const std::vector<Mesh::Vertex> &vertices, const std::vector<unsigned int> &indices,
+                         int targetTriangles, std::vector<unsigned int> &result)
+{
+    size_t numVertices = vertices.size();
+    size_t numTriangles = indices.size() / 3;
+
+    std::vector<unsigned int> triangles(indices);
+    std::vector<bool> triangleAlive(numTriangles, true);
+    std::vector<std::vector<unsigned int>> vertexTriangles(numVertices);
+    std::vector<Quadric> quadrics(numVertices);
+    std::vector<bool> locked(numVertices, false), removed(numVertices, false);
+    std::vector<unsigned int> versions(numVertices, 0);
+
+    for (size_t t = 0; t < numTriangles; t++)
+    {
+        const cyVec3f &a = vertices[triangles[t * 3 + 0]].position;
+        const cyVec3f &b = vertices[triangles[t * 3 + 1]].position;
+        const cyVec3f &c = vertices[triangles[t * 3 + 2]].position;
+
+        cyVec3f n = TriangleNormal(a, b, c);
+        float length = n.Length();
+        if (length > 0)
+        {
+            n /= length;
+            for (int k = 0; k < 3; k++)
+                quadrics[triangles[t * 3 + k]].AddPlane(n.x, n.y, n.z, -n.Dot(a));
+        }
+
+        for (int k = 0; k < 3; k++)
+            vertexTriangles[triangles[t * 3 + k]].push_back((unsigned int)t);
+    }
+
+    // Attribute seams: split vertices sharing a position must not move
+    std::unordered_map<cyVec3f, unsigned int, PositionHash, PositionEqual> positions;
+    for (size_t v = 0; v < numVertices; v++)
+    {
+        auto inserted = positions.insert(std::make_pair(vertices[v].position, (unsigned int)v));
+        if (!inserted.second)
+        {
+            locked[v] = true;
+            locked[inserted.first->second] = true;
+        }
+    }
+
+    // Open borders, which include material boundaries since every sub-mesh is simplified on its own
+    std::unordered_map<unsigned long long, int> edges;
+    for (size_t t = 0; t < numTriangles; t++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned long long a = triangles[t * 3 + k], b = triangles[t * 3 + (k + 1) % 3];
+            edges[a < b ? (a << 32 | b) : (b << 32 | a)]++;
+        }
+    }
+    for (auto &edge : edges)
+    {
+        if (edge.second == 1)
+        {
+            locked[(size_t)(edge.first >> 32)] = true;
+            locked[(size_t)(edge.first & 0xffffffffu)] = true;
+        }
+    }
+
+    std::priority_queue<Candidate> queue;
+
+    auto pushCandidate = [&](unsigned int from)
+    {
+        if (locked[from] || removed[from])
+            return;
+
+        Candidate best = {0, from, from, versions[from]};
+        bool found = false;
+
+        for (unsigned int t : vertexTriangles[from])
+        {
+            if (!triangleAlive[t])
+                continue;
+
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int to = triangles[t * 3 + k];
+                if (to == from)
+                    continue;
+
+                Quadric q = quadrics[from];
+                q += quadrics[to];
+                double cost = q.Evaluate(vertices[to].position);
+
+                if (!found || cost < best.cost)
+                {
+                    best.cost = cost;
+                    best.to = to;
+                    found = true;
+                }
+            }
+        }
+
+        if (found)
+            queue.push(best);
+    };
+
+    for (unsigned int v = 0; v < (unsigned int)numVertices; v++)
+        pushCandidate(v);
+
+    size_t aliveTriangles = numTriangles;
+    double maxCost = 0;
+
+    while (aliveTriangles > (size_t)targetTriangles && !queue.empty())
+    {
+        Candidate candidate = queue.top();
+        queue.pop();
+
+        unsigned int from = candidate.from, to = candidate.to;
+        if (removed[from] || removed[to] || candidate.version != versions[from])
+            continue;
+
+        // Reject collapses that would flip a surviving triangle
+        bool flips = false;
+        for (unsigned int t : vertexTriangles[from])
+        {
+            if (!triangleAlive[t])
+                continue;
+
+            unsigned int *tri = &triangles[t * 3];
+            if (tri[0] == to || tri[1] == to || tri[2] == to)
+                continue;
+
+            cyVec3f p[3], q[3];
+            for (int k = 0; k < 3; k++)
+            {
+                p[k] = vertices[tri[k]].position;
+                q[k] = tri[k] == from ? vertices[to].position : p[k];
+            }
+
+            cyVec3f before = TriangleNormal(p[0], p[1], p[2]);
+            cyVec3f after = TriangleNormal(q[0], q[1], q[2]);
+            if (before.Dot(after) <= 0)
+            {
+                flips = true;
+                break;
+            }
+        }
+
+        if (flips)
+        {
+            versions[from]++;
+            continue;
+        }
+
+        for (unsigned int t : vertexTriangles[from])
+        {
+            if (!triangleAlive[t])
+                continue;
+
+            unsigned int *tri = &triangles[t * 3];
+            if (tri[0] == to || tri[1] == to || tri[2] == to)
+            {
+                triangleAlive[t] = false;
+                aliveTriangles--;
+                continue;
+            }
+
+            for (int k = 0; k < 3; k++)
+            {
+                if (tri[k] == from)
+                    tri[k] = to;
+            }
+            vertexTriangles[to].push_back(t);
+        }
+
+        removed[from] = true;
+        quadrics[to] += quadrics[from];
+        maxCost = candidate.cost > maxCost ? candidate.cost : maxCost;
+
+        // Costs around the surviving vertex changed, queue fresh candidates for it and its neighbours
+        std::vector<unsigned int> neighbours;
+        for (unsigned int t : vertexTriangles[to])
+        {
+            if (!triangleAlive[t])
+                continue;
+
+            for (int k = 0; k < 3; k++)
+                neighbours.push_back(triangles[t * 3 + k]);
+        }
+
+        std::sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+
+        for (unsigned int v : neighbours)
+        {
+            versions[v]++;
+            pushCandidate(v);
+        }
+    }
+
+    result.clear();
+    result.reserve(aliveTriangles * 3);
+    for (size_t t = 0; t < numTriangles; t++)
+    {
+        if (triangleAlive[t])
+            result.insert(result.end(), triangles.begin() + t * 3, triangles.begin() + t * 3 + 3);
+    }
+
+    return (float)sqrt(maxCost);
+}
@@ -0,0 +1,172 @@
+#include "startupreport.h"
+#include "utils.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct PhaseRecord
+    {
+        std::string name;
+        int depth;
+        int calls;
+        double startMs;
+        double wallMs;
+        unsigned long long peakRss;
+        unsigned long long rssGrowth;
+        unsigned long long bytesRead;
+    };
+
+    struct OpenPhase
+    {
+        int record;
+        double startMs;
+        unsigned long long startRss;
+        unsigned long long startRead;
+    };
+
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    // Static initialization runs on the main thread, phases from loader threads would overlap its own
+    const std::thread::id owner = std::this_thread::get_id();
+
+    std::vector<PhaseRecord> records;
+    std::vector<OpenPhase> open;
+    bool finished = false;
+    double totalMs = 0;
+    unsigned long long totalPeakRss = 0, totalRead = 0;
+
+    double ElapsedMs()
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    void WriteEscaped(FILE *file, const std::string &text)
+    {
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                fputc('\\', file);
+            fputc(c, file);
+        }
+    }
+}
+
+void StartupReport::BeginPhase(const std::string &name)
+{
+    if (std::this_thread::get_id() != owner || finished)
+        return;
+
+    // Repeated phases at the same level, such as vertex expansion per sub-mesh, fold into one row
+    int depth = (int)open.size();
+    int record = -1;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        if (records[i].depth == depth && records[i].name == name)
+        {
+            record = (int)i;
+            break;
+        }
+    }
+
+    double now = ElapsedMs();
+    if (record < 0)
+    {
+        PhaseRecord phase = {name, depth, 0, now, 0, 0, 0, 0};
+        records.push_back(phase);
+        record = (int)records.size() - 1;
+    }
+
+    OpenPhase phase = {record, now, Utils::PeakResidentBytes(), Utils::ProcessBytesRead()};
+    open.push_back(phase);
+}
+
+void StartupReport::EndPhase()
+{
+    if (std::this_thread::get_id() != owner || finished || open.empty())
+        return;
+
+    OpenPhase phase = open.back();
+    open.pop_back();
+
+    unsigned long long rss = Utils::PeakResidentBytes();
+    PhaseRecord &record = records[phase.record];
+    record.calls++;
+    record.wallMs += ElapsedMs() - phase.startMs;
+    record.peakRss = MAX(record.peakRss, rss);
+    record.rssGrowth += rss - phase.startRss;
+    record.bytesRead += Utils::ProcessBytesRead() - phase.startRead;
+}
+
+void StartupReport::Finish()
+{
+    if (finished)
+        return;
+
+    while (!open.empty())
+        EndPhase();
+
+    totalMs = ElapsedMs();
+    totalPeakRss = Utils::PeakResidentBytes();
+    totalRead = Utils::ProcessBytesRead();
+    finished = true;
+}
+
+bool StartupReport::IsFinished()
+{
+    return finished;
+}
+
+void StartupReport::Print()
+{
+    char line[256];
+
+    snprintf(line, sizeof(line), "%-44s %5s %10s %10s %10s %10s", "phase", "calls", "wall ms", "peak MB", "+rss MB",
+             "read KB");
+    Utils::Info(line);
+
+    for (const PhaseRecord &record : records)
+    {
+        std::string name = std::string((size_t)record.depth * 2, ' ') + record.name;
+        if (name.size() > 44)
+            name = name.substr(0, 41) + "...";
+
+        snprintf(line, sizeof(line), "%-44s %5d %10.2f %10.1f %10.1f %10.1f", name.c_str(), record.calls,
+                 record.wallMs, record.peakRss / 1048576.0, record.rssGrowth / 1048576.0, record.bytesRead / 1024.0);
+        Utils::Info(line);
+    }
+
+    snprintf(line, sizeof(line), "%-44s %5s %10.2f %10.1f %10s %10.1f", "total", "", totalMs, totalPeakRss / 1048576.0,
+             "", totalRead / 1024.0);
+    Utils::Info(line);
+}
+
+bool StartupReport::WriteJson(const char *fileName)
+{
+    FILE *file = fopen(fileName, "w");
+    if (!file)
+        return false;
+
+    fprintf(file, "{\n  \"total_ms\": %.4f,\n  \"peak_rss_bytes\": %llu,\n  \"bytes_read\": %llu,\n", totalMs,
+            totalPeakRss, totalRead);
+
+    fprintf(file, "  \"phases\": [\n");
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const PhaseRecord &record = records[i];
+
+        fprintf(file, "    {\"name\": \"");
+        WriteEscaped(file, record.name);
+        fprintf(file, "\", \"depth\": %d, \"calls\": %d, \"start_ms\": %.4f, \"wall_ms\": %.4f, \"peak_rss_bytes\": %llu, "
+                      "\"rss_growth_bytes\": %llu, \"bytes_read\": %llu}%s\n", record.depth, record.calls,
+                record.startMs, record.wallMs, record.peakRss, record.rssGrowth, record.bytesRead,
+                i + 1 < records.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+
+    fclose(file);
+    return true;
+}
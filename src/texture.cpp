@@ -1,18 +1,34 @@
 #include "texture.h"
+#include "glstate.h"
+#include "profiler.h"
+#include "startupreport.h"
+#include "resources.h"
+#include "jobsystem.h"
 
 #include <glad/glad.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+// Default name for the resource registry until a loader gives the texture a better one
+static std::string Describe(const char *kind, int width, int height)
+{
+    return std::string(kind) + " " + std::to_string(width) + "x" + std::to_string(height);
+}
+
 Texture::Texture()
-    : mTextureID(0)
+    : mTextureID(0), mTextureType(0), mDepthSamplerID(0)
 {
 }
 
 Texture::~Texture()
 {
+    Resources::Release(Resources::Textures, this);
+    GLState::ForgetTexture(mTextureID);
     glDeleteTextures(1, &mTextureID);
+
+    if (mDepthSamplerID)
+        glDeleteSamplers(1, &mDepthSamplerID);
 }
 
 bool Texture::LoadFromData(int width, int height, int channels, void *data)
@@ -20,7 +36,7 @@ bool Texture::LoadFromData(int width, int height, int channels, void *data)
     mTextureType = GL_TEXTURE_2D;
 
     glGenTextures(1, &mTextureID);
-    glBindTexture(mTextureType, mTextureID);
+    GLState::BindTexture(0, mTextureType, mTextureID);
 
     glTexParameteri(mTextureType, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(mTextureType, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -39,30 +55,95 @@ bool Texture::LoadFromData(int width, int height, int channels, void *data)
             return false;
     }
 
+    Resources::Track(Resources::Textures, this, Resources::TextureBytes(width, height, 4),
+                     Describe(channels == 3 ? "RGB" : "RGBA", width, height));
+
     return true;
 }
 
 void Texture::Bind(unsigned int slot) const
 {
-    glActiveTexture(GL_TEXTURE0 + slot);
-    glBindTexture(mTextureType, mTextureID);
+    GLState::BindTexture(slot, mTextureType, mTextureID);
+}
+
+void Texture::BindDepth(unsigned int slot) const
+{
+    // Same depth texture, but read as raw depth values instead of comparison results
+    Bind(slot);
+    GLState::BindSampler(slot, mDepthSamplerID);
 }
 
 bool Texture::LoadFromFile(const char *fileName)
 {
-    int width, height, channels;
-    unsigned char *data = stbi_load(fileName, &width, &height, &channels, 0);
+    PROFILE_SCOPE("Texture::LoadFromFile");
 
-    if (!data)
+    Image image;
+
+    StartupReport::BeginPhase(std::string("Texture decode ") + fileName);
+    bool decoded = Decode(fileName, image);
+    StartupReport::EndPhase();
+
+    if (!decoded)
+        return false;
+
+    return LoadFromImage(fileName, image);
+}
+
+bool Texture::LoadFromImage(const char *fileName, Image &image)
+{
+    if (!image.data)
         return false;
 
-    bool result = LoadFromData(width, height, channels, data);
+    StartupReport::BeginPhase(std::string("Texture upload ") + fileName);
+    bool result = LoadFromData(image.width, image.height, image.channels, image.data);
+    StartupReport::EndPhase();
 
-    stbi_image_free(data);
+    if (result)
+        Resources::SetLabel(Resources::Textures, this, Describe(fileName, image.width, image.height));
+
+    FreeImage(image);
 
     return result;
 }
 
+bool Texture::Decode(const char *fileName, Image &image)
+{
+    PROFILE_SCOPE("Texture::Decode");
+
+    image.data = stbi_load(fileName, &image.width, &image.height, &image.channels, 0);
+    if (!image.data)
+        return false;
+
+    Resources::Track(Resources::Staging, image.data, (long long)image.width * image.height * image.channels,
+                     std::string("decoded ") + fileName);
+
+    return true;
+}
+
+bool Texture::Decode(const char *name, const unsigned char *data, long long size, Image &image)
+{
+    PROFILE_SCOPE("Texture::Decode");
+
+    image.data = stbi_load_from_memory(data, (int)size, &image.width, &image.height, &image.channels, 0);
+    if (!image.data)
+        return false;
+
+    Resources::Track(Resources::Staging, image.data, (long long)image.width * image.height * image.channels,
+                     std::string("decoded ") + name);
+
+    return true;
+}
+
+void Texture::FreeImage(Image &image)
+{
+    if (!image.data)
+        return;
+
+    Resources::Release(Resources::Staging, image.data);
+    stbi_image_free(image.data);
+    image.data = nullptr;
+}
+
 unsigned int Texture::GetID() const
 {
     return mTextureID;
@@ -73,7 +154,7 @@ bool Texture::LoadCubemapFromData(int width, int height, int channels, void *pX,
     mTextureType = GL_TEXTURE_CUBE_MAP;
 
     glGenTextures(1, &mTextureID);
-    glBindTexture(mTextureType, mTextureID);
+    GLState::BindTexture(0, mTextureType, mTextureID);
 
     glTexParameteri(mTextureType, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(mTextureType, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -102,30 +183,35 @@ bool Texture::LoadCubemapFromData(int width, int height, int channels, void *pX,
             return false;
     }
 
+    Resources::Track(Resources::Textures, this, Resources::TextureBytes(width, height, 4, 6),
+                     Describe(channels == 3 ? "RGB cube" : "RGBA cube", width, height));
+
     return true;
 }
 
 bool Texture::LoadCubemapFromFiles(const char **files)
 {
-    int width, height, channels;
-    unsigned char *pXData = stbi_load(files[0], &width, &height, &channels, 0);
-    unsigned char *nXData = stbi_load(files[1], &width, &height, &channels, 0);
-    unsigned char *pYData = stbi_load(files[2], &width, &height, &channels, 0);
-    unsigned char *nYData = stbi_load(files[3], &width, &height, &channels, 0);
-    unsigned char *pZData = stbi_load(files[4], &width, &height, &channels, 0);
-    unsigned char *nZData = stbi_load(files[5], &width, &height, &channels, 0);
+    // The six faces decode independently, only the upload has to wait for all of them
+    Image faces[6];
+    JobSystem::ParallelFor("Cube face decode", 6, 1, [&](int first, int last)
+    {
+        for (int i = first; i < last; i++)
+            Decode(files[i], faces[i]);
+    });
 
-    if (!pXData || !nXData || !pYData || !nYData || !pZData || !nZData)
-        return false;
+    bool result = true;
+    for (int i = 0; i < 6; i++)
+        result = result && faces[i].data && faces[i].width == faces[0].width && faces[i].height == faces[0].height &&
+                 faces[i].channels == faces[0].channels;
 
-    bool result = LoadCubemapFromData(width, height, channels, pXData, nXData, pYData, nYData, pZData, nZData);
+    if (result)
+    {
+        result = LoadCubemapFromData(faces[0].width, faces[0].height, faces[0].channels, faces[0].data, faces[1].data,
+                                     faces[2].data, faces[3].data, faces[4].data, faces[5].data);
+    }
 
-    stbi_image_free(pXData);
-    stbi_image_free(nXData);
-    stbi_image_free(pYData);
-    stbi_image_free(nYData);
-    stbi_image_free(pZData);
-    stbi_image_free(nZData);
+    for (int i = 0; i < 6; i++)
+        FreeImage(faces[i]);
 
     return result;
 }
@@ -135,7 +221,7 @@ bool Texture::LoadDepthFromData(int width, int height, void *data)
     mTextureType = GL_TEXTURE_2D;
 
     glGenTextures(1, &mTextureID);
-    glBindTexture(mTextureType, mTextureID);
+    GLState::BindTexture(0, mTextureType, mTextureID);
 
     glTexParameteri(mTextureType, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
     glTexParameteri(mTextureType, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
@@ -145,8 +231,40 @@ bool Texture::LoadDepthFromData(int width, int height, void *data)
     glTexParameteri(mTextureType, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
     glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, data);
+    Resources::Track(Resources::Textures, this, Resources::TextureBytes(width, height, 4), Describe("depth", width, height));
+
+    GLState::BindTexture(0, mTextureType, 0);
+
+    glGenSamplers(1, &mDepthSamplerID);
+    glSamplerParameteri(mDepthSamplerID, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    glSamplerParameteri(mDepthSamplerID, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(mDepthSamplerID, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(mDepthSamplerID, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glSamplerParameteri(mDepthSamplerID, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    return true;
+}
+
+bool Texture::LoadDepthCubemap(int size)
+{
+    mTextureType = GL_TEXTURE_CUBE_MAP;
+
+    glGenTextures(1, &mTextureID);
+    GLState::BindTexture(0, mTextureType, mTextureID);
+
+    glTexParameteri(mTextureType, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(mTextureType, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glTexParameteri(mTextureType, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(mTextureType, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(mTextureType, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(mTextureType, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(mTextureType, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    for (int face = 0; face < 6; face++)
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    Resources::Track(Resources::Textures, this, Resources::TextureBytes(size, size, 4, 6), Describe("depth cube", size, size));
 
-    glBindTexture(mTextureType, 0);
+    GLState::BindTexture(0, mTextureType, 0);
 
     return true;
 }
\ No newline at end of file
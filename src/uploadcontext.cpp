@@ -0,0 +1,236 @@
+#include "uploadcontext.h"
+#include "glstate.h"
+#include "profiler.h"
+#include "utils.h"
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct Upload
+    {
+        const char *name;
+        std::function<bool()> upload;
+        std::function<void(bool)> ready;
+        bool loaded;
+        GLsync fence;
+    };
+
+    std::vector<GLFWwindow *> windows;
+    std::vector<std::string> names;
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable wake, uploaded;
+    std::deque<Upload *> queued;
+    std::vector<Upload *> fenced;
+    int pending = 0;
+    bool quit = false;
+
+    void LoaderLoop(int index)
+    {
+        PROFILE_THREAD(names[index].c_str());
+        glfwMakeContextCurrent(windows[index]);
+
+        while (true)
+        {
+            Upload *upload;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, []() { return quit || !queued.empty(); });
+
+                // Queued uploads still run on the way out so nothing submitted is lost
+                if (queued.empty())
+                    break;
+
+                upload = queued.front();
+                queued.pop_front();
+            }
+
+            // Another context may have deleted and handed out again a name this one still has bound
+            GLState::Invalidate();
+
+            {
+                PROFILE_SCOPE(upload->name);
+                upload->loaded = upload->upload();
+            }
+
+            // Flushed so the fence reaches the GPU before another context waits on it
+            upload->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                fenced.push_back(upload);
+            }
+            uploaded.notify_all();
+        }
+
+        glfwMakeContextCurrent(nullptr);
+    }
+
+    void Complete(Upload *upload)
+    {
+        if (upload->fence)
+            glDeleteSync(upload->fence);
+
+        if (upload->ready)
+            upload->ready(upload->loaded);
+        delete upload;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        pending--;
+    }
+}
+
+bool UploadContext::Initialize(GLFWwindow *shared, int numContexts)
+{
+    if (!windows.empty())
+        Shutdown();
+
+    quit = false;
+
+    // Same context hints as the main window, only never shown
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    for (int i = 0; i < numContexts; i++)
+    {
+        GLFWwindow *window = glfwCreateWindow(1, 1, "Upload", nullptr, shared);
+        if (!window)
+        {
+            Utils::Warning("Unable to create upload context, uploads run on the GL thread.");
+            break;
+        }
+
+        windows.push_back(window);
+        names.push_back("Upload " + std::to_string(i + 1));
+    }
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+
+    // Creating a window can leave its context current, the GL thread keeps the main one
+    glfwMakeContextCurrent(shared);
+
+    for (int i = 0; i < (int)windows.size(); i++)
+        threads.emplace_back(LoaderLoop, i);
+
+    return (int)windows.size() == numContexts;
+}
+
+void UploadContext::Shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_all();
+
+    for (std::thread &thread : threads)
+        thread.join();
+    threads.clear();
+
+    for (Upload *upload : fenced)
+    {
+        glDeleteSync(upload->fence);
+        delete upload;
+    }
+    fenced.clear();
+    pending = 0;
+
+    for (GLFWwindow *window : windows)
+        glfwDestroyWindow(window);
+    windows.clear();
+    names.clear();
+}
+
+int UploadContext::GetContextCount()
+{
+    return (int)windows.size();
+}
+
+void UploadContext::Submit(const char *name, std::function<bool()> upload, std::function<void(bool loaded)> ready)
+{
+    auto *entry = new Upload();
+    entry->name = name;
+    entry->upload = upload;
+    entry->ready = ready;
+    entry->loaded = false;
+    entry->fence = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending++;
+
+        if (!windows.empty())
+        {
+            queued.push_back(entry);
+            wake.notify_one();
+            return;
+        }
+    }
+
+    // No upload contexts, the caller is the GL thread and both halves run right away
+    PROFILE_SCOPE(name);
+    entry->loaded = entry->upload();
+    Complete(entry);
+}
+
+void UploadContext::Poll()
+{
+    std::vector<Upload *> candidates;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        candidates.swap(fenced);
+    }
+
+    std::vector<Upload *> waiting;
+    for (Upload *upload : candidates)
+    {
+        // Zero timeout only asks, the GL thread never stalls on an upload here
+        GLenum status = glClientWaitSync(upload->fence, 0, 0);
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+            Complete(upload);
+        else
+            waiting.push_back(upload);
+    }
+
+    if (!waiting.empty())
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fenced.insert(fenced.begin(), waiting.begin(), waiting.end());
+    }
+}
+
+void UploadContext::Flush()
+{
+    PROFILE_SCOPE("UploadContext::Flush");
+
+    while (true)
+    {
+        Upload *upload;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            uploaded.wait(lock, []() { return !pending || !fenced.empty(); });
+            if (fenced.empty())
+                return;
+
+            upload = fenced.front();
+            fenced.erase(fenced.begin());
+        }
+
+        glClientWaitSync(upload->fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        Complete(upload);
+    }
+}
+
+int UploadContext::GetPending()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending;
+}
@@ -2,6 +2,19 @@
 #include <cstdio>
 #include <cstdlib>
 
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <libproc.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#else
+#include <sys/resource.h>
+#endif
+
 void Utils::Info(const char *message)
 {
     printf("%s\n", message);
@@ -37,4 +50,54 @@ char *Utils::ReadFile(const char *fileName)
     fclose(file);
 
     return contents;
-}
\ No newline at end of file
+}
+
+unsigned long long Utils::PeakResidentBytes()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters = {};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return (unsigned long long)counters.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage = {};
+    if (getrusage(RUSAGE_SELF, &usage))
+        return 0;
+#if defined(__APPLE__)
+    return (unsigned long long)usage.ru_maxrss;
+#else
+    return (unsigned long long)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+unsigned long long Utils::ProcessBytesRead()
+{
+#if defined(_WIN32)
+    IO_COUNTERS counters = {};
+    if (GetProcessIoCounters(GetCurrentProcess(), &counters))
+        return (unsigned long long)counters.ReadTransferCount;
+    return 0;
+#elif defined(__APPLE__)
+    rusage_info_v2 info = {};
+    if (proc_pid_rusage(getpid(), RUSAGE_INFO_V2, (rusage_info_t *)&info))
+        return 0;
+    return (unsigned long long)info.ri_diskio_bytesread;
+#else
+    FILE *file = fopen("/proc/self/io", "r");
+    if (!file)
+        return 0;
+
+    unsigned long long value = 0;
+    char key[64];
+    while (fscanf(file, "%63s %llu", key, &value) == 2)
+    {
+        if (std::string(key) == "rchar:")
+            break;
+        value = 0;
+    }
+
+    fclose(file);
+    return value;
+#endif
+}
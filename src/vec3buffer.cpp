@@ -0,0 +1,287 @@
+#include "vec3buffer.h"
+#include "utils.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64)
+#include <xmmintrin.h>
+#define VEC3BUFFER_SSE
+#endif
+
+Vec3Buffer::Vec3Buffer()
+    : mData(nullptr), mCount(0), mStride(0), mCapacity(0)
+{
+}
+
+Vec3Buffer::~Vec3Buffer()
+{
+    delete[] mData;
+}
+
+void Vec3Buffer::Resize(int count)
+{
+    int stride = (count + 3) & ~3;
+
+    if (stride * 3 > mCapacity)
+    {
+        delete[] mData;
+        mCapacity = stride * 3;
+        mData = new float[mCapacity];
+    }
+
+    // Padding lanes stay zero so padded reads never see stale values
+    mCount = count;
+    mStride = stride;
+    memset(mData, 0, sizeof(float) * stride * 3);
+}
+
+void Vec3Buffer::Assign(const float *xyz, int count, int stride)
+{
+    Resize(count);
+
+    float *x = mData, *y = mData + mStride, *z = mData + 2 * mStride;
+    for (int i = 0; i < count; i++)
+    {
+        const float *p = xyz + (size_t)i * stride;
+        x[i] = p[0];
+        y[i] = p[1];
+        z[i] = p[2];
+    }
+}
+
+void Vec3Buffer::Store(float *xyz, int stride) const
+{
+    const float *x = X(), *y = Y(), *z = Z();
+    for (int i = 0; i < mCount; i++)
+    {
+        float *p = xyz + (size_t)i * stride;
+        p[0] = x[i];
+        p[1] = y[i];
+        p[2] = z[i];
+    }
+}
+
+void Vec3Buffer::Set(int i, const cyVec3f &v)
+{
+    mData[i] = v.x;
+    mData[mStride + i] = v.y;
+    mData[2 * mStride + i] = v.z;
+}
+
+cyVec3f Vec3Buffer::Get(int i) const
+{
+    return cyVec3f(mData[i], mData[mStride + i], mData[2 * mStride + i]);
+}
+
+Bounds Vec3Buffer::ComputeBounds() const
+{
+    return ComputeBounds(0, mCount);
+}
+
+Bounds Vec3Buffer::ComputeBounds(int first, int count) const
+{
+    Bounds bounds = {cyVec3f(0, 0, 0), cyVec3f(0, 0, 0)};
+    if (count <= 0)
+        return bounds;
+
+    const float *x = X() + first, *y = Y() + first, *z = Z() + first;
+    bounds.min = bounds.max = Get(first);
+    int i = 0;
+
+#ifdef VEC3BUFFER_SSE
+    if (count >= 4)
+    {
+        __m128 lowX = _mm_loadu_ps(x), lowY = _mm_loadu_ps(y), lowZ = _mm_loadu_ps(z);
+        __m128 highX = lowX, highY = lowY, highZ = lowZ;
+
+        for (i = 4; i + 4 <= count; i += 4)
+        {
+            __m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+            lowX = _mm_min_ps(lowX, vx);
+            lowY = _mm_min_ps(lowY, vy);
+            lowZ = _mm_min_ps(lowZ, vz);
+            highX = _mm_max_ps(highX, vx);
+            highY = _mm_max_ps(highY, vy);
+            highZ = _mm_max_ps(highZ, vz);
+        }
+
+        float lanes[6][4];
+        _mm_storeu_ps(lanes[0], lowX);
+        _mm_storeu_ps(lanes[1], lowY);
+        _mm_storeu_ps(lanes[2], lowZ);
+        _mm_storeu_ps(lanes[3], highX);
+        _mm_storeu_ps(lanes[4], highY);
+        _mm_storeu_ps(lanes[5], highZ);
+
+        for (int j = 0; j < 4; j++)
+        {
+            bounds.min.Set(MIN(bounds.min.x, lanes[0][j]), MIN(bounds.min.y, lanes[1][j]), MIN(bounds.min.z, lanes[2][j]));
+            bounds.max.Set(MAX(bounds.max.x, lanes[3][j]), MAX(bounds.max.y, lanes[4][j]), MAX(bounds.max.z, lanes[5][j]));
+        }
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        bounds.min.Set(MIN(bounds.min.x, x[i]), MIN(bounds.min.y, y[i]), MIN(bounds.min.z, z[i]));
+        bounds.max.Set(MAX(bounds.max.x, x[i]), MAX(bounds.max.y, y[i]), MAX(bounds.max.z, z[i]));
+    }
+
+    return bounds;
+}
+
+void Vec3Buffer::Normalize()
+{
+    float *x = mData, *y = mData + mStride, *z = mData + 2 * mStride;
+    int i = 0;
+
+#ifdef VEC3BUFFER_SSE
+    for (; i + 4 <= mCount; i += 4)
+    {
+        __m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+        __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz)));
+
+        // Zero vectors stay zero instead of turning into NaN
+        __m128 valid = _mm_cmpgt_ps(length, _mm_setzero_ps());
+        __m128 scale = _mm_and_ps(valid, _mm_div_ps(_mm_set1_ps(1.0f), length));
+
+        _mm_storeu_ps(x + i, _mm_mul_ps(vx, scale));
+        _mm_storeu_ps(y + i, _mm_mul_ps(vy, scale));
+        _mm_storeu_ps(z + i, _mm_mul_ps(vz, scale));
+    }
+#endif
+
+    for (; i < mCount; i++)
+    {
+        float length = sqrtf(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+        float scale = length > 0 ? 1.0f / length : 0.0f;
+        x[i] *= scale;
+        y[i] *= scale;
+        z[i] *= scale;
+    }
+}
+
+void Vec3Buffer::Transform(const cyMatrix4f &matrix, Vec3Buffer &result) const
+{
+    if (&result != this)
+        result.Resize(mCount);
+
+    const float *m = matrix.cell;
+    const float *x = X(), *y = Y(), *z = Z();
+    float *rx = result.mData, *ry = result.mData + result.mStride, *rz = result.mData + 2 * result.mStride;
+    int i = 0;
+
+#ifdef VEC3BUFFER_SSE
+    for (; i + 4 <= mCount; i += 4)
+    {
+        __m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+
+        for (int row = 0; row < 3; row++)
+        {
+            __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, _mm_set1_ps(m[row])), _mm_mul_ps(vy, _mm_set1_ps(m[4 + row]))),
+                                  _mm_add_ps(_mm_mul_ps(vz, _mm_set1_ps(m[8 + row])), _mm_set1_ps(m[12 + row])));
+            _mm_storeu_ps((row == 0 ? rx : row == 1 ? ry : rz) + i, v);
+        }
+    }
+#endif
+
+    for (; i < mCount; i++)
+    {
+        float px = x[i], py = y[i], pz = z[i];
+        rx[i] = m[0] * px + m[4] * py + m[8] * pz + m[12];
+        ry[i] = m[1] * px + m[5] * py + m[9] * pz + m[13];
+        rz[i] = m[2] * px + m[6] * py + m[10] * pz + m[14];
+    }
+}
+
+void Vec3Buffer::TransformBounds(const cyMatrix4f &matrix, const Vec3Buffer &mins, const Vec3Buffer &maxs,
+                                 Vec3Buffer &resultMins, Vec3Buffer &resultMaxs)
+{
+    int count = mins.mCount;
+    if (&resultMins != &mins && &resultMins != &maxs)
+        resultMins.Resize(count);
+    if (&resultMaxs != &mins && &resultMaxs != &maxs)
+        resultMaxs.Resize(count);
+
+    // Same as Bounds::Transform: move the center, grow the extent by the absolute rotation and scale
+    const float *m = matrix.cell;
+    float a[9];
+    for (int row = 0; row < 3; row++)
+    {
+        for (int column = 0; column < 3; column++)
+            a[row * 3 + column] = fabsf(m[column * 4 + row]);
+    }
+
+    const float *lowX = mins.X(), *lowY = mins.Y(), *lowZ = mins.Z();
+    const float *highX = maxs.X(), *highY = maxs.Y(), *highZ = maxs.Z();
+    float *outLow[3] = {resultMins.mData, resultMins.mData + resultMins.mStride, resultMins.mData + 2 * resultMins.mStride};
+    float *outHigh[3] = {resultMaxs.mData, resultMaxs.mData + resultMaxs.mStride, resultMaxs.mData + 2 * resultMaxs.mStride};
+    int i = 0;
+
+#ifdef VEC3BUFFER_SSE
+    __m128 half = _mm_set1_ps(0.5f);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 lx = _mm_loadu_ps(lowX + i), ly = _mm_loadu_ps(lowY + i), lz = _mm_loadu_ps(lowZ + i);
+        __m128 hx = _mm_loadu_ps(highX + i), hy = _mm_loadu_ps(highY + i), hz = _mm_loadu_ps(highZ + i);
+
+        __m128 cx = _mm_mul_ps(_mm_add_ps(lx, hx), half), ex = _mm_mul_ps(_mm_sub_ps(hx, lx), half);
+        __m128 cy = _mm_mul_ps(_mm_add_ps(ly, hy), half), ey = _mm_mul_ps(_mm_sub_ps(hy, ly), half);
+        __m128 cz = _mm_mul_ps(_mm_add_ps(lz, hz), half), ez = _mm_mul_ps(_mm_sub_ps(hz, lz), half);
+
+        // Every input is loaded before the first store, so results may overwrite the inputs
+        __m128 low[3], high[3];
+        for (int row = 0; row < 3; row++)
+        {
+            __m128 center = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(m[row])), _mm_mul_ps(cy, _mm_set1_ps(m[4 + row]))),
+                                       _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(m[8 + row])), _mm_set1_ps(m[12 + row])));
+            __m128 extent = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(a[row * 3 + 0])),
+                                                  _mm_mul_ps(ey, _mm_set1_ps(a[row * 3 + 1]))),
+                                       _mm_mul_ps(ez, _mm_set1_ps(a[row * 3 + 2])));
+            low[row] = _mm_sub_ps(center, extent);
+            high[row] = _mm_add_ps(center, extent);
+        }
+
+        for (int row = 0; row < 3; row++)
+        {
+            _mm_storeu_ps(outLow[row] + i, low[row]);
+            _mm_storeu_ps(outHigh[row] + i, high[row]);
+        }
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        float c[3] = {(lowX[i] + highX[i]) * 0.5f, (lowY[i] + highY[i]) * 0.5f, (lowZ[i] + highZ[i]) * 0.5f};
+        float e[3] = {(highX[i] - lowX[i]) * 0.5f, (highY[i] - lowY[i]) * 0.5f, (highZ[i] - lowZ[i]) * 0.5f};
+
+        for (int row = 0; row < 3; row++)
+        {
+            float center = m[row] * c[0] + m[4 + row] * c[1] + m[8 + row] * c[2] + m[12 + row];
+            float extent = a[row * 3 + 0] * e[0] + a[row * 3 + 1] * e[1] + a[row * 3 + 2] * e[2];
+            outLow[row][i] = center - extent;
+            outHigh[row][i] = center + extent;
+        }
+    }
+}
+
+int Vec3Buffer::GetCount() const
+{
+    return mCount;
+}
+
+const float *Vec3Buffer::X() const
+{
+    return mData;
+}
+
+const float *Vec3Buffer::Y() const
+{
+    return mData + mStride;
+}
+
+const float *Vec3Buffer::Z() const
+{
+    return mData + 2 * mStride;
+}